@@ -132,6 +132,17 @@ typedef int (*merge_tuple_final_fn)(const data_config *cfg,
                                     slice              key,
                                     merge_accumulator *oldest_message);
 
+// Called on each INSERT or UPDATE message that a compaction writes out.
+// The callback may leave the message as it is, rewrite it in place or drop
+// it by setting its class to MESSAGE_TYPE_DELETE.  Dropped messages become
+// deletes, which shadow any older messages for the key until a compaction
+// at the bottom of the tree discards them.
+//
+// Returns 0 on success.  Non-zero indicates an internal error.
+typedef int (*compaction_filter_fn)(const data_config *cfg,
+                                    slice              key,
+                                    merge_accumulator *message); // IN/OUT
+
 typedef void (*key_to_str_fn)(const data_config *cfg,
                               slice              key,
                               char              *str,
@@ -153,6 +164,7 @@ typedef void (*message_to_str_fn)(const data_config *cfg,
  *  3. How to merge update messages - defined by the pair of merge_tuples* fns.
  *  4. How to convert between messages and values (encode and decode functions)
  *  4. Few other debugging aids on how-to print & diagnose messages.
+ *  5. Optionally, how compactions should filter messages or expire them.
  *
  * default_data_config.c is a simple reference implementation, provided
  * as a "batteries included" solution. If an application wishes
@@ -170,4 +182,24 @@ struct data_config {
    merge_tuple_final_fn merge_tuples_final;
    key_to_str_fn        key_to_string;
    message_to_str_fn    message_to_string;
+
+   /* Optional, may be NULL. */
+   compaction_filter_fn compaction_filter;
+
+   /*
+    * Built-in TTL expiry.  When set, every INSERT message starts with a
+    * message_expiry header, and inserts whose expiry time has passed read
+    * as deletes.  Compactions drop them without any writes from the
+    * application.
+    */
+   _Bool message_expiry;
 };
+
+/*
+ * The header at the start of INSERT messages when data_config.message_expiry
+ * is set.  expires_at is in seconds since the Unix epoch; 0 never expires.
+ * Messages shorter than the header never expire.
+ */
+typedef struct message_expiry_header {
+   uint64 expires_at;
+} message_expiry_header;
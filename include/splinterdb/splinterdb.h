@@ -70,10 +70,58 @@ typedef struct splinterdb_config {
    uint32 io_perms;
    uint64 io_async_queue_depth;
 
+   // Background IO (compactions, filter builds and the cache cleaner) is
+   // limited to io_bg_max_bytes_per_sec bytes per second so that it does not
+   // hold up reads by lookups and scans. 0 (default) means no limit.
+   //
+   // If io_fg_read_latency_target_us is also set, the limit is scaled down
+   // while foreground reads take longer than the target on average.
+   uint64 io_bg_max_bytes_per_sec;
+   uint64 io_fg_read_latency_target_us;
+
+   // If set, freed extents are discarded on the device (BLKDISCARD for
+   // block devices, hole punching for files) by a background thread, at
+   // most discard_max_bytes_per_sec bytes per second. 0 selects the
+   // default rate.
+   _Bool  use_discard;
+   uint64 discard_max_bytes_per_sec;
+
+   // Largest size the database can grow to, by splinterdb_grow() or by
+   // disk_grow_increment. The on-disk ref count map is sized for it, and
+   // address space (not memory) for the in-memory structures indexed by
+   // disk address is reserved up front. Default (0) is disk_size.
+   //
+   // It is fixed when the database is created. When reopening, a disk_size
+   // larger than the current size grows the database.
+   uint64 max_disk_size;
+
+   // If non-zero, the database grows by this many bytes, up to
+   // max_disk_size, whenever it runs out of space.
+   uint64 disk_grow_increment;
+
    // cache
    _Bool       cache_use_stats;
    const char *cache_logfile;
 
+   // If set, the extents hottest in the cache are recorded on close, and
+   // are prefetched by background tasks after the next open, so that a
+   // restart does not start with a cold cache.
+   _Bool cache_warmup;
+
+   // If set, a background thread writes back dirty cache pages ahead of
+   // eviction, so that threads needing a free page rarely wait for IO. It
+   // cleans eagerly once cache_cleaner_dirty_watermark pages are dirty near
+   // the eviction point, writing at most cache_cleaner_max_pages_per_sec
+   // pages per second. 0 selects the default (no rate limit).
+   _Bool  cache_use_cleaner;
+   uint64 cache_cleaner_dirty_watermark;
+   uint64 cache_cleaner_max_pages_per_sec;
+
+   // Largest size the cache can be grown to by splinterdb_set_cache_size().
+   // Address space (not memory) for it is reserved up front.
+   // Default (0) is cache_size.
+   uint64 cache_max_size;
+
    // task system
    // Background threads configuration:
    //
@@ -89,6 +137,20 @@ typedef struct splinterdb_config {
    uint64 num_memtable_bg_threads;
    uint64 num_normal_bg_threads;
 
+   // A pool of bg-threads may grow up to this many threads while its tasks
+   // are falling behind and the CPU has idle time to spare, and shrinks back
+   // to num_*_bg_threads once they are not. Default (0) is to keep the pool
+   // at num_*_bg_threads.
+   uint64 max_memtable_bg_threads;
+   uint64 max_normal_bg_threads;
+
+   // CPUs to confine each pool of bg-threads to, keeping them off the CPUs
+   // (and caches) of latency-sensitive threads: a list like "0-3,8,10-11",
+   // or "node:N" for the CPUs of NUMA node N. Their scratch space is placed
+   // on the NUMA node they run on. Default (NULL) is to run on any CPU.
+   const char *memtable_bg_cpus;
+   const char *normal_bg_cpus;
+
    // btree
    uint64 btree_rough_count_height;
 
@@ -106,6 +168,20 @@ typedef struct splinterdb_config {
    uint64 use_stats;
    uint64 reclaim_threshold;
 
+   // Key ranges whose data is at least this percent deletes and updates are
+   // compacted as soon as they pile up, regardless of disk utilization, so
+   // that scans over mass-deleted ranges speed back up promptly.
+   // Default (0) is 25. Values over 100 disable it.
+   uint64 tombstone_compaction_percent;
+
+   // Once compaction falls this far behind, as a percent, inserts are
+   // slowed down gradually to the rate it keeps up with, rather than left to
+   // stall outright once every memtable is full. See
+   // splinterdb_get_write_stats. Only applies with background threads for
+   // both memtable and normal tasks.
+   // Default (0) is 30. Values of 100 or more disable it.
+   uint64 write_throttle_percent;
+
    // The following parameter governs when foreground threads
    // performing an update to the database will perform queued
    // background tasks.  When a foreground thread performs a
@@ -132,7 +208,9 @@ typedef struct splinterdb_config {
 
    // The default value of 100 says that foreground threads will begin
    // performing background tasks if there are more queued tasks than
-   // there are background threads to serve them. This heuristic
+   // there are background threads to serve them. (Pools that may grow
+   // count the threads they have at the time, and take foreground threads
+   // helping out as a sign to grow.) This heuristic
    // allows you to configure the number of background threads as you
    // see fit, and the system will do its best to execute tasks on the
    // provided background threads, but will perform tasks on
@@ -191,7 +269,8 @@ splinterdb_close(splinterdb **kvs);
 // splinterdb_close will use scratch space, so the thread that calls it must
 // have been registered (or implicitly registered by being the initial thread).
 //
-// Note: There is currently a limit of MAX_THREADS registered at a given time
+// Note: There is currently a limit of MAX_THREADS (512) registered at a given
+// time
 void
 splinterdb_register_thread(splinterdb *kvs);
 
@@ -216,6 +295,87 @@ splinterdb_delete(const splinterdb *kvsb, slice key);
 int
 splinterdb_update(const splinterdb *kvsb, slice key, slice delta);
 
+// Non-blocking variants of splinterdb_insert, splinterdb_delete and
+// splinterdb_update, for callers such as event loops that cannot afford to
+// block.
+//
+// They never wait for a memtable to free up, are never delayed by write
+// throttling (see write_throttle_percent) and never perform background
+// tasks. Where the blocking variants would, they return EAGAIN instead and
+// set *retry_ns to an estimate of how long to wait before retrying.
+int
+splinterdb_try_insert(const splinterdb *kvsb,
+                      slice             key,
+                      slice             value,
+                      uint64           *retry_ns);
+
+int
+splinterdb_try_delete(const splinterdb *kvsb, slice key, uint64 *retry_ns);
+
+int
+splinterdb_try_update(const splinterdb *kvsb,
+                      slice             key,
+                      slice             delta,
+                      uint64           *retry_ns);
+
+// Has fn(arg) called once a memtable frees up after a try variant returned
+// EAGAIN for the want of one, say to wake an event loop by writing to an
+// eventfd. It is called once per refusal, or fewer, from whichever thread
+// frees the memtable, often a background thread, so it must be quick and
+// must not call into splinterdb. Refusals for write throttling come with an
+// exact retry delay, and are not signalled. A NULL fn stops the calls.
+typedef void (*splinterdb_capacity_fn)(void *arg);
+
+void
+splinterdb_set_capacity_callback(splinterdb            *kvs,
+                                 splinterdb_capacity_fn fn,
+                                 void                  *arg);
+
+// Remove every key from the database.
+//
+// Takes about as long as a memtable rotation, however much data there is:
+// the old contents are released in the background. Inserts wait for the
+// clear to finish; lookups and iterators started before it may still see the
+// old contents.
+//
+// Returns 0 on success.
+int
+splinterdb_clear(const splinterdb *kvsb);
+
+// Called by splinterdb_compact_range as it finishes each level: first the
+// memtable, then each level of the tree from the top down.
+typedef void (*splinterdb_compact_range_progress_fn)(uint64 levels_done,
+                                                     uint64 num_levels,
+                                                     void  *arg);
+
+// Fully compact the keys in [start_key, end_key): flush the memtable, push
+// everything above them down to the leaves and merge each leaf into a single
+// branch, dropping overwritten values and deleted keys. Useful after bulk
+// rewrites, so that lookups and scans need not wait for compactions to catch
+// up. A null start_key or end_key leaves that end of the range open.
+//
+// Blocks until it is done, helping with the background work in the
+// meantime. Inserts and lookups may run concurrently; keys inserted after
+// the call may not be compacted. progress may be NULL.
+//
+// Returns 0 on success, or EINVAL if start_key is not less than end_key.
+int
+splinterdb_compact_range(const splinterdb                   *kvsb,
+                         slice                               start_key,
+                         slice                               end_key,
+                         splinterdb_compact_range_progress_fn progress,
+                         void                               *arg);
+
+// Like splinterdb_compact_range, but it runs on a background thread and
+// returns at once. progress, if not NULL, is called with levels_done equal to
+// num_levels when it is done.
+int
+splinterdb_compact_range_async(const splinterdb                   *kvsb,
+                               slice                               start_key,
+                               slice                               end_key,
+                               splinterdb_compact_range_progress_fn progress,
+                               void                               *arg);
+
 // Lookups
 
 // Size of opaque data required to hold a lookup result
@@ -422,4 +582,87 @@ splinterdb_stats_print_lookup(const splinterdb *kvs);
 void
 splinterdb_stats_reset(splinterdb *kvs);
 
+// Write throttling, see write_throttle_percent. Kept whether or not
+// use_stats is set; splinterdb_stats_reset clears the counts and times.
+typedef struct splinterdb_write_stats {
+   uint64 debt_percent;  // how far compaction is behind, 100 when stalled
+   uint64 throttle_rate; // bytes/s inserts are paced to, 0 if they are not
+   uint64 num_delays;    // inserts delayed by throttling
+   uint64 delay_ns;      // total time they were delayed
+   uint64 num_stalls;    // inserts that found every memtable full
+   uint64 stall_ns;      // total time they waited for one
+} splinterdb_write_stats;
+
+void
+splinterdb_get_write_stats(const splinterdb     *kvs,
+                           splinterdb_write_stats *stats);
+
+// Resize the cache of a running splinterdb to cache_size bytes, at most the
+// configured cache_max_size.
+//
+// Growing takes effect immediately. When shrinking, the cache stops using the
+// retired memory immediately, but the pages cached there are written back and
+// evicted, and the memory released, in the background.
+//
+// Returns 0 on success, EINVAL if cache_size is not a valid size.
+int
+splinterdb_set_cache_size(splinterdb *kvs, uint64 cache_size);
+
+// Returns the current size of the cache in bytes
+uint64
+splinterdb_get_cache_size(const splinterdb *kvs);
+
+// Grow the database of a running splinterdb to disk_size bytes, at most the
+// max_disk_size it was created with. The new size is persisted.
+//
+// Returns 0 on success, EINVAL if disk_size is not a multiple of the extent
+// size, is less than the current size or is more than max_disk_size.
+int
+splinterdb_grow(splinterdb *kvs, uint64 disk_size);
+
+// Returns the current size of the database in bytes
+uint64
+splinterdb_get_disk_size(const splinterdb *kvs);
+
+// Checkpoints
+//
+// A checkpoint records the contents of a database as a table of its own on
+// the same device. It shares every page of data with the database rather
+// than copying it, so it takes about as long as flushing the cache, however
+// large the database. Checkpoints are named by the caller, persist across
+// close and reopen, and a device holds up to 29 of them. checkpoint_id 0 and
+// 1 (the database itself) are reserved.
+
+// Record the current contents of kvs, including every insert which has
+// returned, as checkpoint checkpoint_id. Inserts may go on meanwhile.
+//
+// Returns 0 on success, EINVAL if checkpoint_id is reserved or already in
+// use, ENOSPC if the device holds as many checkpoints as it can.
+int
+splinterdb_checkpoint(const splinterdb *kvs, uint64 checkpoint_id);
+
+// Open checkpoint checkpoint_id of kvs as a splinterdb of its own, which
+// shares the device, cache and background threads of kvs.
+//
+// If read_only is set, inserts into it fail with EPERM and the checkpoint is
+// left as it is. Otherwise it is a writable clone: changes go to the
+// checkpoint, never to kvs. (To keep a checkpoint as it is and still write
+// to it, checkpoint the clone first.)
+//
+// Close it with splinterdb_close() before closing kvs.
+//
+// Returns 0 on success, ENOENT if there is no such checkpoint.
+int
+splinterdb_open_checkpoint(splinterdb  *kvs,
+                           uint64       checkpoint_id,
+                           _Bool        read_only,
+                           splinterdb **clone);
+
+// Delete checkpoint checkpoint_id of kvs, which must not be open, and
+// release the pages only it was using.
+//
+// Returns 0 on success, ENOENT if there is no such checkpoint.
+int
+splinterdb_delete_checkpoint(splinterdb *kvs, uint64 checkpoint_id);
+
 #endif // _SPLINTERDB_H_
@@ -17,11 +17,36 @@ allocator_config_init(allocator_config *allocator_cfg,
 {
    ZERO_CONTENTS(allocator_cfg);
 
-   allocator_cfg->io_cfg   = io_cfg;
-   allocator_cfg->capacity = capacity;
+   allocator_cfg->io_cfg = io_cfg;
+   allocator_config_set_capacity(allocator_cfg, capacity);
+   allocator_config_set_max_capacity(allocator_cfg, capacity);
+
+   uint64 log_extent_size     = 63 - __builtin_clzll(io_cfg->extent_size);
+   allocator_cfg->extent_mask = ~((1ULL << log_extent_size) - 1);
+}
+
+/*
+ * The capacity is stored last, so that a concurrent reader which sees the
+ * new capacity also sees the new page and extent capacities.
+ */
+void
+allocator_config_set_capacity(allocator_config *allocator_cfg, uint64 capacity)
+{
+   io_config *io_cfg = allocator_cfg->io_cfg;
 
    allocator_cfg->page_capacity   = capacity / io_cfg->page_size;
    allocator_cfg->extent_capacity = capacity / io_cfg->extent_size;
-   uint64 log_extent_size         = 63 - __builtin_clzll(io_cfg->extent_size);
-   allocator_cfg->extent_mask     = ~((1ULL << log_extent_size) - 1);
+   __sync_synchronize();
+   allocator_cfg->capacity = capacity;
+}
+
+void
+allocator_config_set_max_capacity(allocator_config *allocator_cfg,
+                                  uint64            max_capacity)
+{
+   io_config *io_cfg = allocator_cfg->io_cfg;
+
+   allocator_cfg->max_capacity        = max_capacity;
+   allocator_cfg->max_page_capacity   = max_capacity / io_cfg->page_size;
+   allocator_cfg->max_extent_capacity = max_capacity / io_cfg->extent_size;
 }
@@ -76,11 +76,21 @@ _Static_assert(
  */
 typedef struct allocator_config {
    io_config *io_cfg;
-   uint64     capacity;
+   uint64     capacity; // grows up to max_capacity, see rc_allocator_grow()
+   uint64     max_capacity;
+
+   // If non-zero, grow by this many bytes whenever out of space
+   uint64 grow_increment;
+
+   // Discard freed extents on the device, at most this many bytes/sec
+   bool32 use_discard;
+   uint64 discard_max_bytes_per_sec;
 
    // computed
    uint64 page_capacity;
    uint64 extent_capacity;
+   uint64 max_page_capacity;
+   uint64 max_extent_capacity;
    uint64 extent_mask;
 } allocator_config;
 
@@ -96,6 +106,14 @@ allocator_config_init(allocator_config *allocator_cfg,
                       io_config        *io_cfg,
                       uint64            capacity);
 
+void
+allocator_config_set_capacity(allocator_config *allocator_cfg,
+                              uint64            capacity);
+
+void
+allocator_config_set_max_capacity(allocator_config *allocator_cfg,
+                                  uint64            max_capacity);
+
 static inline uint64
 allocator_config_extent_base_addr(allocator_config *allocator_cfg, uint64 addr)
 {
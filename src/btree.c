@@ -59,6 +59,9 @@
  *       over hand locking.
  *    5. All threads follow the locking patterns in 3 or 4. They only hold
  *       a single lock at a time.
+ *    6. Lookups and most inserts traverse down the tree taking no lock
+ *       above the node they stop at: they read index nodes optimistically
+ *       and validate them instead (see btree_lookup_node_optimistic()).
  *
  * Exceptions to these rules:
  *    1. find_btree_node_and_get_idx_bounds(): To find the end_idx of the
@@ -1259,6 +1262,25 @@ btree_dec_ref_range(cache              *cc,
       cc, cfg->data_cfg, PAGE_TYPE_BRANCH, meta_page_addr, start_key, end_key);
 }
 
+/*
+ * Like btree_dec_ref_range, but the extents freed are left in batch, to be
+ * discarded and freed when it is flushed.
+ */
+bool32
+btree_dec_ref_range_batched(cache              *cc,
+                            const btree_config *cfg,
+                            uint64              root_addr,
+                            key                 start_key,
+                            key                 end_key,
+                            mini_extent_batch  *batch)
+{
+   debug_assert(btree_key_compare(cfg, start_key, end_key) <= 0);
+   debug_assert(batch->type == PAGE_TYPE_BRANCH);
+   uint64 meta_page_addr = btree_root_to_meta_addr(cfg, root_addr, 0);
+   return mini_keyed_dec_ref_batched(
+      cc, cfg->data_cfg, meta_page_addr, start_key, end_key, batch);
+}
+
 bool32
 btree_dec_ref(cache              *cc,
               const btree_config *cfg,
@@ -1723,11 +1745,257 @@ btree_grow_root(cache              *cc,   // IN
    return 0;
 }
 
+/*
+ * btree_get_pivot for an index node read optimistically, whose contents may
+ * be torn: returns FALSE instead of following an offset out of the page.
+ */
+static inline bool32
+btree_get_pivot_optimistic(const btree_config *cfg,
+                           const btree_hdr    *hdr,
+                           table_index         k,
+                           key                *pivot)
+{
+   uint64      page_size = btree_page_size(cfg);
+   node_offset offset    = *(const volatile node_offset *)&hdr->offsets[k];
+   if (offset + sizeof(index_entry) > page_size) {
+      return FALSE;
+   }
+   const index_entry *entry  = (const index_entry *)((char *)hdr + offset);
+   ondisk_key_length  length =
+      *(const volatile ondisk_key_length *)&entry->pivot;
+   if (length == ONDISK_KEY_NEGATIVE_INFINITY) {
+      *pivot = NEGATIVE_INFINITY_KEY;
+   } else if (length == ONDISK_KEY_POSITIVE_INFINITY) {
+      *pivot = POSITIVE_INFINITY_KEY;
+   } else if (offset + sizeof(index_entry) + length > page_size) {
+      return FALSE;
+   } else {
+      *pivot = key_create(length, entry->pivot.bytes);
+   }
+   return TRUE;
+}
+
+/*
+ * btree_find_pivot for an index node read optimistically. Returns FALSE if
+ * the contents are found to be torn, otherwise sets *child_idx as
+ * btree_find_pivot would and *child_addr to the child to descend into, which
+ * are only to be trusted once the node is validated.
+ */
+static bool32
+btree_find_child_optimistic(const btree_config *cfg,
+                            const btree_hdr    *hdr,
+                            key                 target,
+                            int64              *child_idx,
+                            uint64             *child_addr)
+{
+   int64 num_entries = *(const volatile table_index *)&hdr->num_entries;
+   if (num_entries == 0
+       || sizeof(*hdr) + num_entries * sizeof(table_entry)
+             > btree_page_size(cfg))
+   {
+      return FALSE;
+   }
+
+   int64 lo = 0, hi = num_entries;
+   if (key_is_positive_infinity(target)) {
+      lo = num_entries;
+   }
+   while (lo < hi) {
+      int64 mid = (lo + hi) / 2;
+      key   pivot;
+      if (!btree_get_pivot_optimistic(cfg, hdr, mid, &pivot)) {
+         return FALSE;
+      }
+      int cmp = btree_key_compare(cfg, pivot, target);
+      if (cmp == 0) {
+         lo = mid + 1;
+         break;
+      } else if (cmp < 0) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   // the child covering target is at lo - 1, or 0 if target is below them all
+   *child_idx         = lo - 1;
+   table_index child  = lo == 0 ? 0 : lo - 1;
+   node_offset offset = *(const volatile node_offset *)&hdr->offsets[child];
+   if (offset + sizeof(index_entry) > btree_page_size(cfg)) {
+      return FALSE;
+   }
+   const index_entry *entry = (const index_entry *)((char *)hdr + offset);
+   *child_addr = *(const volatile uint64 *)&entry->pivot_data.child_addr;
+   return TRUE;
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ * btree_lookup_node_optimistic --
+ *
+ *      btree_lookup_node without read locks on the index nodes above
+ *      stop_at_height: they are read optimistically, so a lookup writes no
+ *      shared cacheline on the way down. Each node is validated before the
+ *      child address read from it is followed, and again once the child is
+ *      secured. Memtable splits hold the parent write lock while they change
+ *      the child, so the second validation catches a child that lost the
+ *      target to a new sibling in between.
+ *
+ *      Only the node returned is read locked. Returns FALSE, holding nothing,
+ *      if a node is not cached or changes during the descent, or, with
+ *      within_pivots, if target is below the first pivot of a node on the way
+ *      (an insert of it has to lower that pivot).
+ *-----------------------------------------------------------------------------
+ */
+static bool32
+btree_lookup_node_optimistic(cache              *cc,             // IN
+                             const btree_config *cfg,            // IN
+                             uint64              root_addr,      // IN
+                             key                 target,         // IN
+                             uint16              stop_at_height, // IN
+                             page_type           type,           // IN
+                             bool32              within_pivots,  // IN
+                             btree_node         *out_node)       // OUT
+{
+   btree_node node;
+   uint64     version;
+
+   node.addr = root_addr;
+   node.page = cache_get_optimistic(cc, node.addr, type, &version);
+   if (node.page == NULL) {
+      return FALSE;
+   }
+   node.hdr = (btree_hdr *)node.page->data;
+
+   uint8 height = *(const volatile uint8 *)&node.hdr->height;
+   if (height <= stop_at_height
+       || !cache_validate_optimistic(cc, node.page, version))
+   {
+      return FALSE;
+   }
+
+   for (uint8 h = height; h > stop_at_height; h--) {
+      btree_node child_node;
+      uint64     child_version = 0;
+      int64      child_idx;
+      if (!btree_find_child_optimistic(
+             cfg, node.hdr, target, &child_idx, &child_node.addr)
+          || !cache_validate_optimistic(cc, node.page, version)
+          || (within_pivots && child_idx < 0))
+      {
+         return FALSE;
+      }
+
+      if (h - 1 > stop_at_height) {
+         child_node.page = cache_get_optimistic(
+            cc, child_node.addr, type, &child_version);
+         if (child_node.page == NULL) {
+            return FALSE;
+         }
+         child_node.hdr = (btree_hdr *)child_node.page->data;
+      } else {
+         btree_node_get(cc, cfg, &child_node, type);
+      }
+
+      if (!cache_validate_optimistic(cc, node.page, version)) {
+         if (h - 1 == stop_at_height) {
+            btree_node_unget(cc, cfg, &child_node);
+         }
+         return FALSE;
+      }
+      node    = child_node;
+      version = child_version;
+   }
+
+   *out_node = node;
+   return TRUE;
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ * btree_insert_optimistic --
+ *
+ *      The common case of btree_insert, into a leaf with room for the tuple,
+ *      by optimistic lock coupling: the index nodes are read optimistically
+ *      and only the leaf is locked, so concurrent inserts do not serialize
+ *      on the root and upper index nodes.
+ *
+ *      The descent validates the parent after the leaf is read locked, and a
+ *      leaf split write locks the leaf after changing the parent, so the read
+ *      lock keeps the leaf covering tuple_key until the insert claims it.
+ *
+ *      Returns FALSE, holding nothing, if the insert needs btree_insert's
+ *      locking descent: the leaf must split, a pivot must be lowered or a
+ *      node changed on the way. Otherwise returns TRUE with the insert done
+ *      or its error in *rc.
+ *-----------------------------------------------------------------------------
+ */
+static uint64 dbg_ok, dbg_fb, dbg_full, dbg_retry;
+static bool32
+btree_insert_optimistic(cache              *cc,         // IN
+                        const btree_config *cfg,        // IN
+                        platform_heap_id    heap_id,    // IN
+                        uint64              root_addr,  // IN
+                        key                 tuple_key,  // IN
+                        message             msg,        // IN
+                        uint64             *generation, // OUT
+                        bool32             *was_unique, // OUT
+                        platform_status    *rc)         // OUT
+{
+   uint64 leaf_wait = 1;
+
+   while (TRUE) {
+      btree_node leaf;
+      if (!btree_lookup_node_optimistic(
+             cc, cfg, root_addr, tuple_key, 0, PAGE_TYPE_MEMTABLE, TRUE, &leaf))
+      {
+         return FALSE;
+      }
+
+      leaf_incorporate_spec spec;
+      *rc = btree_create_leaf_incorporate_spec(
+         cfg, heap_id, leaf.hdr, tuple_key, msg, &spec);
+      if (!SUCCESS(*rc)) {
+         btree_node_unget(cc, cfg, &leaf);
+         return TRUE;
+      }
+
+      if (!btree_can_perform_leaf_incorporate_spec(cfg, leaf.hdr, &spec)) {
+         btree_node_unget(cc, cfg, &leaf);
+         destroy_leaf_incorporate_spec(&spec);
+         __sync_fetch_and_add(&dbg_full, 1);
+         return FALSE;
+      }
+
+      if (btree_node_claim(cc, cfg, &leaf)) {
+         btree_node_lock(cc, cfg, &leaf);
+         bool32 incorporated = btree_try_perform_leaf_incorporate_spec(
+            cfg, leaf.hdr, &spec, generation);
+         platform_assert(incorporated);
+         btree_node_full_unlock(cc, cfg, &leaf);
+         destroy_leaf_incorporate_spec(&spec);
+         *was_unique = spec.old_entry_state == ENTRY_DID_NOT_EXIST;
+         return TRUE;
+      }
+
+      // another insert holds the leaf, so back off and descend again
+      btree_node_unget(cc, cfg, &leaf);
+      destroy_leaf_incorporate_spec(&spec);
+      __sync_fetch_and_add(&dbg_retry, 1);
+      platform_sleep_ns(leaf_wait);
+      leaf_wait = leaf_wait > 2048 ? leaf_wait : 2 * leaf_wait;
+   }
+}
+
 /*
  *-----------------------------------------------------------------------------
  * btree_insert --
  *
  *      Inserts the tuple into the dynamic btree.
+ *
+ *      Tries btree_insert_optimistic first. Failing that, it descends with
+ *      claims and write locks, splitting full index nodes on the way down
+ *      so that a leaf split only has to lock the leaf's parent.
  *-----------------------------------------------------------------------------
  */
 platform_status
@@ -1758,6 +2026,21 @@ btree_insert(cache              *cc,         // IN
       return STATUS_BAD_PARAM;
    }
 
+   if (btree_insert_optimistic(cc,
+                               cfg,
+                               heap_id,
+                               root_addr,
+                               tuple_key,
+                               msg,
+                               generation,
+                               was_unique,
+                               &rc))
+   {
+      __sync_fetch_and_add(&dbg_ok, 1);
+      return rc;
+   }
+   if (__sync_add_and_fetch(&dbg_fb, 1) % 1000 == 0) platform_error_log("DBG ok %lu fb %lu full %lu retry %lu\n", dbg_ok, dbg_fb, dbg_full, dbg_retry);
+
    btree_node root_node;
    root_node.addr = root_addr;
 
@@ -2074,6 +2357,13 @@ btree_lookup_node(cache             *cc,             // IN
    }
 
    debug_assert(type == PAGE_TYPE_BRANCH || type == PAGE_TYPE_MEMTABLE);
+   if (stats == NULL
+       && btree_lookup_node_optimistic(
+          cc, cfg, root_addr, target, stop_at_height, type, FALSE, out_node))
+   {
+      return STATUS_OK;
+   }
+
    node.addr = root_addr;
    btree_node_get(cc, cfg, &node, type);
 
@@ -3175,6 +3465,11 @@ btree_pack_loop(btree_pack_req *req,       // IN/OUT
    req->num_tuples++;
    req->key_bytes += key_length(tuple_key);
    req->message_bytes += message_length(msg);
+   if (message_class(msg) == MESSAGE_TYPE_DELETE) {
+      req->num_tombstones++;
+   } else if (message_class(msg) == MESSAGE_TYPE_UPDATE) {
+      req->num_updates++;
+   }
    return STATUS_OK;
 }
 
@@ -3238,6 +3533,43 @@ btree_pack_abort(btree_pack_req *req)
                        POSITIVE_INFINITY_KEY);
 }
 
+/*
+ * Applies TTL expiry and the compaction filter of the data_config to a tuple
+ * on its way into the packed tree. A tuple they remove comes back as a
+ * delete, or is discarded if req->discard_deletes says it can be left out
+ * altogether.
+ */
+static platform_status
+btree_pack_filter_tuple(btree_pack_req *req,
+                        key             tuple_key,
+                        message        *msg,
+                        bool32         *discarded)
+{
+   data_config *data_cfg = req->cfg->data_cfg;
+   *discarded            = FALSE;
+   if (message_class(*msg) == MESSAGE_TYPE_DELETE) {
+      return STATUS_OK;
+   }
+
+   if (data_message_expired(data_cfg, *msg, req->expiry_now)) {
+      *msg = DELETE_MESSAGE;
+   } else if (data_cfg->compaction_filter != NULL) {
+      if (!merge_accumulator_copy_message(&req->filter_buffer, *msg)) {
+         return STATUS_NO_MEMORY;
+      }
+      if (data_compaction_filter(data_cfg, tuple_key, &req->filter_buffer)) {
+         return STATUS_NO_MEMORY;
+      }
+      *msg = merge_accumulator_to_message(&req->filter_buffer);
+   }
+
+   if (message_class(*msg) == MESSAGE_TYPE_DELETE) {
+      req->num_filtered++;
+      *discarded = req->discard_deletes;
+   }
+   return STATUS_OK;
+}
+
 /*
  *-----------------------------------------------------------------------------
  * btree_pack --
@@ -3254,11 +3586,26 @@ btree_pack(btree_pack_req *req)
 {
    btree_pack_setup_start(req);
 
-   key     tuple_key = NEGATIVE_INFINITY_KEY;
-   message data;
+   key             tuple_key = NEGATIVE_INFINITY_KEY;
+   message         data;
+   bool32          filter = data_filters_compactions(req->cfg->data_cfg);
+   platform_status rc;
 
+   req->expiry_now = data_expiry_now(req->cfg->data_cfg);
    while (iterator_can_next(req->itor)) {
       iterator_curr(req->itor, &tuple_key, &data);
+      if (filter) {
+         bool32 discarded;
+         rc = btree_pack_filter_tuple(req, tuple_key, &data, &discarded);
+         if (!SUCCESS(rc)) {
+            platform_error_log("%s error status: %d\n", __func__, rc.r);
+            btree_pack_abort(req);
+            return rc;
+         }
+         if (discarded) {
+            goto next;
+         }
+      }
       if (!btree_pack_can_fit_tuple(req, tuple_key, data)) {
          platform_error_log("%s(): req->num_tuples=%lu exceeded output size "
                             "limit, req->max_tuples=%lu\n",
@@ -3268,12 +3615,13 @@ btree_pack(btree_pack_req *req)
          btree_pack_abort(req);
          return STATUS_LIMIT_EXCEEDED;
       }
-      platform_status rc = btree_pack_loop(req, tuple_key, data);
+      rc = btree_pack_loop(req, tuple_key, data);
       if (!SUCCESS(rc)) {
          platform_error_log("%s error status: %d\n", __func__, rc.r);
          btree_pack_abort(req);
          return rc;
       }
+   next:
       rc = iterator_next(req->itor);
       if (!SUCCESS(rc)) {
          platform_error_log("%s error status: %d\n", __func__, rc.r);
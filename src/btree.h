@@ -154,6 +154,7 @@ typedef struct btree_pack_req {
    hash_fn       hash; // hash function used for calculating filter_hash
    unsigned int  seed; // seed used for calculating filter_hash
    uint32       *fingerprint_arr; // IN/OUT: hashes of the keys in the tree
+   bool32        discard_deletes; // leave out tuples the filter removes
 
    // internal data
    uint16            height;
@@ -161,13 +162,18 @@ typedef struct btree_pack_req {
    btree_pivot_stats edge_stats[BTREE_MAX_HEIGHT][MAX_PAGES_PER_EXTENT];
    uint32            num_edges[BTREE_MAX_HEIGHT];
 
-   mini_allocator mini;
+   mini_allocator    mini;
+   merge_accumulator filter_buffer; // holds messages the filter rewrites
+   uint64            expiry_now;
 
    // output of the compaction
-   uint64 root_addr;     // root address of the output tree
-   uint64 num_tuples;    // no. of tuples in the output tree
-   uint64 key_bytes;     // total size of keys in tuples of the output tree
-   uint64 message_bytes; // total size of msgs in tuples of the output tree
+   uint64 root_addr;      // root address of the output tree
+   uint64 num_tuples;     // no. of tuples in the output tree
+   uint64 key_bytes;      // total size of keys in tuples of the output tree
+   uint64 message_bytes;  // total size of msgs in tuples of the output tree
+   uint64 num_tombstones; // no. of delete messages in the output tree
+   uint64 num_updates;    // no. of update messages in the output tree
+   uint64 num_filtered;   // no. of tuples expired or removed by the filter
 } btree_pack_req;
 
 struct btree_async_ctxt;
@@ -255,6 +261,14 @@ btree_dec_ref_range(cache              *cc,
                     key                 start_key,
                     key                 end_key);
 
+bool32
+btree_dec_ref_range_batched(cache              *cc,
+                            const btree_config *cfg,
+                            uint64              root_addr,
+                            key                 start_key,
+                            key                 end_key,
+                            mini_extent_batch  *batch);
+
 bool32
 btree_dec_ref(cache              *cc,
               const btree_config *cfg,
@@ -342,6 +356,7 @@ btree_pack_req_init(btree_pack_req  *req,
    req->max_tuples = max_tuples;
    req->hash       = hash;
    req->seed       = seed;
+   merge_accumulator_init(&req->filter_buffer, hid);
    if (hash != NULL && max_tuples > 0) {
       req->fingerprint_arr =
          TYPED_ARRAY_ZALLOC(hid, req->fingerprint_arr, max_tuples);
@@ -364,6 +379,7 @@ btree_pack_req_deinit(btree_pack_req *req, platform_heap_id hid)
    if (req->fingerprint_arr) {
       platform_free(hid, req->fingerprint_arr);
    }
+   merge_accumulator_deinit(&req->filter_buffer);
 }
 
 platform_status
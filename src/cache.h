@@ -92,6 +92,15 @@ typedef struct cache_async_ctxt {
    } stats;
 } cache_async_ctxt;
 
+/*
+ * An extent with pages resident in the cache, as reported by
+ * cache_hot_extents(). Used to warm a cold cache after a restart.
+ */
+typedef struct cache_extent_hint {
+   uint64    addr; // base address of the extent
+   page_type type; // type of the resident pages
+} cache_extent_hint;
+
 typedef uint64 (*cache_config_generic_uint64_fn)(const cache_config *cfg);
 
 typedef struct cache_config_ops {
@@ -139,6 +148,18 @@ typedef page_handle *(*page_get_fn)(cache    *cc,
                                     uint64    addr,
                                     bool32    blocking,
                                     page_type type);
+typedef page_handle *(*page_get_optimistic_fn)(cache    *cc,
+                                               uint64    addr,
+                                               page_type type,
+                                               uint64   *version);
+typedef bool32 (*page_validate_optimistic_fn)(cache       *cc,
+                                              page_handle *page,
+                                              uint64       version);
+typedef void (*page_get_many_fn)(cache        *cc,
+                                 const uint64 *addrs,
+                                 uint64        num_pages,
+                                 page_type     type,
+                                 page_handle **pages);
 typedef cache_async_result (*page_get_async_fn)(cache            *cc,
                                                 uint64            addr,
                                                 page_type         type,
@@ -166,6 +187,10 @@ typedef void (*enable_sync_get_fn)(cache *cc, bool32 enabled);
 typedef allocator *(*get_allocator_fn)(const cache *cc);
 typedef cache_config *(*cache_config_fn)(const cache *cc);
 typedef void (*cache_print_fn)(platform_log_handle *log_handle, cache *cc);
+typedef platform_status (*hot_extents_fn)(cache              *cc,
+                                          platform_heap_id    hid,
+                                          cache_extent_hint **hints,
+                                          uint64             *num_hints);
 
 /*
  * Cache Operations structure:
@@ -173,38 +198,43 @@ typedef void (*cache_print_fn)(platform_log_handle *log_handle, cache *cc);
  * for a caching system.
  */
 typedef struct cache_ops {
-   page_alloc_fn        page_alloc;
-   extent_discard_fn    extent_discard;
-   page_get_fn          page_get;
-   page_get_async_fn    page_get_async;
-   page_async_done_fn   page_async_done;
-   page_generic_fn      page_unget;
-   page_try_claim_fn    page_try_claim;
-   page_generic_fn      page_unclaim;
-   page_generic_fn      page_lock;
-   page_generic_fn      page_unlock;
-   page_prefetch_fn     page_prefetch;
-   page_generic_fn      page_mark_dirty;
-   page_generic_fn      page_pin;
-   page_generic_fn      page_unpin;
-   page_sync_fn         page_sync;
-   extent_sync_fn       extent_sync;
-   cache_generic_fn     flush;
-   evict_fn             evict;
-   cache_generic_fn     cleanup;
-   assert_ungot_fn      assert_ungot;
-   cache_generic_fn     assert_free;
-   validate_page_fn     validate_page;
-   cache_present_fn     cache_present;
-   cache_print_fn       print;
-   cache_print_fn       print_stats;
-   io_stats_fn          io_stats;
-   cache_generic_fn     reset_stats;
-   count_dirty_fn       count_dirty;
-   page_get_read_ref_fn page_get_read_ref;
-   enable_sync_get_fn   enable_sync_get;
-   get_allocator_fn     get_allocator;
-   cache_config_fn      get_config;
+   page_alloc_fn               page_alloc;
+   extent_discard_fn           extent_discard;
+   page_get_fn                 page_get;
+   page_get_optimistic_fn      page_get_optimistic;
+   page_validate_optimistic_fn page_validate_optimistic;
+   page_get_many_fn            page_get_many;
+   page_get_async_fn           page_get_async;
+   page_async_done_fn          page_async_done;
+   page_generic_fn             page_unget;
+   page_try_claim_fn           page_try_claim;
+   page_generic_fn             page_unclaim;
+   page_generic_fn             page_lock;
+   page_generic_fn             page_unlock;
+   page_prefetch_fn            page_prefetch;
+   cache_generic_fn            prefetch_wait;
+   hot_extents_fn              hot_extents;
+   page_generic_fn             page_mark_dirty;
+   page_generic_fn             page_pin;
+   page_generic_fn             page_unpin;
+   page_sync_fn                page_sync;
+   extent_sync_fn              extent_sync;
+   cache_generic_fn            flush;
+   evict_fn                    evict;
+   cache_generic_fn            cleanup;
+   assert_ungot_fn             assert_ungot;
+   cache_generic_fn            assert_free;
+   validate_page_fn            validate_page;
+   cache_present_fn            cache_present;
+   cache_print_fn              print;
+   cache_print_fn              print_stats;
+   io_stats_fn                 io_stats;
+   cache_generic_fn            reset_stats;
+   count_dirty_fn              count_dirty;
+   page_get_read_ref_fn        page_get_read_ref;
+   enable_sync_get_fn          enable_sync_get;
+   get_allocator_fn            get_allocator;
+   cache_config_fn             get_config;
 } cache_ops;
 
 // To sub-class cache, make a cache your first field;
@@ -283,6 +313,67 @@ cache_get(cache *cc, uint64 addr, bool32 blocking, page_type type)
    return cc->ops->page_get(cc, addr, blocking, type);
 }
 
+/*
+ *----------------------------------------------------------------------
+ * cache_get_optimistic
+ *
+ * Returns a pointer to the page_handle for the page with address addr
+ * without taking a read lock, so without writing to any shared cacheline,
+ * together with the version to pass to cache_validate_optimistic().
+ *
+ * Returns NULL if the page is not in the cache, or is being loaded or
+ * written; the caller then falls back to cache_get(). Never blocks and never
+ * reads from disk.
+ *
+ * The contents of the page may change under the caller, so nothing read from
+ * it may be trusted, or acted on beyond the page itself, until
+ * cache_validate_optimistic() returns TRUE. There is nothing to release.
+ *----------------------------------------------------------------------
+ */
+static inline page_handle *
+cache_get_optimistic(cache *cc, uint64 addr, page_type type, uint64 *version)
+{
+   return cc->ops->page_get_optimistic(cc, addr, type, version);
+}
+
+/*
+ *----------------------------------------------------------------------
+ * cache_validate_optimistic
+ *
+ * Returns TRUE if the page returned by cache_get_optimistic() has held the
+ * same contents since, so that everything read from it up to this call is
+ * consistent. May be called more than once for the same read.
+ *----------------------------------------------------------------------
+ */
+static inline bool32
+cache_validate_optimistic(cache *cc, page_handle *page, uint64 version)
+{
+   return cc->ops->page_validate_optimistic(cc, page, version);
+}
+
+/*
+ *----------------------------------------------------------------------
+ * cache_get_many
+ *
+ * Blocking get of num_pages pages at once: on return, pages[i] is the
+ * page_handle for addrs[i], with a read lock held.
+ *
+ * Misses on consecutive addresses within an extent are loaded with a single
+ * vectored read, and all reads are in flight together, so callers which
+ * know up front which pages they need should prefer this to a loop over
+ * cache_get().
+ *----------------------------------------------------------------------
+ */
+static inline void
+cache_get_many(cache        *cc,
+               const uint64 *addrs,
+               uint64        num_pages,
+               page_type     type,
+               page_handle **pages)
+{
+   cc->ops->page_get_many(cc, addrs, num_pages, type, pages);
+}
+
 /*
  *----------------------------------------------------------------------
  * cache_ctxt_init
@@ -443,6 +534,45 @@ cache_prefetch(cache *cc, uint64 addr, page_type type)
    return cc->ops->page_prefetch(cc, addr, type);
 }
 
+/*
+ *----------------------------------------------------------------------
+ * cache_prefetch_wait
+ *
+ * Blocks until all prefetches issued by the calling thread have completed.
+ * Completions of prefetch reads are only reaped by the issuing thread, so a
+ * thread which prefetches pages it will not get itself must call this
+ * before going idle.
+ *----------------------------------------------------------------------
+ */
+static inline void
+cache_prefetch_wait(cache *cc)
+{
+   cc->ops->prefetch_wait(cc);
+}
+
+/*
+ *----------------------------------------------------------------------
+ * cache_hot_extents
+ *
+ * Returns in *hints an array, allocated from hid, of the extents which
+ * currently have pages resident in the cache, hottest first. Extents are
+ * ranked by page type (trunk, then filter, then branch pages) and by
+ * recency of access. At most as many extents as fit in the cache are
+ * returned. The caller frees *hints with platform_free().
+ *
+ * The result is only a snapshot; it is intended to be saved and passed to
+ * cache_prefetch() to warm up the cache after a restart.
+ *----------------------------------------------------------------------
+ */
+static inline platform_status
+cache_hot_extents(cache              *cc,
+                  platform_heap_id    hid,
+                  cache_extent_hint **hints,
+                  uint64             *num_hints)
+{
+   return cc->ops->hot_extents(cc, hid, hints, num_hints);
+}
+
 /*
  *----------------------------------------------------------------------
  * cache_mark_dirty
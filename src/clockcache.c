@@ -40,6 +40,21 @@
 /* number of events to poll for during clockcache_wait */
 #define CC_DEFAULT_MAX_IO_EVENTS 32
 
+// Number of batches just ahead of the evictor hand the cleaner always cleans
+#define CC_CLEANER_NEAR_BATCHES 8
+
+// Default dirty pages in the cleaner window which trigger a full clean
+#define CC_CLEANER_DEFAULT_WATERMARK (CC_CLEANER_GAP * CC_ENTRIES_PER_BATCH / 4)
+
+// How long the background cleaner sleeps between passes
+#define CC_CLEANER_PERIOD_NS USEC_TO_NSEC(1000)
+
+// Smallest number of batches the cache can be resized to
+#define CC_MIN_ACTIVE_BATCHES 16
+
+// How long to wait before retrying to retire busy entries after a shrink
+#define CC_RESIZE_RETRY_NS USEC_TO_NSEC(1000)
+
 /*
  *-----------------------------------------------------------------------------
  * Clockcache Operations Logging and Address Tracing
@@ -137,12 +152,33 @@ clockcache_alloc(clockcache *cc, uint64 addr, page_type type);
 void
 clockcache_extent_discard(clockcache *cc, uint64 addr, page_type type);
 
+void
+clockcache_try_page_discard(clockcache *cc, uint64 addr);
+
 uint8
 clockcache_get_allocator_ref(clockcache *cc, uint64 addr);
 
 page_handle *
 clockcache_get(clockcache *cc, uint64 addr, bool32 blocking, page_type type);
 
+page_handle *
+clockcache_get_optimistic(clockcache *cc,
+                          uint64      addr,
+                          page_type   type,
+                          uint64     *version);
+
+bool32
+clockcache_validate_optimistic(clockcache  *cc,
+                               page_handle *page,
+                               uint64       version);
+
+void
+clockcache_get_many(clockcache   *cc,
+                    const uint64 *addrs,
+                    uint64        num_pages,
+                    page_type     type,
+                    page_handle **pages);
+
 void
 clockcache_unget(clockcache *cc, page_handle *page);
 
@@ -161,6 +197,15 @@ clockcache_unlock(clockcache *cc, page_handle *page);
 void
 clockcache_prefetch(clockcache *cc, uint64 addr, page_type type);
 
+void
+clockcache_prefetch_wait(clockcache *cc);
+
+platform_status
+clockcache_hot_extents(clockcache         *cc,
+                       platform_heap_id    hid,
+                       cache_extent_hint **hints,
+                       uint64             *num_hints);
+
 void
 clockcache_mark_dirty(clockcache *cc, page_handle *page);
 
@@ -295,6 +340,36 @@ clockcache_get_virtual(cache *c, uint64 addr, bool32 blocking, page_type type)
    return clockcache_get(cc, addr, blocking, type);
 }
 
+page_handle *
+clockcache_get_optimistic_virtual(cache    *c,
+                                  uint64    addr,
+                                  page_type type,
+                                  uint64   *version)
+{
+   clockcache *cc = (clockcache *)c;
+   return clockcache_get_optimistic(cc, addr, type, version);
+}
+
+bool32
+clockcache_validate_optimistic_virtual(cache       *c,
+                                       page_handle *page,
+                                       uint64       version)
+{
+   clockcache *cc = (clockcache *)c;
+   return clockcache_validate_optimistic(cc, page, version);
+}
+
+void
+clockcache_get_many_virtual(cache        *c,
+                            const uint64 *addrs,
+                            uint64        num_pages,
+                            page_type     type,
+                            page_handle **pages)
+{
+   clockcache *cc = (clockcache *)c;
+   clockcache_get_many(cc, addrs, num_pages, type, pages);
+}
+
 void
 clockcache_unget_virtual(cache *c, page_handle *page)
 {
@@ -337,6 +412,23 @@ clockcache_prefetch_virtual(cache *c, uint64 addr, page_type type)
    clockcache_prefetch(cc, addr, type);
 }
 
+void
+clockcache_prefetch_wait_virtual(cache *c)
+{
+   clockcache *cc = (clockcache *)c;
+   clockcache_prefetch_wait(cc);
+}
+
+platform_status
+clockcache_hot_extents_virtual(cache              *c,
+                               platform_heap_id    hid,
+                               cache_extent_hint **hints,
+                               uint64             *num_hints)
+{
+   clockcache *cc = (clockcache *)c;
+   return clockcache_hot_extents(cc, hid, hints, num_hints);
+}
+
 void
 clockcache_mark_dirty_virtual(cache *c, page_handle *page)
 {
@@ -505,38 +597,43 @@ clockcache_get_config_virtual(const cache *c)
 }
 
 static cache_ops clockcache_ops = {
-   .page_alloc        = clockcache_alloc_virtual,
-   .extent_discard    = clockcache_extent_discard_virtual,
-   .page_get          = clockcache_get_virtual,
-   .page_get_async    = clockcache_get_async_virtual,
-   .page_async_done   = clockcache_async_done_virtual,
-   .page_unget        = clockcache_unget_virtual,
-   .page_try_claim    = clockcache_try_claim_virtual,
-   .page_unclaim      = clockcache_unclaim_virtual,
-   .page_lock         = clockcache_lock_virtual,
-   .page_unlock       = clockcache_unlock_virtual,
-   .page_prefetch     = clockcache_prefetch_virtual,
-   .page_mark_dirty   = clockcache_mark_dirty_virtual,
-   .page_pin          = clockcache_pin_virtual,
-   .page_unpin        = clockcache_unpin_virtual,
-   .page_sync         = clockcache_page_sync_virtual,
-   .extent_sync       = clockcache_extent_sync_virtual,
-   .flush             = clockcache_flush_virtual,
-   .evict             = clockcache_evict_all_virtual,
-   .cleanup           = clockcache_wait_virtual,
-   .assert_ungot      = clockcache_assert_ungot_virtual,
-   .assert_free       = clockcache_assert_no_locks_held_virtual,
-   .print             = clockcache_print_virtual,
-   .print_stats       = clockcache_print_stats_virtual,
-   .io_stats          = clockcache_io_stats_virtual,
-   .reset_stats       = clockcache_reset_stats_virtual,
-   .validate_page     = clockcache_validate_page_virtual,
-   .count_dirty       = clockcache_count_dirty_virtual,
-   .page_get_read_ref = clockcache_get_read_ref_virtual,
-   .cache_present     = clockcache_present_virtual,
-   .enable_sync_get   = clockcache_enable_sync_get_virtual,
-   .get_allocator     = clockcache_get_allocator_virtual,
-   .get_config        = clockcache_get_config_virtual,
+   .page_alloc               = clockcache_alloc_virtual,
+   .extent_discard           = clockcache_extent_discard_virtual,
+   .page_get                 = clockcache_get_virtual,
+   .page_get_optimistic      = clockcache_get_optimistic_virtual,
+   .page_validate_optimistic = clockcache_validate_optimistic_virtual,
+   .page_get_many            = clockcache_get_many_virtual,
+   .page_get_async           = clockcache_get_async_virtual,
+   .page_async_done          = clockcache_async_done_virtual,
+   .page_unget               = clockcache_unget_virtual,
+   .page_try_claim           = clockcache_try_claim_virtual,
+   .page_unclaim             = clockcache_unclaim_virtual,
+   .page_lock                = clockcache_lock_virtual,
+   .page_unlock              = clockcache_unlock_virtual,
+   .page_prefetch            = clockcache_prefetch_virtual,
+   .prefetch_wait            = clockcache_prefetch_wait_virtual,
+   .hot_extents              = clockcache_hot_extents_virtual,
+   .page_mark_dirty          = clockcache_mark_dirty_virtual,
+   .page_pin                 = clockcache_pin_virtual,
+   .page_unpin               = clockcache_unpin_virtual,
+   .page_sync                = clockcache_page_sync_virtual,
+   .extent_sync              = clockcache_extent_sync_virtual,
+   .flush                    = clockcache_flush_virtual,
+   .evict                    = clockcache_evict_all_virtual,
+   .cleanup                  = clockcache_wait_virtual,
+   .assert_ungot             = clockcache_assert_ungot_virtual,
+   .assert_free              = clockcache_assert_no_locks_held_virtual,
+   .print                    = clockcache_print_virtual,
+   .print_stats              = clockcache_print_stats_virtual,
+   .io_stats                 = clockcache_io_stats_virtual,
+   .reset_stats              = clockcache_reset_stats_virtual,
+   .validate_page            = clockcache_validate_page_virtual,
+   .count_dirty              = clockcache_count_dirty_virtual,
+   .page_get_read_ref        = clockcache_get_read_ref_virtual,
+   .cache_present            = clockcache_present_virtual,
+   .enable_sync_get          = clockcache_enable_sync_get_virtual,
+   .get_allocator            = clockcache_get_allocator_virtual,
+   .get_config               = clockcache_get_config_virtual,
 };
 
 /*
@@ -560,11 +657,15 @@ static cache_ops clockcache_ops = {
 #define CC_LOADING     (1u << 4) // page is actively being read from disk
 #define CC_WRITELOCKED (1u << 5) // write lock is held
 #define CC_CLAIMED     (1u << 6) // claim is held
+#define CC_RETIRED     (1u << 7) // entry is beyond the active region
 
 /* Common status flag combinations */
 // free entry
 #define CC_FREE_STATUS (0 | CC_FREE)
 
+// free entry, not to be handed out (see clockcache_resize)
+#define CC_RETIRED_STATUS (0 | CC_FREE | CC_RETIRED)
+
 // evictable unlocked page
 #define CC_EVICTABLE_STATUS (0 | CC_CLEAN)
 
@@ -592,6 +693,9 @@ static cache_ops clockcache_ops = {
 // loading for read
 #define CC_READ_LOADING_STATUS (0 | CC_ACCESSED | CC_CLEAN | CC_LOADING)
 
+// contents may be changing, so cannot be read optimistically
+#define CC_UNSTABLE_FLAGS (0 | CC_FREE | CC_LOADING | CC_WRITELOCKED)
+
 /*
  *-----------------------------------------------------------------------------
  * Clock cache Functions
@@ -628,6 +732,17 @@ clockcache_set_flag(clockcache *cc, uint32 entry_number, entry_status flag)
                                 flag);
 }
 
+/*
+ * Fails the optimistic reads of the entry in flight. Called with the write lock
+ * held, before it is released or the entry is freed.
+ */
+static inline void
+clockcache_bump_version(clockcache *cc, uint32 entry_number)
+{
+   __atomic_add_fetch(
+      &clockcache_get_entry(cc, entry_number)->version, 1, __ATOMIC_RELEASE);
+}
+
 static inline uint32
 clockcache_clear_flag(clockcache *cc, uint32 entry_number, entry_status flag)
 {
@@ -658,7 +773,7 @@ clockcache_record_backtrace(clockcache *cc, uint32 entry_number)
 
    myEntry->history[myhistindex].status   = myEntry->status;
    myEntry->history[myhistindex].refcount = 0;
-   for (threadid i = 0; i < MAX_THREADS; i++) {
+   for (threadid i = 0; i < CC_RC_WIDTH; i++) {
       myEntry->history[myhistindex].refcount +=
          cc->refcount[i * cc->cfg->page_capacity + entry_number];
    }
@@ -1309,13 +1424,16 @@ clockcache_write_callback(void           *metadata,
  *
  *      If is_urgent is set, pages with CC_ACCESSED are written back, otherwise
  *      they are not.
+ *
+ *      Returns the number of pages for which writeback was issued.
  *----------------------------------------------------------------------
  */
-void
+uint64
 clockcache_batch_start_writeback(clockcache *cc, uint64 batch, bool32 is_urgent)
 {
    uint32          entry_no, next_entry_no;
    uint64          addr, first_addr, end_addr, i;
+   uint64          pages_written  = 0;
    const threadid  tid            = platform_get_tid();
    uint64          start_entry_no = batch * CC_ENTRIES_PER_BATCH;
    uint64          end_entry_no   = start_entry_no + CC_ENTRIES_PER_BATCH;
@@ -1402,9 +1520,11 @@ clockcache_batch_start_writeback(clockcache *cc, uint64 batch, bool32 is_urgent)
          status = io_write_async(
             cc->io, req, clockcache_write_callback, req_count, first_addr);
          platform_assert_status_ok(status);
+         pages_written += req_count;
       }
    }
    clockcache_close_log_stream();
+   return pages_written;
 }
 
 /*
@@ -1504,6 +1624,7 @@ clockcache_try_evict(clockcache *cc, uint32 entry_number)
    debug_assert(debug_status);
 
    /* 6. set status to CC_FREE_STATUS (clears claim and write lock) */
+   clockcache_bump_version(cc, entry_number);
    entry->status = CC_FREE_STATUS;
    clockcache_log(
       addr, entry_number, "evict: entry %u addr %lu\n", entry_number, addr);
@@ -1558,6 +1679,10 @@ clockcache_evict_batch(clockcache *cc, uint32 batch)
  *      Moves the clock hand forward cleaning and evicting a batch. Cleans
  *      "accessed" pages if is_urgent is set, for example when get_free_page
  *      has cycled through the cache already.
+ *
+ *      When the background cleaner is running, it keeps the batches ahead of
+ *      the hand clean, so the foreground only issues writeback itself when
+ *      is_urgent is set.
  *----------------------------------------------------------------------
  */
 void
@@ -1567,6 +1692,7 @@ clockcache_move_hand(clockcache *cc, bool32 is_urgent)
    volatile bool32 *evict_batch_busy;
    volatile bool32 *clean_batch_busy;
    uint64           cleaner_hand;
+   uint64           active_batches;
 
    /* move the hand a batch forward */
    uint64            evict_hand = cc->per_thread[tid].free_hand;
@@ -1577,11 +1703,16 @@ clockcache_move_hand(clockcache *cc, bool32 is_urgent)
       debug_assert(was_busy);
    }
    do {
+      active_batches = cc->active_batches;
+
       evict_hand =
-         __sync_add_and_fetch(&cc->evict_hand, 1) % cc->cfg->batch_capacity;
+         __sync_add_and_fetch(&cc->evict_hand, 1) % active_batches;
       evict_batch_busy = &cc->batch_busy[evict_hand];
+      if (cc->cleaner.running && !is_urgent) {
+         continue;
+      }
       // clean the batch ahead
-      cleaner_hand = (evict_hand + cc->cleaner_gap) % cc->cfg->batch_capacity;
+      cleaner_hand     = (evict_hand + cc->cleaner_gap) % active_batches;
       clean_batch_busy = &cc->batch_busy[cleaner_hand];
       if (__sync_bool_compare_and_swap(clean_batch_busy, FALSE, TRUE)) {
          clockcache_batch_start_writeback(cc, cleaner_hand, is_urgent);
@@ -1590,11 +1721,445 @@ clockcache_move_hand(clockcache *cc, bool32 is_urgent)
       }
    } while (!__sync_bool_compare_and_swap(evict_batch_busy, FALSE, TRUE));
 
-   clockcache_evict_batch(cc, evict_hand % cc->cfg->batch_capacity);
-   cc->per_thread[tid].free_hand = evict_hand % cc->cfg->batch_capacity;
+   clockcache_evict_batch(cc, evict_hand);
+   cc->per_thread[tid].free_hand = evict_hand;
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * background cleaner functions
+ *
+ *----------------------------------------------------------------------
+ */
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_cleaner_count_dirty --
+ *
+ *      Counts the dirty (cleanable) pages in the num_batches batches
+ *      following start_batch, stopping early once limit is reached.
+ *----------------------------------------------------------------------
+ */
+static uint64
+clockcache_cleaner_count_dirty(clockcache *cc,
+                               uint64      start_batch,
+                               uint64      num_batches,
+                               uint64      limit)
+{
+   uint64 dirty          = 0;
+   uint64 active_batches = cc->active_batches;
+   for (uint64 i = 1; i <= num_batches && dirty < limit; i++) {
+      uint64 batch = (start_batch + i) % active_batches;
+      uint32 start_entry_no = batch * CC_ENTRIES_PER_BATCH;
+      uint32 end_entry_no   = start_entry_no + CC_ENTRIES_PER_BATCH;
+      for (uint32 entry_no = start_entry_no; entry_no < end_entry_no;
+           entry_no++)
+      {
+         if (clockcache_ok_to_writeback(cc, entry_no, FALSE)) {
+            dirty++;
+         }
+      }
+   }
+   return dirty;
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_cleaner_clean_batch --
+ *
+ *      Issues (non-urgent) writeback for a batch unless it is busy being
+ *      cleaned or evicted by another thread. Returns the number of pages
+ *      written.
+ *----------------------------------------------------------------------
+ */
+static uint64
+clockcache_cleaner_clean_batch(clockcache *cc, uint64 batch)
+{
+   volatile bool32  *batch_busy    = &cc->batch_busy[batch];
+   uint64            pages_written = 0;
+   debug_only bool32 was_busy;
+
+   if (__sync_bool_compare_and_swap(batch_busy, FALSE, TRUE)) {
+      pages_written = clockcache_batch_start_writeback(cc, batch, FALSE);
+      was_busy      = __sync_bool_compare_and_swap(batch_busy, TRUE, FALSE);
+      debug_assert(was_busy);
+   }
+   return pages_written;
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_writeback_pending --
+ *
+ *      Returns TRUE if any page in the cache is in writeback.
+ *----------------------------------------------------------------------
+ */
+static bool32
+clockcache_writeback_pending(clockcache *cc)
+{
+   for (uint32 entry_no = 0; entry_no < cc->cfg->page_capacity; entry_no++) {
+      if (clockcache_test_flag(cc, entry_no, CC_WRITEBACK)) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_cleaner_thread --
+ *
+ *      Main loop of the background cleaner. Each pass looks at the window
+ *      of cleaner_gap batches ahead of the evictor hand:
+ *         -- the CC_CLEANER_NEAR_BATCHES batches which are about to be
+ *            evicted are always cleaned,
+ *         -- the rest of the window is cleaned only once it holds at least
+ *            cleaner_dirty_watermark dirty pages, so that pages which are
+ *            about to be rewritten or discarded are not written early.
+ *      Writes are limited to cleaner_max_pages_per_sec (if set) by a token
+ *      bucket which holds at most a second's worth of pages, and count as
+ *      background IO.
+ *
+ *      Async IO completions are reaped by the issuing thread, so the cleaner
+ *      polls for its own writes between passes and drains them before it
+ *      exits.
+ *----------------------------------------------------------------------
+ */
+static void
+clockcache_cleaner_thread(void *arg)
+{
+   clockcache *cc          = (clockcache *)arg;
+   uint64      rate        = cc->cfg->cleaner_max_pages_per_sec;
+   uint64      tokens      = rate;
+   timestamp   last_refill = platform_get_timestamp();
+
+   io_set_class(cc->io, IO_CLASS_BACKGROUND);
+
+   while (!cc->cleaner.stop) {
+      if (rate != 0) {
+         uint64 elapsed_ns = platform_timestamp_elapsed(last_refill);
+         uint64 refill     = elapsed_ns * rate / SEC_TO_NSEC(1);
+         if (refill != 0) {
+            tokens      = MIN(tokens + refill, rate);
+            last_refill = platform_get_timestamp();
+         }
+      }
+
+      // the window shrinks with the cache, see clockcache_resize()
+      uint64 active_batches = cc->active_batches;
+      uint64 window         = MIN(cc->cleaner_gap, active_batches - 1);
+      uint64 watermark =
+         MIN(cc->cfg->cleaner_dirty_watermark, window * CC_ENTRIES_PER_BATCH);
+      uint64 evict_hand  = cc->evict_hand % active_batches;
+      uint64 num_batches = MIN(CC_CLEANER_NEAR_BATCHES, window);
+      if (clockcache_cleaner_count_dirty(cc, evict_hand, window, watermark)
+          >= watermark)
+      {
+         num_batches = window;
+      }
+
+      for (uint64 i = 1; i <= num_batches && !cc->cleaner.stop; i++) {
+         if (rate != 0 && tokens == 0) {
+            break;
+         }
+         uint64 batch   = (evict_hand + i) % active_batches;
+         uint64 written = clockcache_cleaner_clean_batch(cc, batch);
+         if (written != 0) {
+            cc->cleaner.pages_written += written;
+            cc->cleaner.batches_cleaned++;
+            tokens -= MIN(written, tokens);
+            clockcache_wait(cc);
+         }
+      }
+
+      clockcache_wait(cc);
+      platform_sleep_ns(CC_CLEANER_PERIOD_NS);
+   }
+
+   while (clockcache_writeback_pending(cc)) {
+      clockcache_wait(cc);
+   }
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_start_cleaner --
+ *
+ *      Starts the background cleaner thread. Once it is running, threads
+ *      moving the clock hand no longer clean the batch cleaner_gap ahead of
+ *      it (unless they are desperate for a free page).
+ *----------------------------------------------------------------------
+ */
+platform_status
+clockcache_start_cleaner(clockcache *cc, task_system *ts)
+{
+   platform_assert(!cc->cleaner.running);
+
+   cc->cleaner.stop = FALSE;
+   platform_status rc =
+      task_thread_create("clockcache-cleaner",
+                         clockcache_cleaner_thread,
+                         cc,
+                         0,
+                         ts,
+                         cc->heap_id,
+                         &cc->cleaner.thread);
+   if (!SUCCESS(rc)) {
+      return rc;
+   }
+   cc->cleaner.running = TRUE;
+   return STATUS_OK;
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_stop_cleaner --
+ *
+ *      Stops the background cleaner thread and waits for its writes to
+ *      complete. The foreground resumes cleaning ahead of the hand.
+ *----------------------------------------------------------------------
+ */
+void
+clockcache_stop_cleaner(clockcache *cc)
+{
+   platform_assert(cc->cleaner.running);
+
+   cc->cleaner.stop = TRUE;
+   platform_status rc = platform_thread_join(cc->cleaner.thread);
+   platform_assert_status_ok(rc);
+   cc->cleaner.running = FALSE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * online resize functions
+ *
+ *----------------------------------------------------------------------
+ */
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_retire_batch --
+ *
+ *      Makes a pass over a batch beyond the active region: issues writeback
+ *      for its dirty pages, evicts its clean ones and marks its free entries
+ *      retired, so that they are no longer handed out.
+ *
+ *      Returns TRUE once every entry of the batch is retired. The memory of
+ *      the batch is released when its last entries are retired.
+ *----------------------------------------------------------------------
+ */
+static bool32
+clockcache_retire_batch(clockcache *cc, uint64 batch)
+{
+   uint32 start_entry_no = batch * CC_ENTRIES_PER_BATCH;
+   uint32 end_entry_no   = start_entry_no + CC_ENTRIES_PER_BATCH;
+   uint32 num_retired    = 0;
+   bool32 newly_retired  = FALSE;
+
+   clockcache_batch_start_writeback(cc, batch, TRUE);
+
+   for (uint32 entry_no = start_entry_no; entry_no < end_entry_no; entry_no++) {
+      clockcache_entry *entry = &cc->entry[entry_no];
+      if (entry->status != CC_RETIRED_STATUS) {
+         clockcache_try_evict(cc, entry_no);
+         if (entry->status == CC_FREE_STATUS
+             && __sync_bool_compare_and_swap(
+                &entry->status, CC_FREE_STATUS, CC_RETIRED_STATUS))
+         {
+            newly_retired = TRUE;
+         }
+      }
+      if (entry->status == CC_RETIRED_STATUS) {
+         num_retired++;
+      }
+   }
+
+   if (num_retired != CC_ENTRIES_PER_BATCH) {
+      return FALSE;
+   }
+
+   if (newly_retired) {
+      // best effort, e.g. this fails for huge pages
+      uint64 batch_size =
+         clockcache_multiply_by_page_size(cc, CC_ENTRIES_PER_BATCH);
+      platform_buffer_discard(&cc->bh, batch * batch_size, batch_size);
+      clockcache_log(0, 0, "retired batch: %lu\n", batch);
+   }
+   return TRUE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_retire_thread --
+ *
+ *      Background thread started by clockcache_resize when the cache
+ *      shrinks. Retires the batches beyond the active region, retrying until
+ *      all the pages in them have been unpinned, unlocked and written back.
+ *----------------------------------------------------------------------
+ */
+static void
+clockcache_retire_thread(void *arg)
+{
+   clockcache *cc          = (clockcache *)arg;
+   uint64      start_batch = cc->active_batches;
+   bool32      done        = FALSE;
+
+   while (!done && !cc->resize.stop) {
+      done = TRUE;
+      for (uint64 batch = start_batch;
+           batch < cc->cfg->batch_capacity && !cc->resize.stop;
+           batch++)
+      {
+         if (!clockcache_retire_batch(cc, batch)) {
+            done = FALSE;
+         }
+      }
+      clockcache_wait(cc);
+      if (!done) {
+         platform_sleep_ns(CC_RESIZE_RETRY_NS);
+      }
+   }
+
+   while (clockcache_writeback_pending(cc)) {
+      clockcache_wait(cc);
+   }
+}
+
+/*
+ * Stops the retire thread, leaving any batches not yet retired as they are.
+ * Called with the resize lock held, or from clockcache_deinit().
+ */
+static void
+clockcache_stop_retiring(clockcache *cc)
+{
+   debug_assert(cc->resize.running);
+
+   cc->resize.stop = TRUE;
+   platform_status rc = platform_thread_join(cc->resize.thread);
+   platform_assert_status_ok(rc);
+   cc->resize.running = FALSE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_resize --
+ *
+ *      Changes the capacity of the cache to capacity bytes, which must be a
+ *      multiple of the batch size (CC_ENTRIES_PER_BATCH pages), no larger
+ *      than cfg->max_capacity and at least CC_MIN_ACTIVE_BATCHES batches.
+ *
+ *      Growing hands the retired entries of the new batches back to the
+ *      clock. Shrinking takes effect for allocation immediately, while the
+ *      pages cached in the retiring batches are written back and evicted by a
+ *      background thread created in ts; until then they are still found by
+ *      lookups.
+ *----------------------------------------------------------------------
+ */
+platform_status
+clockcache_resize(clockcache *cc, uint64 capacity, task_system *ts)
+{
+   uint64 batch_size =
+      clockcache_multiply_by_page_size(cc, CC_ENTRIES_PER_BATCH);
+   uint64 new_batches = capacity / batch_size;
+
+   if (capacity % batch_size != 0 || capacity > cc->cfg->max_capacity
+       || new_batches < MIN(CC_MIN_ACTIVE_BATCHES, cc->cfg->batch_capacity))
+   {
+      platform_error_log("Invalid cache size %lu: must be a multiple of %lu"
+                         " between %lu and %lu\n",
+                         capacity,
+                         batch_size,
+                         CC_MIN_ACTIVE_BATCHES * batch_size,
+                         cc->cfg->max_capacity);
+      return STATUS_BAD_PARAM;
+   }
+
+   platform_mutex_lock(&cc->resize.lock);
+   if (cc->resize.running) {
+      clockcache_stop_retiring(cc);
+   }
+
+   uint64 old_batches = cc->active_batches;
+   if (new_batches > old_batches) {
+      uint32 start_entry_no = old_batches * CC_ENTRIES_PER_BATCH;
+      uint32 end_entry_no   = new_batches * CC_ENTRIES_PER_BATCH;
+      for (uint32 entry_no = start_entry_no; entry_no < end_entry_no;
+           entry_no++)
+      {
+         if (cc->entry[entry_no].status == CC_RETIRED_STATUS) {
+            cc->entry[entry_no].status = CC_FREE_STATUS;
+         }
+      }
+   }
+   cc->active_batches = new_batches;
+   clockcache_log(0,
+                  0,
+                  "resize: %lu -> %lu batches\n",
+                  old_batches,
+                  new_batches);
+
+   // start retiring whatever is left beyond the active region
+   bool32 need_retire = FALSE;
+   for (uint32 entry_no = new_batches * CC_ENTRIES_PER_BATCH;
+        entry_no < cc->cfg->page_capacity && !need_retire;
+        entry_no++)
+   {
+      need_retire = cc->entry[entry_no].status != CC_RETIRED_STATUS;
+   }
+
+   platform_status rc = STATUS_OK;
+   if (need_retire) {
+      cc->resize.stop = FALSE;
+
+      rc = task_thread_create("clockcache-resize",
+                              clockcache_retire_thread,
+                              cc,
+                              0,
+                              ts,
+                              cc->heap_id,
+                              &cc->resize.thread);
+      cc->resize.running = SUCCESS(rc);
+   }
+
+   platform_mutex_unlock(&cc->resize.lock);
+   return rc;
+}
+
+/*
+ * Current capacity of the cache in bytes, see clockcache_resize().
+ */
+uint64
+clockcache_capacity(clockcache *cc)
+{
+   return clockcache_multiply_by_page_size(
+      cc, cc->active_batches * CC_ENTRIES_PER_BATCH);
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_grow_lookup --
+ *
+ *      Sets up the lookup for a disk grown to disk_capacity bytes. Must be
+ *      called before any page beyond the old disk size is accessed, see
+ *      rc_allocator_grow().
+ *----------------------------------------------------------------------
+ */
+void
+clockcache_grow_lookup(clockcache *cc, uint64 disk_capacity)
+{
+   uint64 lookup_pages = clockcache_divide_by_page_size(cc, disk_capacity);
+   platform_assert(lookup_pages
+                   <= allocator_get_config(cc->al)->max_page_capacity);
+   for (uint64 i = cc->lookup_pages; i < lookup_pages; i++) {
+      cc->lookup[i] = CC_UNMAPPED_ENTRY;
+   }
+   cc->lookup_pages = MAX(cc->lookup_pages, lookup_pages);
+}
+
 /*
  *----------------------------------------------------------------------
  * clockcache_get_free_page --
@@ -1616,7 +2181,10 @@ clockcache_get_free_page(clockcache *cc,
    timestamp         wait_start;
 
    debug_assert((tid < MAX_THREADS), "Invalid tid=%lu\n", tid);
-   if (cc->per_thread[tid].free_hand == CC_UNMAPPED_ENTRY) {
+   // the hand may have been left in a batch retired by clockcache_resize()
+   if (cc->per_thread[tid].free_hand == CC_UNMAPPED_ENTRY
+       || cc->per_thread[tid].free_hand >= cc->active_batches)
+   {
       clockcache_move_hand(cc, FALSE);
    }
 
@@ -1736,7 +2304,7 @@ clockcache_evict_all(clockcache *cc, bool32 ignore_pinned_pages)
          clockcache_page_to_entry_number(cc, &cc->entry->page);
       // Every page should either be evicted or pinned.
       debug_assert(
-         cc->entry[i].status == CC_FREE_STATUS
+         clockcache_test_flag(cc, i, CC_FREE)
          || (ignore_pinned_pages && clockcache_get_pin(cc, entry_no)));
    }
 
@@ -1763,10 +2331,14 @@ clockcache_config_init(clockcache_config *cache_cfg,
    cache_cfg->super.ops     = &clockcache_config_ops;
    cache_cfg->io_cfg        = io_cfg;
    cache_cfg->capacity      = capacity;
+   cache_cfg->max_capacity  = capacity;
    cache_cfg->log_page_size = 63 - __builtin_clzll(io_cfg->page_size);
    cache_cfg->page_capacity = capacity / io_cfg->page_size;
    cache_cfg->use_stats     = use_stats;
 
+   cache_cfg->cleaner_dirty_watermark   = CC_CLEANER_DEFAULT_WATERMARK;
+   cache_cfg->cleaner_max_pages_per_sec = 0;
+
    rc = snprintf(cache_cfg->logfile, MAX_STRING_LENGTH, "%s", cache_logfile);
    platform_assert(rc < MAX_STRING_LENGTH);
 }
@@ -1789,8 +2361,13 @@ clockcache_init(clockcache        *cc,   // OUT
    cc->cfg       = cfg;
    cc->super.ops = &clockcache_ops;
 
-   uint64 allocator_page_capacity =
-      clockcache_divide_by_page_size(cc, allocator_get_capacity(al));
+   // entries are set up for the max capacity, see clockcache_resize()
+   cc->cfg->max_capacity  = MAX(cc->cfg->max_capacity, cc->cfg->capacity);
+   cc->cfg->page_capacity =
+      clockcache_divide_by_page_size(cc, cc->cfg->max_capacity);
+
+   uint64 allocator_max_page_capacity =
+      allocator_get_config(al)->max_page_capacity;
    uint64 debug_capacity =
       clockcache_multiply_by_page_size(cc, cc->cfg->page_capacity);
    cc->cfg->batch_capacity = cc->cfg->page_capacity / CC_ENTRIES_PER_BATCH;
@@ -1800,10 +2377,17 @@ clockcache_init(clockcache        *cc,   // OUT
       clockcache_divide_by_page_size(cc, clockcache_extent_size(cc));
 
    platform_assert(cc->cfg->page_capacity % PLATFORM_CACHELINE_SIZE == 0);
-   platform_assert(cc->cfg->capacity == debug_capacity);
+   platform_assert(cc->cfg->max_capacity == debug_capacity);
    platform_assert(cc->cfg->page_capacity % CC_ENTRIES_PER_BATCH == 0);
+   platform_assert(cc->cfg->capacity
+                   % clockcache_multiply_by_page_size(cc, CC_ENTRIES_PER_BATCH)
+                   == 0);
 
    cc->cleaner_gap = CC_CLEANER_GAP;
+   cc->active_batches =
+      cc->cfg->capacity
+      / clockcache_multiply_by_page_size(cc, CC_ENTRIES_PER_BATCH);
+   platform_assert(cc->active_batches != 0);
 
 #if defined(CC_LOG) || defined(ADDR_TRACING)
    cc->logfile = platform_open_log_file(cfg->logfile, "w");
@@ -1817,15 +2401,23 @@ clockcache_init(clockcache        *cc,   // OUT
    cc->io      = io;
    cc->heap_id = hid;
 
-   /* lookup maps addrs to entries, entry contains the entries themselves */
-   cc->lookup =
-      TYPED_ARRAY_MALLOC(cc->heap_id, cc->lookup, allocator_page_capacity);
-   if (!cc->lookup) {
-      goto alloc_error;
+   platform_status rc = platform_mutex_init(&cc->resize.lock, mid, hid);
+   if (!SUCCESS(rc)) {
+      return rc;
    }
-   for (i = 0; i < allocator_page_capacity; i++) {
-      cc->lookup[i] = CC_UNMAPPED_ENTRY;
+
+   /*
+    * lookup maps addrs to entries, entry contains the entries themselves.
+    * The lookup is reserved for the max disk size, but only set up (and
+    * so backed by memory) for the current one, see clockcache_grow_lookup().
+    */
+   rc = platform_buffer_init(&cc->lookup_bh,
+                             allocator_max_page_capacity * sizeof(uint32));
+   if (!SUCCESS(rc)) {
+      goto alloc_error;
    }
+   cc->lookup = platform_buffer_getaddr(&cc->lookup_bh);
+   clockcache_grow_lookup(cc, allocator_get_capacity(al));
 
    cc->entry =
       TYPED_ARRAY_ZALLOC(cc->heap_id, cc->entry, cc->cfg->page_capacity);
@@ -1833,25 +2425,26 @@ clockcache_init(clockcache        *cc,   // OUT
       goto alloc_error;
    }
 
-   platform_status rc = STATUS_NO_MEMORY;
-
    /* data must be aligned because of O_DIRECT */
-   rc = platform_buffer_init(&cc->bh, cc->cfg->capacity);
+   rc = platform_buffer_init(&cc->bh, cc->cfg->max_capacity);
    if (!SUCCESS(rc)) {
       goto alloc_error;
    }
    cc->data = platform_buffer_getaddr(&cc->bh);
 
-   /* Set up the entries */
+   /* Set up the entries, beyond the initial capacity they start retired */
    for (i = 0; i < cc->cfg->page_capacity; i++) {
       cc->entry[i].page.data =
          cc->data + clockcache_multiply_by_page_size(cc, i);
       cc->entry[i].page.disk_addr = CC_UNMAPPED_ADDR;
-      cc->entry[i].status         = CC_FREE_STATUS;
+      cc->entry[i].status =
+         i < cc->active_batches * CC_ENTRIES_PER_BATCH ? CC_FREE_STATUS
+                                                       : CC_RETIRED_STATUS;
    }
 
    /* Entry per-thread ref counts */
-   size_t refcount_size = cc->cfg->page_capacity * CC_RC_WIDTH * sizeof(uint8);
+   size_t refcount_size =
+      cc->cfg->page_capacity * CC_RC_WIDTH * sizeof(*cc->refcount);
 
    rc = platform_buffer_init(&cc->rc_bh, refcount_size);
    if (!SUCCESS(rc)) {
@@ -1899,6 +2492,14 @@ clockcache_deinit(clockcache *cc) // IN/OUT
 {
    platform_assert(cc != NULL);
 
+   if (cc->cleaner.running) {
+      clockcache_stop_cleaner(cc);
+   }
+   if (cc->resize.running) {
+      clockcache_stop_retiring(cc);
+   }
+   platform_mutex_destroy(&cc->resize.lock);
+
    if (cc->logfile) {
       clockcache_log(0, 0, "deinit %s\n", "");
 #if defined(CC_LOG) || defined(ADDR_TRACING)
@@ -1907,7 +2508,8 @@ clockcache_deinit(clockcache *cc) // IN/OUT
    }
 
    if (cc->lookup) {
-      platform_free(cc->heap_id, cc->lookup);
+      platform_buffer_deinit(&cc->lookup_bh);
+      cc->lookup = NULL;
    }
    if (cc->entry) {
       platform_free(cc->heap_id, cc->entry);
@@ -1956,7 +2558,15 @@ clockcache_alloc(clockcache *cc, uint64 addr, page_type type)
    entry->page.disk_addr      = addr;
    entry->type                = type;
    uint64 lookup_no = clockcache_divide_by_page_size(cc, entry->page.disk_addr);
-   cc->lookup[lookup_no] = entry_no;
+   /*
+    * A speculative prefetch (e.g. cache warm-up) may have loaded a stale
+    * copy of this page from a since-freed extent. Discard it before mapping.
+    */
+   while (!__sync_bool_compare_and_swap(
+      &cc->lookup[lookup_no], CC_UNMAPPED_ENTRY, entry_no))
+   {
+      clockcache_try_page_discard(cc, addr);
+   }
 
    clockcache_log(entry->page.disk_addr,
                   entry_no,
@@ -2045,6 +2655,7 @@ clockcache_try_page_discard(clockcache *cc, uint64 addr)
       entry->page.disk_addr = CC_UNMAPPED_ADDR;
 
       /* 6. set status to CC_FREE_STATUS (clears claim and write lock) */
+      clockcache_bump_version(cc, entry_number);
       entry->status = CC_FREE_STATUS;
 
       /* 7. reset pincount */
@@ -2283,6 +2894,249 @@ clockcache_get(clockcache *cc, uint64 addr, bool32 blocking, page_type type)
    }
 }
 
+/*
+ *----------------------------------------------------------------------
+ * clockcache_get_optimistic --
+ *
+ *      Returns a pointer to the page_handle for the page with address addr
+ *      without taking a read lock, or NULL if the page is not cached and
+ *      stable. The read is validated against the returned version by
+ *      clockcache_validate_optimistic, seqlock style: the version is bumped
+ *      whenever a write lock is released and whenever the entry is freed.
+ *
+ *      The reader writes no shared cacheline, except to set the access bit
+ *      of a page that does not have it yet.
+ *----------------------------------------------------------------------
+ */
+page_handle *
+clockcache_get_optimistic(clockcache *cc,
+                          uint64      addr,
+                          page_type   type,
+                          uint64     *version)
+{
+   uint32 entry_number = clockcache_lookup(cc, addr);
+   if (entry_number == CC_UNMAPPED_ENTRY) {
+      return NULL;
+   }
+
+   clockcache_entry *entry = clockcache_get_entry(cc, entry_number);
+
+   *version      = __atomic_load_n(&entry->version, __ATOMIC_ACQUIRE);
+   uint32 status = __atomic_load_n(&entry->status, __ATOMIC_ACQUIRE);
+   if ((status & CC_UNSTABLE_FLAGS) != 0 || entry->page.disk_addr != addr) {
+      return NULL;
+   }
+
+   // test and test and set to reduce contention
+   if (!(status & CC_ACCESSED)) {
+      clockcache_set_flag(cc, entry_number, CC_ACCESSED);
+   }
+   if (cc->cfg->use_stats) {
+      cc->stats[platform_get_tid()].cache_hits[type]++;
+   }
+   return &entry->page;
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_validate_optimistic --
+ *
+ *      Returns TRUE if no write lock has been taken on the page and it has
+ *      not been evicted since clockcache_get_optimistic returned version, so
+ *      that the reads of the page in between saw consistent contents.
+ *----------------------------------------------------------------------
+ */
+bool32
+clockcache_validate_optimistic(clockcache  *cc,
+                               page_handle *page,
+                               uint64       version)
+{
+   clockcache_entry *entry = clockcache_page_to_entry(cc, page);
+
+   // order the reads of the page before the checks
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   uint32 status = __atomic_load_n(&entry->status, __ATOMIC_ACQUIRE);
+   return (status & CC_UNSTABLE_FLAGS) == 0
+          && __atomic_load_n(&entry->version, __ATOMIC_RELAXED) == version;
+}
+
+/*
+ * Issuer data stored in the metadata of a clockcache_get_many read.
+ */
+typedef struct clockcache_get_many_md {
+   clockcache      *cc;
+   volatile uint64 *pages_outstanding;
+} clockcache_get_many_md;
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_get_many_callback --
+ *
+ *      Called when a vectored read issued by clockcache_get_many completes.
+ *      Clears the loading flags and accounts for the pages read.
+ *----------------------------------------------------------------------
+ */
+static void
+clockcache_get_many_callback(void           *metadata,
+                             struct iovec   *iovec,
+                             uint64          count,
+                             platform_status status)
+{
+   clockcache_get_many_md *md   = metadata;
+   clockcache             *cc   = md->cc;
+   page_type               type = PAGE_TYPE_INVALID;
+
+   platform_assert_status_ok(status);
+   platform_assert(count > 0);
+   platform_assert(count <= cc->cfg->pages_per_extent);
+
+   for (uint64 page_off = 0; page_off < count; page_off++) {
+      uint32 entry_no =
+         clockcache_data_to_entry_number(cc, (char *)iovec[page_off].iov_base);
+      clockcache_entry *entry = &cc->entry[entry_no];
+      type                    = entry->type;
+      debug_only uint32 was_loading =
+         clockcache_clear_flag(cc, entry_no, CC_LOADING);
+      debug_assert(was_loading);
+      clockcache_log(entry->page.disk_addr,
+                     entry_no,
+                     "get_many (load): entry %u addr %lu\n",
+                     entry_no,
+                     entry->page.disk_addr);
+   }
+
+   if (cc->cfg->use_stats) {
+      threadid tid = platform_get_tid();
+      cc->stats[tid].page_reads[type] += count;
+   }
+
+   __sync_fetch_and_sub(md->pages_outstanding, count);
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_get_many_issue --
+ *
+ *      Issues the vectored read for a run of pages_in_req consecutive pages
+ *      starting at addr, built up by clockcache_get_many.
+ *----------------------------------------------------------------------
+ */
+static void
+clockcache_get_many_issue(clockcache   *cc,
+                          io_async_req *req,
+                          uint64        pages_in_req,
+                          uint64        addr)
+{
+   clockcache_get_many_md *md = io_get_metadata(cc->io, req);
+
+   req->bytes = clockcache_multiply_by_page_size(cc, pages_in_req);
+   __sync_fetch_and_add(md->pages_outstanding, pages_in_req);
+   platform_status rc = io_read_async(
+      cc->io, req, clockcache_get_many_callback, pages_in_req, addr);
+   platform_assert_status_ok(rc);
+}
+
+/*
+ *----------------------------------------------------------------------
+ * clockcache_get_many --
+ *
+ *      Batched, blocking version of clockcache_get(). Returns with a read
+ *      lock held on each of the pages.
+ *
+ *      Pages which are not in the cache are reserved (as in
+ *      clockcache_get_internal) and runs of consecutive addresses within an
+ *      extent are loaded with a single vectored read. All the reads are
+ *      issued before waiting for any of them.
+ *
+ *      Pages which are cached, or which another thread is loading, go
+ *      through clockcache_get(). Any pending read is issued first, as the
+ *      page may be one we are loading ourselves.
+ *----------------------------------------------------------------------
+ */
+void
+clockcache_get_many(clockcache   *cc,
+                    const uint64 *addrs,
+                    uint64        num_pages,
+                    page_type     type,
+                    page_handle **pages)
+{
+   const threadid    tid               = platform_get_tid();
+   allocator_config *allocator_cfg     = allocator_get_config(cc->al);
+   volatile uint64   pages_outstanding = 0;
+   io_async_req     *req               = NULL;
+   struct iovec     *iovec             = NULL;
+   uint64            pages_in_req      = 0;
+   uint64            req_start_addr    = CC_UNMAPPED_ADDR;
+
+   debug_assert(cc->per_thread[tid].enable_sync_get
+                || type == PAGE_TYPE_MEMTABLE);
+
+   for (uint64 i = 0; i < num_pages; i++) {
+      uint64 addr = addrs[i];
+      debug_assert(addr % clockcache_page_size(cc) == 0);
+
+      // only the next page of the same extent extends the pending read
+      uint64 req_end_addr =
+         req_start_addr + clockcache_multiply_by_page_size(cc, pages_in_req);
+      if (pages_in_req != 0
+          && (addr != req_end_addr
+              || !allocator_config_pages_share_extent(
+                 allocator_cfg, req_start_addr, addr)))
+      {
+         clockcache_get_many_issue(cc, req, pages_in_req, req_start_addr);
+         pages_in_req = 0;
+      }
+
+      if (clockcache_lookup(cc, addr) == CC_UNMAPPED_ENTRY) {
+         uint32 entry_no = clockcache_get_free_page(cc,
+                                                    CC_READ_LOADING_STATUS,
+                                                    TRUE,  // refcount
+                                                    TRUE); // blocking
+         clockcache_entry *entry = clockcache_get_entry(cc, entry_no);
+         entry->page.disk_addr   = addr;
+         entry->type             = type;
+
+         uint64 lookup_no = clockcache_divide_by_page_size(cc, addr);
+         if (__sync_bool_compare_and_swap(
+                &cc->lookup[lookup_no], CC_UNMAPPED_ENTRY, entry_no))
+         {
+            if (pages_in_req == 0) {
+               req                        = io_get_async_req(cc->io, TRUE);
+               clockcache_get_many_md *md = io_get_metadata(cc->io, req);
+               md->cc                     = cc;
+               md->pages_outstanding      = &pages_outstanding;
+               iovec                      = io_get_iovec(cc->io, req);
+               req_start_addr             = addr;
+            }
+            iovec[pages_in_req++].iov_base = entry->page.data;
+            if (cc->cfg->use_stats) {
+               cc->stats[tid].cache_misses[type]++;
+            }
+            pages[i] = &entry->page;
+            continue;
+         }
+
+         // someone else is loading this page, release the free entry
+         entry->page.disk_addr = CC_UNMAPPED_ADDR;
+         clockcache_dec_ref(cc, entry_no, tid);
+         entry->status = CC_FREE_STATUS;
+      }
+
+      if (pages_in_req != 0) {
+         clockcache_get_many_issue(cc, req, pages_in_req, req_start_addr);
+         pages_in_req = 0;
+      }
+      pages[i] = clockcache_get(cc, addr, TRUE, type);
+   }
+
+   if (pages_in_req != 0) {
+      clockcache_get_many_issue(cc, req, pages_in_req, req_start_addr);
+   }
+   while (pages_outstanding != 0) {
+      clockcache_wait(cc);
+   }
+}
+
 /*
  *----------------------------------------------------------------------
  * clockcache_read_async_callback --
@@ -2613,6 +3467,7 @@ clockcache_unlock(clockcache *cc, page_handle *page)
                   "unlock: entry %u addr %lu\n",
                   entry_number,
                   page->disk_addr);
+   clockcache_bump_version(cc, entry_number);
    debug_only uint32 was_writing =
       clockcache_clear_flag(cc, entry_number, CC_WRITELOCKED);
    debug_assert(was_writing);
@@ -2831,6 +3686,14 @@ clockcache_extent_sync(clockcache *cc, uint64 addr, uint64 *pages_outstanding)
    }
 }
 
+/*
+ * Issuer data stored in the metadata of a prefetch IO request.
+ */
+typedef struct clockcache_prefetch_md {
+   clockcache *cc;
+   threadid    tid; // issuing thread, whose prefetches_pending to decrement
+} clockcache_prefetch_md;
+
 /*
  *----------------------------------------------------------------------
  * clockcache_prefetch_callback --
@@ -2850,9 +3713,10 @@ clockcache_prefetch_callback(void           *metadata,
                              uint64          count,
                              platform_status status)
 {
-   clockcache       *cc        = *(clockcache **)metadata;
-   page_type         type      = PAGE_TYPE_INVALID;
-   debug_only uint64 last_addr = CC_UNMAPPED_ADDR;
+   clockcache_prefetch_md *md        = metadata;
+   clockcache             *cc        = md->cc;
+   page_type               type      = PAGE_TYPE_INVALID;
+   debug_only uint64       last_addr = CC_UNMAPPED_ADDR;
 
    platform_assert_status_ok(status);
    platform_assert(count > 0);
@@ -2885,6 +3749,8 @@ clockcache_prefetch_callback(void           *metadata,
       cc->stats[tid].page_reads[type] += count;
       cc->stats[tid].prefetches_issued[type]++;
    }
+
+   __sync_fetch_and_sub(&cc->per_thread[md->tid].prefetches_pending, 1);
 }
 
 /*
@@ -2925,6 +3791,8 @@ clockcache_prefetch(clockcache *cc, uint64 base_addr, page_type type)
             // in cache, issue IO req if started
             if (pages_in_req != 0) {
                req->bytes = clockcache_multiply_by_page_size(cc, pages_in_req);
+               __sync_fetch_and_add(&cc->per_thread[tid].prefetches_pending,
+                                    1);
                platform_status rc = io_read_async(cc->io,
                                                   req,
                                                   clockcache_prefetch_callback,
@@ -2955,11 +3823,12 @@ clockcache_prefetch(clockcache *cc, uint64 base_addr, page_type type)
                if (pages_in_req == 0) {
                   debug_assert(req_start_addr == CC_UNMAPPED_ADDR);
                   // start a new IO req
-                  req                          = io_get_async_req(cc->io, TRUE);
-                  void *req_metadata           = io_get_metadata(cc->io, req);
-                  *(clockcache **)req_metadata = cc;
-                  iovec                        = io_get_iovec(cc->io, req);
-                  req_start_addr               = addr;
+                  req                        = io_get_async_req(cc->io, TRUE);
+                  clockcache_prefetch_md *md = io_get_metadata(cc->io, req);
+                  md->cc                     = cc;
+                  md->tid                    = tid;
+                  iovec                      = io_get_iovec(cc->io, req);
+                  req_start_addr             = addr;
                }
                iovec[pages_in_req++].iov_base = entry->page.data;
                clockcache_log(addr,
@@ -2985,6 +3854,7 @@ clockcache_prefetch(clockcache *cc, uint64 base_addr, page_type type)
    // issue IO req if started
    if (pages_in_req != 0) {
       req->bytes         = clockcache_multiply_by_page_size(cc, pages_in_req);
+      __sync_fetch_and_add(&cc->per_thread[tid].prefetches_pending, 1);
       platform_status rc = io_read_async(cc->io,
                                          req,
                                          clockcache_prefetch_callback,
@@ -2996,6 +3866,109 @@ clockcache_prefetch(clockcache *cc, uint64 base_addr, page_type type)
    }
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * clockcache_prefetch_wait --
+ *
+ *      Waits for all prefetches issued by the calling thread to complete.
+ *      IO completions are reaped per thread, so a thread which prefetches
+ *      pages it does not itself go on to get must call this before idling,
+ *      or other threads waiting on those pages will spin.
+ *-----------------------------------------------------------------------------
+ */
+void
+clockcache_prefetch_wait(clockcache *cc)
+{
+   threadid tid = platform_get_tid();
+   while (cc->per_thread[tid].prefetches_pending != 0) {
+      clockcache_wait(cc);
+   }
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ * clockcache_hot_extents --
+ *
+ *      Returns the extents with resident pages, ranked by the passes in
+ *      clockcache_hot_extent_passes. Each extent is reported once, by the
+ *      first pass which finds one of its pages.
+ *
+ *      The scan takes no locks, so the result is only a hint.
+ *-----------------------------------------------------------------------------
+ */
+static const struct {
+   page_type type;
+   bool32    accessed_only;
+} clockcache_hot_extent_passes[] = {
+   {PAGE_TYPE_TRUNK, FALSE},
+   {PAGE_TYPE_FILTER, TRUE},
+   {PAGE_TYPE_BRANCH, TRUE},
+   {PAGE_TYPE_FILTER, FALSE},
+   {PAGE_TYPE_BRANCH, FALSE},
+};
+
+platform_status
+clockcache_hot_extents(clockcache         *cc,
+                       platform_heap_id    hid,
+                       cache_extent_hint **hints,
+                       uint64             *num_hints)
+{
+   uint64 extent_size  = clockcache_extent_size(cc);
+   uint64 num_extents  = allocator_get_capacity(cc->al) / extent_size;
+   uint64 bitmap_words = (num_extents + 63) / 64;
+   uint64 max_hints    = cc->cfg->page_capacity / cc->cfg->pages_per_extent;
+   uint64 count        = 0;
+
+   uint64            *seen = TYPED_ARRAY_ZALLOC(hid, seen, bitmap_words);
+   cache_extent_hint *h    = TYPED_ARRAY_MALLOC(hid, h, max_hints);
+   if (seen == NULL || h == NULL) {
+      if (seen != NULL) {
+         platform_free(hid, seen);
+      }
+      if (h != NULL) {
+         platform_free(hid, h);
+      }
+      return STATUS_NO_MEMORY;
+   }
+
+   for (uint64 pass = 0; pass < ARRAY_SIZE(clockcache_hot_extent_passes);
+        pass++)
+   {
+      page_type type = clockcache_hot_extent_passes[pass].type;
+      bool32    accessed_only =
+         clockcache_hot_extent_passes[pass].accessed_only;
+      for (uint32 entry_no = 0;
+           entry_no < cc->cfg->page_capacity && count < max_hints;
+           entry_no++)
+      {
+         clockcache_entry *entry = clockcache_get_entry(cc, entry_no);
+         uint64            addr  = entry->page.disk_addr;
+         if (entry->type != type || addr == CC_UNMAPPED_ADDR
+             || clockcache_test_flag(cc, entry_no, CC_FREE)
+             || (accessed_only
+                 && !clockcache_test_flag(cc, entry_no, CC_ACCESSED)))
+         {
+            continue;
+         }
+         uint64 extent_no = addr / extent_size;
+         if (extent_no >= num_extents
+             || (seen[extent_no / 64] & (1ULL << (extent_no % 64))))
+         {
+            continue;
+         }
+         seen[extent_no / 64] |= 1ULL << (extent_no % 64);
+         h[count].addr = extent_no * extent_size;
+         h[count].type = type;
+         count++;
+      }
+   }
+
+   platform_free(hid, seen);
+   *hints     = h;
+   *num_hints = count;
+   return STATUS_OK;
+}
+
 /*
  *----------------------------------------------------------------------
  * clockcache_print --
@@ -3180,6 +4153,9 @@ clockcache_print_stats(platform_log_handle *log_handle, clockcache *cc)
    platform_log(log_handle, "-----------------------------------------------------------------------------------------------\n");
    platform_log(log_handle, "avg write pgs: "FRACTION_FMT(9,2)"\n",
                 FRACTION_ARGS(avg_write_pages));
+   platform_log(log_handle, "cleaner pages written: %lu (%lu batches)\n",
+                cc->cleaner.pages_written,
+                cc->cleaner.batches_cleaned);
    // clang-format on
 
    allocator_print_stats(cc->al);
@@ -3198,6 +4174,8 @@ clockcache_reset_stats(clockcache *cc)
       memset(stats->cache_miss_time_ns, 0, sizeof(stats->cache_miss_time_ns));
       memset(stats->page_writes, 0, sizeof(stats->page_writes));
    }
+   cc->cleaner.pages_written   = 0;
+   cc->cleaner.batches_cleaned = 0;
 }
 
 /*
@@ -12,6 +12,7 @@
 #include "allocator.h"
 #include "cache.h"
 #include "io.h"
+#include "task.h"
 
 //#define ADDR_TRACING
 #define TRACE_ADDR  (UINT64_MAX - 1)
@@ -28,10 +29,15 @@
 typedef struct clockcache_config {
    cache_config super;
    io_config   *io_cfg;
-   uint64       capacity;
+   uint64       capacity;     // initial capacity
+   uint64       max_capacity; // see clockcache_resize()
    bool32       use_stats;
    char         logfile[MAX_STRING_LENGTH];
 
+   // background cleaner, see clockcache_start_cleaner()
+   uint64 cleaner_dirty_watermark;   // dirty pages ahead of the hand
+   uint64 cleaner_max_pages_per_sec; // 0 => unlimited
+
    // computed
    uint64 log_page_size;
    uint64 extent_mask;
@@ -71,6 +77,7 @@ struct clockcache_entry {
    page_handle           page;
    volatile entry_status status;
    page_type             type;
+   volatile uint32       version; // bumped whenever the contents may change
 #ifdef RECORD_ACQUISITION_STACKS
    int            next_history_record;
    history_record history[NUM_HISTORY_RECORDS];
@@ -90,6 +97,7 @@ struct clockcache_entry {
  *         --status: flags, e.g. free, write locked, flushing, etc.
  *         --page: disk address and pointer to the page data
  *         --type: used for stats
+ *         --version: validates optimistic reads, which take no read lock
  *
  *      Each page has a distributed ref count, accessed by
  *      clockcache_[get,inc,dec]_ref(cc, entry_number, tid) and stored in
@@ -106,6 +114,17 @@ struct clockcache_entry {
  *      cc->cleaner_gap batches ahead of the current evictor head, so that
  *      cleaned pages have time to flush before eviction. Both cleaning and
  *      eviction use cc->batch_busy to avoid conflicts and contention.
+ *
+ *      Optionally, a background cleaner thread (clockcache_start_cleaner)
+ *      takes over cleaning from the foreground: it writes back dirty batches
+ *      in the cleaner_gap window ahead of cc->evict_hand, so that threads
+ *      looking for free pages rarely have to issue or wait for writes.
+ *
+ *      Memory for cfg->max_capacity is reserved up front, but only the first
+ *      cc->active_batches batches are handed out by the clock. The cache is
+ *      resized online by moving this boundary (clockcache_resize); entries
+ *      beyond it are evicted in the background and marked retired, and
+ *      their memory is released.
  *----------------------------------------------------------------------
  */
 struct clockcache {
@@ -115,6 +134,8 @@ struct clockcache {
    io_handle         *io;
 
    uint32              *lookup;
+   buffer_handle        lookup_bh;
+   uint64               lookup_pages; // # of lookup entries set up
    clockcache_entry    *entry;
    buffer_handle        bh;   // actual memory for pages
    char                *data; // convenience pointer for bh
@@ -122,19 +143,38 @@ struct clockcache {
    platform_heap_id     heap_id;
 
    // Distributed locks (the write bit is in the status uint32 of the entry)
-   buffer_handle   rc_bh;
-   volatile uint8 *refcount;
-   volatile uint8 *pincount;
+   buffer_handle    rc_bh;
+   volatile uint16 *refcount; // shared by MAX_THREADS / CC_RC_WIDTH threads
+   volatile uint8  *pincount;
 
    // Clock hands and related metadata
    volatile uint32  evict_hand;
    volatile uint32  free_hand;
    volatile bool32 *batch_busy;
    uint64           cleaner_gap;
+   volatile uint64  active_batches;
+
+   // Background cleaner
+   struct {
+      volatile bool32 stop;
+      volatile bool32 running;
+      platform_thread thread;
+      uint64          pages_written;
+      uint64          batches_cleaned;
+   } cleaner;
+
+   // Online resize
+   struct {
+      platform_mutex  lock;
+      volatile bool32 stop;
+      bool32          running;
+      platform_thread thread;
+   } resize;
 
    volatile struct {
       volatile uint32 free_hand;
       bool32          enable_sync_get;
+      volatile uint64 prefetches_pending; // see clockcache_prefetch_wait()
    } PLATFORM_CACHELINE_ALIGNED per_thread[MAX_THREADS];
 
    // Stats
@@ -166,3 +206,18 @@ clockcache_init(clockcache        *cc,   // OUT
 
 void
 clockcache_deinit(clockcache *cc); // IN
+
+platform_status
+clockcache_start_cleaner(clockcache *cc, task_system *ts);
+
+void
+clockcache_stop_cleaner(clockcache *cc);
+
+platform_status
+clockcache_resize(clockcache *cc, uint64 capacity, task_system *ts);
+
+uint64
+clockcache_capacity(clockcache *cc);
+
+void
+clockcache_grow_lookup(clockcache *cc, uint64 disk_capacity);
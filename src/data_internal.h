@@ -606,6 +606,53 @@ data_merge_tuples_final(const data_config *cfg,
    return result;
 }
 
+/*
+ * The current time for data_message_expired, in seconds since the Unix epoch.
+ * Only read the clock when cfg expires messages at all.
+ */
+static inline uint64
+data_expiry_now(const data_config *cfg)
+{
+   if (!cfg->message_expiry) {
+      return 0;
+   }
+   return platform_get_real_time() / SEC_TO_NSEC(1);
+}
+
+static inline bool32
+data_message_expired(const data_config *cfg, message msg, uint64 now)
+{
+   if (!cfg->message_expiry || message_class(msg) != MESSAGE_TYPE_INSERT
+       || message_length(msg) < sizeof(message_expiry_header))
+   {
+      return FALSE;
+   }
+   message_expiry_header hdr;
+   memcpy(&hdr, message_data(msg), sizeof(hdr));
+   return hdr.expires_at != 0 && hdr.expires_at <= now;
+}
+
+static inline bool32
+data_filters_compactions(const data_config *cfg)
+{
+   return cfg->message_expiry || cfg->compaction_filter != NULL;
+}
+
+static inline int
+data_compaction_filter(const data_config *cfg,
+                       key                tuple_key,
+                       merge_accumulator *msg)
+{
+   debug_assert(key_is_user_key(tuple_key));
+   debug_assert(merge_accumulator_message_class(msg) != MESSAGE_TYPE_DELETE);
+
+   int result = cfg->compaction_filter(cfg, tuple_key.user_slice, msg);
+   if (merge_accumulator_message_class(msg) == MESSAGE_TYPE_DELETE) {
+      merge_accumulator_resize(msg, 0);
+   }
+   return result;
+}
+
 static inline void
 data_key_to_string(const data_config *cfg, key k, char *str, size_t size)
 {
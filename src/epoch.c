@@ -0,0 +1,68 @@
+// Copyright 2023 VMware, Inc.
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ *-----------------------------------------------------------------------------
+ * epoch.c --
+ *
+ *     Epoch-based reclamation, see epoch.h.
+ *-----------------------------------------------------------------------------
+ */
+
+#include "platform.h"
+#include "epoch.h"
+
+#include "poison.h"
+
+void
+epoch_domain_init(epoch_domain *domain)
+{
+   ZERO_CONTENTS(domain);
+   // 0 marks an empty slot
+   domain->current = 1;
+}
+
+/*
+ * Returns a bound below which every tag is safe to free: no reader still in a
+ * read section (or, with include_async, an async read section) entered at or
+ * before it.
+ *
+ * Advances the epoch, so that readers entering from now on do not hold back
+ * the tags retired so far.
+ */
+uint64
+epoch_safe_bound(epoch_domain *domain, bool32 include_async)
+{
+   uint64 bound = __atomic_add_fetch(&domain->current, 1, __ATOMIC_SEQ_CST);
+   for (threadid tid = 0; tid < MAX_THREADS; tid++) {
+      epoch_slot *slot  = &domain->slot[tid];
+      uint64      epoch = __atomic_load_n(&slot->epoch, __ATOMIC_ACQUIRE);
+      if (epoch != 0 && epoch < bound) {
+         bound = epoch;
+      }
+      if (include_async) {
+         epoch = __atomic_load_n(&slot->async_epoch, __ATOMIC_ACQUIRE);
+         if (epoch != 0 && epoch < bound) {
+            bound = epoch;
+         }
+      }
+   }
+   return bound;
+}
+
+/*
+ * Waits for every reader that might reach a structure unlinked before the
+ * call to leave. The caller must not be in a read section itself.
+ */
+void
+epoch_synchronize(epoch_domain *domain, bool32 include_async)
+{
+   debug_assert(epoch_get_slot(domain)->depth == 0);
+   debug_assert(!include_async || epoch_get_slot(domain)->async_epoch == 0);
+   uint64 tag  = epoch_retire(domain);
+   uint64 wait = 1;
+   while (!epoch_is_safe(domain, tag, include_async)) {
+      platform_sleep_ns(wait);
+      wait = wait > 2048 ? wait : 2 * wait;
+   }
+}
@@ -0,0 +1,161 @@
+// Copyright 2023 VMware, Inc.
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * epoch.h --
+ *
+ *     Epoch-based reclamation.
+ *
+ *     Readers bracket their accesses to shared structures with epoch_enter
+ *     and epoch_exit, which announce the current epoch in a slot of the
+ *     reader's own, so a read section writes no shared cacheline. A writer
+ *     that has unlinked a structure tags it with epoch_retire and frees it
+ *     once the tag is below epoch_safe_bound, that is once every reader that
+ *     might still reach it has left. Writers never wait for readers.
+ *
+ *     Read sections nest. A read section must not wait for anything that
+ *     waits on reclamation, such as a memtable being recycled. Async lookups,
+ *     which return to their caller mid-lookup, use epoch_enter_async and
+ *     epoch_exit_async instead, and only the reclamations that pass
+ *     include_async to epoch_safe_bound wait for them.
+ *
+ *     A thread may keep async lookups in flight without pause, so they are
+ *     counted in two buckets: new ones join the newer bucket, which becomes
+ *     the older one, and is no longer joined, once the older one drains. The
+ *     epoch the thread announces for them thus keeps moving.
+ */
+
+#pragma once
+
+#include "platform.h"
+
+typedef struct epoch_slot {
+   volatile uint64 epoch;       // 0 outside of read sections
+   volatile uint64 async_epoch; // 0 outside of async read sections
+   uint64          depth;
+   uint64          async_bucket_epoch[2];
+   uint64          async_bucket_count[2];
+   uint64          async_new_bucket; // joined by new async read sections
+} PLATFORM_CACHELINE_ALIGNED epoch_slot;
+
+typedef struct epoch_domain {
+   volatile uint64 current;
+   epoch_slot      slot[MAX_THREADS];
+} PLATFORM_CACHELINE_ALIGNED epoch_domain;
+
+void
+epoch_domain_init(epoch_domain *domain);
+
+static inline epoch_slot *
+epoch_get_slot(epoch_domain *domain)
+{
+   threadid tid = platform_get_tid();
+   debug_assert(tid < MAX_THREADS, "tid=%lu", tid);
+   return &domain->slot[tid];
+}
+
+/*
+ * Announces the epoch before any of the reader's loads of shared structures.
+ * The announcement may be stale by the time it is visible, which only makes
+ * it more conservative.
+ */
+static inline void
+epoch_enter(epoch_domain *domain)
+{
+   epoch_slot *slot = epoch_get_slot(domain);
+   if (slot->depth++ == 0) {
+      __atomic_store_n(&slot->epoch, domain->current, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   }
+}
+
+static inline void
+epoch_exit(epoch_domain *domain)
+{
+   epoch_slot *slot = epoch_get_slot(domain);
+   debug_assert(slot->depth != 0);
+   if (--slot->depth == 0) {
+      __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+   }
+}
+
+/*
+ * Returns the token to pass to epoch_exit_async, which must be called on the
+ * same thread.
+ */
+static inline uint64
+epoch_enter_async(epoch_domain *domain)
+{
+   epoch_slot *slot    = epoch_get_slot(domain);
+   uint64      new_bkt = slot->async_new_bucket;
+   uint64      old_bkt = 1 - new_bkt;
+   if (slot->async_bucket_count[old_bkt] == 0
+       && slot->async_bucket_count[new_bkt] != 0)
+   {
+      // stop joining the newer bucket, so it can drain
+      old_bkt                = new_bkt;
+      new_bkt                = 1 - new_bkt;
+      slot->async_new_bucket = new_bkt;
+   }
+   if (slot->async_bucket_count[new_bkt] == 0) {
+      slot->async_bucket_epoch[new_bkt] = domain->current;
+      if (slot->async_bucket_count[old_bkt] == 0) {
+         __atomic_store_n(&slot->async_epoch,
+                          slot->async_bucket_epoch[new_bkt],
+                          __ATOMIC_RELAXED);
+         __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      }
+   }
+   slot->async_bucket_count[new_bkt]++;
+   return slot->async_bucket_epoch[new_bkt];
+}
+
+static inline void
+epoch_exit_async(epoch_domain *domain, uint64 token)
+{
+   epoch_slot *slot = epoch_get_slot(domain);
+   uint64      bkt  = 0;
+   if (slot->async_bucket_count[0] == 0
+       || slot->async_bucket_epoch[0] != token)
+   {
+      bkt = 1;
+   }
+   debug_assert(slot->async_bucket_count[bkt] != 0);
+   debug_assert(slot->async_bucket_epoch[bkt] == token);
+   slot->async_bucket_count[bkt]--;
+
+   uint64 oldest = 0;
+   for (bkt = 0; bkt < 2; bkt++) {
+      if (slot->async_bucket_count[bkt] != 0
+          && (oldest == 0 || slot->async_bucket_epoch[bkt] < oldest))
+      {
+         oldest = slot->async_bucket_epoch[bkt];
+      }
+   }
+   if (oldest != slot->async_epoch) {
+      __atomic_store_n(&slot->async_epoch, oldest, __ATOMIC_RELEASE);
+   }
+}
+
+/*
+ * Returns the tag for a structure the caller has just unlinked. Readers that
+ * enter after the epoch moves past the tag cannot reach it.
+ */
+static inline uint64
+epoch_retire(epoch_domain *domain)
+{
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   return __atomic_load_n(&domain->current, __ATOMIC_SEQ_CST);
+}
+
+uint64
+epoch_safe_bound(epoch_domain *domain, bool32 include_async);
+
+static inline bool32
+epoch_is_safe(epoch_domain *domain, uint64 tag, bool32 include_async)
+{
+   return tag < epoch_safe_bound(domain, include_async);
+}
+
+void
+epoch_synchronize(epoch_domain *domain, bool32 include_async);
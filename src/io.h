@@ -14,6 +14,19 @@
 typedef struct io_handle    io_handle;
 typedef struct io_async_req io_async_req;
 
+/*
+ * IO is scheduled by the class of the thread issuing it. Foreground IO
+ * serves lookups, inserts and scans and is never held back. Background IO
+ * (compactions, filter builds, cache cleaning) is limited to
+ * io_config->bg_max_bytes_per_sec, so that it does not crowd out foreground
+ * reads.
+ */
+typedef enum io_class {
+   IO_CLASS_FOREGROUND = 0,
+   IO_CLASS_BACKGROUND,
+   NUM_IO_CLASSES
+} io_class;
+
 /*
  * IO Configuration structure - used to setup the run-time IO system.
  */
@@ -26,6 +39,14 @@ typedef struct io_config {
    int    flags;
    uint32 perms;
 
+   // Background IO is limited to this many bytes per second. 0 means no
+   // limit.
+   uint64 bg_max_bytes_per_sec;
+
+   // If set (requires a background limit), the background limit is scaled
+   // down while recent foreground reads take longer than this on average.
+   uint64 fg_read_latency_target_ns;
+
    // computed
    uint64 async_max_pages;
 } io_config;
@@ -56,12 +77,17 @@ typedef platform_status (*io_write_async_fn)(io_handle     *io,
                                              io_callback_fn callback,
                                              uint64         count,
                                              uint64         addr);
+typedef platform_status (*io_discard_fn)(io_handle *io,
+                                         uint64     bytes,
+                                         uint64     addr);
 typedef void (*io_cleanup_fn)(io_handle *io, uint64 count);
 typedef void (*io_cleanup_all_fn)(io_handle *io);
 typedef void (*io_register_thread_fn)(io_handle *io);
 typedef void (*io_deregister_thread_fn)(io_handle *io);
 typedef bool32 (*io_max_latency_elapsed_fn)(io_handle *io, timestamp ts);
 
+typedef io_class (*io_set_class_fn)(io_handle *io, io_class cls);
+
 typedef void *(*io_get_context_fn)(io_handle *io);
 
 /*
@@ -75,11 +101,13 @@ typedef struct io_ops {
    io_get_metadata_fn        get_metadata;
    io_read_async_fn          read_async;
    io_write_async_fn         write_async;
+   io_discard_fn             discard;
    io_cleanup_fn             cleanup;
    io_cleanup_all_fn         cleanup_all;
    io_register_thread_fn     register_thread;
    io_deregister_thread_fn   deregister_thread;
    io_max_latency_elapsed_fn max_latency_elapsed;
+   io_set_class_fn           set_class;
    io_get_context_fn         get_context;
 } io_ops;
 
@@ -146,6 +174,20 @@ io_write_async(io_handle     *io,
    return io->ops->write_async(io, req, callback, count, addr);
 }
 
+/*
+ * Tells the device that the given range no longer holds data, so that it
+ * may reclaim the space. The contents of the range are undefined
+ * afterwards. Returns STATUS_NOTSUP if the device cannot discard.
+ */
+static inline platform_status
+io_discard(io_handle *io, uint64 bytes, uint64 addr)
+{
+   if (io->ops->discard) {
+      return io->ops->discard(io, bytes, addr);
+   }
+   return STATUS_NOTSUP;
+}
+
 static inline void
 io_cleanup(io_handle *io, uint64 count)
 {
@@ -184,6 +226,19 @@ io_max_latency_elapsed(io_handle *io, timestamp ts)
    return TRUE;
 }
 
+/*
+ * Sets the IO class of the calling thread, returning its previous class,
+ * so that callers can restore it when they are done.
+ */
+static inline io_class
+io_set_class(io_handle *io, io_class cls)
+{
+   if (io->ops->set_class) {
+      return io->ops->set_class(io, cls);
+   }
+   return IO_CLASS_FOREGROUND;
+}
+
 // Return the opaque handle to the IO-context, established by
 // a call to io_setup() off of this IO-handle 'io'.
 static inline void *
@@ -87,36 +87,58 @@ memtable_end_raw_rotation(memtable_context *ctxt)
    platform_batch_rwlock_full_unlock(ctxt->rwlock, MEMTABLE_INSERT_LOCK_IDX);
 }
 
-void
+/*
+ * Lookups do not lock out incorporations. Instead, the generations they read
+ * are checked against lookup_seq, which incorporations make odd while they
+ * retire a memtable and swap in the root it went into.
+ */
+uint64
 memtable_begin_lookup(memtable_context *ctxt)
 {
-   platform_batch_rwlock_get(ctxt->rwlock, MEMTABLE_LOOKUP_LOCK_IDX);
+   uint64 seq;
+   while ((seq = __atomic_load_n(&ctxt->lookup_seq, __ATOMIC_ACQUIRE)) & 1) {
+      platform_yield();
+   }
+   return seq;
 }
 
-void
-memtable_end_lookup(memtable_context *ctxt)
+bool32
+memtable_end_lookup(memtable_context *ctxt, uint64 seq)
 {
-   platform_batch_rwlock_unget(ctxt->rwlock, MEMTABLE_LOOKUP_LOCK_IDX);
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   return __atomic_load_n(&ctxt->lookup_seq, __ATOMIC_RELAXED) == seq;
 }
 
+/*
+ * Writers take the claim on the lookup lock to exclude each other, but never
+ * wait for lookups.
+ */
 void
 memtable_block_lookups(memtable_context *ctxt)
 {
    platform_batch_rwlock_get(ctxt->rwlock, MEMTABLE_LOOKUP_LOCK_IDX);
    platform_batch_rwlock_claim_loop(ctxt->rwlock, MEMTABLE_LOOKUP_LOCK_IDX);
-   platform_batch_rwlock_lock(ctxt->rwlock, MEMTABLE_LOOKUP_LOCK_IDX);
+   __atomic_store_n(&ctxt->lookup_seq, ctxt->lookup_seq + 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
 }
 
 void
 memtable_unblock_lookups(memtable_context *ctxt)
 {
-   platform_batch_rwlock_full_unlock(ctxt->rwlock, MEMTABLE_LOOKUP_LOCK_IDX);
+   __atomic_store_n(&ctxt->lookup_seq, ctxt->lookup_seq + 1, __ATOMIC_RELEASE);
+   platform_batch_rwlock_unclaim(ctxt->rwlock, MEMTABLE_LOOKUP_LOCK_IDX);
+   platform_batch_rwlock_unget(ctxt->rwlock, MEMTABLE_LOOKUP_LOCK_IDX);
 }
 
 
-platform_status
-memtable_maybe_rotate_and_begin_insert(memtable_context *ctxt,
-                                       uint64           *generation)
+/*
+ * Unless block is set, returns STATUS_BUSY rather than back off and wait
+ * for another thread to finish rotating the memtable.
+ */
+static platform_status
+memtable_rotate_and_begin_insert(memtable_context *ctxt,
+                                 uint64           *generation,
+                                 bool32            block)
 {
    uint64 wait = 100;
    while (TRUE) {
@@ -127,6 +149,9 @@ memtable_maybe_rotate_and_begin_insert(memtable_context *ctxt,
       if (current_mt->state != MEMTABLE_STATE_READY) {
          // The next memtable is not ready yet, back off and wait.
          memtable_end_insert(ctxt);
+         if (!block) {
+            return STATUS_BUSY;
+         }
          platform_sleep_ns(wait);
          wait = wait > 2048 ? wait : 2 * wait;
          continue;
@@ -174,6 +199,9 @@ memtable_maybe_rotate_and_begin_insert(memtable_context *ctxt,
             memtable_process(ctxt, current_generation);
          } else {
             memtable_end_insert(ctxt);
+            if (!block) {
+               return STATUS_BUSY;
+            }
             platform_sleep_ns(wait);
             wait = wait > 2048 ? wait : 2 * wait;
          }
@@ -184,6 +212,20 @@ memtable_maybe_rotate_and_begin_insert(memtable_context *ctxt,
    }
 }
 
+platform_status
+memtable_maybe_rotate_and_begin_insert(memtable_context *ctxt,
+                                       uint64           *generation)
+{
+   return memtable_rotate_and_begin_insert(ctxt, generation, TRUE);
+}
+
+platform_status
+memtable_try_rotate_and_begin_insert(memtable_context *ctxt,
+                                     uint64           *generation)
+{
+   return memtable_rotate_and_begin_insert(ctxt, generation, FALSE);
+}
+
 /*
  *-----------------------------------------------------------------------------
  * Increments the distributed tuple counter.  Must hold a read lock on
@@ -219,10 +261,19 @@ memtable_insert(memtable_context *ctxt,
    const threadid tid = platform_get_tid();
    bool32         was_unique;
 
+   btree_scratch *scratch = ctxt->scratch[tid];
+   if (scratch == NULL) {
+      scratch = TYPED_ZALLOC(ctxt->heap_id, scratch);
+      if (scratch == NULL) {
+         return STATUS_NO_MEMORY;
+      }
+      ctxt->scratch[tid] = scratch;
+   }
+
    platform_status rc = btree_insert(ctxt->cc,
                                      ctxt->cfg.btree_cfg,
                                      heap_id,
-                                     &ctxt->scratch[tid],
+                                     scratch,
                                      mt->root_addr,
                                      &mt->mini,
                                      tuple_key,
@@ -280,6 +331,108 @@ memtable_force_finalize(memtable_context *ctxt)
    return current_generation;
 }
 
+/*
+ * Finalizes the current memtable if it has any tuples, so that every tuple
+ * inserted so far belongs to a generation before ctxt->generation. Returns
+ * STATUS_BUSY if the next memtable is not ready to take over yet.
+ *
+ * Must hold the raw insert rotation.
+ */
+static platform_status
+memtable_finalize_if_not_empty(memtable_context *ctxt, bool32 *finalized)
+{
+   *finalized = FALSE;
+   if (memtable_is_empty(ctxt)) {
+      return STATUS_OK;
+   }
+
+   uint64    generation = ctxt->generation;
+   uint64    next_mt_no = (generation + 1) % ctxt->cfg.max_memtables;
+   memtable *next_mt    = &ctxt->mt[next_mt_no];
+   if (next_mt->state != MEMTABLE_STATE_READY) {
+      return STATUS_BUSY;
+   }
+
+   memtable *mt = &ctxt->mt[generation % ctxt->cfg.max_memtables];
+   memtable_transition(mt, MEMTABLE_STATE_READY, MEMTABLE_STATE_FINALIZED);
+   ctxt->generation++;
+   platform_assert(ctxt->generation - ctxt->generation_retired
+                   <= ctxt->cfg.max_memtables);
+   memtable_mark_empty(ctxt);
+   *finalized = TRUE;
+   return STATUS_OK;
+}
+
+/*
+ * Finalizes the current memtable, if it has any tuples, and hands it over to
+ * be processed. On success, *generation is the last generation holding
+ * tuples inserted before the call. Returns STATUS_BUSY if the next memtable
+ * is not ready to take over yet.
+ */
+platform_status
+memtable_finalize_current(memtable_context *ctxt, uint64 *generation)
+{
+   memtable_begin_raw_rotation(ctxt);
+   bool32          finalized;
+   platform_status rc   = memtable_finalize_if_not_empty(ctxt, &finalized);
+   uint64          last = ctxt->generation - 1;
+   memtable_end_raw_rotation(ctxt);
+
+   if (SUCCESS(rc)) {
+      *generation = last;
+      if (finalized) {
+         memtable_process(ctxt, last);
+      }
+   }
+   return rc;
+}
+
+/*
+ * Blocks inserts and finalizes the current memtable if it has any tuples.
+ * Returns STATUS_BUSY, with inserts unblocked again, if the next memtable is
+ * not ready to take over yet.
+ *
+ * On success, inserts stay blocked until memtable_end_clear.
+ */
+platform_status
+memtable_begin_clear(memtable_context *ctxt, bool32 *finalized)
+{
+   memtable_begin_raw_rotation(ctxt);
+   platform_status rc = memtable_finalize_if_not_empty(ctxt, finalized);
+   if (!SUCCESS(rc)) {
+      memtable_end_raw_rotation(ctxt);
+   }
+   return rc;
+}
+
+/*
+ * Hides every generation before the current one from lookups and from
+ * incorporation.
+ *
+ * Must be between memtable_block_lookups and memtable_unblock_lookups, and
+ * between memtable_begin_clear and memtable_end_clear.
+ */
+void
+memtable_mark_cleared(memtable_context *ctxt)
+{
+   ctxt->generation_cleared = ctxt->generation - 1;
+}
+
+/*
+ * Unblocks inserts and hands the memtable finalized by memtable_begin_clear,
+ * if any, over to be processed. Being cleared, it is dropped rather than
+ * incorporated.
+ */
+void
+memtable_end_clear(memtable_context *ctxt, bool32 finalized)
+{
+   uint64 generation = ctxt->generation - 1;
+   memtable_end_raw_rotation(ctxt);
+   if (finalized) {
+      memtable_process(ctxt, generation);
+   }
+}
+
 void
 memtable_init(memtable *mt, cache *cc, memtable_config *cfg, uint64 generation)
 {
@@ -309,7 +462,8 @@ memtable_context_create(platform_heap_id hid,
 {
    memtable_context *ctxt =
       TYPED_FLEXIBLE_STRUCT_ZALLOC(hid, ctxt, mt, cfg->max_memtables);
-   ctxt->cc = cc;
+   ctxt->cc      = cc;
+   ctxt->heap_id = hid;
    memmove(&ctxt->cfg, cfg, sizeof(ctxt->cfg));
 
    platform_mutex_init(
@@ -325,6 +479,7 @@ memtable_context_create(platform_heap_id hid,
    ctxt->generation                = 0;
    ctxt->generation_to_incorporate = 0;
    ctxt->generation_retired        = (uint64)-1;
+   ctxt->generation_cleared        = (uint64)-1;
 
    ctxt->is_empty = TRUE;
 
@@ -342,6 +497,12 @@ memtable_context_destroy(platform_heap_id hid, memtable_context *ctxt)
       memtable_deinit(cc, &ctxt->mt[mt_no]);
    }
 
+   for (threadid tid = 0; tid < MAX_THREADS; tid++) {
+      if (ctxt->scratch[tid] != NULL) {
+         platform_free(hid, ctxt->scratch[tid]);
+      }
+   }
+
    platform_mutex_destroy(&ctxt->incorporation_mutex);
    platform_free(hid, ctxt->rwlock);
 
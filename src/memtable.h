@@ -59,7 +59,7 @@ memtable_try_transition(memtable      *mt,
          debug_assert(new_state == MEMTABLE_STATE_INCORPORATION_ASSIGNED);
          break;
       case MEMTABLE_STATE_INCORPORATION_ASSIGNED:
-         // This occurs after the lookup lock has been acquired in
+         // This occurs after lookups have been blocked in
          // incorporate_memtable
          debug_assert(new_state == MEMTABLE_STATE_INCORPORATING);
          break;
@@ -127,14 +127,24 @@ typedef struct memtable_context {
    platform_mutex  incorporation_mutex;
    volatile uint64 generation_to_incorporate;
 
-   // Protected by the MEMTABLE_LOOKUP_LOCK_IDX'th lock of rwlock. Must hold
-   // read lock to read and write lock to modify.
+   // Modified only between memtable_block_lookups and
+   // memtable_unblock_lookups, read between memtable_begin_lookup and
+   // memtable_end_lookup.
    volatile uint64 generation_retired;
 
+   // The last generation dropped by memtable_mark_cleared. Protected like
+   // generation_retired.
+   volatile uint64 generation_cleared;
+
+   // Odd while lookups are blocked, see memtable_begin_lookup
+   volatile uint64 lookup_seq;
+
    bool32 is_empty;
 
-   // Effectively thread local, no locking at all:
-   btree_scratch scratch[MAX_THREADS];
+   // Effectively thread local, no locking at all. Indexed by thread id, and
+   // allocated by each thread on its first insert.
+   platform_heap_id heap_id;
+   btree_scratch   *scratch[MAX_THREADS];
 
    memtable mt[];
 } memtable_context;
@@ -143,14 +153,28 @@ platform_status
 memtable_maybe_rotate_and_begin_insert(memtable_context *ctxt,
                                        uint64           *generation);
 
+/*
+ * Like memtable_maybe_rotate_and_begin_insert, but never waits: returns
+ * STATUS_BUSY if the next memtable is not ready, or if another thread is
+ * rotating the memtable.
+ */
+platform_status
+memtable_try_rotate_and_begin_insert(memtable_context *ctxt,
+                                     uint64           *generation);
+
 void
 memtable_end_insert(memtable_context *ctxt);
 
-void
+/*
+ * Returns the lookup sequence number to pass to memtable_end_lookup, which
+ * returns FALSE if the generations read in between may be inconsistent,
+ * because a memtable was retired or cleared in the meantime.
+ */
+uint64
 memtable_begin_lookup(memtable_context *ctxt);
 
-void
-memtable_end_lookup(memtable_context *ctxt);
+bool32
+memtable_end_lookup(memtable_context *ctxt, uint64 seq);
 
 void
 memtable_block_lookups(memtable_context *ctxt);
@@ -172,6 +196,18 @@ memtable_dec_ref_maybe_recycle(memtable_context *ctxt, memtable *mt);
 uint64
 memtable_force_finalize(memtable_context *ctxt);
 
+platform_status
+memtable_finalize_current(memtable_context *ctxt, uint64 *generation);
+
+platform_status
+memtable_begin_clear(memtable_context *ctxt, bool32 *finalized);
+
+void
+memtable_mark_cleared(memtable_context *ctxt);
+
+void
+memtable_end_clear(memtable_context *ctxt, bool32 finalized);
+
 void
 memtable_init(memtable *mt, cache *cc, memtable_config *cfg, uint64 generation);
 
@@ -218,6 +254,43 @@ memtable_generation_retired(memtable_context *ctxt)
    return ctxt->generation_retired;
 }
 
+/*
+ * Lookups walk the memtables from the current generation down to, but not
+ * including, this one, skipping both retired and cleared generations.
+ *
+ * Must be between memtable_begin_lookup and memtable_end_lookup.
+ */
+static inline uint64
+memtable_generation_lookup_end(memtable_context *ctxt)
+{
+   uint64 generation = ctxt->generation;
+   uint64 retired    = ctxt->generation_retired;
+   uint64 cleared    = ctxt->generation_cleared;
+   return generation - cleared < generation - retired ? cleared : retired;
+}
+
+/*
+ * Returns TRUE once generation has been incorporated (or dropped by a clear)
+ * and lookups no longer search it.
+ */
+static inline bool32
+memtable_generation_is_retired(memtable_context *ctxt, uint64 generation)
+{
+   uint64 current = ctxt->generation;
+   return current - ctxt->generation_retired <= current - generation;
+}
+
+/*
+ * Returns TRUE if generation was dropped by a clear, in which case its
+ * contents must not be incorporated.
+ */
+static inline bool32
+memtable_generation_is_cleared(memtable_context *ctxt, uint64 generation)
+{
+   uint64 current = ctxt->generation;
+   return current - generation >= current - ctxt->generation_cleared;
+}
+
 /*
  * Must hold write lock on insert_lock
  */
@@ -231,14 +304,14 @@ memtable_increment_to_generation_to_incorporate(memtable_context *ctxt,
 }
 
 /*
- * Must hold write lock on lookup_lock
+ * Must be between memtable_block_lookups and memtable_unblock_lookups.
  */
 static inline void
 memtable_increment_to_generation_retired(memtable_context *ctxt,
                                          uint64            generation)
 {
    platform_assert(ctxt->generation_retired + 1 == generation);
-   // protected by lookup_lock, so don't need atomics
+   // only one writer can block lookups, so don't need atomics
    ctxt->generation_retired++;
 }
 
@@ -260,18 +333,28 @@ memtable_zap(cache *cc, memtable *mt)
    btree_dec_ref(cc, mt->cfg, mt->root_addr, PAGE_TYPE_MEMTABLE);
 }
 
+/*
+ * A lookup may reach a memtable until the memtable is recycled for a later
+ * generation, which the caller's epoch holds off.
+ */
 static inline bool32
-memtable_ok_to_lookup(memtable *mt)
+memtable_ok_to_lookup(memtable *mt, uint64 generation)
 {
-   return mt->state != MEMTABLE_STATE_INCORPORATING
-          && mt->state != MEMTABLE_STATE_INCORPORATED;
+   return mt->generation == generation
+          && mt->state != MEMTABLE_STATE_INVALID;
 }
 
+/*
+ * Once compacted, a memtable is looked up in its compacted branch, including
+ * while and after that branch is incorporated.
+ */
 static inline bool32
 memtable_ok_to_lookup_compacted(memtable *mt)
 {
    return mt->state == MEMTABLE_STATE_COMPACTED
-          || mt->state == MEMTABLE_STATE_INCORPORATION_ASSIGNED;
+          || mt->state == MEMTABLE_STATE_INCORPORATION_ASSIGNED
+          || mt->state == MEMTABLE_STATE_INCORPORATING
+          || mt->state == MEMTABLE_STATE_INCORPORATED;
 }
 
 bool32
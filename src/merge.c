@@ -316,7 +316,8 @@ merge_resolve_equal_keys(merge_iterator *merge_itor)
  *-----------------------------------------------------------------------------
  * if merge_itor->finalize_updates:
  *    resolves MESSAGE_TYPE_UPDATE messages into
- *       MESSAGE_TYPE_INSERT or MESSAGE_TYPE_DELETE messages
+ *       MESSAGE_TYPE_INSERT or MESSAGE_TYPE_DELETE messages, and treats
+ *       expired inserts (see data_message_expired) as deletes
  * if merge_itor->delete_mode == dont_emit_deletes:
  *    discards MESSAGE_TYPE_DELETE messages
  * return True if it discarded a MESSAGE_TYPE_DELETE message
@@ -347,6 +348,13 @@ merge_finalize_updates_and_discard_deletes(merge_iterator *merge_itor,
          merge_accumulator_to_message(&merge_itor->merge_buffer);
       class = message_class(merge_itor->curr_data);
    }
+   if (merge_itor->finalize_updates
+       && data_message_expired(
+          cfg, merge_itor->curr_data, merge_itor->expiry_now))
+   {
+      // an expired insert reads as a delete
+      class = MESSAGE_TYPE_DELETE;
+   }
    if (class == MESSAGE_TYPE_DELETE && !merge_itor->emit_deletes) {
       merge_itor->discarded_deletes++;
       *discarded = TRUE;
@@ -559,6 +567,7 @@ merge_iterator_create(platform_heap_id hid,
    merge_itor->merge_messages   = merge_mode != MERGE_RAW;
    merge_itor->finalize_updates = merge_mode == MERGE_FULL;
    merge_itor->emit_deletes     = merge_mode != MERGE_FULL;
+   merge_itor->expiry_now       = data_expiry_now(cfg);
 
    merge_itor->cfg      = cfg;
    merge_itor->curr_key = NULL_KEY;
@@ -40,7 +40,7 @@ typedef struct ordered_iterator {
  *   are not at the leaf of the splinter tree.
  *
  * - FULL.  Messages for the same key are merged, updates are
- *   finalized, and delete messages are discarded.  This is
+ *   finalized, and delete messages and expired inserts are discarded.  This is
  *   appropriate for compactions at trunk leaves and for splinter
  *   range iterators.
  *
@@ -78,6 +78,9 @@ typedef struct merge_iterator {
    ordered_iterator *ordered_iterators_pad;
    ordered_iterator *ordered_iterators[MAX_MERGE_ARITY];
 
+   // now, for expiring inserts when finalizing updates
+   uint64 expiry_now;
+
    // Stats
    uint64 discarded_deletes;
 
@@ -32,12 +32,16 @@
  *
  *      The header of a meta_page in a mini_allocator. Keyed mini_allocators
  *      use entry_buffer and unkeyed ones use entry.
+ *
+ *      The meta_head of a packed mini_allocator holds its external ref count
+ *      in packed_refs, which is 0 in every other meta_page.
  *-----------------------------------------------------------------------------
  */
 typedef struct ONDISK mini_meta_hdr {
    uint64 next_meta_addr;
    uint64 pos;
    uint32 num_entries;
+   uint32 packed_refs;
    char   entry_buffer[];
 } mini_meta_hdr;
 
@@ -65,6 +69,9 @@ typedef struct ONDISK keyed_meta_entry {
  *
  *      Metadata for each extent stored in the extent list for an unkeyed
  *      mini_allocator. Currently, this is just the extent address itself.
+ *
+ *      Packed mini_allocators record every page they own instead, including
+ *      their meta_pages, so extent_addr is then a page address.
  *-----------------------------------------------------------------------------
  */
 typedef struct ONDISK unkeyed_meta_entry {
@@ -134,6 +141,7 @@ mini_init_meta_page(mini_allocator *mini, page_handle *meta_page)
    hdr->next_meta_addr = 0;
    hdr->pos            = offsetof(typeof(*hdr), entry_buffer);
    hdr->num_entries    = 0;
+   hdr->packed_refs    = 0;
 }
 
 /*
@@ -245,6 +253,183 @@ base_addr(cache *cc, uint64 addr)
       allocator_get_config(cache_get_allocator(cc)), addr);
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * mini_extent_batch_[init,flush] --
+ * mini_free_extent --
+ *
+ *      mini_free_extent frees an extent whose last ref has been dropped
+ *      (it is at AL_NO_REFS). Without a batch, it is discarded from the cache
+ *      and freed right away. With one, it is added to the batch, which
+ *      discards and frees all its extents at once when it is flushed.
+ *
+ *      Flushing sorts the extents first, so that the cache discards and the
+ *      allocator ref count updates each walk the extents in address order,
+ *      and adjacent extents are freed back to back.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Disk deallocation, standard cache side effects.
+ *-----------------------------------------------------------------------------
+ */
+void
+mini_extent_batch_init(mini_extent_batch *batch, cache *cc, page_type type)
+{
+   batch->cc          = cc;
+   batch->type        = type;
+   batch->num_extents = 0;
+}
+
+static int
+mini_extent_addr_cmp(const void *a, const void *b, void *arg)
+{
+   uint64 addr_a = *(const uint64 *)a;
+   uint64 addr_b = *(const uint64 *)b;
+   return addr_a < addr_b ? -1 : addr_a > addr_b;
+}
+
+void
+mini_extent_batch_flush(mini_extent_batch *batch)
+{
+   if (batch->num_extents == 0) {
+      return;
+   }
+
+   uint64 temp;
+   platform_sort_slow(batch->extent_addr,
+                      batch->num_extents,
+                      sizeof(batch->extent_addr[0]),
+                      mini_extent_addr_cmp,
+                      NULL,
+                      &temp);
+
+   for (uint64 i = 0; i < batch->num_extents; i++) {
+      cache_extent_discard(batch->cc, batch->extent_addr[i], batch->type);
+   }
+
+   allocator *al = cache_get_allocator(batch->cc);
+   for (uint64 i = 0; i < batch->num_extents; i++) {
+      uint8 ref = allocator_dec_ref(al, batch->extent_addr[i], batch->type);
+      platform_assert(ref == AL_FREE);
+   }
+   batch->num_extents = 0;
+}
+
+static void
+mini_free_extent(cache             *cc,
+                 page_type          type,
+                 uint64             base_addr,
+                 mini_extent_batch *batch)
+{
+   if (batch != NULL) {
+      debug_assert(batch->cc == cc);
+      debug_assert(batch->type == type);
+      if (batch->num_extents == MINI_EXTENT_BATCH_SIZE) {
+         mini_extent_batch_flush(batch);
+      }
+      batch->extent_addr[batch->num_extents++] = base_addr;
+      return;
+   }
+
+   cache_extent_discard(cc, base_addr, type);
+   uint8 ref = allocator_dec_ref(cache_get_allocator(cc), base_addr, type);
+   platform_assert(ref == AL_FREE);
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ * mini_packer_[init,deinit] --
+ * mini_packer_alloc --
+ * mini_release_packed_page --
+ *
+ *      The packer hands out runs of contiguous pages from its open extent,
+ *      and opens a new one when a run does not fit in what is left of it.
+ *      Each page handed out takes a ref on its extent, which is dropped by
+ *      mini_release_packed_page. The packer's own ref on the open extent is
+ *      dropped when it is closed, so the last release frees the extent.
+ *
+ * Results:
+ *      alloc: the address of the first page of the run.
+ *
+ * Side effects:
+ *      Disk allocation/deallocation, standard cache side effects.
+ *-----------------------------------------------------------------------------
+ */
+void
+mini_packer_init(mini_packer     *packer,
+                 cache           *cc,
+                 page_type        type,
+                 platform_heap_id hid)
+{
+   ZERO_CONTENTS(packer);
+   packer->cc   = cc;
+   packer->al   = cache_get_allocator(cc);
+   packer->type = type;
+   platform_spinlock_init(&packer->lock, platform_get_module_id(), hid);
+}
+
+static void
+mini_release_packed_page(cache             *cc,
+                         page_type          type,
+                         uint64             addr,
+                         mini_extent_batch *batch)
+{
+   allocator *al          = cache_get_allocator(cc);
+   uint64     extent_addr = base_addr(cc, addr);
+   uint8      ref         = allocator_dec_ref(al, extent_addr, type);
+   if (ref == AL_NO_REFS) {
+      mini_free_extent(cc, type, extent_addr, batch);
+   }
+}
+
+void
+mini_packer_deinit(mini_packer *packer)
+{
+   if (packer->extent_addr != 0) {
+      mini_release_packed_page(
+         packer->cc, packer->type, packer->extent_addr, NULL);
+      packer->extent_addr = 0;
+   }
+   platform_spinlock_destroy(&packer->lock);
+}
+
+static uint64
+mini_packer_alloc(mini_packer *packer, uint64 num_pages)
+{
+   uint64 page_size   = cache_page_size(packer->cc);
+   uint64 extent_size = cache_extent_size(packer->cc);
+   uint64 run_size    = num_pages * page_size;
+   platform_assert(0 < num_pages && run_size <= extent_size);
+
+   uint64 closed_extent_addr = 0;
+   platform_spin_lock(&packer->lock);
+   if (packer->extent_addr == 0
+       || packer->next_addr + run_size > packer->extent_addr + extent_size)
+   {
+      closed_extent_addr = packer->extent_addr;
+      platform_status rc =
+         allocator_alloc(packer->al, &packer->extent_addr, packer->type);
+      platform_assert_status_ok(rc);
+      packer->next_addr = packer->extent_addr;
+   }
+   uint64 addr = packer->next_addr;
+   for (uint64 i = 0; i < num_pages; i++) {
+      uint8 ref = allocator_inc_ref(packer->al, packer->extent_addr);
+      platform_assert(ref > AL_ONE_REF);
+   }
+   packer->next_addr += run_size;
+   platform_spin_unlock(&packer->lock);
+
+   // the packer's ref may be the last one, so release it outside the lock
+   if (closed_extent_addr != 0) {
+      mini_release_packed_page(
+         packer->cc, packer->type, closed_extent_addr, NULL);
+   }
+   return addr;
+}
+
 /*
  *-----------------------------------------------------------------------------
  * mini_init --
@@ -523,12 +708,17 @@ mini_append_entry(mini_allocator *mini,
    }
    if (!success) {
       // need to allocate a new meta page
-      uint64 new_meta_tail = mini->meta_tail + cache_page_size(mini->cc);
-      if (new_meta_tail % cache_extent_size(mini->cc) == 0) {
-         // need to allocate the next meta extent
-         platform_status rc =
-            mini_allocator_get_new_extent(mini, &new_meta_tail);
-         platform_assert_status_ok(rc);
+      uint64 new_meta_tail;
+      if (mini->packer != NULL) {
+         new_meta_tail = mini_packer_alloc(mini->packer, 1);
+      } else {
+         new_meta_tail = mini->meta_tail + cache_page_size(mini->cc);
+         if (new_meta_tail % cache_extent_size(mini->cc) == 0) {
+            // need to allocate the next meta extent
+            platform_status rc =
+               mini_allocator_get_new_extent(mini, &new_meta_tail);
+            platform_assert_status_ok(rc);
+         }
       }
 
       mini_set_next_meta_addr(mini, meta_page, new_meta_tail);
@@ -539,6 +729,12 @@ mini_append_entry(mini_allocator *mini,
       mini_full_unlock_meta_page(mini, last_meta_page);
       mini_init_meta_page(mini, meta_page);
 
+      if (mini->packer != NULL) {
+         // packed meta_pages are released along with the pages they record
+         success = mini_unkeyed_append_entry(mini, meta_page, new_meta_tail);
+         platform_assert(success);
+      }
+
       if (mini->keyed) {
          success = mini_keyed_append_entry(
             mini, batch, meta_page, next_addr, entry_key);
@@ -556,6 +752,51 @@ mini_append_entry(mini_allocator *mini,
    return TRUE;
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * mini_init_packed --
+ *
+ *      Initialize a new packed mini allocator, which is unkeyed and takes its
+ *      pages, including its meta_pages, from packer.
+ *
+ *      Like other unkeyed allocators, it has a single ref for the whole
+ *      allocator, but it is kept in the meta_head rather than in the ref
+ *      count of its extent, which is shared with other allocators.
+ *
+ * Results:
+ *      The meta_head of the new allocator.
+ *
+ * Side effects:
+ *      Disk allocation, standard cache side effects.
+ *-----------------------------------------------------------------------------
+ */
+uint64
+mini_init_packed(mini_allocator *mini, mini_packer *packer)
+{
+   platform_assert(mini != NULL);
+   platform_assert(packer != NULL);
+
+   ZERO_CONTENTS(mini);
+   mini->cc          = packer->cc;
+   mini->al          = packer->al;
+   mini->packer      = packer;
+   mini->num_batches = 1;
+   mini->type        = packer->type;
+   mini->meta_head   = mini_packer_alloc(packer, 1);
+   mini->meta_tail   = mini->meta_head;
+
+   page_handle *meta_page = cache_alloc(mini->cc, mini->meta_head, mini->type);
+   mini_init_meta_page(mini, meta_page);
+   mini_meta_hdr *hdr = (mini_meta_hdr *)meta_page->data;
+   hdr->packed_refs   = 1;
+   debug_only bool32 success =
+      mini_unkeyed_append_entry(mini, meta_page, mini->meta_head);
+   debug_assert(success);
+   mini_full_unlock_meta_page(mini, meta_page);
+
+   return mini->meta_head;
+}
+
 /*
  *-----------------------------------------------------------------------------
  * mini_alloc --
@@ -569,6 +810,8 @@ mini_append_entry(mini_allocator *mini,
  *      If next_extent is not NULL, then the successor extent to the allocated
  *      addr will be copied to it.
  *
+ *      Packed allocators take each page from the packer.
+ *
  * Results:
  *      A newly allocated disk address.
  *
@@ -585,6 +828,11 @@ mini_alloc(mini_allocator *mini,
    debug_assert(batch < mini->num_batches);
    debug_assert(!mini->keyed || !key_is_null(alloc_key));
 
+   if (mini->packer != NULL) {
+      debug_assert(next_extent == NULL);
+      return mini_alloc_pages(mini, 1);
+   }
+
    uint64 next_addr = mini_lock_batch_get_next_addr(mini, batch);
 
    if (next_addr % cache_extent_size(mini->cc) == 0) {
@@ -609,6 +857,35 @@ mini_alloc(mini_allocator *mini,
    return next_addr;
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * mini_alloc_pages --
+ *
+ *      Allocate num_pages contiguous pages, all within one extent, from a
+ *      packed mini_allocator.
+ *
+ * Results:
+ *      The disk address of the first page.
+ *
+ * Side effects:
+ *      Disk allocation, standard cache side effects.
+ *-----------------------------------------------------------------------------
+ */
+uint64
+mini_alloc_pages(mini_allocator *mini, uint64 num_pages)
+{
+   platform_assert(mini->packer != NULL);
+
+   uint64 addr      = mini_packer_alloc(mini->packer, num_pages);
+   uint64 page_size = cache_page_size(mini->cc);
+   for (uint64 i = 0; i < num_pages; i++) {
+      bool32 success =
+         mini_append_entry(mini, 0, NULL_KEY, addr + i * page_size);
+      platform_assert(success);
+   }
+   return addr;
+}
+
 /*
  *-----------------------------------------------------------------------------
  * mini_release --
@@ -632,6 +909,11 @@ mini_release(mini_allocator *mini, key end_key)
 {
    debug_assert(!mini->keyed || !key_is_null(end_key));
 
+   if (mini->packer != NULL) {
+      // packed allocators do not hold any extents of their own
+      return;
+   }
+
    for (uint64 batch = 0; batch < mini->num_batches; batch++) {
       // Dealloc the next extent
       uint8 ref =
@@ -664,7 +946,11 @@ mini_release(mini_allocator *mini, key end_key)
  */
 
 void
-mini_deinit(cache *cc, uint64 meta_head, page_type type, bool32 pinned)
+mini_deinit(cache             *cc,
+            uint64             meta_head,
+            page_type          type,
+            bool32             pinned,
+            mini_extent_batch *batch)
 {
    allocator *al        = cache_get_allocator(cc);
    uint64     meta_addr = meta_head;
@@ -682,9 +968,7 @@ mini_deinit(cache *cc, uint64 meta_head, page_type type, bool32 pinned)
          uint64 last_meta_base_addr = base_addr(cc, last_meta_addr);
          uint8  ref = allocator_dec_ref(al, last_meta_base_addr, type);
          platform_assert(ref == AL_NO_REFS);
-         cache_extent_discard(cc, last_meta_base_addr, type);
-         ref = allocator_dec_ref(al, last_meta_base_addr, type);
-         platform_assert(ref == AL_FREE);
+         mini_free_extent(cc, type, last_meta_base_addr, batch);
       }
    } while (meta_addr != 0);
 }
@@ -728,7 +1012,7 @@ mini_destroy_unused(mini_allocator *mini)
       platform_assert(ref == AL_FREE);
    }
 
-   mini_deinit(mini->cc, mini->meta_head, mini->type, FALSE);
+   mini_deinit(mini->cc, mini->meta_head, mini->type, FALSE, NULL);
 }
 
 
@@ -992,6 +1276,12 @@ mini_keyed_for_each_self_exclusive(cache           *cc,
  *      the external ref count reaches 0 (actual ref count reaches
  *      MINI_NO_REFS), the mini allocator is destroyed.
  *
+ *      Packed allocators keep their ref count in the meta_head, and release
+ *      each of their pages when it reaches 0.
+ *
+ *      mini_unkeyed_dec_ref_batched leaves the extents it frees in batch
+ *      instead of discarding them, see mini_free_extent.
+ *
  * Results:
  *      Prior external ref count (internal ref count - MINI_NO_REFS)
  *
@@ -999,9 +1289,64 @@ mini_keyed_for_each_self_exclusive(cache           *cc,
  *      Deallocation/cache side effects when external ref count hits 0
  *-----------------------------------------------------------------------------
  */
+static uint32
+mini_packed_refs(cache *cc, uint64 meta_head, page_type type)
+{
+   page_handle   *meta_page = cache_get(cc, meta_head, TRUE, type);
+   mini_meta_hdr *hdr       = (mini_meta_hdr *)meta_page->data;
+   uint32         refs      = hdr->packed_refs;
+   cache_unget(cc, meta_page);
+   return refs;
+}
+
+static uint32
+mini_packed_add_refs(cache *cc, uint64 meta_head, page_type type, int32 delta)
+{
+   page_handle *meta_page = mini_get_claim_meta_page(cc, meta_head, type);
+   cache_lock(cc, meta_page);
+   mini_meta_hdr *hdr = (mini_meta_hdr *)meta_page->data;
+   platform_assert(hdr->packed_refs != 0);
+   hdr->packed_refs += delta;
+   uint32 refs = hdr->packed_refs;
+   cache_mark_dirty(cc, meta_page);
+   cache_unlock(cc, meta_page);
+   mini_unget_unclaim_meta_page(cc, meta_page);
+   return refs;
+}
+
+static void
+mini_packed_dealloc(cache             *cc,
+                    uint64             meta_head,
+                    page_type          type,
+                    mini_extent_batch *batch)
+{
+   uint64 meta_addr = meta_head;
+   do {
+      page_handle *meta_page = cache_get(cc, meta_addr, TRUE, type);
+
+      // the meta_page's own ref keeps its extent alive until it is unget
+      uint64              num_meta_entries = mini_num_entries(meta_page);
+      unkeyed_meta_entry *entry            = unkeyed_first_entry(meta_page);
+      for (uint64 i = 0; i < num_meta_entries; i++) {
+         if (entry->extent_addr != meta_addr) {
+            mini_release_packed_page(cc, type, entry->extent_addr, batch);
+         }
+         entry = unkeyed_next_entry(entry);
+      }
+      uint64 last_meta_addr = meta_addr;
+      meta_addr             = mini_get_next_meta_addr(meta_page);
+      cache_unget(cc, meta_page);
+      mini_release_packed_page(cc, type, last_meta_addr, batch);
+   } while (meta_addr != 0);
+}
+
 uint8
-mini_unkeyed_inc_ref(cache *cc, uint64 meta_head)
+mini_unkeyed_inc_ref(cache *cc, uint64 meta_head, page_type type)
 {
+   if (mini_packed_refs(cc, meta_head, type) != 0) {
+      return mini_packed_add_refs(cc, meta_head, type, 1);
+   }
+
    allocator *al  = cache_get_allocator(cc);
    uint8      ref = allocator_inc_ref(al, base_addr(cc, meta_head));
    platform_assert(ref > MINI_NO_REFS);
@@ -1014,14 +1359,16 @@ mini_dealloc_extent(cache *cc, page_type type, uint64 base_addr, void *out)
    allocator *al  = cache_get_allocator(cc);
    uint8      ref = allocator_dec_ref(al, base_addr, type);
    platform_assert(ref == AL_NO_REFS);
-   cache_extent_discard(cc, base_addr, type);
-   ref = allocator_dec_ref(al, base_addr, type);
-   platform_assert(ref == AL_FREE);
+   mini_free_extent(cc, type, base_addr, (mini_extent_batch *)out);
    return TRUE;
 }
 
-uint8
-mini_unkeyed_dec_ref(cache *cc, uint64 meta_head, page_type type, bool32 pinned)
+static uint8
+mini_unkeyed_dec_ref_internal(cache             *cc,
+                              uint64             meta_head,
+                              page_type          type,
+                              bool32             pinned,
+                              mini_extent_batch *batch)
 {
    if (type == PAGE_TYPE_MEMTABLE) {
       platform_assert(pinned);
@@ -1029,6 +1376,14 @@ mini_unkeyed_dec_ref(cache *cc, uint64 meta_head, page_type type, bool32 pinned)
       platform_assert(!pinned);
    }
 
+   if (mini_packed_refs(cc, meta_head, type) != 0) {
+      uint32 refs = mini_packed_add_refs(cc, meta_head, type, -1);
+      if (refs == 0) {
+         mini_packed_dealloc(cc, meta_head, type, batch);
+      }
+      return refs;
+   }
+
    allocator *al  = cache_get_allocator(cc);
    uint8      ref = allocator_dec_ref(al, base_addr(cc, meta_head), type);
    if (ref != MINI_NO_REFS) {
@@ -1038,11 +1393,27 @@ mini_unkeyed_dec_ref(cache *cc, uint64 meta_head, page_type type, bool32 pinned)
    }
 
    // need to deallocate and clean up the mini allocator
-   mini_unkeyed_for_each(cc, meta_head, type, FALSE, mini_dealloc_extent, NULL);
-   mini_deinit(cc, meta_head, type, pinned);
+   mini_unkeyed_for_each(
+      cc, meta_head, type, FALSE, mini_dealloc_extent, batch);
+   mini_deinit(cc, meta_head, type, pinned, batch);
    return 0;
 }
 
+uint8
+mini_unkeyed_dec_ref(cache *cc, uint64 meta_head, page_type type, bool32 pinned)
+{
+   return mini_unkeyed_dec_ref_internal(cc, meta_head, type, pinned, NULL);
+}
+
+uint8
+mini_unkeyed_dec_ref_batched(cache             *cc,
+                             uint64             meta_head,
+                             mini_extent_batch *batch)
+{
+   return mini_unkeyed_dec_ref_internal(
+      cc, meta_head, batch->type, FALSE, batch);
+}
+
 /*
  *-----------------------------------------------------------------------------
  * mini_keyed_[inc,dec]_ref --
@@ -1068,6 +1439,9 @@ mini_unkeyed_dec_ref(cache *cc, uint64 meta_head, page_type type, bool32 pinned)
  *      again, since a range query cannot have gotten a reference to their range
  *      after the call to dec_ref is made.
  *
+ *      mini_keyed_dec_ref_batched leaves the extents it frees in batch
+ *      instead of discarding them, see mini_free_extent.
+ *
  * Results:
  *      None
  *
@@ -1113,9 +1487,7 @@ mini_keyed_dec_ref_extent(cache    *cc,
    allocator *al  = cache_get_allocator(cc);
    uint8      ref = allocator_dec_ref(al, base_addr, type);
    if (ref == AL_NO_REFS) {
-      cache_extent_discard(cc, base_addr, type);
-      ref = allocator_dec_ref(al, base_addr, type);
-      platform_assert(ref == AL_FREE);
+      mini_free_extent(cc, type, base_addr, (mini_extent_batch *)out);
       return TRUE;
    }
    return FALSE;
@@ -1132,13 +1504,14 @@ mini_wait_for_blockers(cache *cc, uint64 meta_head)
    }
 }
 
-bool32
-mini_keyed_dec_ref(cache       *cc,
-                   data_config *data_cfg,
-                   page_type    type,
-                   uint64       meta_head,
-                   key          start_key,
-                   key          end_key)
+static bool32
+mini_keyed_dec_ref_internal(cache             *cc,
+                            data_config       *data_cfg,
+                            page_type          type,
+                            uint64             meta_head,
+                            key                start_key,
+                            key                end_key,
+                            mini_extent_batch *batch)
 {
    mini_wait_for_blockers(cc, meta_head);
    bool32 should_cleanup =
@@ -1149,16 +1522,40 @@ mini_keyed_dec_ref(cache       *cc,
                                          start_key,
                                          end_key,
                                          mini_keyed_dec_ref_extent,
-                                         NULL);
+                                         batch);
    if (should_cleanup) {
       allocator *al  = cache_get_allocator(cc);
       uint8      ref = allocator_get_refcount(al, base_addr(cc, meta_head));
       platform_assert(ref == AL_ONE_REF);
-      mini_deinit(cc, meta_head, type, FALSE);
+      mini_deinit(cc, meta_head, type, FALSE, batch);
    }
    return should_cleanup;
 }
 
+bool32
+mini_keyed_dec_ref(cache       *cc,
+                   data_config *data_cfg,
+                   page_type    type,
+                   uint64       meta_head,
+                   key          start_key,
+                   key          end_key)
+{
+   return mini_keyed_dec_ref_internal(
+      cc, data_cfg, type, meta_head, start_key, end_key, NULL);
+}
+
+bool32
+mini_keyed_dec_ref_batched(cache             *cc,
+                           data_config       *data_cfg,
+                           uint64             meta_head,
+                           key                start_key,
+                           key                end_key,
+                           mini_extent_batch *batch)
+{
+   return mini_keyed_dec_ref_internal(
+      cc, data_cfg, batch->type, meta_head, start_key, end_key, batch);
+}
+
 /*
  *-----------------------------------------------------------------------------
  * mini_keyed_(un)block_dec_ref --
@@ -1246,9 +1643,10 @@ mini_keyed_extent_count(cache       *cc,
  *-----------------------------------------------------------------------------
  */
 static bool32
-mini_prefetch_extent(cache *cc, page_type type, uint64 base_addr, void *out)
+mini_prefetch_extent(cache *cc, page_type type, uint64 addr, void *out)
 {
-   cache_prefetch(cc, base_addr, type);
+   // packed allocators record pages, so prefetch the extents holding them
+   cache_prefetch(cc, base_addr(cc, addr), type);
    return FALSE;
 }
 
@@ -1259,6 +1657,71 @@ mini_unkeyed_prefetch(cache *cc, page_type type, uint64 meta_head)
       cc, meta_head, type, FALSE, mini_prefetch_extent, NULL);
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * mini_unkeyed_space_use --
+ *
+ *      Computes the space used by an (unkeyed) mini allocator and its
+ *      external ref count, so that callers can divide the space among the
+ *      refs.
+ *
+ *      For packed allocators, bytes_saved is how much less space they use
+ *      than they would with a meta extent and data extents of their own.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *-----------------------------------------------------------------------------
+ */
+void
+mini_unkeyed_space_use(cache    *cc,
+                       uint64    meta_head,
+                       page_type type,
+                       uint64   *refs,
+                       uint64   *bytes_used,
+                       uint64   *bytes_saved)
+{
+   uint64 page_size        = cache_page_size(cc);
+   uint64 extent_size      = cache_extent_size(cc);
+   uint64 pages_per_extent = cache_pages_per_extent(cc);
+
+   uint64 num_entries      = 0;
+   uint64 num_meta_pages   = 0;
+   uint64 num_meta_extents = 0;
+   uint64 meta_addr        = meta_head;
+   do {
+      page_handle *meta_page = cache_get(cc, meta_addr, TRUE, type);
+      num_entries += mini_num_entries(meta_page);
+      num_meta_pages++;
+      uint64 last_meta_addr = meta_addr;
+      meta_addr             = mini_get_next_meta_addr(meta_page);
+      cache_unget(cc, meta_page);
+      if (meta_addr == 0
+          || base_addr(cc, meta_addr) != base_addr(cc, last_meta_addr))
+      {
+         num_meta_extents++;
+      }
+   } while (meta_addr != 0);
+
+   uint32 packed_refs = mini_packed_refs(cc, meta_head, type);
+   if (packed_refs != 0) {
+      uint64 num_data_pages   = num_entries - num_meta_pages;
+      uint64 unpacked_extents =
+         1 + (num_data_pages + pages_per_extent - 1) / pages_per_extent;
+      *refs        = packed_refs;
+      *bytes_used  = num_entries * page_size;
+      *bytes_saved = unpacked_extents * extent_size - *bytes_used;
+   } else {
+      allocator *al = cache_get_allocator(cc);
+      *refs =
+         allocator_get_refcount(al, base_addr(cc, meta_head)) - MINI_NO_REFS;
+      *bytes_used  = (num_entries + num_meta_extents) * extent_size;
+      *bytes_saved = 0;
+   }
+}
+
 /*
  *-----------------------------------------------------------------------------
  * mini_[keyed,unkeyed]_print --
@@ -12,6 +12,10 @@
  *     such as reference counting and deallocation. Keyed mini allocators
  *     further associate a key range to each extent, so that these bulk
  *     operations can be restricted to given key ranges.
+ *
+ *     Small unkeyed objects can instead be packed: their pages are handed out
+ *     of extents shared with other packed objects by a mini_packer, and are
+ *     released page by page.
  */
 
 #pragma once
@@ -30,6 +34,40 @@
  */
 #define MINI_MAX_BATCHES 8
 
+/*
+ * mini_packer: Shared page allocator for packed mini allocators.
+ *
+ * Pages are handed out of a single open extent, so pages of different small
+ * objects share extents. Every page handed out holds a ref on its extent, and
+ * the packer holds one more while the extent is open, so an extent is freed
+ * once all the pages in it have been released and it has been closed.
+ */
+typedef struct mini_packer {
+   allocator        *al;
+   cache            *cc;
+   page_type         type;
+   platform_spinlock lock;
+   uint64            extent_addr; // the open extent, 0 if none
+   uint64            next_addr;
+} mini_packer;
+
+/*
+ * mini_extent_batch: Extents freed by batched dec_refs.
+ *
+ * Extents whose last ref is dropped through the _batched dec_ref functions
+ * are collected here rather than discarded right away, and are discarded from
+ * the cache and returned to the allocator together, in address order, when
+ * the batch is flushed (or fills up).
+ */
+#define MINI_EXTENT_BATCH_SIZE 128
+
+typedef struct mini_extent_batch {
+   cache    *cc;
+   page_type type;
+   uint64    num_extents;
+   uint64    extent_addr[MINI_EXTENT_BATCH_SIZE];
+} mini_extent_batch;
+
 /*
  * mini_allocator: Mini-allocator context.
  */
@@ -37,6 +75,7 @@ typedef struct mini_allocator {
    allocator      *al;
    cache          *cc;
    data_config    *data_cfg;
+   mini_packer    *packer; // non-NULL for packed allocators
    bool32          keyed;
    bool32          pinned;
    uint64          meta_head;
@@ -61,6 +100,9 @@ mini_init(mini_allocator *mini,
 void
 mini_release(mini_allocator *mini, key end_key);
 
+uint64
+mini_init_packed(mini_allocator *mini, mini_packer *packer);
+
 /*
  * NOTE: Can only be called on a mini_allocator which has made no allocations.
  */
@@ -73,14 +115,35 @@ mini_alloc(mini_allocator *mini,
            key             alloc_key,
            uint64         *next_extent);
 
+uint64
+mini_alloc_pages(mini_allocator *mini, uint64 num_pages);
+
+void
+mini_packer_init(mini_packer     *packer,
+                 cache           *cc,
+                 page_type        type,
+                 platform_heap_id hid);
+
+void
+mini_packer_deinit(mini_packer *packer);
+
+void
+mini_extent_batch_init(mini_extent_batch *batch, cache *cc, page_type type);
+
+void
+mini_extent_batch_flush(mini_extent_batch *batch);
 
 uint8
-mini_unkeyed_inc_ref(cache *cc, uint64 meta_head);
+mini_unkeyed_inc_ref(cache *cc, uint64 meta_head, page_type type);
 uint8
 mini_unkeyed_dec_ref(cache    *cc,
                      uint64    meta_head,
                      page_type type,
                      bool32    pinned);
+uint8
+mini_unkeyed_dec_ref_batched(cache             *cc,
+                             uint64             meta_head,
+                             mini_extent_batch *batch);
 
 void
 mini_keyed_inc_ref(cache       *cc,
@@ -96,6 +159,13 @@ mini_keyed_dec_ref(cache       *cc,
                    uint64       meta_head,
                    key          start_key,
                    key          end_key);
+bool32
+mini_keyed_dec_ref_batched(cache             *cc,
+                           data_config       *data_cfg,
+                           uint64             meta_head,
+                           key                start_key,
+                           key                end_key,
+                           mini_extent_batch *batch);
 
 void
 mini_block_dec_ref(cache *cc, uint64 meta_head);
@@ -113,6 +183,14 @@ mini_keyed_extent_count(cache       *cc,
 void
 mini_unkeyed_prefetch(cache *cc, page_type type, uint64 meta_head);
 
+void
+mini_unkeyed_space_use(cache    *cc,
+                       uint64    meta_head,
+                       page_type type,
+                       uint64   *refs,
+                       uint64   *bytes_used,
+                       uint64   *bytes_saved);
+
 void
 mini_unkeyed_print(cache *cc, uint64 meta_head, page_type type);
 void
@@ -23,6 +23,8 @@
 #include "laio.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
@@ -35,6 +37,9 @@ laio_read(io_handle *ioh, void *buf, uint64 bytes, uint64 addr);
 static platform_status
 laio_write(io_handle *ioh, void *buf, uint64 bytes, uint64 addr);
 
+static platform_status
+laio_discard(io_handle *ioh, uint64 bytes, uint64 addr);
+
 static io_async_req *
 laio_get_async_req(io_handle *ioh, bool32 blocking);
 
@@ -73,6 +78,9 @@ laio_register_thread(io_handle *ioh);
 static void
 laio_deregister_thread(io_handle *ioh);
 
+static io_class
+laio_set_class(io_handle *ioh, io_class cls);
+
 static io_async_req *
 laio_get_kth_req(laio_handle *io, uint64 k);
 
@@ -87,15 +95,18 @@ static io_ops laio_ops = {
    .get_metadata      = laio_get_metadata,
    .read_async        = laio_read_async,
    .write_async       = laio_write_async,
+   .discard           = laio_discard,
    .cleanup           = laio_cleanup,
    .cleanup_all       = laio_cleanup_all,
    .register_thread   = laio_register_thread,
    .deregister_thread = laio_deregister_thread,
+   .set_class         = laio_set_class,
    .get_context       = laio_get_context,
 };
 
 /*
  * Given an AIO handle, set up a thread-specific IO context opaque handle.
+ * This is done on the thread's first async IO, see laio_thread_context().
  */
 static platform_status
 io_context_setup(laio_handle *io)
@@ -122,6 +133,22 @@ io_context_setup(laio_handle *io)
    return STATUS_OK;
 }
 
+/*
+ * Returns the calling thread's IO context, setting it up if this is the
+ * thread's first async IO. Each context reserves kernel_queue_size events of
+ * the system-wide limit (fs.aio-max-nr), so threads that only do synchronous
+ * IO do not take one.
+ */
+static io_context_t
+laio_thread_context(laio_handle *io)
+{
+   const threadid tid = platform_get_tid();
+   if (io->ctx[tid] == NULL) {
+      io_context_setup(io);
+   }
+   return io->ctx[tid];
+}
+
 /*
  * As part of thread deregistration, we need to release the IO context
  * that was setup for this thread. Here, we assume that required io_cleanup()
@@ -198,9 +225,12 @@ io_handle_init(laio_handle *io, io_config *cfg, platform_heap_id hid)
    platform_assert(cfg->async_queue_size % LAIO_HAND_BATCH_SIZE == 0);
 
    memset(io, 0, sizeof(*io));
-   io->super.ops = &laio_ops;
-   io->cfg       = cfg;
-   io->heap_id   = hid;
+   io->super.ops      = &laio_ops;
+   io->cfg            = cfg;
+   io->heap_id        = hid;
+   io->bg_tokens      = cfg->bg_max_bytes_per_sec;
+   io->bg_last_refill = platform_get_timestamp();
+   platform_spinlock_init(&io->bg_lock, platform_get_module_id(), hid);
 
    bool32 is_create = ((cfg->flags & O_CREAT) != 0);
    if (is_create) {
@@ -275,9 +305,141 @@ io_handle_deinit(laio_handle *io)
    }
    platform_assert(status == 0);
 
+   platform_spinlock_destroy(&io->bg_lock);
    platform_free(io->heap_id, io->req);
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * IO scheduling --
+ *
+ *      Each thread's IO is foreground or background, see io_set_class().
+ *      Background IO draws its size in bytes from a token bucket which
+ *      refills at laio_bg_rate() and holds at most a second's worth. The
+ *      bucket may go into debt, and the thread which took it there sleeps
+ *      until the debt is paid off, so a burst of background IO is spread
+ *      out rather than refused.
+ *
+ *      With fg_read_latency_target_ns set, the latency of foreground reads is
+ *      tracked as a moving average and the background rate is scaled down in
+ *      proportion to how far it exceeds the target.
+ *-----------------------------------------------------------------------------
+ */
+static io_class
+laio_set_class(io_handle *ioh, io_class cls)
+{
+   laio_handle   *io  = (laio_handle *)ioh;
+   const threadid tid = platform_get_tid();
+
+   if (tid >= MAX_THREADS) {
+      return IO_CLASS_FOREGROUND;
+   }
+   io_class old          = io->thread_class[tid];
+   io->thread_class[tid] = cls;
+   return old;
+}
+
+static inline io_class
+laio_get_class(laio_handle *io)
+{
+   const threadid tid = platform_get_tid();
+   return tid < MAX_THREADS ? io->thread_class[tid] : IO_CLASS_FOREGROUND;
+}
+
+static inline bool32
+laio_timing_fg_reads(laio_handle *io)
+{
+   return io->cfg->fg_read_latency_target_ns != 0
+          && laio_get_class(io) == IO_CLASS_FOREGROUND;
+}
+
+/*
+ * Folds the latency of a foreground read started at 'start' into the moving
+ * average. Concurrent updates may lose a sample, which only perturbs it.
+ */
+static void
+laio_record_fg_read(laio_handle *io, timestamp start)
+{
+   uint64 latency = platform_timestamp_elapsed(start);
+   uint64 average = io->fg_read_latency_ns;
+
+   io->fg_read_latency_ns =
+      average == 0 ? latency : (7 * average + latency) / 8;
+   io->fg_last_read = platform_get_timestamp();
+   __sync_fetch_and_add(&io->fg_reads, 1);
+}
+
+/*
+ * laio_bg_rate() - The current limit on background IO, in bytes per second,
+ * or 0 if it is not limited.
+ */
+uint64
+laio_bg_rate(laio_handle *io)
+{
+   uint64 rate   = io->cfg->bg_max_bytes_per_sec;
+   uint64 target = io->cfg->fg_read_latency_target_ns;
+
+   if (rate == 0 || target == 0
+       || platform_timestamp_elapsed(io->fg_last_read)
+             > LAIO_FG_LATENCY_WINDOW_NS)
+   {
+      return rate;
+   }
+
+   uint64 latency = io->fg_read_latency_ns;
+   if (latency <= target) {
+      return rate;
+   }
+   // rate * target / latency, without overflowing the product
+   uint64 scaled = rate / latency * target + rate % latency * target / latency;
+   return MAX(scaled, rate / LAIO_BG_MIN_RATE_DIVISOR);
+}
+
+/*
+ * Charges 'bytes' of IO by the calling thread to the background token bucket
+ * if it is a background thread, sleeping off any debt. While it sleeps, the
+ * thread reaps completions of its own async IOs.
+ */
+static void
+laio_bg_throttle(laio_handle *io, uint64 bytes)
+{
+   if (laio_get_class(io) != IO_CLASS_BACKGROUND) {
+      return;
+   }
+   __sync_fetch_and_add(&io->bg_bytes, bytes);
+
+   uint64 rate = laio_bg_rate(io);
+   if (rate == 0) {
+      return;
+   }
+
+   platform_spin_lock(&io->bg_lock);
+   uint64 elapsed_ns =
+      MIN(platform_timestamp_elapsed(io->bg_last_refill), SEC_TO_NSEC(1));
+   uint64 refill = elapsed_ns * rate / SEC_TO_NSEC(1);
+   if (refill != 0) {
+      io->bg_tokens      = MIN(io->bg_tokens + (int64)refill, (int64)rate);
+      io->bg_last_refill = platform_get_timestamp();
+   }
+   io->bg_tokens -= bytes;
+   int64 debt = -io->bg_tokens;
+   platform_spin_unlock(&io->bg_lock);
+
+   if (debt <= 0) {
+      return;
+   }
+
+   uint64    wait_ns = debt * SEC_TO_NSEC(1) / rate;
+   timestamp start   = platform_get_timestamp();
+   uint64    elapsed = 0;
+   while (elapsed < wait_ns) {
+      platform_sleep_ns(MIN(wait_ns - elapsed, LAIO_BG_THROTTLE_SLICE_NS));
+      laio_cleanup(&io->super, 0);
+      elapsed = platform_timestamp_elapsed(start);
+   }
+   __sync_fetch_and_add(&io->bg_throttled_ns, elapsed);
+}
+
 /*
  * laio_read() - Basically a wrapper around pread().
  */
@@ -287,8 +449,15 @@ laio_read(io_handle *ioh, void *buf, uint64 bytes, uint64 addr)
    laio_handle *io;
    int          ret;
 
-   io  = (laio_handle *)ioh;
-   ret = pread(io->fd, buf, bytes, addr);
+   io = (laio_handle *)ioh;
+   laio_bg_throttle(io, bytes);
+   if (laio_timing_fg_reads(io)) {
+      timestamp start = platform_get_timestamp();
+      ret             = pread(io->fd, buf, bytes, addr);
+      laio_record_fg_read(io, start);
+   } else {
+      ret = pread(io->fd, buf, bytes, addr);
+   }
    if (ret == bytes) {
       return STATUS_OK;
    }
@@ -304,7 +473,8 @@ laio_write(io_handle *ioh, void *buf, uint64 bytes, uint64 addr)
    laio_handle *io;
    int          ret;
 
-   io  = (laio_handle *)ioh;
+   io = (laio_handle *)ioh;
+   laio_bg_throttle(io, bytes);
    ret = pwrite(io->fd, buf, bytes, addr);
    if (ret == bytes) {
       return STATUS_OK;
@@ -312,6 +482,34 @@ laio_write(io_handle *ioh, void *buf, uint64 bytes, uint64 addr)
    return STATUS_IO_ERROR;
 }
 
+/*
+ * laio_discard() - Discard a range of the device: BLKDISCARD for block
+ * devices, and punching a hole for files.
+ */
+static platform_status
+laio_discard(io_handle *ioh, uint64 bytes, uint64 addr)
+{
+   laio_handle *io;
+   struct stat  st;
+   int          ret;
+
+   io = (laio_handle *)ioh;
+   if (fstat(io->fd, &st) != 0) {
+      return CONST_STATUS(errno);
+   }
+   if (S_ISBLK(st.st_mode)) {
+      uint64 range[2] = {addr, bytes};
+      ret             = ioctl(io->fd, BLKDISCARD, &range);
+   } else {
+      ret = fallocate(
+         io->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, addr, bytes);
+   }
+   if (ret != 0) {
+      return CONST_STATUS(errno);
+   }
+   return STATUS_OK;
+}
+
 /*
  * Return a ptr to the k'th Async IO request structure, accounting
  * for a nested array of 'async_max_pages' pages of IO vector structures
@@ -384,13 +582,13 @@ laio_get_metadata(io_handle *ioh, io_async_req *req)
 }
 
 /*
- * Accessor method: Return opaque handle to IO-context setup by io_setup().
+ * Accessor method: Return opaque handle to IO-context setup by io_setup(),
+ * setting it up if need be.
  */
 static void *
 laio_get_context(io_handle *ioh)
 {
-   threadid tid = platform_get_tid();
-   return ((laio_handle *)ioh)->ctx[tid];
+   return laio_thread_context((laio_handle *)ioh);
 }
 
 void
@@ -421,13 +619,17 @@ laio_read_async(io_handle     *ioh,
 
    threadid tid = platform_get_tid();
 
-   io = (laio_handle *)ioh;
+   io               = (laio_handle *)ioh;
+   io_context_t ctx = laio_thread_context(io);
+   laio_bg_throttle(io, count * io->cfg->page_size);
    io_prep_preadv(&req->iocb, io->fd, req->iovec, count, addr);
-   req->callback = callback;
-   req->count    = count;
+   req->callback    = callback;
+   req->count       = count;
+   req->cls         = laio_get_class(io);
+   req->submit_time = laio_timing_fg_reads(io) ? platform_get_timestamp() : 0;
    io_set_callback(&req->iocb, laio_callback);
    do {
-      status = io_submit(io->ctx[tid], 1, &req->iocb_p);
+      status = io_submit(ctx, 1, &req->iocb_p);
       if (status < 0) {
          platform_error_log("%s(): OS-pid=%d, tid=%lu, req=%p"
                             ", io_submit errorno=%d: %s\n",
@@ -459,13 +661,17 @@ laio_write_async(io_handle     *ioh,
 
    threadid tid = platform_get_tid();
 
-   io = (laio_handle *)ioh;
+   io               = (laio_handle *)ioh;
+   io_context_t ctx = laio_thread_context(io);
+   laio_bg_throttle(io, count * io->cfg->page_size);
    io_prep_pwritev(&req->iocb, io->fd, req->iovec, count, addr);
-   req->callback = callback;
-   req->count    = count;
+   req->callback    = callback;
+   req->count       = count;
+   req->cls         = laio_get_class(io);
+   req->submit_time = 0;
    io_set_callback(&req->iocb, laio_callback);
    do {
-      status = io_submit(io->ctx[tid], 1, &req->iocb_p);
+      status = io_submit(ctx, 1, &req->iocb_p);
       if (status < 0) {
          platform_error_log("%s(): OS-pid=%d, tid=%lu, req=%p"
                             ", io_submit errorno=%d: %s\n",
@@ -499,6 +705,11 @@ laio_cleanup(io_handle *ioh, uint64 count)
 
    io = (laio_handle *)ioh;
 
+   // This thread has not issued any async IO
+   if (io->ctx[tid] == NULL) {
+      return;
+   }
+
    // Check for completion of up to 'count' events, one event at a time.
    // Or, check for all outstanding events (count == 0)
    for (i = 0; ((count == 0) || (i < count)); i++) {
@@ -522,6 +733,11 @@ laio_cleanup(io_handle *ioh, uint64 count)
          break;
       }
       // Invoke the callback for the one event that completed.
+      io_async_req *req =
+         (io_async_req *)((char *)event.obj - offsetof(io_async_req, iocb));
+      if (req->submit_time != 0) {
+         laio_record_fg_read(io, req->submit_time);
+      }
       laio_callback(io->ctx[tid], event.obj, event.res, 0);
    }
 }
@@ -555,27 +771,28 @@ laio_cleanup_all(io_handle *ioh)
 }
 
 /*
- * When a thread registers with Splinter's task system, setup its
- * IO-setup opaque handle that will be used by Async IO interfaces.
+ * When a thread registers with Splinter's task system, reset its IO class.
+ * The IO-setup opaque handle used by Async IO interfaces is set up on the
+ * thread's first async IO, see laio_thread_context().
  */
 static void
 laio_register_thread(io_handle *ioh)
 {
-   io_context_setup((laio_handle *)ioh);
+   laio_set_class(ioh, IO_CLASS_FOREGROUND);
 }
 
 static void
 laio_deregister_thread(io_handle *ioh)
 {
+   laio_handle   *io  = (laio_handle *)ioh;
    const threadid tid = platform_get_tid();
-   platform_assert((laio_get_context(ioh) != NULL),
-                   "Attempting to deregister IO for thread ID=%lu"
-                   " found an uninitialized IO-context handle.\n",
-                   tid);
+   if (io->ctx[tid] == NULL) {
+      return;
+   }
 
    // Process pending AIO-requests for this thread before deregistering it
    laio_cleanup(ioh, 0);
-   io_context_cleanup((laio_handle *)ioh, tid);
+   io_context_cleanup(io, tid);
 }
 
 static inline bool32
@@ -609,5 +826,11 @@ laio_config_valid(io_config *cfg)
          cfg->extent_size);
       return STATUS_BAD_PARAM;
    }
+   if (cfg->fg_read_latency_target_ns != 0 && cfg->bg_max_bytes_per_sec == 0)
+   {
+      platform_error_log("A foreground read latency target requires a limit "
+                         "on background IO.\n");
+      return STATUS_BAD_PARAM;
+   }
    return STATUS_OK;
 }
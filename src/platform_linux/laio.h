@@ -25,6 +25,17 @@
 #define LAIO_DEFAULT_EXTENT_SIZE                                               \
    (LAIO_DEFAULT_PAGES_PER_EXTENT * LAIO_DEFAULT_PAGE_SIZE)
 
+/*
+ * Background IO scheduling: the adaptive mode never scales the background
+ * rate below 1/LAIO_BG_MIN_RATE_DIVISOR of the configured limit, and ignores
+ * the foreground read latency once no foreground read has completed for
+ * LAIO_FG_LATENCY_WINDOW_NS. Throttled threads sleep in slices of at most
+ * LAIO_BG_THROTTLE_SLICE_NS, reaping their own completions in between.
+ */
+#define LAIO_BG_MIN_RATE_DIVISOR  (16)
+#define LAIO_FG_LATENCY_WINDOW_NS (100 * 1000 * 1000)
+#define LAIO_BG_THROTTLE_SLICE_NS (1000 * 1000)
+
 /*
  * Async IO Request structure: Each such request can track up to a configured
  * number of pages, io_config{}->async_max_pages, on which an IO is issued.
@@ -41,6 +52,8 @@ struct io_async_req {
    bool32         busy;         // request in-use flag
    uint64         bytes;        // total bytes in the IO request
    uint64         count;        // number of vector elements
+   io_class       cls;          // IO class of the issuing thread
+   timestamp      submit_time;  // when a foreground read was submitted
    struct iovec   iovec[];      // vector with IO offsets and size
 };
 
@@ -57,7 +70,24 @@ typedef struct laio_handle {
    uint64           req_hand[MAX_THREADS];
    platform_heap_id heap_id;
    int              fd; // File descriptor to Splinter device/file.
+
+   // IO scheduling, see io_class. bg_lock protects the background token
+   // bucket, whose tokens (bytes) go negative while it is in debt.
+   io_class          thread_class[MAX_THREADS];
+   platform_spinlock bg_lock;
+   int64             bg_tokens;
+   timestamp         bg_last_refill;
+   uint64            fg_read_latency_ns; // moving average
+   timestamp         fg_last_read;
+
+   // scheduling stats
+   uint64 bg_bytes;
+   uint64 bg_throttled_ns;
+   uint64 fg_reads;
 } laio_handle;
 
 platform_status
 laio_config_valid(io_config *cfg);
+
+uint64
+laio_bg_rate(laio_handle *io);
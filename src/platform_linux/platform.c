@@ -174,6 +174,22 @@ platform_buffer_deinit(buffer_handle *bh)
    return STATUS_OK;
 }
 
+/*
+ * platform_buffer_discard() - Release the memory backing a range of a buffer
+ * created by platform_buffer_init(). The range stays mapped, and reads back
+ * as zeroes if it is touched again.
+ */
+platform_status
+platform_buffer_discard(buffer_handle *bh, size_t offset, size_t length)
+{
+   debug_assert(offset + length <= bh->length);
+   int ret = madvise((char *)bh->addr + offset, length, MADV_REMOVE);
+   if (ret) {
+      return CONST_STATUS(errno);
+   }
+   return STATUS_OK;
+}
+
 /*
  * platform_thread_create() - External interface to create a Splinter thread.
  */
@@ -182,21 +198,38 @@ platform_thread_create(platform_thread       *thread,
                        bool32                 detached,
                        platform_thread_worker worker,
                        void                  *arg,
-                       platform_heap_id       UNUSED_PARAM(heap_id))
+                       platform_heap_id       heap_id)
 {
-   int ret;
+   return platform_thread_create_on(
+      thread, detached, worker, arg, heap_id, NULL);
+}
+
+platform_status
+platform_thread_create_on(platform_thread        *thread,
+                          bool32                  detached,
+                          platform_thread_worker  worker,
+                          void                   *arg,
+                          platform_heap_id        UNUSED_PARAM(heap_id),
+                          const platform_cpu_set *cpus)
+{
+   int            ret;
+   pthread_attr_t attr;
 
+   pthread_attr_init(&attr);
    if (detached) {
-      pthread_attr_t attr;
-      pthread_attr_init(&attr);
       size_t stacksize = 16UL * 1024UL;
       pthread_attr_setstacksize(&attr, stacksize);
       pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-      ret = pthread_create(thread, &attr, (void *(*)(void *))worker, arg);
-      pthread_attr_destroy(&attr);
-   } else {
-      ret = pthread_create(thread, NULL, (void *(*)(void *))worker, arg);
    }
+   if (cpus != NULL && platform_cpu_set_count(cpus) != 0) {
+      ret = pthread_attr_setaffinity_np(&attr, sizeof(*cpus), cpus);
+      if (ret != 0) {
+         pthread_attr_destroy(&attr);
+         return CONST_STATUS(ret);
+      }
+   }
+   ret = pthread_create(thread, &attr, (void *(*)(void *))worker, arg);
+   pthread_attr_destroy(&attr);
 
    return CONST_STATUS(ret);
 }
@@ -218,6 +251,110 @@ platform_thread_id_self()
    return pthread_self();
 }
 
+platform_status
+platform_get_cpu_ticks(uint64 *idle, uint64 *total)
+{
+   FILE *stat_file = fopen("/proc/stat", "r");
+   if (stat_file == NULL) {
+      return STATUS_NOTSUP;
+   }
+
+   // cpu user nice system idle iowait irq softirq steal
+   uint64 ticks[8] = {0};
+
+   int nread = fscanf(stat_file,
+                      "cpu %lu %lu %lu %lu %lu %lu %lu %lu",
+                      &ticks[0],
+                      &ticks[1],
+                      &ticks[2],
+                      &ticks[3],
+                      &ticks[4],
+                      &ticks[5],
+                      &ticks[6],
+                      &ticks[7]);
+   fclose(stat_file);
+   if (nread < 4) {
+      return STATUS_NOTSUP;
+   }
+
+   *idle  = ticks[3] + ticks[4];
+   *total = 0;
+   for (uint64 i = 0; i < ARRAY_SIZE(ticks); i++) {
+      *total += ticks[i];
+   }
+   return STATUS_OK;
+}
+
+/*
+ * Adds the CPUs in list, like "0-3,8,10-11", to set.
+ */
+static platform_status
+platform_cpu_set_add_list(const char *list, platform_cpu_set *set)
+{
+   const char *p = list;
+   while (*p != '\0' && *p != '\n') {
+      char         *end;
+      unsigned long first = strtoul(p, &end, 10);
+      unsigned long last  = first;
+      if (end == p) {
+         return STATUS_BAD_PARAM;
+      }
+      p = end;
+      if (*p == '-') {
+         p++;
+         last = strtoul(p, &end, 10);
+         if (end == p || last < first) {
+            return STATUS_BAD_PARAM;
+         }
+         p = end;
+      }
+      if (last >= CPU_SETSIZE) {
+         return STATUS_BAD_PARAM;
+      }
+      for (unsigned long cpu = first; cpu <= last; cpu++) {
+         CPU_SET(cpu, set);
+      }
+      if (*p == ',') {
+         p++;
+      } else if (*p != '\0' && *p != '\n') {
+         return STATUS_BAD_PARAM;
+      }
+   }
+   return STATUS_OK;
+}
+
+platform_status
+platform_cpu_set_parse(const char *cpus, platform_cpu_set *set)
+{
+   CPU_ZERO(set);
+   if (cpus == NULL || *cpus == '\0') {
+      return STATUS_OK;
+   }
+   if (strncmp(cpus, "node:", 5) != 0) {
+      return platform_cpu_set_add_list(cpus, set);
+   }
+
+   char         *end;
+   unsigned long node = strtoul(cpus + 5, &end, 10);
+   if (end == cpus + 5 || *end != '\0') {
+      return STATUS_BAD_PARAM;
+   }
+   char path[64];
+   snprintf(
+      path, sizeof(path), "/sys/devices/system/node/node%lu/cpulist", node);
+   FILE *list_file = fopen(path, "r");
+   if (list_file == NULL) {
+      return STATUS_NOT_FOUND;
+   }
+   char            list[1024];
+   platform_status rc = STATUS_IO_ERROR;
+   if (fgets(list, sizeof(list), list_file) != NULL) {
+      rc = platform_cpu_set_add_list(list, set);
+   }
+   fclose(list_file);
+   return rc;
+}
+
 platform_status
 platform_mutex_init(platform_mutex    *lock,
                     platform_module_id UNUSED_PARAM(module_id),
@@ -289,7 +426,8 @@ platform_spinlock_destroy(platform_spinlock *lock)
  *
  * These locks are allocated in batches of PLATFORM_CACHELINE_SIZE / 2, so that
  * the write lock and claim bits, as well as the distributed read counters, can
- * be colocated across the batch.
+ * be colocated across the batch. The read counters are striped by thread id,
+ * so a counter may count the read locks of several threads.
  *-----------------------------------------------------------------------------
  */
 
@@ -299,6 +437,14 @@ platform_batch_rwlock_init(platform_batch_rwlock *lock)
    ZERO_CONTENTS(lock);
 }
 
+// The calling thread's read counter for the lock_idx'th lock
+static inline volatile uint8 *
+platform_batch_rwlock_counter(platform_batch_rwlock *lock, uint64 lock_idx)
+{
+   threadid tid = platform_get_tid();
+   return &lock->read_counter[tid % PLATFORM_BATCH_RWLOCK_STRIPES][lock_idx];
+}
+
 /*
  *-----------------------------------------------------------------------------
  * lock/unlock
@@ -320,7 +466,7 @@ platform_batch_rwlock_lock(platform_batch_rwlock *lock, uint64 lock_idx)
                 "platform_batch_rwlock_lock: Attempt to lock a locked page.\n");
 
    uint64 wait = 1;
-   for (uint64 i = 0; i < MAX_THREADS; i++) {
+   for (uint64 i = 0; i < PLATFORM_BATCH_RWLOCK_STRIPES; i++) {
       while (lock->read_counter[i][lock_idx] != 0) {
          platform_sleep_ns(wait);
          wait = wait > 2048 ? wait : 2 * wait;
@@ -358,13 +504,12 @@ platform_batch_rwlock_full_unlock(platform_batch_rwlock *lock, uint64 lock_idx)
 bool32
 platform_batch_rwlock_try_claim(platform_batch_rwlock *lock, uint64 lock_idx)
 {
-   threadid tid = platform_get_tid();
-   debug_assert(lock->read_counter[tid][lock_idx]);
+   volatile uint8 *counter = platform_batch_rwlock_counter(lock, lock_idx);
+   debug_assert(*counter);
    if (__sync_lock_test_and_set(&lock->write_lock[lock_idx].claim, 1)) {
       return FALSE;
    }
-   debug_only uint8 old_counter =
-      __sync_fetch_and_sub(&lock->read_counter[tid][lock_idx], 1);
+   debug_only uint8 old_counter = __sync_fetch_and_sub(counter, 1);
    debug_assert(0 < old_counter);
    return TRUE;
 }
@@ -384,8 +529,8 @@ platform_batch_rwlock_claim_loop(platform_batch_rwlock *lock, uint64 lock_idx)
 void
 platform_batch_rwlock_unclaim(platform_batch_rwlock *lock, uint64 lock_idx)
 {
-   threadid tid = platform_get_tid();
-   __sync_fetch_and_add(&lock->read_counter[tid][lock_idx], 1);
+   volatile uint8 *counter = platform_batch_rwlock_counter(lock, lock_idx);
+   __sync_fetch_and_add(counter, 1);
    __sync_lock_release(&lock->write_lock[lock_idx].claim);
 }
 
@@ -400,21 +545,20 @@ platform_batch_rwlock_unclaim(platform_batch_rwlock *lock, uint64 lock_idx)
 void
 platform_batch_rwlock_get(platform_batch_rwlock *lock, uint64 lock_idx)
 {
-   threadid tid = platform_get_tid();
+   volatile uint8 *counter = platform_batch_rwlock_counter(lock, lock_idx);
    while (1) {
       uint64 wait = 1;
       while (lock->write_lock[lock_idx].lock) {
          platform_sleep_ns(wait);
          wait = wait > 2048 ? wait : 2 * wait;
       }
-      debug_only uint8 old_counter =
-         __sync_fetch_and_add(&lock->read_counter[tid][lock_idx], 1);
-      debug_assert(old_counter == 0);
+      debug_only uint8 old_counter = __sync_fetch_and_add(counter, 1);
+      debug_assert(old_counter < MAX_THREADS / PLATFORM_BATCH_RWLOCK_STRIPES);
       if (!lock->write_lock[lock_idx].lock) {
          return;
       }
-      old_counter = __sync_fetch_and_sub(&lock->read_counter[tid][lock_idx], 1);
-      debug_assert(old_counter == 1);
+      old_counter = __sync_fetch_and_sub(counter, 1);
+      debug_assert(old_counter != 0);
    }
    platform_assert(0);
 }
@@ -422,10 +566,9 @@ platform_batch_rwlock_get(platform_batch_rwlock *lock, uint64 lock_idx)
 void
 platform_batch_rwlock_unget(platform_batch_rwlock *lock, uint64 lock_idx)
 {
-   threadid         tid = platform_get_tid();
-   debug_only uint8 old_counter =
-      __sync_fetch_and_sub(&lock->read_counter[tid][lock_idx], 1);
-   debug_assert(old_counter == 1);
+   volatile uint8  *counter = platform_batch_rwlock_counter(lock, lock_idx);
+   debug_only uint8 old_counter = __sync_fetch_and_sub(counter, 1);
+   debug_assert(old_counter != 0);
 }
 
 
@@ -64,13 +64,14 @@ typedef int32 bool32;
 #define ARRAY_SIZE(x) ASSERT_EXPR(IS_ARRAY(x), (sizeof(x) / sizeof((x)[0])))
 
 /*
- * MAX_THREADS is used primarily for convenience, where allocations made on a
- * per-thread basis create an array with MAX_THREADS items, e.g. the
- * trunk_stats field in trunk_handle. The task subsystem also uses a 64-bit
- * bit-array to track thread IDs in use. This could be changed relatively
- * easily if needed.
+ * MAX_THREADS bounds the thread IDs handed out by the task subsystem, which
+ * tracks the IDs in use in a bit-array of MAX_THREADS bits. Small per-thread
+ * state, e.g. the trunk_stats field in trunk_handle, is kept in arrays of
+ * MAX_THREADS items. Larger per-thread state, e.g. btree scratch space, is
+ * allocated by each thread on first use, so it costs nothing for thread IDs
+ * that are never used.
  */
-#define MAX_THREADS (64)
+#define MAX_THREADS (512)
 #define INVALID_TID (MAX_THREADS)
 
 #define HASH_SEED (42)
@@ -686,6 +687,9 @@ platform_buffer_getaddr(const buffer_handle *bh);
 platform_status
 platform_buffer_deinit(buffer_handle *bh);
 
+platform_status
+platform_buffer_discard(buffer_handle *bh, size_t offset, size_t length);
+
 platform_status
 platform_mutex_init(platform_mutex    *mu,
                     platform_module_id module_id,
@@ -709,6 +713,18 @@ platform_thread_create(platform_thread       *thread,
                        void                  *arg,
                        platform_heap_id       heap_id);
 
+/*
+ * As platform_thread_create(), but the thread runs only on the CPUs in cpus,
+ * from its start, unless cpus is NULL or empty.
+ */
+platform_status
+platform_thread_create_on(platform_thread        *thread,
+                          bool32                  detached,
+                          platform_thread_worker  worker,
+                          void                   *arg,
+                          platform_heap_id        heap_id,
+                          const platform_cpu_set *cpus);
+
 platform_status
 platform_thread_join(platform_thread thread);
 
@@ -716,6 +732,21 @@ platform_thread_join(platform_thread thread);
 platform_thread
 platform_thread_id_self();
 
+/*
+ * The CPU time of the whole system since boot, in clock ticks: *idle is the
+ * time spent idle (or waiting for IO), *total that in any state.
+ */
+platform_status
+platform_get_cpu_ticks(uint64 *idle, uint64 *total);
+
+/*
+ * Parses cpus into set: either a list of CPUs and ranges of them, like
+ * "0-3,8,10-11", or "node:N" for the CPUs of NUMA node N. NULL or "" is the
+ * empty set.
+ */
+platform_status
+platform_cpu_set_parse(const char *cpus, platform_cpu_set *set);
+
 char *
 platform_strtok_r(char *str, const char *delim, platform_strtok_ctx *ctx);
 
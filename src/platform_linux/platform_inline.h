@@ -23,6 +23,18 @@ platform_popcount(uint32 x)
    return __builtin_popcount(x);
 }
 
+static inline uint64
+platform_cpu_set_count(const platform_cpu_set *set)
+{
+   return CPU_COUNT(set);
+}
+
+static inline bool32
+platform_cpu_set_contains(const platform_cpu_set *set, uint64 cpu)
+{
+   return cpu < CPU_SETSIZE && CPU_ISSET(cpu, set);
+}
+
 #define platform_checksum32  XXH32
 #define platform_checksum64  XXH64
 #define platform_checksum128 XXH128
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sched.h> // for cpu_set_t
 #include <semaphore.h>
 #include <stdlib.h>
 #include <string.h>
@@ -73,6 +74,9 @@ typedef void *List_Links;
 
 typedef pthread_t platform_thread;
 
+// A set of CPUs threads may be confined to. Empty means no confinement.
+typedef cpu_set_t platform_cpu_set;
+
 // Thread-specific mutex, with ownership tracking.
 typedef struct {
    pthread_mutex_t mutex;
@@ -88,14 +92,26 @@ typedef struct {
    volatile uint8 claim;
 } platform_claimlock;
 
+/*
+ * Each reader counts itself in the read counters of its stripe of threads,
+ * tid % PLATFORM_BATCH_RWLOCK_STRIPES, so the size of the lock does not grow
+ * with MAX_THREADS. Each stripe's counters are on their own cacheline.
+ */
+#define PLATFORM_BATCH_RWLOCK_STRIPES (32)
+
 typedef struct {
    platform_claimlock write_lock[PLATFORM_CACHELINE_SIZE / 2];
-   volatile uint8     read_counter[MAX_THREADS][PLATFORM_CACHELINE_SIZE / 2];
+   volatile uint8     read_counter[PLATFORM_BATCH_RWLOCK_STRIPES]
+                              [PLATFORM_CACHELINE_SIZE / 2];
 } PLATFORM_CACHELINE_ALIGNED platform_batch_rwlock;
 
 _Static_assert(sizeof(platform_batch_rwlock)
-                  == PLATFORM_CACHELINE_SIZE * (MAX_THREADS / 2 + 1),
+                  == PLATFORM_CACHELINE_SIZE
+                        * (PLATFORM_BATCH_RWLOCK_STRIPES / 2 + 1),
                "Missized platform_batch_rwlock\n");
+// Each thread holds at most one read lock on each lock in the batch
+_Static_assert(MAX_THREADS / PLATFORM_BATCH_RWLOCK_STRIPES <= UINT8_MAX,
+               "platform_batch_rwlock read counters may overflow\n");
 
 
 /*
@@ -34,6 +34,15 @@
  */
 #define SHOULD_TRACE(addr) (0) // Do not trace anything
 
+/*
+ * Default discard rate, and how often the discard thread looks for freed
+ * extents. The discard thread accumulates at most this many ns worth of
+ * its rate limit, to bound the size of a burst of discards.
+ */
+#define RC_ALLOCATOR_DEFAULT_DISCARD_BYTES_PER_SEC (256 * MiB)
+#define RC_ALLOCATOR_DISCARD_PERIOD_NS             (10 * MILLION)
+#define RC_ALLOCATOR_DISCARD_MAX_BURST_NS          (100 * MILLION)
+
 /*
  *------------------------------------------------------------------------------
  * Function declarations and virtual trampolines
@@ -222,6 +231,386 @@ rc_allocator_extent_number(rc_allocator *al, uint64 addr)
    return (addr / al->cfg->io_cfg->extent_size);
 }
 
+/*
+ *----------------------------------------------------------------------
+ * Free-extent bitmap and per-thread reservations
+ *----------------------------------------------------------------------
+ */
+static inline rc_allocator_reservation *
+rc_allocator_get_reservation(rc_allocator *al)
+{
+   return &al->reservation[MIN(platform_get_tid(), MAX_THREADS)];
+}
+
+static inline void
+rc_allocator_lock_reservation(rc_allocator_reservation *res)
+{
+   while (__sync_lock_test_and_set(&res->lock, 1)) {
+      platform_pause();
+   }
+}
+
+static inline void
+rc_allocator_unlock_reservation(rc_allocator_reservation *res)
+{
+   __sync_lock_release(&res->lock);
+}
+
+static platform_status
+rc_allocator_init_bitmap(rc_allocator *al)
+{
+   al->bitmap_words  = (al->cfg->max_extent_capacity + 63) / 64;
+   al->summary_words = (al->bitmap_words + 63) / 64;
+   al->free_bitmap =
+      TYPED_ARRAY_ZALLOC(al->heap_id, al->free_bitmap, al->bitmap_words);
+   if (al->free_bitmap == NULL) {
+      return STATUS_NO_MEMORY;
+   }
+   al->free_summary =
+      TYPED_ARRAY_ZALLOC(al->heap_id, al->free_summary, al->summary_words);
+   if (al->free_summary == NULL) {
+      platform_free(al->heap_id, al->free_bitmap);
+      return STATUS_NO_MEMORY;
+   }
+   for (uint64 tid = 0; tid <= MAX_THREADS; tid++) {
+      // Spread the threads out over the disk
+      al->reservation[tid].hand = tid * al->summary_words / (MAX_THREADS + 1);
+   }
+   return STATUS_OK;
+}
+
+static void
+rc_allocator_deinit_bitmap(rc_allocator *al)
+{
+   platform_free(al->heap_id, al->free_summary);
+   platform_free(al->heap_id, al->free_bitmap);
+}
+
+/*
+ * Marks an extent with a ref count of 0 as available for allocation.
+ *
+ * The summary bit is set after the bitmap bit, and is only cleared by
+ * rc_allocator_clear_summary(), which re-checks the bitmap word after
+ * clearing it. So a summary bit is never left clear over a free extent.
+ */
+static inline void
+rc_allocator_mark_free(rc_allocator *al, uint64 extent_no)
+{
+   uint64 word = extent_no / 64;
+   uint64 bit  = 1ULL << (word % 64);
+   __sync_fetch_and_or(&al->free_bitmap[word], 1ULL << (extent_no % 64));
+   if ((al->free_summary[word / 64] & bit) == 0) {
+      __sync_fetch_and_or(&al->free_summary[word / 64], bit);
+   }
+}
+
+static inline void
+rc_allocator_clear_summary(rc_allocator *al, uint64 word)
+{
+   uint64 bit = 1ULL << (word % 64);
+   __sync_fetch_and_and(&al->free_summary[word / 64], ~bit);
+   if (al->free_bitmap[word] != 0) {
+      __sync_fetch_and_or(&al->free_summary[word / 64], bit);
+   }
+}
+
+/*
+ * Claims up to max free extents from the given bitmap word, returning the
+ * number claimed.
+ */
+static uint64
+rc_allocator_claim_from_word(rc_allocator *al,
+                             uint64        word,
+                             uint64       *extents,
+                             uint64        max)
+{
+   uint64 free_bits = al->free_bitmap[word];
+   uint64 claimed   = 0;
+
+   while (free_bits != 0 && claimed == 0) {
+      // Take the lowest max free bits
+      uint64 mask = 0;
+      for (uint64 i = 0; i < max && free_bits != 0; i++) {
+         mask |= free_bits & -free_bits;
+         free_bits &= free_bits - 1;
+      }
+      uint64 old_bits = __sync_fetch_and_and(&al->free_bitmap[word], ~mask);
+      uint64 got      = old_bits & mask;
+      while (got != 0) {
+         extents[claimed++] = word * 64 + __builtin_ctzll(got);
+         got &= got - 1;
+      }
+      free_bits = old_bits & ~mask;
+   }
+
+   if (free_bits == 0) {
+      rc_allocator_clear_summary(al, word);
+   }
+   return claimed;
+}
+
+/*
+ * Scans the free bitmap starting at *hand and claims up to max free
+ * extents. *hand is left at the last summary word scanned.
+ */
+static uint64
+rc_allocator_reserve_extents(rc_allocator *al,
+                             uint64       *hand,
+                             uint64       *extents,
+                             uint64        max)
+{
+   uint64 found = 0;
+   uint64 s     = *hand % al->summary_words;
+
+   for (uint64 i = 0; i < al->summary_words; i++) {
+      s              = (*hand + i) % al->summary_words;
+      uint64 summary = al->free_summary[s];
+      while (summary != 0 && found < max) {
+         uint64 word = s * 64 + __builtin_ctzll(summary);
+         summary &= summary - 1;
+         found +=
+            rc_allocator_claim_from_word(al, word, extents + found, max - found);
+      }
+      if (found == max) {
+         break;
+      }
+   }
+   *hand = s;
+   return found;
+}
+
+/*
+ * Takes an extent out of some other thread's reservation. Only used when
+ * the free bitmap is empty.
+ */
+static bool32
+rc_allocator_steal_extent(rc_allocator *al, uint64 *extent_no)
+{
+   for (uint64 tid = 0; tid <= MAX_THREADS; tid++) {
+      rc_allocator_reservation *res = &al->reservation[tid];
+      if (res->next == res->count) {
+         continue;
+      }
+      rc_allocator_lock_reservation(res);
+      bool32 found = res->next < res->count;
+      if (found) {
+         *extent_no = res->extents[--res->count];
+      }
+      rc_allocator_unlock_reservation(res);
+      if (found) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+/*
+ * Allocates a specific extent, for the fixed-location extents set up by
+ * rc_allocator_init().
+ */
+static void
+rc_allocator_alloc_at(rc_allocator *al, uint64 extent_no, page_type type)
+{
+   rc_allocator_reservation *res  = rc_allocator_get_reservation(al);
+   uint64                    word = extent_no / 64;
+   uint64                    bit  = 1ULL << (extent_no % 64);
+
+   uint64 old_bits = __sync_fetch_and_and(&al->free_bitmap[word], ~bit);
+   platform_assert(old_bits & bit);
+   al->ref_count[extent_no] = 2;
+   __sync_add_and_fetch(&res->allocated, 1);
+   __sync_add_and_fetch(&res->extent_allocs[type], 1);
+}
+
+/*
+ *----------------------------------------------------------------------
+ * Discard of freed extents
+ *
+ *      When enabled, extents whose ref count drops to 0 are queued in
+ *      discard_bitmap. A background thread discards them on the device,
+ *      coalescing adjacent extents into one discard and limited to
+ *      discard_max_bytes_per_sec, and only then marks them free, so an
+ *      extent is never reallocated and rewritten before its discard.
+ *----------------------------------------------------------------------
+ */
+static inline void
+rc_allocator_release_extent(rc_allocator *al, uint64 extent_no)
+{
+   if (al->discard.running) {
+      __sync_fetch_and_or(&al->discard_bitmap[extent_no / 64],
+                          1ULL << (extent_no % 64));
+      __sync_add_and_fetch(&al->discard_pending, 1);
+   } else {
+      rc_allocator_mark_free(al, extent_no);
+   }
+}
+
+/*
+ * Takes up to max extents queued for discard in the given word, and
+ * returns them as a bit mask.
+ */
+static uint64
+rc_allocator_take_discards(rc_allocator *al, uint64 word, uint64 max)
+{
+   uint64 queued = al->discard_bitmap[word];
+   uint64 mask   = 0;
+   for (uint64 i = 0; i < max && queued != 0; i++) {
+      mask |= queued & -queued;
+      queued &= queued - 1;
+   }
+   if (mask == 0) {
+      return 0;
+   }
+   return __sync_fetch_and_and(&al->discard_bitmap[word], ~mask) & mask;
+}
+
+static void
+rc_allocator_discard_run(rc_allocator *al, uint64 start, uint64 count)
+{
+   uint64 extent_size = al->cfg->io_cfg->extent_size;
+
+   if (!al->discard.unsupported) {
+      platform_status rc =
+         io_discard(al->io, count * extent_size, start * extent_size);
+      if (SUCCESS(rc)) {
+         al->discard.discards_issued++;
+         al->discard.extents_discarded += count;
+      } else if (STATUS_IS_EQ(rc, STATUS_NOTSUP)) {
+         platform_error_log("Device does not support discard, "
+                            "freed extents will not be discarded.\n");
+         al->discard.unsupported = TRUE;
+      } else {
+         platform_error_log("Discard of %lu extents at %lu failed: %s\n",
+                            count,
+                            start * extent_size,
+                            platform_status_to_string(rc));
+      }
+   }
+
+   for (uint64 i = 0; i < count; i++) {
+      rc_allocator_mark_free(al, start + i);
+   }
+   __sync_sub_and_fetch(&al->discard_pending, count);
+}
+
+/*
+ * Discards up to max queued extents and returns the number discarded.
+ */
+static uint64
+rc_allocator_discard_queued(rc_allocator *al, uint64 max)
+{
+   uint64 discarded = 0;
+   uint64 run_start = 0;
+   uint64 run_count = 0;
+
+   for (uint64 word = 0; word < al->bitmap_words && discarded < max; word++) {
+      if (al->discard_bitmap[word] == 0) {
+         continue;
+      }
+      uint64 taken = rc_allocator_take_discards(al, word, max - discarded);
+      discarded += __builtin_popcountll(taken);
+      while (taken != 0) {
+         uint64 extent_no = word * 64 + __builtin_ctzll(taken);
+         taken &= taken - 1;
+         if (run_count != 0 && extent_no == run_start + run_count) {
+            run_count++;
+            continue;
+         }
+         if (run_count != 0) {
+            rc_allocator_discard_run(al, run_start, run_count);
+         }
+         run_start = extent_no;
+         run_count = 1;
+      }
+   }
+   if (run_count != 0) {
+      rc_allocator_discard_run(al, run_start, run_count);
+   }
+   return discarded;
+}
+
+/*
+ * Frees all queued extents without discarding them.
+ */
+static void
+rc_allocator_flush_discards(rc_allocator *al)
+{
+   for (uint64 word = 0; word < al->bitmap_words; word++) {
+      if (al->discard_bitmap[word] == 0) {
+         continue;
+      }
+      uint64 taken = __sync_fetch_and_and(&al->discard_bitmap[word], 0);
+      __sync_sub_and_fetch(&al->discard_pending, __builtin_popcountll(taken));
+      while (taken != 0) {
+         rc_allocator_mark_free(al, word * 64 + __builtin_ctzll(taken));
+         taken &= taken - 1;
+      }
+   }
+}
+
+static void
+rc_allocator_discard_thread(void *arg)
+{
+   rc_allocator *al          = (rc_allocator *)arg;
+   uint64        extent_size = al->cfg->io_cfg->extent_size;
+   uint64        rate        = al->cfg->discard_max_bytes_per_sec;
+   if (rate == 0) {
+      rate = RC_ALLOCATOR_DEFAULT_DISCARD_BYTES_PER_SEC;
+   }
+   uint64 extents_per_sec = MAX(rate / extent_size, 1);
+   uint64 max_tokens      = MAX(
+      extents_per_sec * RC_ALLOCATOR_DISCARD_MAX_BURST_NS / SEC_TO_NSEC(1), 1);
+   uint64    tokens      = max_tokens;
+   timestamp last_refill = platform_get_timestamp();
+
+   while (!al->discard.stop) {
+      uint64 elapsed_ns = platform_timestamp_elapsed(last_refill);
+      uint64 refill     = elapsed_ns * extents_per_sec / SEC_TO_NSEC(1);
+      if (refill != 0) {
+         tokens      = MIN(tokens + refill, max_tokens);
+         last_refill = platform_get_timestamp();
+      }
+      if (al->discard_pending > 0 && tokens != 0) {
+         tokens -= rc_allocator_discard_queued(al, tokens);
+      }
+      platform_sleep_ns(RC_ALLOCATOR_DISCARD_PERIOD_NS);
+   }
+}
+
+static platform_status
+rc_allocator_start_discard(rc_allocator *al)
+{
+   al->discard_bitmap =
+      TYPED_ARRAY_ZALLOC(al->heap_id, al->discard_bitmap, al->bitmap_words);
+   if (al->discard_bitmap == NULL) {
+      return STATUS_NO_MEMORY;
+   }
+   al->discard.running = TRUE;
+   platform_status rc  = platform_thread_create(&al->discard.thread,
+                                               FALSE,
+                                               rc_allocator_discard_thread,
+                                               al,
+                                               al->heap_id);
+   if (!SUCCESS(rc)) {
+      al->discard.running = FALSE;
+      platform_free(al->heap_id, al->discard_bitmap);
+   }
+   return rc;
+}
+
+static void
+rc_allocator_stop_discard(rc_allocator *al)
+{
+   if (!al->discard.running) {
+      return;
+   }
+   al->discard.stop = TRUE;
+   platform_thread_join(al->discard.thread);
+   al->discard.running = FALSE;
+   rc_allocator_flush_discards(al);
+   platform_free(al->heap_id, al->discard_bitmap);
+}
+
 static platform_status
 rc_allocator_init_meta_page(rc_allocator *al)
 {
@@ -251,10 +640,34 @@ rc_allocator_init_meta_page(rc_allocator *al)
    memset(al->meta_page->splinters,
           INVALID_ALLOCATOR_ROOT_ID,
           sizeof(al->meta_page->splinters));
+   al->meta_page->capacity     = al->cfg->capacity;
+   al->meta_page->max_capacity = al->cfg->max_capacity;
 
    return STATUS_OK;
 }
 
+static checksum128
+rc_allocator_meta_page_checksum(rc_allocator *al)
+{
+   return platform_checksum128(al->meta_page,
+                               offsetof(rc_allocator_meta_page, checksum),
+                               RC_ALLOCATOR_META_PAGE_CSUM_SEED);
+}
+
+/*
+ * Checksums and writes out the meta page. Called with al->lock held.
+ */
+static void
+rc_allocator_write_meta_page(rc_allocator *al)
+{
+   al->meta_page->checksum = rc_allocator_meta_page_checksum(al);
+   platform_status status  = io_write(al->io,
+                                     al->meta_page,
+                                     al->cfg->io_cfg->page_size,
+                                     RC_ALLOCATOR_BASE_OFFSET);
+   platform_assert_status_ok(status);
+}
+
 /*
  *----------------------------------------------------------------------
  * rc_allocator_valid_config() --
@@ -296,6 +709,18 @@ rc_allocator_valid_config(allocator_config *cfg)
       return STATUS_BAD_PARAM;
    }
 
+   if (cfg->max_capacity < cfg->capacity
+       || cfg->max_capacity % cfg->io_cfg->extent_size != 0)
+   {
+      platform_error_log("Configured max disk size, %lu bytes, is not an"
+                         " integral multiple of extent size, %lu bytes,"
+                         " of at least the disk size, %lu bytes.\n",
+                         cfg->max_capacity,
+                         cfg->io_cfg->extent_size,
+                         cfg->capacity);
+      return STATUS_BAD_PARAM;
+   }
+
    // Assert: Disk size == (extent-size * #-of-extents)
    if (cfg->capacity != (cfg->io_cfg->extent_size * cfg->extent_capacity)) {
       platform_error_log("Configured disk size, %lu bytes, is not an integral"
@@ -325,7 +750,6 @@ rc_allocator_init(rc_allocator      *al,
                   platform_module_id mid)
 {
    uint64          rc_extent_count;
-   uint64          addr;
    platform_status rc;
    platform_assert(al != NULL);
    ZERO_CONTENTS(al);
@@ -350,8 +774,12 @@ rc_allocator_init(rc_allocator      *al,
       platform_mutex_destroy(&al->lock);
       return rc;
    }
-   // To ensure alignment always allocate in multiples of page size.
-   uint64 buffer_size = cfg->extent_capacity * sizeof(uint8);
+   /*
+    * To ensure alignment always allocate in multiples of page size. The ref
+    * count map, both in memory and on disk, is sized for max_capacity so
+    * that the allocator can grow in place.
+    */
+   uint64 buffer_size = cfg->max_extent_capacity * sizeof(uint8);
    buffer_size        = ROUNDUP(buffer_size, cfg->io_cfg->page_size);
    rc                 = platform_buffer_init(&al->bh, buffer_size);
    if (!SUCCESS(rc)) {
@@ -363,10 +791,22 @@ rc_allocator_init(rc_allocator      *al,
    al->ref_count = platform_buffer_getaddr(&al->bh);
    memset(al->ref_count, 0, buffer_size);
 
-   // allocate the super block
-   allocator_alloc(&al->super, &addr, PAGE_TYPE_SUPERBLOCK);
-   // super block extent should always start from address 0.
-   platform_assert(addr == RC_ALLOCATOR_BASE_OFFSET);
+   rc = rc_allocator_init_bitmap(al);
+   if (!SUCCESS(rc)) {
+      platform_buffer_deinit(&al->bh);
+      platform_mutex_destroy(&al->lock);
+      platform_free(al->heap_id, al->meta_page);
+      platform_error_log("Failed to create free bitmap for rc allocator\n");
+      return rc;
+   }
+   for (uint64 i = 0; i < cfg->extent_capacity; i++) {
+      rc_allocator_mark_free(al, i);
+   }
+
+   // allocate the super block, which always starts from address 0.
+   rc_allocator_alloc_at(al,
+                         RC_ALLOCATOR_BASE_OFFSET / cfg->io_cfg->extent_size,
+                         PAGE_TYPE_SUPERBLOCK);
 
    /*
     * Allocate room for the ref counts, use same rounded up size used in buffer
@@ -375,8 +815,17 @@ rc_allocator_init(rc_allocator      *al,
    rc_extent_count = (buffer_size + al->cfg->io_cfg->extent_size - 1)
                      / al->cfg->io_cfg->extent_size;
    for (uint64 i = 0; i < rc_extent_count; i++) {
-      allocator_alloc(&al->super, &addr, PAGE_TYPE_SUPERBLOCK);
-      platform_assert(addr == cfg->io_cfg->extent_size * (i + 1));
+      rc_allocator_alloc_at(al, i + 1, PAGE_TYPE_SUPERBLOCK);
+   }
+   al->max_allocated = rc_allocator_in_use(al);
+
+   if (cfg->use_discard && io != NULL) {
+      rc = rc_allocator_start_discard(al);
+      if (!SUCCESS(rc)) {
+         platform_error_log("Failed to start discard thread for allocator\n");
+         rc_allocator_deinit(al);
+         return rc;
+      }
    }
 
    return STATUS_OK;
@@ -385,6 +834,8 @@ rc_allocator_init(rc_allocator      *al,
 void
 rc_allocator_deinit(rc_allocator *al)
 {
+   rc_allocator_stop_discard(al);
+   rc_allocator_deinit_bitmap(al);
    platform_buffer_deinit(&al->bh);
    al->ref_count = NULL;
    platform_mutex_destroy(&al->lock);
@@ -428,13 +879,40 @@ rc_allocator_mount(rc_allocator      *al,
       return status;
    }
 
+   // load the meta page from disk.
+   status = io_read(
+      io, al->meta_page, al->cfg->io_cfg->page_size, RC_ALLOCATOR_BASE_OFFSET);
+   platform_assert_status_ok(status);
+   // validate the checksum of the meta page.
+   checksum128 currChecksum = rc_allocator_meta_page_checksum(al);
+   if (!platform_checksum_is_equal(al->meta_page->checksum, currChecksum)) {
+      platform_assert(0, "Corrupt Meta Page upon mount");
+   }
+
+   /*
+    * The on-disk layout was fixed by the max capacity at creation, and the
+    * disk may have grown since. A larger configured disk size grows it.
+    */
+   allocator_config_set_max_capacity(cfg, al->meta_page->max_capacity);
+   if (cfg->capacity < al->meta_page->capacity) {
+      allocator_config_set_capacity(cfg, al->meta_page->capacity);
+   }
+   platform_assert(cfg->capacity <= cfg->max_capacity,
+                   "Disk size %lu exceeds the max disk size %lu",
+                   cfg->capacity,
+                   cfg->max_capacity);
+   if (al->meta_page->capacity != cfg->capacity) {
+      al->meta_page->capacity = cfg->capacity;
+      rc_allocator_write_meta_page(al);
+   }
+
    platform_assert(cfg->io_cfg->page_size % 4096 == 0);
    platform_assert(cfg->capacity
                    == cfg->io_cfg->extent_size * cfg->extent_capacity);
    platform_assert(cfg->capacity
                    == cfg->io_cfg->page_size * cfg->page_capacity);
 
-   uint64 buffer_size = cfg->extent_capacity * sizeof(uint8);
+   uint64 buffer_size = cfg->max_extent_capacity * sizeof(uint8);
    buffer_size        = ROUNDUP(buffer_size, cfg->io_cfg->page_size);
    status             = platform_buffer_init(&al->bh, buffer_size);
    if (!SUCCESS(status)) {
@@ -445,28 +923,33 @@ rc_allocator_mount(rc_allocator      *al,
    }
    al->ref_count = platform_buffer_getaddr(&al->bh);
 
-   // load the meta page from disk.
-   status = io_read(
-      io, al->meta_page, al->cfg->io_cfg->page_size, RC_ALLOCATOR_BASE_OFFSET);
-   platform_assert_status_ok(status);
-   // validate the checksum of the meta page.
-   checksum128 currChecksum =
-      platform_checksum128(al->meta_page,
-                           sizeof(al->meta_page->splinters),
-                           RC_ALLOCATOR_META_PAGE_CSUM_SEED);
-   if (!platform_checksum_is_equal(al->meta_page->checksum, currChecksum)) {
-      platform_assert(0, "Corrupt Meta Page upon mount");
-   }
-
    // load the ref counts from disk.
-   uint32 io_size =
-      ROUNDUP(al->cfg->extent_capacity, al->cfg->io_cfg->page_size);
-   status = io_read(io, al->ref_count, io_size, cfg->io_cfg->extent_size);
+   status = io_read(io, al->ref_count, buffer_size, cfg->io_cfg->extent_size);
    platform_assert_status_ok(status);
 
+   status = rc_allocator_init_bitmap(al);
+   if (!SUCCESS(status)) {
+      platform_buffer_deinit(&al->bh);
+      platform_free(al->heap_id, al->meta_page);
+      platform_mutex_destroy(&al->lock);
+      platform_error_log("Failed to create free bitmap for rc allocator\n");
+      return status;
+   }
    for (uint64 i = 0; i < al->cfg->extent_capacity; i++) {
       if (al->ref_count[i] != 0) {
-         al->stats.curr_allocated++;
+         al->mount_allocated++;
+      } else {
+         rc_allocator_mark_free(al, i);
+      }
+   }
+   al->max_allocated = al->mount_allocated;
+
+   if (cfg->use_discard) {
+      status = rc_allocator_start_discard(al);
+      if (!SUCCESS(status)) {
+         platform_error_log("Failed to start discard thread for allocator\n");
+         rc_allocator_deinit(al);
+         return status;
       }
    }
    return STATUS_OK;
@@ -479,8 +962,8 @@ rc_allocator_unmount(rc_allocator *al)
    platform_status status;
 
    // persist the ref counts upon unmount.
-   uint32 io_size =
-      ROUNDUP(al->cfg->extent_capacity, al->cfg->io_cfg->page_size);
+   uint64 io_size =
+      ROUNDUP(al->cfg->max_extent_capacity, al->cfg->io_cfg->page_size);
    status =
       io_write(al->io, al->ref_count, io_size, al->cfg->io_cfg->extent_size);
    platform_assert_status_ok(status);
@@ -538,8 +1021,10 @@ rc_allocator_dec_ref(rc_allocator *al, uint64 addr, page_type type)
 
    if (ref_count == 0) {
       platform_assert(type != PAGE_TYPE_INVALID);
-      __sync_sub_and_fetch(&al->stats.curr_allocated, 1);
-      __sync_add_and_fetch(&al->stats.extent_deallocs[type], 1);
+      rc_allocator_reservation *res = rc_allocator_get_reservation(al);
+      __sync_sub_and_fetch(&res->allocated, 1);
+      __sync_add_and_fetch(&res->extent_deallocs[type], 1);
+      rc_allocator_release_extent(al, extent_no);
    }
    if (SHOULD_TRACE(addr)) {
       platform_default_log("rc_allocator_dec_ref(%lu): %d -> %d\n",
@@ -609,15 +1094,7 @@ rc_allocator_alloc_super_addr(rc_allocator     *al,
          // assign the first available slot and update the on disk metadata.
          al->meta_page->splinters[idx] = allocator_root_id;
          *addr                         = (1 + idx) * al->cfg->io_cfg->page_size;
-         al->meta_page->checksum =
-            platform_checksum128(al->meta_page,
-                                 sizeof(al->meta_page->splinters),
-                                 RC_ALLOCATOR_META_PAGE_CSUM_SEED);
-         platform_status io_status = io_write(al->io,
-                                              al->meta_page,
-                                              al->cfg->io_cfg->page_size,
-                                              RC_ALLOCATOR_BASE_OFFSET);
-         platform_assert_status_ok(io_status);
+         rc_allocator_write_meta_page(al);
          status = STATUS_OK;
          break;
       }
@@ -640,15 +1117,7 @@ rc_allocator_remove_super_addr(rc_allocator     *al,
        */
       if (al->meta_page->splinters[idx] == allocator_root_id) {
          al->meta_page->splinters[idx] = INVALID_ALLOCATOR_ROOT_ID;
-         al->meta_page->checksum =
-            platform_checksum128(al->meta_page,
-                                 sizeof(al->meta_page->splinters),
-                                 RC_ALLOCATOR_META_PAGE_CSUM_SEED);
-         platform_status status = io_write(al->io,
-                                           al->meta_page,
-                                           al->cfg->io_cfg->page_size,
-                                           RC_ALLOCATOR_BASE_OFFSET);
-         platform_assert_status_ok(status);
+         rc_allocator_write_meta_page(al);
          platform_mutex_unlock(&al->lock);
          return;
       }
@@ -684,11 +1153,102 @@ rc_allocator_get_config(rc_allocator *al)
    return al->cfg;
 }
 
+/*
+ *----------------------------------------------------------------------
+ * rc_allocator_grow --
+ *
+ *      Grows the disk to the given capacity, which must be a multiple of
+ *      the extent size and at most max_capacity. The new capacity is
+ *      persisted in the meta page. Shrinking is not supported.
+ *
+ *      Writes beyond the end of a file extend it, so growing a file needs
+ *      no IO beyond the meta page. A block device must already be large
+ *      enough.
+ *----------------------------------------------------------------------
+ */
+static platform_status
+rc_allocator_grow_locked(rc_allocator *al, uint64 capacity)
+{
+   allocator_config *cfg = al->cfg;
+
+   if (capacity % cfg->io_cfg->extent_size != 0 || capacity < cfg->capacity
+       || capacity > cfg->max_capacity)
+   {
+      return STATUS_BAD_PARAM;
+   }
+   if (capacity == cfg->capacity) {
+      return STATUS_OK;
+   }
+
+   if (al->grow_callback != NULL) {
+      al->grow_callback(al->grow_arg, capacity);
+   }
+   uint64 old_extent_capacity = cfg->extent_capacity;
+   allocator_config_set_capacity(cfg, capacity);
+   for (uint64 i = old_extent_capacity; i < cfg->extent_capacity; i++) {
+      rc_allocator_mark_free(al, i);
+   }
+
+   al->meta_page->capacity = capacity;
+   rc_allocator_write_meta_page(al);
+   return STATUS_OK;
+}
+
+platform_status
+rc_allocator_grow(rc_allocator *al, uint64 capacity)
+{
+   platform_mutex_lock(&al->lock);
+   platform_status rc = rc_allocator_grow_locked(al, capacity);
+   platform_mutex_unlock(&al->lock);
+   return rc;
+}
+
+void
+rc_allocator_set_grow_callback(rc_allocator        *al,
+                               rc_allocator_grow_fn callback,
+                               void                *arg)
+{
+   platform_mutex_lock(&al->lock);
+   al->grow_callback = callback;
+   al->grow_arg      = arg;
+   platform_mutex_unlock(&al->lock);
+}
+
+/*
+ * Grows the disk by grow_increment (up to max_capacity) after an allocation
+ * found it full at the given capacity. Returns TRUE if the disk has grown
+ * since, whether by this thread or by another.
+ */
+static bool32
+rc_allocator_auto_grow(rc_allocator *al, uint64 full_capacity)
+{
+   allocator_config *cfg = al->cfg;
+
+   if (cfg->grow_increment == 0) {
+      return FALSE;
+   }
+   platform_mutex_lock(&al->lock);
+   if (cfg->capacity == full_capacity && cfg->capacity < cfg->max_capacity) {
+      uint64 increment =
+         ROUNDUP(cfg->grow_increment, cfg->io_cfg->extent_size);
+      uint64 capacity = MIN(cfg->capacity + increment, cfg->max_capacity);
+      platform_default_log("Growing disk from %s to %s.\n",
+                           size_str(cfg->capacity),
+                           size_str(capacity));
+      platform_status rc = rc_allocator_grow_locked(al, capacity);
+      platform_assert_status_ok(rc);
+   }
+   bool32 grown = cfg->capacity > full_capacity;
+   platform_mutex_unlock(&al->lock);
+   return grown;
+}
+
 /*
  *----------------------------------------------------------------------
  * rc_allocator_alloc--
  *
- *      Allocate an extent
+ *      Allocate an extent. The extent is taken from the calling thread's
+ *      reservation, which is refilled from the free bitmap when empty.
  *----------------------------------------------------------------------
  */
 platform_status
@@ -696,18 +1256,41 @@ rc_allocator_alloc(rc_allocator *al,   // IN
                    uint64       *addr, // OUT
                    page_type     type)     // IN
 {
-   uint64 first_hand = al->hand % al->cfg->extent_capacity;
-   uint64 hand;
-   bool32 extent_is_free = FALSE;
+   rc_allocator_reservation *res      = rc_allocator_get_reservation(al);
+   uint64                    capacity = al->cfg->capacity;
+   uint64                    extent_no;
+   bool32                    extent_is_free = FALSE;
+   bool32                    refilled       = FALSE;
+
+   rc_allocator_lock_reservation(res);
+   if (res->next == res->count) {
+      res->next  = 0;
+      res->count = rc_allocator_reserve_extents(
+         al, &res->hand, res->extents, RC_ALLOCATOR_RESERVE_EXTENTS);
+      refilled = TRUE;
+   }
+   if (res->next < res->count) {
+      extent_no      = res->extents[res->next++];
+      extent_is_free = TRUE;
+   }
+   rc_allocator_unlock_reservation(res);
 
-   do {
-      hand = __sync_fetch_and_add(&al->hand, 1) % al->cfg->extent_capacity;
-      if (al->ref_count[hand] == 0) {
-         extent_is_free =
-            __sync_bool_compare_and_swap(&al->ref_count[hand], 0, 2);
-      }
-   } while (!extent_is_free
-            && (hand + 1) % al->cfg->extent_capacity != first_hand);
+   if (!extent_is_free) {
+      extent_is_free = rc_allocator_steal_extent(al, &extent_no);
+   }
+   if (!extent_is_free && al->discard_pending > 0) {
+      // Rather skip the discards than fail the allocation
+      uint64 hand = 0;
+      rc_allocator_flush_discards(al);
+      extent_is_free =
+         rc_allocator_reserve_extents(al, &hand, &extent_no, 1) == 1;
+   }
+   while (!extent_is_free && rc_allocator_auto_grow(al, capacity)) {
+      uint64 hand = capacity / al->cfg->io_cfg->extent_size / 64 / 64;
+      capacity    = al->cfg->capacity;
+      extent_is_free =
+         rc_allocator_reserve_extents(al, &hand, &extent_no, 1) == 1;
+   }
 
    // Error out if no extent is free; allocation fails.
    if (!extent_is_free) {
@@ -716,19 +1299,28 @@ rc_allocator_alloc(rc_allocator *al,   // IN
          " allocated %lu out of %lu extents.\n",
          type,
          page_type_str[type],
-         al->stats.curr_allocated,
+         rc_allocator_in_use(al),
          al->cfg->extent_capacity);
       return STATUS_NO_SPACE;
    }
-   int64 curr_allocated = __sync_add_and_fetch(&al->stats.curr_allocated, 1);
-   int64 max_allocated  = al->stats.max_allocated;
-   while (curr_allocated > max_allocated) {
-      __sync_bool_compare_and_swap(
-         &al->stats.max_allocated, max_allocated, curr_allocated);
-      max_allocated = al->stats.max_allocated;
+
+   platform_assert(al->ref_count[extent_no] == 0);
+   al->ref_count[extent_no] = 2;
+   __sync_add_and_fetch(&res->allocated, 1);
+   __sync_add_and_fetch(&res->extent_allocs[type], 1);
+
+   // The high-water mark is only sampled when a reservation is refilled.
+   if (refilled) {
+      int64 curr_allocated = rc_allocator_in_use(al);
+      int64 max_allocated  = al->max_allocated;
+      while (curr_allocated > max_allocated) {
+         __sync_bool_compare_and_swap(
+            &al->max_allocated, max_allocated, curr_allocated);
+         max_allocated = al->max_allocated;
+      }
    }
-   __sync_add_and_fetch(&al->stats.extent_allocs[type], 1);
-   *addr = hand * al->cfg->io_cfg->extent_size;
+
+   *addr = extent_no * al->cfg->io_cfg->extent_size;
    if (SHOULD_TRACE(*addr)) {
       platform_default_log(
          "rc_allocator_alloc_extent %12lu (%s)\n", *addr, page_type_str[type]);
@@ -747,7 +1339,33 @@ rc_allocator_alloc(rc_allocator *al,   // IN
 uint64
 rc_allocator_in_use(rc_allocator *al)
 {
-   return al->stats.curr_allocated;
+   int64 curr_allocated = al->mount_allocated;
+   for (uint64 tid = 0; tid <= MAX_THREADS; tid++) {
+      curr_allocated += al->reservation[tid].allocated;
+   }
+   return curr_allocated;
+}
+
+/*
+ *----------------------------------------------------------------------
+ * rc_allocator_get_stats --
+ *
+ *      Sums the per-thread allocation stats.
+ *----------------------------------------------------------------------
+ */
+void
+rc_allocator_get_stats(rc_allocator *al, rc_allocator_stats *stats)
+{
+   ZERO_CONTENTS(stats);
+   stats->curr_allocated = rc_allocator_in_use(al);
+   stats->max_allocated  = MAX(al->max_allocated, stats->curr_allocated);
+   for (uint64 tid = 0; tid <= MAX_THREADS; tid++) {
+      rc_allocator_reservation *res = &al->reservation[tid];
+      for (page_type type = PAGE_TYPE_FIRST; type < NUM_PAGE_TYPES; type++) {
+         stats->extent_allocs[type] += res->extent_allocs[type];
+         stats->extent_deallocs[type] += res->extent_deallocs[type];
+      }
+   }
 }
 
 /*
@@ -763,12 +1381,14 @@ rc_allocator_in_use(rc_allocator *al)
 void
 rc_allocator_assert_noleaks(rc_allocator *al)
 {
+   rc_allocator_stats stats;
+   rc_allocator_get_stats(al, &stats);
    for (page_type type = PAGE_TYPE_FIRST; type < NUM_PAGE_TYPES; type++) {
       // Log pages and super-block page are never deallocated.
       if ((type == PAGE_TYPE_LOG) || (type == PAGE_TYPE_SUPERBLOCK)) {
          continue;
       }
-      if (al->stats.extent_allocs[type] != al->stats.extent_deallocs[type]) {
+      if (stats.extent_allocs[type] != stats.extent_deallocs[type]) {
          platform_default_log("assert_noleaks: leak found\n");
          platform_default_log("\n");
          rc_allocator_print_stats(al);
@@ -797,16 +1417,25 @@ rc_allocator_print_stats(rc_allocator *al)
    platform_default_log("|%s|\n", dashes);
    // clang-format on
 
+   rc_allocator_stats stats;
+   rc_allocator_get_stats(al, &stats);
    uint64 extent_size = al->cfg->io_cfg->extent_size; // bytes
    platform_default_log(
       "| Currently Allocated: %12lu extents %-14s          |\n",
-      al->stats.curr_allocated,
-      size_fmtstr("(%s)", (al->stats.curr_allocated * extent_size)));
+      stats.curr_allocated,
+      size_fmtstr("(%s)", (stats.curr_allocated * extent_size)));
 
    platform_default_log(
       "| Max Allocated:       %12lu extents %-14s          |\n",
-      al->stats.max_allocated,
-      size_fmtstr("(%s)", (al->stats.max_allocated * extent_size)));
+      stats.max_allocated,
+      size_fmtstr("(%s)", (stats.max_allocated * extent_size)));
+
+   if (al->discard.running) {
+      platform_default_log(
+         "| Discarded:           %12lu extents %-14s          |\n",
+         al->discard.extents_discarded,
+         size_fmtstr("(%s)", (al->discard.extents_discarded * extent_size)));
+   }
 
    // clang-format off
    platform_default_log("|%s|\n", dashes);
@@ -818,8 +1447,8 @@ rc_allocator_print_stats(rc_allocator *al)
    int64 exp_allocated_count = 0;
    for (page_type type = PAGE_TYPE_FIRST; type < NUM_PAGE_TYPES; type++) {
       const char *str       = page_type_str[type];
-      int64       allocs    = al->stats.extent_allocs[type];
-      int64       deallocs  = al->stats.extent_deallocs[type];
+      int64       allocs    = stats.extent_allocs[type];
+      int64       deallocs  = stats.extent_deallocs[type];
       int64       footprint = allocs - deallocs;
 
       exp_allocated_count += footprint;
@@ -851,7 +1480,7 @@ rc_allocator_print_allocated(rc_allocator *al)
 {
    uint64 i;
    uint8  ref;
-   uint64 nallocated = al->stats.curr_allocated;
+   uint64 nallocated = rc_allocator_in_use(al);
 
    // For more than a few allocated extents, print enclosing { } tags.
    bool32 print_curly = (nallocated > 20);
@@ -32,12 +32,20 @@
  */
 typedef struct ONDISK rc_allocator_meta_page {
    allocator_root_id splinters[RC_ALLOCATOR_MAX_ROOT_IDS];
+   uint64            capacity;     // current disk size, in bytes
+   uint64            max_capacity; // sizes the on-disk ref count map
    checksum128       checksum;
 } rc_allocator_meta_page;
 
 _Static_assert(offsetof(rc_allocator_meta_page, splinters) == 0,
                "splinters array should be first field in meta_page struct");
 
+/*
+ * Called when the allocator grows, before any extent of the new capacity
+ * is handed out.
+ */
+typedef void (*rc_allocator_grow_fn)(void *arg, uint64 capacity);
+
 /*
  *----------------------------------------------------------------------
  * rc_allocator_stats --
@@ -50,9 +58,50 @@ typedef struct rc_allocator_stats {
    int64 extent_deallocs[NUM_PAGE_TYPES];
 } rc_allocator_stats;
 
+/*
+ * Number of free extents a thread takes from the shared free bitmap at a
+ * time. Allocations are served out of this per-thread reservation, so the
+ * shared bitmap is only touched once every RC_ALLOCATOR_RESERVE_EXTENTS
+ * allocations.
+ */
+#define RC_ALLOCATOR_RESERVE_EXTENTS (16)
+
+/*
+ *----------------------------------------------------------------------
+ * rc_allocator_reservation --
+ *
+ *  Per-thread reservation of free extents, along with the allocation
+ *  stats of that thread. Extents in a reservation have a ref count of 0
+ *  but are not marked free in the bitmap, so no other thread will hand
+ *  them out, except by stealing them when the disk is otherwise full.
+ *
+ *  Threads without a thread id share the last slot, so the extents are
+ *  protected by a (normally uncontended) spin lock.
+ *----------------------------------------------------------------------
+ */
+typedef struct rc_allocator_reservation {
+   volatile bool32 lock;
+   uint64          hand; // summary word at which to resume the bitmap scan
+   uint64          next;
+   uint64          count;
+   uint64          extents[RC_ALLOCATOR_RESERVE_EXTENTS];
+
+   // Stats, summed over all threads by rc_allocator_get_stats()
+   int64 allocated; // allocs - deallocs done by this thread
+   int64 extent_allocs[NUM_PAGE_TYPES];
+   int64 extent_deallocs[NUM_PAGE_TYPES];
+} PLATFORM_CACHELINE_ALIGNED rc_allocator_reservation;
+
 /*
  *----------------------------------------------------------------------
  * rc_allocator -- Ref Count allocator context structure.
+ *
+ *  Free extents are tracked in a two-level bitmap: bit i of free_bitmap
+ *  is set iff extent i has a ref count of 0 and is not reserved by any
+ *  thread, and bit j of free_summary is set if word j of free_bitmap may
+ *  have any bits set. Threads refill their reservations by scanning the
+ *  summary a word at a time and claiming whole runs of free bits with a
+ *  single atomic op.
  *----------------------------------------------------------------------
  */
 typedef struct rc_allocator {
@@ -60,19 +109,44 @@ typedef struct rc_allocator {
    allocator_config       *cfg;
    buffer_handle           bh;
    uint8                  *ref_count;
-   uint64                  hand;
    io_handle              *io;
    rc_allocator_meta_page *meta_page;
 
+   uint64 *free_bitmap;
+   uint64 *free_summary;
+   uint64  bitmap_words;
+   uint64  summary_words;
+
+   /*
+    * mutex to synchronize updates to the meta page: super block addresses
+    * of the splinter tables and the capacity.
+    */
+   platform_mutex       lock;
+   platform_heap_id     heap_id;
+   rc_allocator_grow_fn grow_callback;
+   void                *grow_arg;
+
+   // # of extents found allocated at mount
+   int64          mount_allocated;
+   volatile int64 max_allocated;
+
    /*
-    * mutex to synchronize updates to super block addresses of the splinter
-    * tables in the meta page.
+    * Extents which were freed while discard is enabled are set in
+    * discard_bitmap instead of free_bitmap, and only become free once the
+    * discard thread has discarded them on the device.
     */
-   platform_mutex   lock;
-   platform_heap_id heap_id;
+   uint64        *discard_bitmap;
+   volatile int64 discard_pending;
+   struct {
+      volatile bool32 stop;
+      bool32          running;
+      bool32          unsupported;
+      platform_thread thread;
+      uint64          extents_discarded;
+      uint64          discards_issued;
+   } discard;
 
-   // Stats -- not distributed for now
-   rc_allocator_stats stats;
+   rc_allocator_reservation reservation[MAX_THREADS + 1];
 } rc_allocator;
 
 platform_status
@@ -94,3 +168,14 @@ rc_allocator_mount(rc_allocator      *al,
 
 void
 rc_allocator_unmount(rc_allocator *al);
+
+void
+rc_allocator_get_stats(rc_allocator *al, rc_allocator_stats *stats);
+
+platform_status
+rc_allocator_grow(rc_allocator *al, uint64 capacity);
+
+void
+rc_allocator_set_grow_callback(rc_allocator        *al,
+                               rc_allocator_grow_fn callback,
+                               void                *arg);
@@ -22,6 +22,13 @@
 
 #define ROUTING_FPS_PER_PAGE 4096
 
+/*
+ * Filters expected to fill at most 1/ROUTING_PACK_EXTENT_FRACTION of an
+ * extent are packed into extents shared with other small filters, instead of
+ * taking a meta, an index and a data extent of their own.
+ */
+#define ROUTING_PACK_EXTENT_FRACTION 4
+
 /*
  *----------------------------------------------------------------------
  * routing_hdr: Disk-resident structure.
@@ -187,6 +194,46 @@ routing_get_header(cache          *cc,
    return hdr;
 }
 
+/*
+ * routing_get_header for a lookup that takes no read locks: both pages are read
+ * optimistically, and the header address read from the index page is only
+ * followed once the index page is validated. Returns NULL if a page is not
+ * cached or changes, otherwise the header, which is to be validated against
+ * *filter_version once read.
+ */
+static inline routing_hdr *
+routing_get_header_optimistic(cache          *cc,
+                              routing_config *cfg,
+                              uint64          filter_addr,
+                              uint64          index,
+                              page_handle   **filter_page,
+                              uint64         *filter_version)
+{
+   uint64 page_size      = cache_config_page_size(cfg->cache_cfg);
+   uint64 addrs_per_page = page_size / sizeof(uint64);
+   debug_assert(index / addrs_per_page < 32);
+   uint64       index_addr = filter_addr + page_size * (index / addrs_per_page);
+   uint64       index_version;
+   page_handle *index_page =
+      cache_get_optimistic(cc, index_addr, PAGE_TYPE_FILTER, &index_version);
+   if (index_page == NULL) {
+      return NULL;
+   }
+   uint64 hdr_raw_addr =
+      ((volatile uint64 *)index_page->data)[index % addrs_per_page];
+   if (!cache_validate_optimistic(cc, index_page, index_version)) {
+      return NULL;
+   }
+   platform_assert(hdr_raw_addr != 0);
+   uint64 header_addr = hdr_raw_addr - (hdr_raw_addr % page_size);
+   *filter_page       = cache_get_optimistic(
+      cc, header_addr, PAGE_TYPE_FILTER, filter_version);
+   if (*filter_page == NULL) {
+      return NULL;
+   }
+   return (routing_hdr *)((*filter_page)->data + hdr_raw_addr - header_addr);
+}
+
 static inline void
 routing_unget_header(cache *cc, page_handle *header_page)
 {
@@ -234,7 +281,7 @@ routing_get_bucket_bounds(char   *encoding,
       *start        = 0;
       word          = 0;
       encoding_word = *((uint32 *)encoding + word);
-      while (encoding_word == 0) {
+      while (encoding_word == 0 && 4 * word < len) {
          word++;
          encoding_word = *((uint32 *)encoding + word);
       }
@@ -259,7 +306,7 @@ routing_get_bucket_bounds(char   *encoding,
       *start     = 32 * word + bit_offset - bucket_offset + 1;
 
       encoding_word &= encoding_word - 1;
-      while (encoding_word == 0) {
+      while (encoding_word == 0 && 4 * word < len) {
          word++;
          encoding_word = *((uint32 *)encoding + word);
       }
@@ -320,11 +367,14 @@ routing_get_bucket_counts(routing_config *cfg, routing_hdr *hdr, uint32 *count)
  *      filter_addr.
  *
  *      meta_head should be passed to routing_filter_zap
+ *
+ *      If packer is not NULL, small filters take their pages from it.
  *----------------------------------------------------------------------
  */
 platform_status
 routing_filter_add(cache          *cc,
                    routing_config *cfg,
+                   mini_packer    *packer,
                    routing_filter *old_filter,
                    routing_filter *filter,
                    uint32         *new_fp_arr,
@@ -414,26 +464,48 @@ routing_filter_add(cache          *cc,
    encoding_buffer = (uint64 *)(old_fp_buffer + ROUTING_FPS_PER_PAGE);
    memset(encoding_buffer, 0xff, ROUTING_FPS_PER_PAGE / 32 * sizeof(uint32));
 
-   // we use a mini_allocator to obtain pages
-   allocator      *al = cache_get_allocator(cc);
-   uint64          meta_head;
-   platform_status rc = allocator_alloc(al, &meta_head, PAGE_TYPE_FILTER);
-   platform_assert_status_ok(rc);
-   filter->meta_head = meta_head;
+   // estimate the filter size to decide whether to pack it
+   uint64 addrs_per_page  = page_size / sizeof(uint64);
+   uint64 num_index_pages = (num_indices - 1) / addrs_per_page + 1;
+   uint64 est_bits =
+      filter->num_fingerprints * (remainder_and_value_size + 1)
+      + num_indices * (index_size + 8 * (sizeof(routing_hdr) + 8));
+   uint64 est_pages = num_index_pages + est_bits / (8 * page_size) + 1;
+   bool32 packed =
+      packer != NULL
+      && est_pages <= pages_per_extent / ROUTING_PACK_EXTENT_FRACTION;
+
    // filters use an unkeyed mini allocator
    mini_allocator mini;
-   mini_init(&mini, cc, NULL, filter->meta_head, 0, 1, PAGE_TYPE_FILTER, FALSE);
+   if (packed) {
+      filter->meta_head = mini_init_packed(&mini, packer);
+   } else {
+      allocator      *al = cache_get_allocator(cc);
+      uint64          meta_head;
+      platform_status rc = allocator_alloc(al, &meta_head, PAGE_TYPE_FILTER);
+      platform_assert_status_ok(rc);
+      filter->meta_head = meta_head;
+      mini_init(
+         &mini, cc, NULL, filter->meta_head, 0, 1, PAGE_TYPE_FILTER, FALSE);
+      num_index_pages = pages_per_extent;
+   }
 
-   // set up the index pages
-   uint64       addrs_per_page = page_size / sizeof(uint64);
+   // set up the index pages, which must be contiguous
    page_handle *index_page[MAX_PAGES_PER_EXTENT];
-   uint64       index_addr = mini_alloc(&mini, 0, NULL_KEY, NULL);
-   platform_assert(index_addr % extent_size == 0);
-   index_page[0] = cache_alloc(cc, index_addr, PAGE_TYPE_FILTER);
-   for (uint64 i = 1; i < pages_per_extent; i++) {
-      uint64 next_index_addr = mini_alloc(&mini, 0, NULL_KEY, NULL);
-      platform_assert(next_index_addr == index_addr + i * page_size);
-      index_page[i] = cache_alloc(cc, next_index_addr, PAGE_TYPE_FILTER);
+   uint64       index_addr;
+   if (packed) {
+      index_addr = mini_alloc_pages(&mini, num_index_pages);
+   } else {
+      index_addr = mini_alloc(&mini, 0, NULL_KEY, NULL);
+      platform_assert(index_addr % extent_size == 0);
+      for (uint64 i = 1; i < num_index_pages; i++) {
+         uint64 next_index_addr = mini_alloc(&mini, 0, NULL_KEY, NULL);
+         platform_assert(next_index_addr == index_addr + i * page_size);
+      }
+   }
+   for (uint64 i = 0; i < num_index_pages; i++) {
+      index_page[i] =
+         cache_alloc(cc, index_addr + i * page_size, PAGE_TYPE_FILTER);
    }
    filter->addr = index_addr;
 
@@ -592,7 +664,7 @@ routing_filter_add(cache          *cc,
 
          // Set the index_no
          // ALEX: for now the indices must fit in a single extent
-         debug_assert(index_no / addrs_per_page < pages_per_extent);
+         debug_assert(index_no / addrs_per_page < num_index_pages);
          uint64  index_page_no = index_no / addrs_per_page;
          uint64  index_offset  = index_no % addrs_per_page;
          uint64 *index_cursor  = (uint64 *)(index_page[index_page_no]->data);
@@ -625,7 +697,7 @@ routing_filter_add(cache          *cc,
    debug_assert(fp_no == num_new_unique_fp);
    routing_unlock_and_unget_page(cc, filter_page);
 
-   for (uint64 i = 0; i < pages_per_extent; i++) {
+   for (uint64 i = 0; i < num_index_pages; i++) {
       routing_unlock_and_unget_page(cc, index_page[i]);
    }
 
@@ -648,11 +720,20 @@ routing_filter_prefetch(cache          *cc,
    uint64 num_index_pages  = (num_indices - 1) / addrs_per_page + 1;
    uint64 index_no         = 0;
 
+   // the index pages are contiguous, so fetch them with one read
+   uint64       index_addr[MAX_PAGES_PER_EXTENT];
+   page_handle *index_pages[MAX_PAGES_PER_EXTENT];
+   platform_assert(num_index_pages <= MAX_PAGES_PER_EXTENT);
    for (uint64 index_page_no = 0; index_page_no < num_index_pages;
         index_page_no++) {
-      uint64       index_addr = filter->addr + (page_size * index_page_no);
-      page_handle *index_page =
-         cache_get(cc, index_addr, TRUE, PAGE_TYPE_FILTER);
+      index_addr[index_page_no] = filter->addr + (page_size * index_page_no);
+   }
+   cache_get_many(
+      cc, index_addr, num_index_pages, PAGE_TYPE_FILTER, index_pages);
+
+   for (uint64 index_page_no = 0; index_page_no < num_index_pages;
+        index_page_no++) {
+      page_handle *index_page = index_pages[index_page_no];
       platform_assert(index_no < num_indices);
 
       uint64 max_index_no;
@@ -809,6 +890,75 @@ routing_filter_estimate_unique_fp(cache           *cc,
    return num_unique * 16;
 }
 
+/*
+ *----------------------------------------------------------------------
+ * routing_hdr_lookup
+ *
+ *      Looks for remainder in bucket bucket_off of the filter header hdr,
+ *      and returns the values found for it in found_values.
+ *
+ *      page_bytes bounds the reads from hdr on, or is UINT64_MAX for a header
+ *      which is read locked. Returns FALSE if the header is found to be
+ *      corrupt, which on a page read without a read lock only means it
+ *      changed during the read.
+ *----------------------------------------------------------------------
+ */
+static inline bool32
+routing_hdr_lookup(routing_config *cfg,
+                   routing_hdr    *hdr,
+                   uint64          page_bytes,
+                   uint32          bucket_off,
+                   uint32          remainder,
+                   size_t          remainder_and_value_size,
+                   size_t          value_size,
+                   uint64         *found_values)
+{
+   uint64 num_remainders = *(volatile uint16 *)&hdr->num_remainders;
+   uint64 encoding_size  = (num_remainders + cfg->index_size - 1) / 8 + 4;
+   uint64 header_length  = encoding_size + sizeof(routing_hdr);
+   if (header_length > page_bytes) {
+      return FALSE;
+   }
+
+   uint64 start, end;
+   routing_get_bucket_bounds(
+      hdr->encoding, header_length, bucket_off, &start, &end);
+   char *remainder_block_start = (char *)hdr + header_length;
+
+   // platform_default_log("routing_filter_lookup: "
+   //      "index 0x%lx bucket 0x%lx (0x%lx) remainder 0x%x start %lu end
+   //      %lu\n", index, bucket, bucket % index_size, remainder, start, end);
+
+   uint64 remainder_block_bytes =
+      sizeof(uint32) * ((end * remainder_and_value_size + 31) / 32);
+   if (end < start || remainder_block_bytes > page_bytes - header_length) {
+      return FALSE;
+   }
+
+   uint64 found_values_int = 0;
+   for (uint32 i = 0; i < end - start; i++) {
+      uint32 pos = end - i - 1;
+      uint32 found_remainder_and_value;
+      routing_filter_get_remainder_and_value(cfg,
+                                             (uint32 *)remainder_block_start,
+                                             pos,
+                                             &found_remainder_and_value,
+                                             remainder_and_value_size);
+      uint32 found_remainder = found_remainder_and_value >> value_size;
+      if (found_remainder == remainder) {
+         uint32 value_mask  = (1UL << value_size) - 1;
+         uint16 found_value = found_remainder_and_value & value_mask;
+         if (found_value >= 64) {
+            return FALSE;
+         }
+         found_values_int |= (1UL << found_value);
+      }
+   }
+
+   *found_values = found_values_int;
+   return TRUE;
+}
+
 /*
  *----------------------------------------------------------------------
  * routing_filter_lookup
@@ -857,47 +1007,41 @@ routing_filter_lookup(cache          *cc,
       routing_get_index(fp << value_size, index_remainder_and_value_size);
    uint32 remainder = fp & remainder_mask;
 
+   // first without read locks, which write to the shared ref counts
    page_handle *filter_node;
-   routing_hdr *hdr =
-      routing_get_header(cc, cfg, filter->addr, index, &filter_node);
-   uint64 encoding_size = (hdr->num_remainders + index_size - 1) / 8 + 4;
-   uint64 header_length = encoding_size + sizeof(routing_hdr);
-
-   uint64 start, end;
-   routing_get_bucket_bounds(
-      hdr->encoding, header_length, bucket_off, &start, &end);
-   char *remainder_block_start = (char *)hdr + header_length;
-
-   // platform_default_log("routing_filter_lookup: "
-   //      "index 0x%lx bucket 0x%lx (0x%lx) remainder 0x%x start %lu end
-   //      %lu\n", index, bucket, bucket % index_size, remainder, start, end);
-
-   if (start == end) {
-      routing_unget_header(cc, filter_node);
-      *found_values = 0;
-      return STATUS_OK;
-   }
-
-   uint64 found_values_int = 0;
-   for (uint32 i = 0; i < end - start; i++) {
-      uint32 pos = end - i - 1;
-      uint32 found_remainder_and_value;
-      routing_filter_get_remainder_and_value(cfg,
-                                             (uint32 *)remainder_block_start,
-                                             pos,
-                                             &found_remainder_and_value,
-                                             remainder_and_value_size);
-      uint32 found_remainder = found_remainder_and_value >> value_size;
-      if (found_remainder == remainder) {
-         uint32 value_mask  = (1UL << value_size) - 1;
-         uint16 found_value = found_remainder_and_value & value_mask;
-         platform_assert(found_value < 64);
-         found_values_int |= (1UL << found_value);
+   uint64       version;
+   routing_hdr *hdr = routing_get_header_optimistic(
+      cc, cfg, filter->addr, index, &filter_node, &version);
+   if (hdr != NULL) {
+      uint64 hdr_off    = (char *)hdr - filter_node->data;
+      uint64 page_bytes = cache_config_page_size(cfg->cache_cfg) - hdr_off;
+      uint64 found_values_int;
+      if (routing_hdr_lookup(cfg,
+                             hdr,
+                             page_bytes,
+                             bucket_off,
+                             remainder,
+                             remainder_and_value_size,
+                             value_size,
+                             &found_values_int)
+          && cache_validate_optimistic(cc, filter_node, version))
+      {
+         *found_values = found_values_int;
+         return STATUS_OK;
       }
    }
 
+   hdr = routing_get_header(cc, cfg, filter->addr, index, &filter_node);
+   bool32 valid = routing_hdr_lookup(cfg,
+                                     hdr,
+                                     UINT64_MAX,
+                                     bucket_off,
+                                     remainder,
+                                     remainder_and_value_size,
+                                     value_size,
+                                     found_values);
+   platform_assert(valid);
    routing_unget_header(cc, filter_node);
-   *found_values = found_values_int;
    return STATUS_OK;
 }
 
@@ -1174,6 +1318,26 @@ routing_filter_zap(cache *cc, routing_filter *filter)
    mini_unkeyed_dec_ref(cc, meta_head, PAGE_TYPE_FILTER, FALSE);
 }
 
+/*
+ *----------------------------------------------------------------------
+ * routing_filter_zap_batched
+ *
+ *      same as routing_filter_zap, but leaves the extents it frees in batch
+ *----------------------------------------------------------------------
+ */
+void
+routing_filter_zap_batched(cache             *cc,
+                           routing_filter    *filter,
+                           mini_extent_batch *batch)
+{
+   if (filter->num_fingerprints == 0) {
+      return;
+   }
+
+   debug_assert(batch->type == PAGE_TYPE_FILTER);
+   mini_unkeyed_dec_ref_batched(cc, filter->meta_head, batch);
+}
+
 /*
  *----------------------------------------------------------------------
  * routing_filter_estimate_unique_keys
@@ -11,6 +11,7 @@
 
 #include "cache.h"
 #include "iterator.h"
+#include "mini_allocator.h"
 #include "splinterdb/data.h"
 #include "util.h"
 #include "platform.h"
@@ -92,6 +93,7 @@ typedef struct routing_async_ctxt {
 platform_status
 routing_filter_add(cache          *cc,
                    routing_config *cfg,
+                   mini_packer    *packer,
                    routing_filter *old_filter,
                    routing_filter *filter,
                    uint32         *new_fp_arr,
@@ -159,6 +161,11 @@ routing_filter_lookup_async(cache              *cc,
 void
 routing_filter_zap(cache *cc, routing_filter *filter);
 
+void
+routing_filter_zap_batched(cache             *cc,
+                           routing_filter    *filter,
+                           mini_extent_batch *batch);
+
 uint32
 routing_filter_estimate_unique_keys_from_count(routing_config *cfg,
                                                uint64          num_unique);
@@ -52,6 +52,11 @@ typedef struct splinterdb {
    platform_heap_id   heap_id;
    data_config       *data_cfg;
    bool               we_created_heap;
+
+   // For a checkpoint opened by splinterdb_open_checkpoint, the splinterdb
+   // whose device, cache and task system it shares. NULL otherwise.
+   struct splinterdb *owner;
+   uint64             num_open_checkpoints;
 } splinterdb;
 
 
@@ -173,6 +178,9 @@ splinterdb_init_config(const splinterdb_config *kvs_cfg, // IN
                   cfg.io_perms,
                   cfg.io_async_queue_depth,
                   cfg.filename);
+   kvs->io_cfg.bg_max_bytes_per_sec = cfg.io_bg_max_bytes_per_sec;
+   kvs->io_cfg.fg_read_latency_target_ns =
+      USEC_TO_NSEC(cfg.io_fg_read_latency_target_us);
 
    // Validate IO-configuration parameters
    rc = laio_config_valid(&kvs->io_cfg);
@@ -181,12 +189,24 @@ splinterdb_init_config(const splinterdb_config *kvs_cfg, // IN
    }
 
    allocator_config_init(&kvs->allocator_cfg, &kvs->io_cfg, cfg.disk_size);
+   allocator_config_set_max_capacity(&kvs->allocator_cfg,
+                                     MAX(cfg.disk_size, cfg.max_disk_size));
+   kvs->allocator_cfg.grow_increment            = cfg.disk_grow_increment;
+   kvs->allocator_cfg.use_discard               = cfg.use_discard;
+   kvs->allocator_cfg.discard_max_bytes_per_sec = cfg.discard_max_bytes_per_sec;
 
    clockcache_config_init(&kvs->cache_cfg,
                           &kvs->io_cfg,
                           cfg.cache_size,
                           cfg.cache_logfile,
                           cfg.use_stats);
+   if (cfg.cache_cleaner_dirty_watermark) {
+      kvs->cache_cfg.cleaner_dirty_watermark =
+         cfg.cache_cleaner_dirty_watermark;
+   }
+   kvs->cache_cfg.cleaner_max_pages_per_sec =
+      cfg.cache_cleaner_max_pages_per_sec;
+   kvs->cache_cfg.max_capacity = MAX(cfg.cache_size, cfg.cache_max_size);
 
    shard_log_config_init(&kvs->log_cfg, &kvs->cache_cfg.super, kvs->data_cfg);
 
@@ -199,6 +219,24 @@ splinterdb_init_config(const splinterdb_config *kvs_cfg, // IN
    if (!SUCCESS(rc)) {
       return rc;
    }
+   kvs->task_cfg.max_background_threads[TASK_TYPE_MEMTABLE] =
+      MAX(kvs_cfg->num_memtable_bg_threads, kvs_cfg->max_memtable_bg_threads);
+   kvs->task_cfg.max_background_threads[TASK_TYPE_NORMAL] =
+      MAX(kvs_cfg->num_normal_bg_threads, kvs_cfg->max_normal_bg_threads);
+
+   const char *bg_cpus[NUM_TASK_TYPES] = {NULL};
+   bg_cpus[TASK_TYPE_MEMTABLE]         = kvs_cfg->memtable_bg_cpus;
+   bg_cpus[TASK_TYPE_NORMAL]           = kvs_cfg->normal_bg_cpus;
+   for (task_type type = TASK_TYPE_FIRST; type != NUM_TASK_TYPES; type++) {
+      rc = platform_cpu_set_parse(bg_cpus[type],
+                                  &kvs->task_cfg.background_cpus[type]);
+      if (!SUCCESS(rc)) {
+         platform_error_log("Invalid CPUs for background threads, '%s': %s\n",
+                            bg_cpus[type],
+                            platform_status_to_string(rc));
+         return rc;
+      }
+   }
 
    rc = trunk_config_init(&kvs->trunk_cfg,
                           &kvs->cache_cfg.super,
@@ -219,11 +257,30 @@ splinterdb_init_config(const splinterdb_config *kvs_cfg, // IN
    if (!SUCCESS(rc)) {
       return rc;
    }
+   kvs->trunk_cfg.use_cache_warmup = cfg.cache_warmup;
+   if (cfg.tombstone_compaction_percent) {
+      kvs->trunk_cfg.tombstone_compaction_percent =
+         cfg.tombstone_compaction_percent;
+   }
+   if (cfg.write_throttle_percent) {
+      kvs->trunk_cfg.write_throttle_percent = cfg.write_throttle_percent;
+   }
 
    return STATUS_OK;
 }
 
 
+/*
+ * Called by the allocator when the disk grows, before any page beyond the
+ * old size is used.
+ */
+static void
+splinterdb_grow_cache(void *arg, uint64 disk_size)
+{
+   splinterdb *kvs = (splinterdb *)arg;
+   clockcache_grow_lookup(&kvs->cache_handle, disk_size);
+}
+
 /*
  * Internal function for create or open
  */
@@ -339,6 +396,18 @@ splinterdb_create_or_open(const splinterdb_config *kvs_cfg,      // IN
       goto deinit_allocator;
    }
 
+   rc_allocator_set_grow_callback(
+      &kvs->allocator_handle, splinterdb_grow_cache, kvs);
+
+   if (kvs_cfg->cache_use_cleaner) {
+      status = clockcache_start_cleaner(&kvs->cache_handle, kvs->task_sys);
+      if (!SUCCESS(status)) {
+         platform_error_log("Failed to start SplinterDB cache cleaner: %s\n",
+                            platform_status_to_string(status));
+         goto deinit_cache;
+      }
+   }
+
    kvs->trunk_id = 1;
    if (open_existing) {
       kvs->spl = trunk_mount(&kvs->trunk_cfg,
@@ -433,6 +502,18 @@ splinterdb_close(splinterdb **kvs_in) // IN
    splinterdb *kvs = *kvs_in;
    platform_assert(kvs != NULL);
 
+   if (kvs->owner != NULL) {
+      // a checkpoint only has its own trunk to unmount
+      trunk_unmount(&kvs->spl);
+      __sync_fetch_and_sub(&kvs->owner->num_open_checkpoints, 1);
+      platform_free(kvs->heap_id, kvs);
+      *kvs_in = (splinterdb *)NULL;
+      return;
+   }
+   platform_assert(kvs->num_open_checkpoints == 0,
+                   "splinterdb_close: %lu checkpoints are still open\n",
+                   kvs->num_open_checkpoints);
+
    // Print stats if shared memory is enabled.
    if (kvs->heap_id) {
       splinterdb_close_print_stats(kvs);
@@ -556,6 +637,105 @@ splinterdb_update(const splinterdb *kvsb, slice user_key, slice update)
    return splinterdb_insert_message(kvsb, user_key, msg);
 }
 
+static int
+splinterdb_try_insert_message(const splinterdb *kvs,
+                              slice             user_key,
+                              message           msg,
+                              uint64           *retry_ns)
+{
+   key tuple_key = key_create_from_slice(user_key);
+   platform_assert(kvs != NULL);
+   platform_status status =
+      trunk_try_insert(kvs->spl, tuple_key, msg, retry_ns);
+   return platform_status_to_int(status);
+}
+
+int
+splinterdb_try_insert(const splinterdb *kvsb,
+                      slice             user_key,
+                      slice             value,
+                      uint64           *retry_ns)
+{
+   message msg = message_create(MESSAGE_TYPE_INSERT, value);
+   return splinterdb_try_insert_message(kvsb, user_key, msg, retry_ns);
+}
+
+int
+splinterdb_try_delete(const splinterdb *kvsb, slice user_key, uint64 *retry_ns)
+{
+   return splinterdb_try_insert_message(
+      kvsb, user_key, DELETE_MESSAGE, retry_ns);
+}
+
+int
+splinterdb_try_update(const splinterdb *kvsb,
+                      slice             user_key,
+                      slice             update,
+                      uint64           *retry_ns)
+{
+   message msg = message_create(MESSAGE_TYPE_UPDATE, update);
+   platform_assert(kvsb->data_cfg->merge_tuples);
+   return splinterdb_try_insert_message(kvsb, user_key, msg, retry_ns);
+}
+
+void
+splinterdb_set_capacity_callback(splinterdb            *kvs,
+                                 splinterdb_capacity_fn fn,
+                                 void                  *arg)
+{
+   trunk_set_capacity_callback(kvs->spl, fn, arg);
+}
+
+int
+splinterdb_clear(const splinterdb *kvsb)
+{
+   platform_assert(kvsb != NULL);
+   platform_status status = trunk_clear(kvsb->spl);
+   return platform_status_to_int(status);
+}
+
+static void
+splinterdb_compact_range_keys(slice start_key,
+                              slice end_key,
+                              key  *start,
+                              key  *end)
+{
+   *start = slice_is_null(start_key) ? NEGATIVE_INFINITY_KEY
+                                     : key_create_from_slice(start_key);
+   *end   = slice_is_null(end_key) ? POSITIVE_INFINITY_KEY
+                                   : key_create_from_slice(end_key);
+}
+
+int
+splinterdb_compact_range(const splinterdb                   *kvsb,
+                         slice                               start_key,
+                         slice                               end_key,
+                         splinterdb_compact_range_progress_fn progress,
+                         void                               *arg)
+{
+   platform_assert(kvsb != NULL);
+   key start, end;
+   splinterdb_compact_range_keys(start_key, end_key, &start, &end);
+   platform_status status =
+      trunk_compact_range(kvsb->spl, start, end, progress, arg);
+   return platform_status_to_int(status);
+}
+
+int
+splinterdb_compact_range_async(const splinterdb                   *kvsb,
+                               slice                               start_key,
+                               slice                               end_key,
+                               splinterdb_compact_range_progress_fn progress,
+                               void                               *arg)
+{
+   platform_assert(kvsb != NULL);
+   key start, end;
+   splinterdb_compact_range_keys(start_key, end_key, &start, &end);
+   platform_status status =
+      trunk_compact_range_async(kvsb->spl, start, end, progress, arg);
+   return platform_status_to_int(status);
+}
+
 /*
  *-----------------------------------------------------------------------------
  * _splinterdb_lookup_result structure --
@@ -790,6 +970,157 @@ splinterdb_stats_reset(splinterdb *kvs)
    trunk_reset_stats(kvs->spl);
 }
 
+void
+splinterdb_get_write_stats(const splinterdb     *kvs,
+                           splinterdb_write_stats *stats)
+{
+   const trunk_write_throttle *throttle = &kvs->spl->throttle;
+   stats->debt_percent                  = throttle->debt_percent;
+   stats->throttle_rate                 = throttle->rate;
+   stats->num_delays                    = throttle->num_delays;
+   stats->delay_ns                      = throttle->delay_ns;
+   stats->num_stalls                    = throttle->num_stalls;
+   stats->stall_ns                      = throttle->stall_ns;
+}
+
+/*
+ * Returns the splinterdb which owns the device, cache and task system kvs
+ * uses.
+ */
+static inline splinterdb *
+splinterdb_device_owner(const splinterdb *kvs)
+{
+   return kvs->owner != NULL ? kvs->owner : (splinterdb *)kvs;
+}
+
+int
+splinterdb_set_cache_size(splinterdb *kvs, uint64 cache_size)
+{
+   kvs = splinterdb_device_owner(kvs);
+   platform_status rc =
+      clockcache_resize(&kvs->cache_handle, cache_size, kvs->task_sys);
+   return platform_status_to_int(rc);
+}
+
+uint64
+splinterdb_get_cache_size(const splinterdb *kvs)
+{
+   kvs = splinterdb_device_owner(kvs);
+   return clockcache_capacity((clockcache *)&kvs->cache_handle);
+}
+
+int
+splinterdb_grow(splinterdb *kvs, uint64 disk_size)
+{
+   kvs                = splinterdb_device_owner(kvs);
+   platform_status rc = rc_allocator_grow(&kvs->allocator_handle, disk_size);
+   return platform_status_to_int(rc);
+}
+
+uint64
+splinterdb_get_disk_size(const splinterdb *kvs)
+{
+   kvs = splinterdb_device_owner(kvs);
+   return kvs->allocator_cfg.capacity;
+}
+
+int
+splinterdb_checkpoint(const splinterdb *kvs, uint64 checkpoint_id)
+{
+   platform_assert(kvs != NULL);
+   platform_status rc = trunk_checkpoint(kvs->spl, checkpoint_id);
+   return platform_status_to_int(rc);
+}
+
+/*
+ * Returns STATUS_OK if checkpoint_id names a checkpoint on the device of
+ * owner.
+ */
+static platform_status
+splinterdb_find_checkpoint(splinterdb *owner, uint64 checkpoint_id)
+{
+   if (checkpoint_id == INVALID_ALLOCATOR_ROOT_ID
+       || checkpoint_id == owner->trunk_id)
+   {
+      return STATUS_NOT_FOUND;
+   }
+   uint64 super_addr;
+   return allocator_get_super_addr(
+      (allocator *)&owner->allocator_handle, checkpoint_id, &super_addr);
+}
+
+int
+splinterdb_open_checkpoint(splinterdb  *kvs,
+                           uint64       checkpoint_id,
+                           _Bool        read_only,
+                           splinterdb **clone)
+{
+   platform_assert(kvs != NULL);
+   splinterdb     *owner = splinterdb_device_owner(kvs);
+   platform_status rc    = splinterdb_find_checkpoint(owner, checkpoint_id);
+   if (!SUCCESS(rc)) {
+      return platform_status_to_int(rc);
+   }
+
+   splinterdb *ckpt = TYPED_ZALLOC(owner->heap_id, ckpt);
+   if (ckpt == NULL) {
+      return platform_status_to_int(STATUS_NO_MEMORY);
+   }
+   ckpt->task_sys = owner->task_sys;
+   ckpt->trunk_id = checkpoint_id;
+   ckpt->heap_id  = owner->heap_id;
+   ckpt->data_cfg = owner->data_cfg;
+   ckpt->owner    = owner;
+   if (read_only) {
+      ckpt->spl = trunk_mount_read_only(&owner->trunk_cfg,
+                                        (allocator *)&owner->allocator_handle,
+                                        (cache *)&owner->cache_handle,
+                                        owner->task_sys,
+                                        checkpoint_id,
+                                        owner->heap_id);
+   } else {
+      ckpt->spl = trunk_mount(&owner->trunk_cfg,
+                              (allocator *)&owner->allocator_handle,
+                              (cache *)&owner->cache_handle,
+                              owner->task_sys,
+                              checkpoint_id,
+                              owner->heap_id);
+   }
+   if (ckpt->spl == NULL) {
+      platform_free(owner->heap_id, ckpt);
+      return platform_status_to_int(STATUS_INVALID_STATE);
+   }
+
+   __sync_fetch_and_add(&owner->num_open_checkpoints, 1);
+   *clone = ckpt;
+   return platform_status_to_int(STATUS_OK);
+}
+
+int
+splinterdb_delete_checkpoint(splinterdb *kvs, uint64 checkpoint_id)
+{
+   platform_assert(kvs != NULL);
+   splinterdb     *owner = splinterdb_device_owner(kvs);
+   platform_status rc    = splinterdb_find_checkpoint(owner, checkpoint_id);
+   if (!SUCCESS(rc)) {
+      return platform_status_to_int(rc);
+   }
+
+   // mounted read-only, so as not to finish its compactions first
+   trunk_handle *spl =
+      trunk_mount_read_only(&owner->trunk_cfg,
+                            (allocator *)&owner->allocator_handle,
+                            (cache *)&owner->cache_handle,
+                            owner->task_sys,
+                            checkpoint_id,
+                            owner->heap_id);
+   if (spl == NULL) {
+      return platform_status_to_int(STATUS_INVALID_STATE);
+   }
+   trunk_destroy(spl);
+   return platform_status_to_int(STATUS_OK);
+}
+
 static void
 splinterdb_close_print_stats(splinterdb *kvs)
 {
@@ -824,18 +1155,21 @@ splinterdb_get_task_system_handle(const splinterdb *kvs)
 const platform_io_handle *
 splinterdb_get_io_handle(const splinterdb *kvs)
 {
+   kvs = splinterdb_device_owner(kvs);
    return &kvs->io_handle;
 }
 
 const allocator *
 splinterdb_get_allocator_handle(const splinterdb *kvs)
 {
+   kvs = splinterdb_device_owner(kvs);
    return (allocator *)&kvs->allocator_handle;
 }
 
 const cache *
 splinterdb_get_cache_handle(const splinterdb *kvs)
 {
+   kvs = splinterdb_device_owner(kvs);
    return (cache *)&kvs->cache_handle;
 }
 
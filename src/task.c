@@ -13,6 +13,10 @@ const char *task_type_name[] = {"TASK_TYPE_INVALID",
 _Static_assert((ARRAY_SIZE(task_type_name) == NUM_TASK_TYPES),
                "Array task_type_name[] is incorrectly sized.");
 
+static const char *task_priority_name[] = {"high", "normal", "low"};
+_Static_assert((ARRAY_SIZE(task_priority_name) == NUM_TASK_PRIORITIES),
+               "Array task_priority_name[] is incorrectly sized.");
+
 /****************************************
  * Thread ID allocation and management  *
  ****************************************/
@@ -21,23 +25,21 @@ _Static_assert((ARRAY_SIZE(task_type_name) == NUM_TASK_TYPES),
  * the task system structure to indicate that no threads are currently active.
  */
 static void
-task_init_tid_bitmask(uint64 *tid_bitmask)
+task_init_tid_bitmask(uint64 tid_bitmask[TASK_TID_BITMASK_WORDS])
 {
-   // We use a 64 bit word to act as the thread bitmap.
-   _Static_assert(MAX_THREADS == 64, "Max threads should be 64");
    /*
     * This is a special bitmask where 1 indicates free and 0 indicates
     * allocated. So, we set all bits to 1 during init.
     */
-   for (int i = 0; i < MAX_THREADS; i++) {
-      *tid_bitmask |= (1ULL << i);
+   for (uint64 i = 0; i < TASK_TID_BITMASK_WORDS; i++) {
+      tid_bitmask[i] = (uint64)-1;
    }
 }
 
 static inline uint64 *
 task_system_get_tid_bitmask(task_system *ts)
 {
-   return &ts->tid_bitmask;
+   return ts->tid_bitmask;
 }
 
 static threadid *
@@ -47,41 +49,52 @@ task_system_get_max_tid(task_system *ts)
 }
 
 /*
- * Return the bitmasks of tasks active. Mainly intended as a testing hook.
+ * Return a word of the bitmask of active tasks. Mainly intended as a testing
+ * hook.
  */
 uint64
-task_active_tasks_mask(task_system *ts)
+task_active_tasks_mask(task_system *ts, uint64 word)
 {
-   return *task_system_get_tid_bitmask(ts);
+   platform_assert(word < TASK_TID_BITMASK_WORDS, "word=%lu", word);
+   return task_system_get_tid_bitmask(ts)[word];
 }
 
 /*
- * Allocate a threadid.  Returns INVALID_TID when no tid is available.
+ * Allocate a threadid, the lowest one free.  Returns INVALID_TID when no tid
+ * is available.
  */
 static threadid
 task_allocate_threadid(task_system *ts)
 {
    threadid tid         = INVALID_TID;
    uint64  *tid_bitmask = task_system_get_tid_bitmask(ts);
-   uint64   old_bitmask;
-   uint64   new_bitmask;
 
-   do {
-      old_bitmask = *tid_bitmask;
-      // first bit set to 1 starting from LSB.
+   for (uint64 word = 0; word < TASK_TID_BITMASK_WORDS; word++) {
+      uint64 old_bitmask = tid_bitmask[word];
+      // first bit set to 1 starting from LSB, 0 if all in the word are in-use.
       uint64 pos = __builtin_ffsl(old_bitmask);
-
-      // If all threads are in-use, bitmask will be all 0s.
-      if (pos == 0) {
-         return INVALID_TID;
+      while (pos != 0) {
+         // set bit at that position to 0, indicating in use.
+         uint64 new_bitmask = (old_bitmask & ~(1ULL << (pos - 1)));
+         if (__sync_bool_compare_and_swap(
+                &tid_bitmask[word], old_bitmask, new_bitmask))
+         {
+            // builtin_ffsl returns the position plus 1.
+            tid = 64 * word + pos - 1;
+            break;
+         }
+         old_bitmask = tid_bitmask[word];
+         pos         = __builtin_ffsl(old_bitmask);
+      }
+      if (tid != INVALID_TID) {
+         break;
       }
+   }
 
-      // builtin_ffsl returns the position plus 1.
-      tid = pos - 1;
-      // set bit at that position to 0, indicating in use.
-      new_bitmask = (old_bitmask & ~(1ULL << (pos - 1)));
-   } while (
-      !__sync_bool_compare_and_swap(tid_bitmask, old_bitmask, new_bitmask));
+   // If all threads are in-use, bitmask will be all 0s.
+   if (tid == INVALID_TID) {
+      return INVALID_TID;
+   }
 
    // Invariant: we have successfully allocated tid
 
@@ -101,23 +114,17 @@ task_allocate_threadid(task_system *ts)
 static void
 task_deallocate_threadid(task_system *ts, threadid tid)
 {
-   uint64 *tid_bitmask = task_system_get_tid_bitmask(ts);
+   uint64 *word = &task_system_get_tid_bitmask(ts)[tid / 64];
+   uint64  bit  = 1ULL << (tid % 64);
 
-   uint64 bitmask_val = *tid_bitmask;
+   // set bit back to 1 to indicate a free slot.
+   uint64 bitmask_val = __sync_fetch_and_or(word, bit);
 
    // Ensure that caller is only clearing for a thread that's in-use.
-   platform_assert(!(bitmask_val & (1ULL << tid)),
+   platform_assert(!(bitmask_val & bit),
                    "Thread [%lu] is expected to be in-use. Bitmap: 0x%lx",
                    tid,
                    bitmask_val);
-
-   // set bit back to 1 to indicate a free slot.
-   uint64 tmp_bitmask = *tid_bitmask;
-   uint64 new_value   = tmp_bitmask | (1ULL << tid);
-   while (!__sync_bool_compare_and_swap(tid_bitmask, tmp_bitmask, new_value)) {
-      tmp_bitmask = *tid_bitmask;
-      new_value   = tmp_bitmask | (1ULL << tid);
-   }
 }
 
 
@@ -197,6 +204,7 @@ typedef struct {
 
    task_system     *ts;
    threadid         tid;
+   size_t           scratch_size;
    platform_heap_id heap_id;
 } thread_invoke;
 
@@ -220,6 +228,14 @@ task_invoke_with_hooks(void *func_and_args)
 
    platform_set_tid(thread_started->tid);
 
+   // Zero the scratch space here, rather than in the creating thread, so its
+   // pages are first touched, and so placed, on this thread's NUMA node.
+   if (0 < thread_started->scratch_size) {
+      memset(thread_started->ts->thread_scratch[thread_started->tid],
+             0,
+             thread_started->scratch_size);
+   }
+
    task_run_thread_hooks(thread_started->ts);
 
    // Execute the user-provided call-back function which is where
@@ -235,16 +251,17 @@ task_invoke_with_hooks(void *func_and_args)
 
 /*
  * task_create_thread_with_hooks() - Creates a thread to execute func
- * with argument 'arg'.
+ * with argument 'arg', on the CPUs in cpus if that is not NULL.
  */
 static platform_status
-task_create_thread_with_hooks(platform_thread       *thread,
-                              bool32                 detached,
-                              platform_thread_worker func,
-                              void                  *arg,
-                              size_t                 scratch_size,
-                              task_system           *ts,
-                              platform_heap_id       hid)
+task_create_thread_with_hooks(platform_thread        *thread,
+                              bool32                  detached,
+                              platform_thread_worker  func,
+                              void                   *arg,
+                              size_t                  scratch_size,
+                              task_system            *ts,
+                              platform_heap_id        hid,
+                              const platform_cpu_set *cpus)
 {
    platform_status ret;
 
@@ -257,7 +274,8 @@ task_create_thread_with_hooks(platform_thread       *thread,
    }
 
    if (0 < scratch_size) {
-      char *scratch = TYPED_MANUAL_ZALLOC(ts->heap_id, scratch, scratch_size);
+      // zeroed by the new thread, see task_invoke_with_hooks()
+      char *scratch = TYPED_MANUAL_MALLOC(ts->heap_id, scratch, scratch_size);
       if (scratch == NULL) {
          ret = STATUS_NO_MEMORY;
          goto dealloc_tid;
@@ -271,14 +289,15 @@ task_create_thread_with_hooks(platform_thread       *thread,
       goto free_scratch;
    }
 
-   thread_to_create->func    = func;
-   thread_to_create->arg     = arg;
-   thread_to_create->heap_id = hid;
-   thread_to_create->ts      = ts;
-   thread_to_create->tid     = newtid;
+   thread_to_create->func         = func;
+   thread_to_create->arg          = arg;
+   thread_to_create->heap_id      = hid;
+   thread_to_create->ts           = ts;
+   thread_to_create->tid          = newtid;
+   thread_to_create->scratch_size = scratch_size;
 
-   ret = platform_thread_create(
-      thread, detached, task_invoke_with_hooks, thread_to_create, hid);
+   ret = platform_thread_create_on(
+      thread, detached, task_invoke_with_hooks, thread_to_create, hid, cpus);
    if (!SUCCESS(ret)) {
       goto free_thread;
    }
@@ -311,7 +330,7 @@ task_thread_create(const char            *name,
    platform_status ret;
 
    ret = task_create_thread_with_hooks(
-      &thr, FALSE, func, arg, scratch_size, ts, hid);
+      &thr, FALSE, func, arg, scratch_size, ts, hid, NULL);
    if (!SUCCESS(ret)) {
       platform_error_log("Could not create a thread: %s\n",
                          platform_status_to_string(ret));
@@ -425,6 +444,19 @@ task_deregister_thread(task_system *ts,
 
 /****************************************
  * Background task management
+ *
+ * Each thread enqueues tasks on its own task_deque for the task's group and
+ * priority, or on the shared queue for them if the deque is full. A thread
+ * looking for work picks a priority (see task_priority), and takes from its
+ * shared queue first, then from the bottom of its own deque, and otherwise
+ * steals from the top of the other threads' deques. Only the shared queues
+ * take the group's lock, and they are empty most of the time.
+ *
+ * Idle background threads park on the group's condvar. A parking thread
+ * counts itself in num_parked before it checks current_waiting_tasks one
+ * last time, and an enqueuer counts its task in current_waiting_tasks before
+ * it checks num_parked, so either the thread sees the task or the enqueuer
+ * sees the thread and wakes it.
  ****************************************/
 
 static inline platform_status
@@ -439,40 +471,250 @@ task_group_unlock(task_group *group)
    return platform_condvar_unlock(&group->cv);
 }
 
-/* Caller must hold lock on the group. */
+/* TRUE if group's pool of background threads grows and shrinks. */
+static inline bool32
+task_group_is_adaptive(task_group *group)
+{
+   return group->bg.max_threads > group->bg.min_threads;
+}
+
+/* Only the owner of dq may push. Returns FALSE if dq is full. */
+static bool32
+task_deque_push(task_deque *dq, task *new_task)
+{
+   int64 bottom = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+   int64 top    = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+   if (bottom - top >= TASK_DEQUE_CAPACITY) {
+      return FALSE;
+   }
+   __atomic_store_n(&dq->tasks[(uint64)bottom % TASK_DEQUE_CAPACITY],
+                    new_task,
+                    __ATOMIC_RELAXED);
+   __atomic_store_n(&dq->bottom, bottom + 1, __ATOMIC_RELEASE);
+   return TRUE;
+}
+
+/* Only the owner of dq may pop. Takes the newest task. */
 static task *
-task_group_get_next_task(task_group *group)
+task_deque_pop(task_deque *dq)
 {
-   task_queue *tq            = &group->tq;
-   task       *assigned_task = NULL;
-   if (group->current_waiting_tasks == 0) {
-      return assigned_task;
+   int64 bottom = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+   if (bottom <= __atomic_load_n(&dq->top, __ATOMIC_RELAXED)) {
+      // top only grows, so dq is empty even if we read a stale top
+      return NULL;
    }
 
-   platform_assert(tq->head != NULL);
-   platform_assert(tq->tail != NULL);
+   bottom--;
+   __atomic_store_n(&dq->bottom, bottom, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   int64 top = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+   if (top > bottom) {
+      // thieves took the rest
+      __atomic_store_n(&dq->bottom, bottom + 1, __ATOMIC_RELAXED);
+      return NULL;
+   }
 
-   uint64 outstanding_tasks =
-      __sync_fetch_and_sub(&group->current_waiting_tasks, 1);
-   platform_assert(outstanding_tasks != 0);
+   task *assigned_task = __atomic_load_n(
+      &dq->tasks[(uint64)bottom % TASK_DEQUE_CAPACITY], __ATOMIC_RELAXED);
+   if (top == bottom) {
+      // the last task, which a thief may be taking too
+      if (!__atomic_compare_exchange_n(&dq->top,
+                                       &top,
+                                       top + 1,
+                                       FALSE,
+                                       __ATOMIC_SEQ_CST,
+                                       __ATOMIC_RELAXED))
+      {
+         assigned_task = NULL;
+      }
+      __atomic_store_n(&dq->bottom, bottom + 1, __ATOMIC_RELAXED);
+   }
+   return assigned_task;
+}
 
-   assigned_task = tq->head;
-   tq->head      = tq->head->next;
+/*
+ * Any thread may steal. Takes the oldest task, or returns NULL if dq is
+ * empty or another thread took the task first.
+ */
+static task *
+task_deque_steal(task_deque *dq)
+{
+   int64 top = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+   int64 bottom = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+   if (top >= bottom) {
+      return NULL;
+   }
+
+   task *assigned_task = __atomic_load_n(
+      &dq->tasks[(uint64)top % TASK_DEQUE_CAPACITY], __ATOMIC_RELAXED);
+   if (!__atomic_compare_exchange_n(
+          &dq->top, &top, top + 1, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+   {
+      return NULL;
+   }
+   return assigned_task;
+}
+
+/* Caller must hold lock on the group. */
+static void
+task_priority_queue_push(task_priority_queue *pq, task *new_task)
+{
+   task_queue *tq = &pq->tq;
+   if (tq->tail) {
+      tq->tail->next = new_task;
+      new_task->prev = tq->tail;
+      tq->tail       = new_task;
+   } else {
+      platform_assert(tq->head == NULL);
+      tq->head = tq->tail = new_task;
+   }
+   pq->num_queued++;
+}
+
+/* Caller must hold lock on the group. */
+static task *
+task_priority_queue_pop(task_priority_queue *pq)
+{
+   task_queue *tq            = &pq->tq;
+   task       *assigned_task = tq->head;
+   if (assigned_task == NULL) {
+      platform_assert(pq->num_queued == 0);
+      return NULL;
+   }
+
+   tq->head = assigned_task->next;
    if (tq->head == NULL) {
       platform_assert(tq->tail == assigned_task);
       tq->tail = NULL;
-      platform_assert((outstanding_tasks == 1),
-                      "outstanding_tasks=%lu\n",
-                      outstanding_tasks);
-      ;
+   } else {
+      tq->head->prev = NULL;
+   }
+   pq->num_queued--;
+   return assigned_task;
+}
+
+/*
+ * Returns thread tid's deque of the given priority in group, or NULL if tid
+ * has not enqueued a task to group yet.
+ */
+static inline task_deque *
+task_group_get_deque(task_group *group, task_priority priority, threadid tid)
+{
+   task_thread_deques *deques =
+      __atomic_load_n(&group->deques[tid], __ATOMIC_ACQUIRE);
+   return deques == NULL ? NULL : &deques->deque[priority];
+}
+
+/*
+ * Returns the calling thread's deque of the given priority in group,
+ * allocating the thread's deques if this is its first enqueue to group. Only
+ * the calling thread, tid, allocates them, so it needs no lock. Returns NULL
+ * if out of memory.
+ */
+static task_deque *
+task_group_get_own_deque(task_group   *group,
+                         task_priority priority,
+                         threadid      tid)
+{
+   task_thread_deques *deques = group->deques[tid];
+   if (deques == NULL) {
+      deques = TYPED_ZALLOC(group->ts->heap_id, deques);
+      if (deques == NULL) {
+         return NULL;
+      }
+      __atomic_store_n(&group->deques[tid], deques, __ATOMIC_RELEASE);
+   }
+   return &deques->deque[priority];
+}
+
+/*
+ * Takes a task of the given priority for the calling thread, tid: from the
+ * shared queue, else from its own deque, else from another thread's deque.
+ */
+static task *
+task_group_get_next_task_of_priority(task_group   *group,
+                                     task_priority priority,
+                                     threadid      tid)
+{
+   task_priority_queue *pq = &group->pq[priority];
+   if (pq->num_waiting == 0) {
+      return NULL;
+   }
+
+   task *assigned_task = NULL;
+   if (pq->num_queued != 0) {
+      platform_status rc = task_group_lock(group);
+      platform_assert_status_ok(rc);
+      assigned_task = task_priority_queue_pop(pq);
+      task_group_unlock(group);
+   }
+
+   task_deque *dq = task_group_get_deque(group, priority, tid);
+   if (assigned_task == NULL && dq != NULL) {
+      assigned_task = task_deque_pop(dq);
+   }
+
+   if (assigned_task == NULL) {
+      threadid num_tids = task_get_max_tid(group->ts);
+      for (threadid i = 1; i < num_tids && assigned_task == NULL; i++) {
+         threadid victim = (tid + i) % num_tids;
+         dq              = task_group_get_deque(group, priority, victim);
+         if (dq != NULL) {
+            assigned_task = task_deque_steal(dq);
+         }
+      }
+      if (assigned_task != NULL && group->use_stats) {
+         group->stats[tid].total_tasks_stolen++;
+      }
+   }
+
+   if (assigned_task != NULL) {
+      __sync_fetch_and_sub(&pq->num_waiting, 1);
+   }
+   return assigned_task;
+}
+
+/*
+ * Takes the next task for the calling thread, tid, of the highest priority
+ * waiting, or on every TASK_STARVATION_INTERVAL'th task, of the lowest. The
+ * task is counted as executing before it stops being counted as waiting.
+ */
+static task *
+task_group_get_next_task(task_group *group, threadid tid)
+{
+   platform_assert(tid < MAX_THREADS, "tid=%lu", tid);
+   if (group->current_waiting_tasks == 0) {
+      return NULL;
+   }
+   __sync_fetch_and_add(&group->current_executing_tasks, 1);
+
+   bool32 lowest_first =
+      (group->num_taken[tid] + 1) % TASK_STARVATION_INTERVAL == 0;
+   task *assigned_task = NULL;
+   for (uint64 i = 0; i < NUM_TASK_PRIORITIES && assigned_task == NULL; i++) {
+      task_priority priority = lowest_first ? NUM_TASK_PRIORITIES - 1 - i : i;
+      assigned_task =
+         task_group_get_next_task_of_priority(group, priority, tid);
    }
 
+   if (assigned_task == NULL) {
+      __sync_fetch_and_sub(&group->current_executing_tasks, 1);
+      return NULL;
+   }
+   group->num_taken[tid]++;
+   uint64 outstanding_tasks =
+      __sync_fetch_and_sub(&group->current_waiting_tasks, 1);
+   platform_assert(outstanding_tasks != 0);
    return assigned_task;
 }
 
 /*
  * Do not need to hold lock on the group. (And advisably should not
  * hold lock on group for performance reasons.)
+ *
+ * Frees assigned_task and retires it from the counts of executing and
+ * outstanding tasks once it has run.
  */
 static platform_status
 task_group_run_task(task_group *group, task *assigned_task)
@@ -480,18 +722,48 @@ task_group_run_task(task_group *group, task *assigned_task)
    const threadid tid = platform_get_tid();
    timestamp      current;
 
+   if (task_group_is_adaptive(group)) {
+      __sync_fetch_and_add(
+         &group->bg.total_queue_wait_ns,
+         platform_timestamp_elapsed(assigned_task->enqueue_time));
+      __sync_fetch_and_add(&group->bg.total_tasks_taken, 1);
+   }
+
    if (group->use_stats) {
+      task_stats   *stats    = &group->stats[tid];
+      task_priority priority = assigned_task->priority;
+
       current                   = platform_get_timestamp();
       timestamp queue_wait_time = current - assigned_task->enqueue_time;
-      group->stats[tid].total_queue_wait_time_ns += queue_wait_time;
-      if (queue_wait_time > group->stats[tid].max_queue_wait_time_ns) {
-         group->stats[tid].max_queue_wait_time_ns = queue_wait_time;
+      stats->total_queue_wait_time_ns += queue_wait_time;
+      if (queue_wait_time > stats->max_queue_wait_time_ns) {
+         stats->max_queue_wait_time_ns = queue_wait_time;
       }
+      stats->total_priority_wait_time_ns[priority] += queue_wait_time;
+      stats->total_priority_executions[priority]++;
+      if (queue_wait_time > stats->max_priority_wait_time_ns[priority]) {
+         stats->max_priority_wait_time_ns[priority] = queue_wait_time;
+      }
+   }
+
+   /*
+    * Normal tasks (compactions, filter builds) are background IO, wherever
+    * they run. Memtable tasks are latency critical, so their IO is not.
+    */
+   io_handle *ioh     = &group->ts->ioh->super;
+   bool32     is_bg   = group == &group->ts->group[TASK_TYPE_NORMAL];
+   io_class   old_cls = IO_CLASS_FOREGROUND;
+   if (is_bg) {
+      old_cls = io_set_class(ioh, IO_CLASS_BACKGROUND);
    }
 
    assigned_task->func(assigned_task->arg,
                        task_system_get_thread_scratch(group->ts, tid));
 
+   if (is_bg) {
+      io_set_class(ioh, old_cls);
+   }
+
    if (group->use_stats) {
       current = platform_timestamp_elapsed(current);
       if (current > group->stats[tid].max_runtime_ns) {
@@ -500,48 +772,171 @@ task_group_run_task(task_group *group, task *assigned_task)
       }
    }
 
+   platform_free(group->ts->heap_id, assigned_task);
+   __sync_fetch_and_sub(&group->current_executing_tasks, 1);
+   __sync_fetch_and_sub(&group->ts->num_outstanding_tasks, 1);
    return STATUS_OK;
 }
 
+/*
+ * Parks the calling background thread until there may be a task waiting,
+ * or the group is stopping.
+ */
+static void
+task_group_park(task_group *group)
+{
+   platform_status rc = task_group_lock(group);
+   platform_assert(SUCCESS(rc));
+   __atomic_add_fetch(&group->num_parked, 1, __ATOMIC_SEQ_CST);
+   while (!group->bg.stop
+          && __atomic_load_n(&group->current_waiting_tasks, __ATOMIC_SEQ_CST)
+                == 0)
+   {
+      rc = platform_condvar_wait(&group->cv);
+      platform_assert(SUCCESS(rc));
+   }
+   __atomic_sub_fetch(&group->num_parked, 1, __ATOMIC_SEQ_CST);
+   task_group_unlock(group);
+}
+
+/*
+ * Wakes a parked background thread, if there is one, for a task just
+ * counted in current_waiting_tasks.
+ */
+static void
+task_group_unpark_one(task_group *group)
+{
+   if (__atomic_load_n(&group->num_parked, __ATOMIC_SEQ_CST) == 0) {
+      return;
+   }
+   platform_status rc = task_group_lock(group);
+   platform_assert(SUCCESS(rc));
+   platform_condvar_signal(&group->cv);
+   task_group_unlock(group);
+}
+
+/*
+ * Claims one of the group's pending retirements, if any are left. TRUE if
+ * the calling background thread should exit.
+ */
+static bool32
+task_group_try_retire(task_group *group)
+{
+   uint64 num_to_retire =
+      __atomic_load_n(&group->bg.num_to_retire, __ATOMIC_SEQ_CST);
+   while (num_to_retire != 0) {
+      if (__atomic_compare_exchange_n(&group->bg.num_to_retire,
+                                      &num_to_retire,
+                                      num_to_retire - 1,
+                                      TRUE,
+                                      __ATOMIC_SEQ_CST,
+                                      __ATOMIC_SEQ_CST))
+      {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
 /*
  * task_worker_thread() - Worker function for the background task pool.
  *
  * This function is invoked when configured background threads are created.
  * We sit in an endless-loop looking for work to do and execute the tasks
- * enqueued.
+ * enqueued, parking when there is none, until the group stops or this
+ * thread is retired from it.
  */
 static void
 task_worker_thread(void *arg)
 {
-   task_group *group = (task_group *)arg;
-
-   platform_status rc = task_group_lock(group);
-   platform_assert(SUCCESS(rc));
-
-   while (group->bg.stop != TRUE) {
-      /* Invariant: we hold the lock */
-      task *task_to_run = NULL;
-      task_to_run       = task_group_get_next_task(group);
+   task_bg_thread *self  = (task_bg_thread *)arg;
+   task_group     *group = self->group;
+   const threadid  tid   = platform_get_tid();
 
+   while (!__atomic_load_n(&group->bg.stop, __ATOMIC_ACQUIRE)) {
+      if (group->bg.num_to_retire != 0 && task_group_try_retire(group)) {
+         break;
+      }
+      task *task_to_run = task_group_get_next_task(group, tid);
       if (task_to_run != NULL) {
-         __sync_fetch_and_add(&group->current_executing_tasks, 1);
-         task_group_unlock(group);
-         const threadid tid = platform_get_tid();
          group->stats[tid].total_bg_task_executions++;
          task_group_run_task(group, task_to_run);
-         platform_free(group->ts->heap_id, task_to_run);
-         rc = task_group_lock(group);
-         platform_assert(SUCCESS(rc));
-         __sync_fetch_and_sub(&group->current_executing_tasks, 1);
+      } else if (group->current_waiting_tasks != 0) {
+         // a task is still being pushed, or another thread beat us to it
+         platform_pause();
       } else {
-         rc = platform_condvar_wait(&group->cv);
-         platform_assert(SUCCESS(rc));
+         task_group_park(group);
+      }
+   }
+   __atomic_store_n(&self->exited, TRUE, __ATOMIC_RELEASE);
+}
+
+/*
+ * Starts one more background thread for group, in a free slot.
+ */
+static platform_status
+task_group_add_thread(task_group *group)
+{
+   task_bg_thread *slot = NULL;
+   for (uint64 i = 0; i < MAX_THREADS; i++) {
+      if (!group->bg.threads[i].in_use) {
+         slot = &group->bg.threads[i];
+         break;
       }
    }
+   if (slot == NULL) {
+      return STATUS_BUSY;
+   }
+
+   slot->group  = group;
+   slot->exited = FALSE;
+   platform_status rc = task_create_thread_with_hooks(&slot->thread,
+                                                      FALSE,
+                                                      task_worker_thread,
+                                                      slot,
+                                                      group->bg.scratch_size,
+                                                      group->ts,
+                                                      group->ts->heap_id,
+                                                      group->bg.cpus);
+   if (!SUCCESS(rc)) {
+      platform_error_log("Could not create a background thread: %s\n",
+                         platform_status_to_string(rc));
+      return rc;
+   }
+   slot->in_use = TRUE;
+   __atomic_add_fetch(&group->bg.num_threads, 1, __ATOMIC_SEQ_CST);
+   return STATUS_OK;
+}
+
+/*
+ * Asks one of group's background threads, whichever gets to it first, to
+ * exit. It is joined later, by task_group_join_retired_threads().
+ */
+static void
+task_group_retire_one(task_group *group)
+{
+   debug_assert(group->bg.num_threads > 0);
+   __atomic_sub_fetch(&group->bg.num_threads, 1, __ATOMIC_SEQ_CST);
+   __atomic_add_fetch(&group->bg.num_to_retire, 1, __ATOMIC_SEQ_CST);
 
+   platform_status rc = task_group_lock(group);
+   platform_assert(SUCCESS(rc));
+   platform_condvar_signal(&group->cv);
    task_group_unlock(group);
 }
 
+static void
+task_group_join_retired_threads(task_group *group)
+{
+   for (uint64 i = 0; i < MAX_THREADS; i++) {
+      task_bg_thread *slot = &group->bg.threads[i];
+      if (slot->in_use && __atomic_load_n(&slot->exited, __ATOMIC_ACQUIRE)) {
+         platform_thread_join(slot->thread);
+         slot->in_use = FALSE;
+      }
+   }
+}
+
 /*
  * Function to terminate all background threads and clean up.
  */
@@ -550,44 +945,66 @@ task_group_stop_and_wait_for_threads(task_group *group)
 {
    task_group_lock(group);
 
-   platform_assert(group->tq.head == NULL);
-   platform_assert(group->tq.tail == NULL);
+   for (task_priority priority = 0; priority < NUM_TASK_PRIORITIES;
+        priority++)
+   {
+      platform_assert(group->pq[priority].tq.head == NULL);
+      platform_assert(group->pq[priority].tq.tail == NULL);
+   }
    platform_assert(group->current_waiting_tasks == 0,
                    "Attempt to shut down task group with %lu waiting tasks",
                    group->current_waiting_tasks);
 
-   uint8 num_threads = group->bg.num_threads;
-
    // Inform the background thread that it's time to exit now.
-   group->bg.stop = TRUE;
+   __atomic_store_n(&group->bg.stop, TRUE, __ATOMIC_RELEASE);
    platform_condvar_broadcast(&group->cv);
    task_group_unlock(group);
 
-   // Allow all background threads to wrap up their work.
-   for (uint8 i = 0; i < num_threads; i++) {
-      platform_thread_join(group->bg.threads[i]);
-      group->bg.num_threads--;
+   // Allow all background threads, retired ones included, to wrap up.
+   for (uint64 i = 0; i < MAX_THREADS; i++) {
+      if (group->bg.threads[i].in_use) {
+         platform_thread_join(group->bg.threads[i].thread);
+         group->bg.threads[i].in_use = FALSE;
+      }
    }
+   group->bg.num_threads   = 0;
+   group->bg.num_to_retire = 0;
 }
 
 static void
 task_group_deinit(task_group *group)
 {
    task_group_stop_and_wait_for_threads(group);
+   for (threadid tid = 0; tid < MAX_THREADS; tid++) {
+      if (group->deques[tid] != NULL) {
+         platform_free(group->ts->heap_id, group->deques[tid]);
+      }
+   }
    platform_condvar_destroy(&group->cv);
 }
 
+/*
+ * Starts num_bg_threads background threads for group, which may later grow
+ * to max_bg_threads of them and shrink back (see task_system_monitor()).
+ * They all run on the CPUs in cpus, or anywhere if it is empty.
+ */
 static platform_status
-task_group_init(task_group  *group,
-                task_system *ts,
-                bool32       use_stats,
-                uint8        num_bg_threads,
-                uint64       scratch_size)
+task_group_init(task_group             *group,
+                task_system            *ts,
+                bool32                  use_stats,
+                uint64                  num_bg_threads,
+                uint64                  max_bg_threads,
+                uint64                  scratch_size,
+                const platform_cpu_set *cpus)
 {
    ZERO_CONTENTS(group);
-   group->ts            = ts;
-   group->use_stats     = use_stats;
-   platform_heap_id hid = ts->heap_id;
+   group->ts              = ts;
+   group->use_stats       = use_stats;
+   group->bg.min_threads  = num_bg_threads;
+   group->bg.max_threads  = MAX(num_bg_threads, max_bg_threads);
+   group->bg.scratch_size = scratch_size;
+   group->bg.cpus         = platform_cpu_set_count(cpus) ? cpus : NULL;
+   platform_heap_id hid   = ts->heap_id;
    platform_status  rc;
 
    rc = platform_condvar_init(&group->cv, hid);
@@ -595,19 +1012,12 @@ task_group_init(task_group  *group,
       return rc;
    }
 
-   for (uint8 i = 0; i < num_bg_threads; i++) {
-      rc = task_thread_create("splinter-bg-thread",
-                              task_worker_thread,
-                              (void *)group,
-                              scratch_size,
-                              ts,
-                              hid,
-                              &group->bg.threads[i]);
+   for (uint64 i = 0; i < num_bg_threads; i++) {
+      rc = task_group_add_thread(group);
       if (!SUCCESS(rc)) {
          task_group_stop_and_wait_for_threads(group);
          goto out;
       }
-      group->bg.num_threads++;
    }
    return STATUS_OK;
 
@@ -618,61 +1028,120 @@ out:
 }
 
 /*
- * task_enqueue() - Adds one task to the task queue.
+ * Grows or shrinks an adaptive group by one thread, from what it saw since
+ * the last sample, given the share of CPU time that was idle:
+ *
+ * - The group is behind if foreground threads had to run its tasks, if
+ *   tasks waited longer than TASK_BG_QUEUE_WAIT_TARGET_NS on average, or if
+ *   more tasks are waiting than there are threads to take them. If so, and
+ *   there is idle CPU to run it, it gets another thread.
+ *
+ * - Otherwise, once TASK_BG_SHRINK_SAMPLES samples in a row found some of
+ *   its threads parked or the CPU saturated, it loses one.
+ */
+static void
+task_group_resize(task_group *group, uint64 cpu_idle_percent)
+{
+   task_bg_thread_group *bg = &group->bg;
+
+   uint64 queue_wait_ns = bg->total_queue_wait_ns;
+   uint64 tasks_taken   = bg->total_tasks_taken;
+   uint64 fg_executions = bg->total_fg_task_executions;
+
+   uint64 new_tasks_taken = tasks_taken - bg->last_tasks_taken;
+   uint64 avg_queue_wait_ns =
+      (queue_wait_ns - bg->last_queue_wait_ns) / MAX(new_tasks_taken, 1);
+   bool32 fg_helped = fg_executions != bg->last_fg_task_executions;
+
+   bg->last_queue_wait_ns      = queue_wait_ns;
+   bg->last_tasks_taken        = tasks_taken;
+   bg->last_fg_task_executions = fg_executions;
+
+   bool32 behind = fg_helped || avg_queue_wait_ns > TASK_BG_QUEUE_WAIT_TARGET_NS
+                   || group->current_waiting_tasks > bg->num_threads;
+   bool32 cpu_idle = cpu_idle_percent >= TASK_BG_MIN_IDLE_PERCENT;
+
+   if (behind && cpu_idle && bg->num_threads < bg->max_threads) {
+      if (SUCCESS(task_group_add_thread(group))) {
+         bg->num_threads_added++;
+      }
+      bg->num_calm_samples = 0;
+   } else if (group->num_parked > 0 || !cpu_idle) {
+      bg->num_calm_samples++;
+      if (bg->num_calm_samples >= TASK_BG_SHRINK_SAMPLES
+          && bg->num_threads > bg->min_threads)
+      {
+         task_group_retire_one(group);
+         bg->num_threads_retired++;
+         bg->num_calm_samples = 0;
+      }
+   } else {
+      bg->num_calm_samples = 0;
+   }
+}
+
+/*
+ * task_enqueue() - Adds one task of the given priority to the calling
+ * thread's deque, or to the shared queue if the deque is full (or cannot be
+ * allocated).
  */
 platform_status
-task_enqueue(task_system *ts,
-             task_type    type,
-             task_fn      func,
-             void        *arg,
-             bool32       at_head)
+task_enqueue(task_system  *ts,
+             task_type     type,
+             task_fn       func,
+             void         *arg,
+             task_priority priority)
 {
+   debug_assert(priority < NUM_TASK_PRIORITIES);
    task *new_task = TYPED_ZALLOC(ts->heap_id, new_task);
    if (new_task == NULL) {
       return STATUS_NO_MEMORY;
    }
-   new_task->func = func;
-   new_task->arg  = arg;
-   new_task->ts   = ts;
-
-   task_group     *group = &ts->group[type];
-   task_queue     *tq    = &group->tq;
-   platform_status rc;
-
-   rc = task_group_lock(group);
-   if (!SUCCESS(rc)) {
-      platform_free(ts->heap_id, new_task);
-      return rc;
+   new_task->func     = func;
+   new_task->arg      = arg;
+   new_task->ts       = ts;
+   new_task->priority = priority;
+
+   task_group          *group = &ts->group[type];
+   task_priority_queue *pq    = &group->pq[priority];
+   const threadid       tid   = platform_get_tid();
+   platform_assert(tid < MAX_THREADS, "tid=%lu", tid);
+   if (group->use_stats || task_group_is_adaptive(group)) {
+      new_task->enqueue_time = platform_get_timestamp();
    }
 
-   if (tq->tail) {
-      if (at_head) {
-         tq->head->prev = new_task;
-         new_task->next = tq->head;
-         tq->head       = new_task;
-      } else {
-         tq->tail->next = new_task;
-         new_task->prev = tq->tail;
-         tq->tail       = new_task;
+   // count the task before anyone can take it
+   __sync_fetch_and_add(&ts->num_outstanding_tasks, 1);
+   uint64 waiting_of_priority = __sync_add_and_fetch(&pq->num_waiting, 1);
+   uint64 waiting_tasks =
+      __atomic_add_fetch(&group->current_waiting_tasks, 1, __ATOMIC_SEQ_CST);
+
+   task_deque *dq = task_group_get_own_deque(group, priority, tid);
+   if (dq == NULL || !task_deque_push(dq, new_task)) {
+      platform_status rc = task_group_lock(group);
+      if (!SUCCESS(rc)) {
+         __sync_fetch_and_sub(&group->current_waiting_tasks, 1);
+         __sync_fetch_and_sub(&pq->num_waiting, 1);
+         __sync_fetch_and_sub(&ts->num_outstanding_tasks, 1);
+         platform_free(ts->heap_id, new_task);
+         return rc;
       }
-   } else {
-      platform_assert(tq->head == NULL);
-      tq->head = tq->tail = new_task;
+      task_priority_queue_push(pq, new_task);
+      task_group_unlock(group);
    }
 
-   __sync_fetch_and_add(&group->current_waiting_tasks, 1);
-
    if (group->use_stats) {
-      new_task->enqueue_time = platform_get_timestamp();
-      const threadid tid     = platform_get_tid();
-      if (group->current_waiting_tasks
-          > group->stats[tid].max_outstanding_tasks) {
-         group->stats[tid].max_outstanding_tasks = group->current_waiting_tasks;
+      task_stats *stats = &group->stats[tid];
+      if (waiting_tasks > stats->max_outstanding_tasks) {
+         stats->max_outstanding_tasks = waiting_tasks;
+      }
+      if (waiting_of_priority > stats->max_waiting_tasks[priority]) {
+         stats->max_waiting_tasks[priority] = waiting_of_priority;
       }
-      group->stats[tid].total_tasks_enqueued += 1;
+      stats->total_tasks_enqueued += 1;
    }
-   platform_condvar_signal(&group->cv);
-   return task_group_unlock(group);
+   task_group_unpark_one(group);
+   return STATUS_OK;
 }
 
 /*
@@ -683,9 +1152,6 @@ task_enqueue(task_system *ts,
 static platform_status
 task_group_perform_one(task_group *group, uint64 queue_scale_percent)
 {
-   platform_status rc;
-   task           *assigned_task = NULL;
-
    /* We do the queue size comparison in this round-about way to avoid
       integer overflow. */
    if (queue_scale_percent
@@ -695,38 +1161,16 @@ task_group_perform_one(task_group *group, uint64 queue_scale_percent)
       return STATUS_TIMEDOUT;
    }
 
-   rc = task_group_lock(group);
-   if (!SUCCESS(rc)) {
-      return rc;
-   }
-
-   assigned_task = task_group_get_next_task(group);
-
-   /*
-    * It is important to update the current_executing_tasks while
-    * holding the lock. The reason is that, if we release the lock
-    * before updating current_executing_tasks, then another thread
-    * might observe that both the number of enqueued tasks and the
-    * number of executing tasks are both 0, and hence that the system
-    * is quiescent, even though it is not.
-    */
-   if (assigned_task) {
-      __sync_fetch_and_add(&group->current_executing_tasks, 1);
+   const threadid tid           = platform_get_tid();
+   task          *assigned_task = task_group_get_next_task(group, tid);
+   if (assigned_task == NULL) {
+      return STATUS_TIMEDOUT;
    }
-
-   task_group_unlock(group);
-
-   if (assigned_task) {
-      const threadid tid = platform_get_tid();
-      group->stats[tid].total_fg_task_executions++;
-      task_group_run_task(group, assigned_task);
-      __sync_fetch_and_sub(&group->current_executing_tasks, 1);
-      platform_free(group->ts->heap_id, assigned_task);
-   } else {
-      rc = STATUS_TIMEDOUT;
+   group->stats[tid].total_fg_task_executions++;
+   if (task_group_is_adaptive(group)) {
+      __sync_fetch_and_add(&group->bg.total_fg_task_executions, 1);
    }
-
-   return rc;
+   return task_group_run_task(group, assigned_task);
 }
 
 /*
@@ -758,38 +1202,15 @@ task_perform_all(task_system *ts)
    } while (STATUS_IS_NE(rc, STATUS_TIMEDOUT));
 }
 
+/*
+ * A task is outstanding from before it is enqueued until after it has run,
+ * and so until after any tasks it enqueued are outstanding, in whatever
+ * group. So no outstanding tasks means no waiting or running ones.
+ */
 bool32
 task_system_is_quiescent(task_system *ts)
 {
-   platform_status rc;
-   task_type       ttlocked;
-   bool32          result = FALSE;
-
-   for (ttlocked = TASK_TYPE_FIRST; ttlocked < NUM_TASK_TYPES; ttlocked++) {
-      rc = task_group_lock(&ts->group[ttlocked]);
-      if (!SUCCESS(rc)) {
-         goto cleanup;
-      }
-   }
-
-   for (task_type ttchecked = TASK_TYPE_FIRST; ttchecked < NUM_TASK_TYPES;
-        ttchecked++)
-   {
-      if (ts->group[ttchecked].current_executing_tasks
-          || ts->group[ttchecked].current_waiting_tasks)
-      {
-         goto cleanup;
-      }
-   }
-   result = TRUE;
-
-cleanup:
-   for (task_type tt = TASK_TYPE_FIRST; tt < ttlocked; tt++) {
-      rc = task_group_unlock(&ts->group[tt]);
-      debug_assert(SUCCESS(rc));
-   }
-
-   return result;
+   return __atomic_load_n(&ts->num_outstanding_tasks, __ATOMIC_SEQ_CST) == 0;
 }
 
 platform_status
@@ -814,7 +1235,8 @@ task_perform_until_quiescent(task_system *ts)
  * Validate that the task system configuration is basically supportable.
  */
 static platform_status
-task_config_valid(const uint64 num_background_threads[NUM_TASK_TYPES])
+task_config_valid(const uint64 num_background_threads[NUM_TASK_TYPES],
+                  const uint64 max_background_threads[NUM_TASK_TYPES])
 {
    uint64 normal_bg_threads   = num_background_threads[TASK_TYPE_NORMAL];
    uint64 memtable_bg_threads = num_background_threads[TASK_TYPE_MEMTABLE];
@@ -828,16 +1250,46 @@ task_config_valid(const uint64 num_background_threads[NUM_TASK_TYPES])
                          (MAX_THREADS - 1));
       return STATUS_BAD_PARAM;
    }
+
+   uint64 max_normal_bg_threads   = max_background_threads[TASK_TYPE_NORMAL];
+   uint64 max_memtable_bg_threads = max_background_threads[TASK_TYPE_MEMTABLE];
+   if (max_normal_bg_threads < normal_bg_threads
+       || max_memtable_bg_threads < memtable_bg_threads)
+   {
+      platform_error_log("Maximum numbers of background threads, "
+                         "max_normal_bg_threads=%lu, "
+                         "max_memtable_bg_threads=%lu, must be at least "
+                         "normal_bg_threads=%lu, memtable_bg_threads=%lu.\n",
+                         max_normal_bg_threads,
+                         max_memtable_bg_threads,
+                         normal_bg_threads,
+                         memtable_bg_threads);
+      return STATUS_BAD_PARAM;
+   }
+   if ((max_normal_bg_threads + max_memtable_bg_threads) >= MAX_THREADS) {
+      platform_error_log("Total maximum number of background threads "
+                         "configured, max_normal_bg_threads=%lu, "
+                         "max_memtable_bg_threads=%lu, must be <= %d.\n",
+                         max_normal_bg_threads,
+                         max_memtable_bg_threads,
+                         (MAX_THREADS - 1));
+      return STATUS_BAD_PARAM;
+   }
    return STATUS_OK;
 }
 
+/*
+ * Sets up a task system config whose background thread pools are fixed at
+ * num_bg_threads, and run on any CPU. Raise max_background_threads
+ * afterwards to let them grow, and fill in background_cpus to confine them.
+ */
 platform_status
 task_system_config_init(task_system_config *task_cfg,
                         bool32              use_stats,
                         const uint64        num_bg_threads[NUM_TASK_TYPES],
                         uint64              scratch_size)
 {
-   platform_status rc = task_config_valid(num_bg_threads);
+   platform_status rc = task_config_valid(num_bg_threads, num_bg_threads);
    if (!SUCCESS(rc)) {
       return rc;
    }
@@ -848,9 +1300,84 @@ task_system_config_init(task_system_config *task_cfg,
    memcpy(task_cfg->num_background_threads,
           num_bg_threads,
           NUM_TASK_TYPES * sizeof(num_bg_threads[0]));
+   memcpy(task_cfg->max_background_threads,
+          num_bg_threads,
+          NUM_TASK_TYPES * sizeof(num_bg_threads[0]));
+   ZERO_ARRAY(task_cfg->background_cpus);
    return STATUS_OK;
 }
 
+/*
+ * Returns the share of CPU time that was idle since the last call, or
+ * last_percent if too little time has gone by to tell.
+ */
+static uint64
+task_system_cpu_idle_percent(task_system *ts, uint64 last_percent)
+{
+   uint64 idle;
+   uint64 total;
+   if (!SUCCESS(platform_get_cpu_ticks(&idle, &total))) {
+      // Can't tell, so don't hold the pools back
+      return 100;
+   }
+   uint64 elapsed_ticks = total - ts->monitor.last_cpu_total;
+   if (elapsed_ticks < TASK_BG_MIN_CPU_TICKS) {
+      return last_percent;
+   }
+   uint64 idle_ticks          = idle - ts->monitor.last_cpu_idle;
+   ts->monitor.last_cpu_idle  = idle;
+   ts->monitor.last_cpu_total = total;
+   return 100 * idle_ticks / elapsed_ticks;
+}
+
+/*
+ * Worker function for the task system's monitor thread, which resizes the
+ * pools of adaptive task groups (see task_group_resize()) until the task
+ * system is destroyed.
+ */
+static void
+task_system_monitor(void *arg)
+{
+   task_system *ts               = (task_system *)arg;
+   uint64       cpu_idle_percent = 100;
+
+   while (!__atomic_load_n(&ts->monitor.stop, __ATOMIC_ACQUIRE)) {
+      platform_sleep_ns(TASK_BG_SAMPLE_INTERVAL_NS);
+      cpu_idle_percent = task_system_cpu_idle_percent(ts, cpu_idle_percent);
+      for (task_type type = TASK_TYPE_FIRST; type != NUM_TASK_TYPES; type++) {
+         task_group *group = &ts->group[type];
+         if (task_group_is_adaptive(group)) {
+            task_group_join_retired_threads(group);
+            task_group_resize(group, cpu_idle_percent);
+         }
+      }
+   }
+}
+
+static platform_status
+task_system_start_monitor(task_system *ts)
+{
+   platform_get_cpu_ticks(&ts->monitor.last_cpu_idle,
+                          &ts->monitor.last_cpu_total);
+   platform_status rc = platform_thread_create(
+      &ts->monitor.thread, FALSE, task_system_monitor, ts, ts->heap_id);
+   if (SUCCESS(rc)) {
+      ts->monitor.running = TRUE;
+   }
+   return rc;
+}
+
+static void
+task_system_stop_monitor(task_system *ts)
+{
+   if (!ts->monitor.running) {
+      return;
+   }
+   __atomic_store_n(&ts->monitor.stop, TRUE, __ATOMIC_RELEASE);
+   platform_thread_join(ts->monitor.thread);
+   ts->monitor.running = FALSE;
+}
+
 /*
  * -----------------------------------------------------------------------------
  * Task system initializer. Makes sure that the initial thread has an
@@ -866,7 +1393,8 @@ task_system_create(platform_heap_id          hid,
                    task_system             **system,
                    const task_system_config *cfg)
 {
-   platform_status rc = task_config_valid(cfg->num_background_threads);
+   platform_status rc = task_config_valid(cfg->num_background_threads,
+                                          cfg->max_background_threads);
    if (!SUCCESS(rc)) {
       return rc;
    }
@@ -879,7 +1407,7 @@ task_system_create(platform_heap_id          hid,
    ts->cfg     = cfg;
    ts->ioh     = ioh;
    ts->heap_id = hid;
-   task_init_tid_bitmask(&ts->tid_bitmask);
+   task_init_tid_bitmask(ts->tid_bitmask);
 
    // task initialization
    register_standard_hooks(ts);
@@ -893,7 +1421,9 @@ task_system_create(platform_heap_id          hid,
                                            ts,
                                            cfg->use_stats,
                                            cfg->num_background_threads[type],
-                                           cfg->scratch_size);
+                                           cfg->max_background_threads[type],
+                                           cfg->scratch_size,
+                                           &cfg->background_cpus[type]);
       if (!SUCCESS(rc)) {
          task_deregister_this_thread(ts);
          task_system_destroy(hid, &ts);
@@ -908,7 +1438,33 @@ task_system_create(platform_heap_id          hid,
                               ((nbg_threads > 1) ? "s " : " "),
                               task_type_name[type]);
       }
+      if (task_group_is_adaptive(&ts->group[type])) {
+         platform_default_log("Splinter task system may grow background "
+                              "threads of type '%s' to %lu.\n",
+                              task_type_name[type],
+                              cfg->max_background_threads[type]);
+      }
+      if (ts->group[type].bg.cpus != NULL) {
+         platform_default_log("Splinter task system confines background "
+                              "threads of type '%s' to %lu CPUs.\n",
+                              task_type_name[type],
+                              platform_cpu_set_count(ts->group[type].bg.cpus));
+      }
    }
+
+   for (task_type type = TASK_TYPE_FIRST; type != NUM_TASK_TYPES; type++) {
+      if (task_group_is_adaptive(&ts->group[type])) {
+         rc = task_system_start_monitor(ts);
+         if (!SUCCESS(rc)) {
+            task_deregister_this_thread(ts);
+            task_system_destroy(hid, &ts);
+            *system = NULL;
+            return rc;
+         }
+         break;
+      }
+   }
+
    debug_assert((*system == NULL),
                 "Task system handle, %p, is expected to be NULL.\n",
                 *system);
@@ -927,6 +1483,7 @@ void
 task_system_destroy(platform_heap_id hid, task_system **ts_in)
 {
    task_system *ts = *ts_in;
+   task_system_stop_monitor(ts);
    for (task_type type = TASK_TYPE_FIRST; type != NUM_TASK_TYPES; type++) {
       task_group_deinit(&ts->group[type]);
    }
@@ -934,12 +1491,15 @@ task_system_destroy(platform_heap_id hid, task_system **ts_in)
    if (tid != INVALID_TID) {
       task_deregister_this_thread(ts);
    }
-   if (ts->tid_bitmask != ((uint64)-1)) {
-      platform_error_log(
-         "Destroying task system that still has some registered threads."
-         ", tid=%lu, tid_bitmask=0x%lx\n",
-         tid,
-         ts->tid_bitmask);
+   for (uint64 word = 0; word < TASK_TID_BITMASK_WORDS; word++) {
+      if (ts->tid_bitmask[word] != ((uint64)-1)) {
+         platform_error_log(
+            "Destroying task system that still has some registered threads."
+            ", tid=%lu, tid_bitmask[%lu]=0x%lx\n",
+            tid,
+            word,
+            ts->tid_bitmask[word]);
+      }
    }
    platform_free(hid, ts);
    *ts_in = (task_system *)NULL;
@@ -998,6 +1558,18 @@ task_group_print_stats(task_group *group, task_type type)
       global.max_outstanding_tasks = MAX(global.max_outstanding_tasks,
                                          group->stats[i].max_outstanding_tasks);
       global.total_tasks_enqueued += group->stats[i].total_tasks_enqueued;
+      global.total_tasks_stolen += group->stats[i].total_tasks_stolen;
+      for (task_priority p = 0; p < NUM_TASK_PRIORITIES; p++) {
+         global.max_waiting_tasks[p] = MAX(
+            global.max_waiting_tasks[p], group->stats[i].max_waiting_tasks[p]);
+         global.max_priority_wait_time_ns[p] =
+            MAX(global.max_priority_wait_time_ns[p],
+                group->stats[i].max_priority_wait_time_ns[p]);
+         global.total_priority_wait_time_ns[p] +=
+            group->stats[i].total_priority_wait_time_ns[p];
+         global.total_priority_executions[p] +=
+            group->stats[i].total_priority_executions[p];
+      }
    }
 
    switch (type) {
@@ -1012,6 +1584,14 @@ task_group_print_stats(task_group *group, task_type type)
          break;
    }
    platform_default_log("--------------------------------\n");
+   platform_default_log("| background threads   : %10lu (min=%lu, max=%lu)\n",
+                        group->bg.num_threads,
+                        group->bg.min_threads,
+                        group->bg.max_threads);
+   platform_default_log("| bg threads added     : %10lu\n",
+                        group->bg.num_threads_added);
+   platform_default_log("| bg threads retired   : %10lu\n",
+                        group->bg.num_threads_retired);
    platform_default_log("| max runtime (ns)     : %10lu\n",
                         global.max_runtime_ns);
    platform_default_log("| max runtime func     : %10p\n",
@@ -1032,10 +1612,25 @@ task_group_print_stats(task_group *group, task_type type)
                         global.total_bg_task_executions);
    platform_default_log("| total fg tasks run      : %10lu\n",
                         global.total_fg_task_executions);
+   platform_default_log("| total tasks stolen      : %10lu\n",
+                        global.total_tasks_stolen);
    platform_default_log("| current waiting tasks : %lu\n",
                         group->current_waiting_tasks);
    platform_default_log("| max outstanding tasks : %lu\n",
                         global.max_outstanding_tasks);
+   platform_default_log("| priority | waiting | max waiting |  tasks run "
+                        "| avg wait (ns) | max wait (ns)\n");
+   for (task_priority p = 0; p < NUM_TASK_PRIORITIES; p++) {
+      platform_default_log(
+         "| %8s | %7lu | %11lu | %10lu | %13lu | %13lu\n",
+         task_priority_name[p],
+         group->pq[p].num_waiting,
+         global.max_waiting_tasks[p],
+         global.total_priority_executions[p],
+         global.total_priority_wait_time_ns[p]
+            / MAX(global.total_priority_executions[p], 1),
+         global.max_priority_wait_time_ns[p]);
+   }
    platform_default_log("\n");
 }
 
@@ -10,13 +10,29 @@ typedef struct task_system task_system;
 typedef void (*task_hook)(task_system *arg);
 typedef void (*task_fn)(void *arg, void *scratch);
 
+/*
+ * Within a task group, waiting tasks of a higher priority run before those
+ * of a lower one, except that every TASK_STARVATION_INTERVAL'th task a
+ * thread takes is of the lowest priority waiting, so that a backlog of
+ * higher priority tasks does not starve the rest.
+ */
+typedef enum task_priority {
+   TASK_PRIORITY_HIGH = 0, // e.g. filter builds, which lower lookup cost
+   TASK_PRIORITY_NORMAL,   // e.g. flushes and compactions
+   TASK_PRIORITY_LOW,      // e.g. space reclamation and cache warmup
+   NUM_TASK_PRIORITIES
+} task_priority;
+
+#define TASK_STARVATION_INTERVAL (8)
+
 typedef struct task {
-   struct task *next;
-   struct task *prev;
-   task_fn      func;
-   void        *arg;
-   task_system *ts;
-   timestamp    enqueue_time;
+   struct task  *next;
+   struct task  *prev;
+   task_fn       func;
+   void         *arg;
+   task_system  *ts;
+   task_priority priority;
+   timestamp     enqueue_time;
 } task;
 
 /*
@@ -31,6 +47,12 @@ typedef struct {
    uint64    total_bg_task_executions;
    uint64    total_fg_task_executions;
    uint64    total_tasks_enqueued;
+   uint64    total_tasks_stolen;
+   // Per priority
+   uint64 max_waiting_tasks[NUM_TASK_PRIORITIES];
+   uint64 max_priority_wait_time_ns[NUM_TASK_PRIORITIES];
+   uint64 total_priority_wait_time_ns[NUM_TASK_PRIORITIES];
+   uint64 total_priority_executions[NUM_TASK_PRIORITIES];
 } PLATFORM_CACHELINE_ALIGNED task_stats;
 
 typedef struct task_queue {
@@ -38,10 +60,94 @@ typedef struct task_queue {
    task *tail;
 } task_queue;
 
+#define TASK_DEQUE_CAPACITY (256)
+
+/*
+ * Each thread enqueues its tasks on its own deque in each task group, and
+ * pops them back off the bottom, newest first. Other threads steal from the
+ * top, oldest first. This is the bounded Chase-Lev deque: only its owner
+ * pushes and pops, so neither needs a lock, and thieves contend only with
+ * each other and, for the last task, with the owner.
+ */
+typedef struct task_deque {
+   volatile int64 top;
+   char           pad[PLATFORM_CACHELINE_SIZE - sizeof(int64)];
+   volatile int64 bottom;
+   task          *tasks[TASK_DEQUE_CAPACITY];
+} PLATFORM_CACHELINE_ALIGNED task_deque;
+
+/*
+ * A thread's deques in a task group, one per priority. Each thread allocates
+ * its own on its first enqueue to the group.
+ */
+typedef struct task_thread_deques {
+   task_deque deque[NUM_TASK_PRIORITIES];
+} task_thread_deques;
+
+/*
+ * The waiting tasks of one priority in a task group, other than those on the
+ * threads' deques.
+ */
+typedef struct task_priority_queue {
+   // Tasks that did not fit on their enqueuer's deque
+   task_queue      tq;
+   volatile uint64 num_queued; // tasks in tq, protected by the group's lock
+   volatile uint64 num_waiting;
+} task_priority_queue;
+
+/*
+ * A task group with max_background_threads above num_background_threads
+ * grows and shrinks its pool of background threads between the two. Every
+ * TASK_BG_SAMPLE_INTERVAL_NS, the task system's monitor thread adds a thread
+ * to the pool if, since the last sample, foreground threads had to perform
+ * the group's tasks, its tasks waited over TASK_BG_QUEUE_WAIT_TARGET_NS on
+ * average or more of them are waiting than there are threads, as long as at
+ * least TASK_BG_MIN_IDLE_PERCENT of the CPU time was idle. It retires a
+ * thread once TASK_BG_SHRINK_SAMPLES samples in a row found that the pool
+ * had parked threads or that the CPU was saturated.
+ */
+#define TASK_BG_SAMPLE_INTERVAL_NS   (10 * 1000 * 1000)
+#define TASK_BG_QUEUE_WAIT_TARGET_NS (1000 * 1000)
+#define TASK_BG_MIN_IDLE_PERCENT     (10)
+#define TASK_BG_SHRINK_SAMPLES       (100)
+// Fewest CPU ticks (summed over CPUs) to measure the idle share over
+#define TASK_BG_MIN_CPU_TICKS (20)
+
+typedef struct task_bg_thread {
+   struct task_group *group;
+   platform_thread    thread;
+   bool32             in_use; // started and not yet joined
+   volatile bool32    exited; // done working, and ready to be joined
+} task_bg_thread;
+
 typedef struct task_bg_thread_group {
-   bool32          stop;
-   uint8           num_threads;
-   platform_thread threads[MAX_THREADS];
+   bool32 stop;
+   // threads in the pool, not counting those asked to retire
+   volatile uint64 num_threads;
+   uint64          min_threads;
+   uint64          max_threads;
+   uint64          scratch_size;
+   // CPUs the threads run on, or NULL for any
+   const platform_cpu_set *cpus;
+   // retirements asked for that no thread has taken up yet
+   volatile uint64 num_to_retire;
+   // Only the monitor thread starts and joins threads once the group is up
+   task_bg_thread threads[MAX_THREADS];
+
+   // Signs of the pool falling behind, kept if the pool is adaptive
+   volatile uint64 total_queue_wait_ns;
+   volatile uint64 total_tasks_taken;
+   volatile uint64 total_fg_task_executions;
+
+   // The monitor thread's last sample
+   uint64 last_queue_wait_ns;
+   uint64 last_tasks_taken;
+   uint64 last_fg_task_executions;
+   uint64 num_calm_samples;
+
+   // stats
+   uint64 num_threads_added;
+   uint64 num_threads_retired;
 } task_bg_thread_group;
 
 /*
@@ -49,13 +155,19 @@ typedef struct task_bg_thread_group {
  * by a structure of this type.
  */
 typedef struct task_group {
-   task_system *ts;
-   task_queue   tq; // Queue of tasks in this group, of a task type
-
-   volatile uint64 current_waiting_tasks;
+   task_system        *ts;
+   task_priority_queue pq[NUM_TASK_PRIORITIES];
+   // Indexed by thread id, NULL until that thread first enqueues a task
+   task_thread_deques *volatile deques[MAX_THREADS];
+   // tasks taken by each thread, to pace its turns at the lowest priority
+   uint64 num_taken[MAX_THREADS];
+
+   volatile uint64 current_waiting_tasks; // of all priorities
    volatile uint64 current_executing_tasks;
 
+   // Idle background threads park on cv
    platform_condvar     cv;
+   volatile uint64      num_parked;
    task_bg_thread_group bg;
 
    // Per thread stats.
@@ -80,7 +192,14 @@ typedef enum task_type {
 typedef struct task_system_config {
    bool32 use_stats;
    uint64 num_background_threads[NUM_TASK_TYPES];
-   uint64 scratch_size;
+   // Above num_background_threads, the pool is adaptive up to this size, see
+   // TASK_BG_SAMPLE_INTERVAL_NS. task_system_config_init() makes it
+   // num_background_threads.
+   uint64 max_background_threads[NUM_TASK_TYPES];
+   // CPUs each group's background threads are confined to, if not empty.
+   // Their scratch space is then placed on those CPUs' NUMA node.
+   platform_cpu_set background_cpus[NUM_TASK_TYPES];
+   uint64           scratch_size;
 } task_system_config;
 
 platform_status
@@ -92,6 +211,9 @@ task_system_config_init(task_system_config *task_cfg,
 
 #define TASK_MAX_HOOKS (4)
 
+#define TASK_TID_BITMASK_WORDS (MAX_THREADS / 64)
+_Static_assert(MAX_THREADS % 64 == 0, "MAX_THREADS must be a multiple of 64");
+
 /*
  * ----------------------------------------------------------------------
  * Splinter specific state that gets created during initialization in
@@ -115,14 +237,25 @@ struct task_system {
     * bitmask used for generating and clearing thread id's.
     * If a bit is set to 0, it means we have an in use thread id for that
     * particular position, 1 means it is unset and that thread id is available
-    * for use.
+    * for use. Thread id tid is bit tid % 64 of word tid / 64.
     */
-   uint64 tid_bitmask;
+   uint64 tid_bitmask[TASK_TID_BITMASK_WORDS];
    // max thread id so far.
    threadid max_tid;
    void    *thread_scratch[MAX_THREADS];
    // task groups
    task_group group[NUM_TASK_TYPES];
+   // tasks enqueued in any group and not yet finished
+   volatile uint64 num_outstanding_tasks;
+
+   // Resizes the pools of adaptive task groups, if there are any
+   struct {
+      volatile bool32 stop;
+      bool32          running;
+      platform_thread thread;
+      uint64          last_cpu_idle;
+      uint64          last_cpu_total;
+   } monitor;
 
    int       hook_init_done;
    int       num_hooks;
@@ -196,11 +329,11 @@ void *
 task_system_get_thread_scratch(task_system *ts, threadid tid);
 
 platform_status
-task_enqueue(task_system *ts,
-             task_type    type,
-             task_fn      func,
-             void        *arg,
-             bool32       at_head);
+task_enqueue(task_system  *ts,
+             task_type     type,
+             task_fn       func,
+             void         *arg,
+             task_priority priority);
 
 /*
  * Possibly performs one background task if there is one waiting,
@@ -240,6 +373,20 @@ task_perform_one(task_system *ts)
    return task_perform_one_if_needed(ts, 0);
 }
 
+/* The number of tasks of type waiting to run. */
+static inline uint64
+task_num_waiting(task_system *ts, task_type type)
+{
+   return ts->group[type].current_waiting_tasks;
+}
+
+/* The number of background threads running tasks of type. */
+static inline uint64
+task_num_background_threads(task_system *ts, task_type type)
+{
+   return ts->group[type].bg.num_threads;
+}
+
 /*
  * task_perform_all() - Perform all tasks queued with the task system.
  * Returns as soon as it finds the queue is empty.  Useful
@@ -270,8 +417,9 @@ task_wait_for_completion(task_system *ts);
 threadid
 task_get_max_tid(task_system *ts);
 
+// Word 'word' of the bitmask of active threads, for thread ids from 64 * word
 uint64
-task_active_tasks_mask(task_system *ts);
+task_active_tasks_mask(task_system *ts, uint64 word);
 
 void
 task_print_stats(task_system *ts);
@@ -78,6 +78,35 @@ static const int64 latency_histo_buckets[LATENCYHISTO_SIZE] = {
  */
 #define TRUNK_MIN_SPACE_RECL (2048)
 
+/*
+ * Pivots are compacted for the deletes and updates in their whole branches
+ * only once there are at least this many of them, however dense they are.
+ */
+#define TRUNK_MIN_TOMBSTONE_COMPACTION             (2048)
+#define TRUNK_DEFAULT_TOMBSTONE_COMPACTION_PERCENT (25)
+
+/*
+ * Write throttling, see trunk_write_throttle. Delays shorter than
+ * TRUNK_THROTTLE_MIN_DELAY_NS are carried over to later inserts rather than
+ * slept.
+ */
+#define TRUNK_DEFAULT_WRITE_THROTTLE_PERCENT (30)
+#define TRUNK_THROTTLE_TASKS_PER_BG_THREAD   (16)
+#define TRUNK_THROTTLE_MIN_RATE_DIVISOR      (8)
+#define TRUNK_THROTTLE_MIN_DELAY_NS          (50 * 1000)
+
+/*
+ * The least trunk_try_insert asks its caller to wait before retrying, such as
+ * when another thread is rotating the memtable.
+ */
+#define TRUNK_TRY_INSERT_MIN_RETRY_NS (100 * 1000)
+
+/*
+ * trunk_compact_range waits at most this long for a node to be ready for a
+ * flush or compaction before it leaves the node as it is.
+ */
+#define TRUNK_COMPACT_RANGE_WAIT_NS (SEC_TO_NSEC(10))
+
 /* Some randomly chosen Splinter super-block checksum seed. */
 #define TRUNK_SUPER_CSUM_SEED (42)
 
@@ -90,10 +119,17 @@ static const int64 latency_histo_buckets[LATENCYHISTO_SIZE] = {
 #define TRUNK_SINGLE_LEAF_THRESHOLD_PCT (75)
 
 /*
- * Index of the trunk_root_lock batch rwlock used.
+ * Index of the trunk_root_lock batch rwlock whose claim serializes root
+ * updates. Readers do not take it, see trunk_root_get.
  */
 #define TRUNK_ROOT_LOCK_IDX 0
 
+/*
+ * Index of the trunk_root_lock batch rwlock which tree updates hold for read
+ * and trunk_clear and trunk_checkpoint hold for write. See trunk_block_clear.
+ */
+#define TRUNK_CLEAR_LOCK_IDX 1
+
 /*
  * During Splinter configuration, the fanout parameter is provided by the user.
  * SplinterDB defers internal node splitting in order to use hand-over-hand
@@ -449,15 +485,38 @@ trunk_log_node_if_enabled(platform_stream_handle *stream,
 typedef struct ONDISK trunk_super_block {
    uint64 root_addr; // Address of the root of the trunk for the instance
                      // referenced by this superblock.
+   uint64      meta_head; // trunk mini allocator, not root-relative: the root
+                          // moves by copy-on-write
    uint64      meta_tail;
    uint64      log_addr;
    uint64      log_meta_addr;
+   uint64      warmup_addr; // head of the cache warm-up list, 0 if none
    uint64      timestamp;
    bool32      checkpointed;
    bool32      unmounted;
    checksum128 checksum;
 } trunk_super_block;
 
+/*
+ *-----------------------------------------------------------------------------
+ * Cache warm-up list: Disk-resident chain of PAGE_TYPE_MISC pages.
+ *
+ * Written at unmount when use_cache_warmup is set, and consumed (and freed)
+ * at the next mount. Records the extents which were hot in the cache, hottest
+ * first, so they can be prefetched in the background after the restart.
+ *-----------------------------------------------------------------------------
+ */
+typedef struct ONDISK trunk_warmup_entry {
+   uint64 addr; // extent base address
+   uint32 type; // page_type of the extent
+} trunk_warmup_entry;
+
+typedef struct ONDISK trunk_warmup_hdr {
+   uint64             next_addr;   // next page of the list, 0 if last
+   uint64             num_entries; // entries on this page
+   trunk_warmup_entry entry[];
+} trunk_warmup_hdr;
+
 /*
  * A subbundle is a collection of branches which originated in the same node.
  * It is used to organize branches with their routing filters when they are
@@ -566,6 +625,8 @@ typedef struct ONDISK trunk_pivot_data {
    uint64 num_kv_bytes_bundle; // # kv bytes for this pivot in bundles
    uint64 num_tuples_whole;    // # tuples for this pivot in whole branches
    uint64 num_tuples_bundle;   // # tuples for this pivot in bundles
+   uint64 num_tombstones;      // # deletes for this pivot in whole branches
+   uint64 num_updates;         // # updates for this pivot in whole branches
    uint64 generation;          // receives new higher number when pivot splits
    uint16 start_branch;        // first branch live (not used in leaves)
    uint16 start_bundle;        // first bundle live (not used in leaves)
@@ -715,6 +776,7 @@ struct trunk_compact_bundle_req {
    uint16                height;
    uint16                bundle_no;
    trunk_compaction_type type;
+   uint64                clear_generation; // spl->clear_generation at enqueue
 
    // Computed as part of the compaction process
    uint64  pivot_generation[TRUNK_MAX_PIVOTS];
@@ -723,6 +785,12 @@ struct trunk_compact_bundle_req {
    uint64  output_pivot_tuple_count[TRUNK_MAX_PIVOTS];
    uint64  input_pivot_kv_byte_count[TRUNK_MAX_PIVOTS];
    uint64  output_pivot_kv_byte_count[TRUNK_MAX_PIVOTS];
+   uint64  output_pivot_tombstone_count[TRUNK_MAX_PIVOTS];
+   uint64  output_pivot_update_count[TRUNK_MAX_PIVOTS];
+   // totals for the whole output branch
+   uint64  output_tuple_count;
+   uint64  output_tombstone_count;
+   uint64  output_update_count;
    uint64  tuples_reclaimed;
    uint64  kv_bytes_reclaimed;
    uint32 *fp_arr;
@@ -817,11 +885,10 @@ trunk_bundle *                     trunk_flush_into_bundle         (trunk_handle
 void                               trunk_replace_bundle_branches   (trunk_handle *spl, trunk_node *node, trunk_branch *new_branch, trunk_compact_bundle_req *req);
 static inline uint16               trunk_add_branch_number         (trunk_handle *spl, uint16 branch_no, uint16 offset);
 static inline uint16               trunk_subtract_branch_number    (trunk_handle *spl, uint16 branch_no, uint16 offset);
-static inline void                 trunk_dec_ref                   (trunk_handle *spl, trunk_branch *branch, bool32 is_memtable);
 static inline void                 trunk_zap_branch_range          (trunk_handle *spl, trunk_branch *branch, key start_key, key end_key, page_type type);
 static inline void                 trunk_inc_intersection          (trunk_handle *spl, trunk_branch *branch, key target, bool32 is_memtable);
 void                               trunk_memtable_flush_virtual    (void *arg, uint64 generation);
-platform_status                    trunk_memtable_insert           (trunk_handle *spl, key tuple_key, message data);
+platform_status                    trunk_memtable_insert           (trunk_handle *spl, key tuple_key, message data, bool32 block, uint64 *retry_ns);
 void                               trunk_bundle_build_filters      (void *arg, void *scratch);
 
 #define trunk_inc_filter(spl, filter)                     \
@@ -830,7 +897,12 @@ void                               trunk_bundle_build_filters      (void *arg, v
 static inline void                 trunk_inc_filter_ref            (trunk_handle *spl, routing_filter *filter, uint32 lineno);
 
 static inline void                 trunk_dec_filter                (trunk_handle *spl, routing_filter *filter);
+static void                        trunk_reclaim_branch_range      (trunk_handle *spl, trunk_branch *branch, key start_key, key end_key);
+static void                        trunk_reclaim_filter            (trunk_handle *spl, routing_filter *filter);
+static void                        trunk_clear_subtree             (trunk_handle *spl, uint64 addr);
 void                               trunk_compact_bundle            (void *arg, void *scratch);
+static bool32                      trunk_resume_compactions        (trunk_handle *spl, uint64 addr, void *arg);
+static void                        trunk_compact_tombstones        (trunk_handle *spl, trunk_node *node);
 platform_status                    trunk_flush                     (trunk_handle *spl, trunk_node *parent, trunk_pivot_data *pdata, bool32 is_space_rec);
 platform_status                    trunk_flush_fullest             (trunk_handle *spl, trunk_node *node);
 static inline bool32                 trunk_needs_split               (trunk_handle *spl, trunk_node *node);
@@ -899,47 +971,29 @@ trunk_tree_height(trunk_handle *spl)
  * Super block functions
  *-----------------------------------------------------------------------------
  */
-void
-trunk_set_super_block(trunk_handle *spl,
-                      bool32        is_checkpoint,
-                      bool32        is_unmount,
-                      bool32        is_create)
+/*
+ * Stamps and checksums contents, and writes it through to the super block at
+ * super_addr.
+ */
+static void
+trunk_write_super_block(trunk_handle      *spl,
+                        uint64             super_addr,
+                        trunk_super_block *contents)
 {
-   uint64             super_addr;
    page_handle       *super_page;
    trunk_super_block *super;
    uint64             wait = 1;
-   platform_status    rc;
 
-   if (is_create) {
-      rc = allocator_alloc_super_addr(spl->al, spl->id, &super_addr);
-   } else {
-      rc = allocator_get_super_addr(spl->al, spl->id, &super_addr);
-   }
-   platform_assert_status_ok(rc);
    super_page = cache_get(spl->cc, super_addr, TRUE, PAGE_TYPE_SUPERBLOCK);
    while (!cache_try_claim(spl->cc, super_page)) {
       platform_sleep_ns(wait);
       wait *= 2;
    }
-   wait = 1;
    cache_lock(spl->cc, super_page);
 
-   super            = (trunk_super_block *)super_page->data;
-   super->root_addr = spl->root_addr;
-   super->meta_tail = mini_meta_tail(&spl->mini);
-   if (spl->cfg.use_log) {
-      if (spl->log) {
-         super->log_addr      = log_addr(spl->log);
-         super->log_meta_addr = log_meta_addr(spl->log);
-      } else {
-         super->log_addr      = 0;
-         super->log_meta_addr = 0;
-      }
-   }
-   super->timestamp    = platform_get_real_time();
-   super->checkpointed = is_checkpoint;
-   super->unmounted    = is_unmount;
+   super = (trunk_super_block *)super_page->data;
+   memmove(super, contents, sizeof(*super));
+   super->timestamp = platform_get_real_time();
    super->checksum =
       platform_checksum128(super,
                            sizeof(trunk_super_block) - sizeof(checksum128),
@@ -952,6 +1006,36 @@ trunk_set_super_block(trunk_handle *spl,
    cache_page_sync(spl->cc, super_page, TRUE, PAGE_TYPE_SUPERBLOCK);
 }
 
+void
+trunk_set_super_block(trunk_handle *spl,
+                      bool32        is_checkpoint,
+                      bool32        is_unmount,
+                      bool32        is_create)
+{
+   uint64          super_addr;
+   platform_status rc;
+
+   if (is_create) {
+      rc = allocator_alloc_super_addr(spl->al, spl->id, &super_addr);
+   } else {
+      rc = allocator_get_super_addr(spl->al, spl->id, &super_addr);
+   }
+   platform_assert_status_ok(rc);
+
+   trunk_super_block super = {0};
+   super.root_addr         = spl->root_addr;
+   super.meta_head         = spl->mini.meta_head;
+   super.meta_tail         = mini_meta_tail(&spl->mini);
+   if (spl->cfg.use_log && spl->log) {
+      super.log_addr      = log_addr(spl->log);
+      super.log_meta_addr = log_meta_addr(spl->log);
+   }
+   super.warmup_addr  = is_unmount ? spl->warmup_addr : 0;
+   super.checkpointed = is_checkpoint;
+   super.unmounted    = is_unmount;
+   trunk_write_super_block(spl, super_addr, &super);
+}
+
 trunk_super_block *
 trunk_get_super_block_if_valid(trunk_handle *spl, page_handle **super_page)
 {
@@ -983,6 +1067,207 @@ trunk_release_super_block(trunk_handle *spl, page_handle *super_page)
    cache_unget(spl->cc, super_page);
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * Cache warm-up functions
+ *
+ *      At unmount, trunk_cache_warmup_save records the hot extents of the cache
+ *      in the warm-up list. At mount, trunk_cache_warmup_start reads and frees
+ *      the list, and enqueues background tasks which prefetch those extents
+ *      while the database is already serving requests.
+ *-----------------------------------------------------------------------------
+ */
+#define TRUNK_WARMUP_EXTENTS_PER_TASK 64
+
+typedef struct trunk_warmup_ctxt {
+   trunk_handle     *spl;
+   uint64            num_hints;
+   volatile uint64   next_hint;
+   volatile uint64   tasks_outstanding;
+   cache_extent_hint hint[];
+} trunk_warmup_ctxt;
+
+static inline uint64
+trunk_warmup_entries_per_page(trunk_handle *spl)
+{
+   return (trunk_page_size(&spl->cfg) - sizeof(trunk_warmup_hdr))
+          / sizeof(trunk_warmup_entry);
+}
+
+static void
+trunk_cache_warmup_save(trunk_handle *spl)
+{
+   cache_extent_hint *hints;
+   uint64             num_hints;
+
+   spl->warmup_addr = 0;
+   platform_status rc =
+      cache_hot_extents(spl->cc, spl->heap_id, &hints, &num_hints);
+   if (!SUCCESS(rc)) {
+      platform_error_log("Failed to collect hot extents for warm-up: %s\n",
+                         platform_status_to_string(rc));
+      return;
+   }
+   if (num_hints == 0) {
+      platform_free(spl->heap_id, hints);
+      return;
+   }
+
+   uint64 page_addr;
+   rc = allocator_alloc(spl->al, &page_addr, PAGE_TYPE_MISC);
+   if (!SUCCESS(rc)) {
+      platform_free(spl->heap_id, hints);
+      return;
+   }
+   spl->warmup_addr = page_addr;
+
+   uint64 page_size        = trunk_page_size(&spl->cfg);
+   uint64 entries_per_page = trunk_warmup_entries_per_page(spl);
+   uint64 hint_no          = 0;
+   while (page_addr != 0) {
+      page_handle      *page = cache_alloc(spl->cc, page_addr, PAGE_TYPE_MISC);
+      trunk_warmup_hdr *hdr  = (trunk_warmup_hdr *)page->data;
+      memset(hdr, 0, page_size);
+      while (hdr->num_entries < entries_per_page && hint_no < num_hints) {
+         hdr->entry[hdr->num_entries].addr = hints[hint_no].addr;
+         hdr->entry[hdr->num_entries].type = hints[hint_no].type;
+         hdr->num_entries++;
+         hint_no++;
+      }
+
+      uint64 next_addr = 0;
+      if (hint_no < num_hints) {
+         next_addr = page_addr + page_size;
+         if (next_addr % trunk_extent_size(&spl->cfg) == 0) {
+            // out of space just truncates the list
+            rc = allocator_alloc(spl->al, &next_addr, PAGE_TYPE_MISC);
+            if (!SUCCESS(rc)) {
+               next_addr = 0;
+            }
+         }
+      }
+      hdr->next_addr = next_addr;
+
+      cache_mark_dirty(spl->cc, page);
+      cache_unlock(spl->cc, page);
+      cache_unclaim(spl->cc, page);
+      cache_unget(spl->cc, page);
+      page_addr = next_addr;
+   }
+
+   platform_free(spl->heap_id, hints);
+   cache_flush(spl->cc);
+}
+
+static void
+trunk_cache_warmup_task(void *arg, void *scratch)
+{
+   trunk_warmup_ctxt *ctxt = (trunk_warmup_ctxt *)arg;
+   trunk_handle      *spl  = ctxt->spl;
+
+   uint64 start =
+      __sync_fetch_and_add(&ctxt->next_hint, TRUNK_WARMUP_EXTENTS_PER_TASK);
+   uint64 end = MIN(start + TRUNK_WARMUP_EXTENTS_PER_TASK, ctxt->num_hints);
+   for (uint64 hint_no = start; hint_no < end; hint_no++) {
+      cache_extent_hint *hint = &ctxt->hint[hint_no];
+      // skip extents which have been freed since the list was saved
+      if (allocator_get_refcount(spl->al, hint->addr) >= AL_ONE_REF) {
+         cache_prefetch(spl->cc, hint->addr, hint->type);
+      }
+   }
+   cache_prefetch_wait(spl->cc);
+
+   if (__sync_sub_and_fetch(&ctxt->tasks_outstanding, 1) == 0) {
+      platform_free(spl->heap_id, ctxt);
+   }
+}
+
+static void
+trunk_cache_warmup_free_extent(trunk_handle *spl, uint64 base_addr)
+{
+   uint8 ref = allocator_dec_ref(spl->al, base_addr, PAGE_TYPE_MISC);
+   platform_assert(ref == AL_NO_REFS);
+   cache_extent_discard(spl->cc, base_addr, PAGE_TYPE_MISC);
+   ref = allocator_dec_ref(spl->al, base_addr, PAGE_TYPE_MISC);
+   platform_assert(ref == AL_FREE);
+}
+
+static void
+trunk_cache_warmup_start(trunk_handle *spl, uint64 warmup_addr)
+{
+   uint64             page_addr;
+   page_handle       *page;
+   trunk_warmup_hdr  *hdr;
+   trunk_warmup_ctxt *ctxt      = NULL;
+   uint64             num_hints = 0;
+
+   if (warmup_addr == 0) {
+      return;
+   }
+
+   if (spl->cfg.use_cache_warmup) {
+      for (page_addr = warmup_addr; page_addr != 0; page_addr = hdr->next_addr)
+      {
+         page = cache_get(spl->cc, page_addr, TRUE, PAGE_TYPE_MISC);
+         hdr  = (trunk_warmup_hdr *)page->data;
+         num_hints += hdr->num_entries;
+         cache_unget(spl->cc, page);
+      }
+      if (num_hints != 0) {
+         ctxt = TYPED_FLEXIBLE_STRUCT_ZALLOC(
+            spl->heap_id, ctxt, hint, num_hints);
+      }
+   }
+
+   // copy out the list (if warming up) and free it either way
+   allocator_config *al_cfg  = allocator_get_config(spl->al);
+   uint64            hint_no = 0;
+   page_addr                 = warmup_addr;
+   while (page_addr != 0) {
+      page = cache_get(spl->cc, page_addr, TRUE, PAGE_TYPE_MISC);
+      hdr  = (trunk_warmup_hdr *)page->data;
+      if (ctxt != NULL) {
+         for (uint64 i = 0; i < hdr->num_entries; i++) {
+            ctxt->hint[hint_no].addr = hdr->entry[i].addr;
+            ctxt->hint[hint_no].type = hdr->entry[i].type;
+            hint_no++;
+         }
+      }
+      uint64 next_addr = hdr->next_addr;
+      cache_unget(spl->cc, page);
+
+      if (next_addr == 0
+          || !allocator_config_pages_share_extent(al_cfg, page_addr, next_addr))
+      {
+         trunk_cache_warmup_free_extent(
+            spl, allocator_config_extent_base_addr(al_cfg, page_addr));
+      }
+      page_addr = next_addr;
+   }
+
+   if (ctxt == NULL) {
+      return;
+   }
+
+   ctxt->spl       = spl;
+   ctxt->num_hints = num_hints;
+   uint64 num_tasks = (num_hints + TRUNK_WARMUP_EXTENTS_PER_TASK - 1)
+                      / TRUNK_WARMUP_EXTENTS_PER_TASK;
+   ctxt->tasks_outstanding = num_tasks;
+   for (uint64 task_no = 0; task_no < num_tasks; task_no++) {
+      platform_status rc = task_enqueue(spl->ts,
+                                        TASK_TYPE_NORMAL,
+                                        trunk_cache_warmup_task,
+                                        ctxt,
+                                        TASK_PRIORITY_LOW);
+      if (!SUCCESS(rc)
+          && __sync_sub_and_fetch(&ctxt->tasks_outstanding, 1) == 0)
+      {
+         platform_free(spl->heap_id, ctxt);
+      }
+   }
+}
+
 /*
  *-----------------------------------------------------------------------------
  * Higher-level Branch and Bundle Functions
@@ -1116,14 +1401,15 @@ trunk_copy_node_and_add_to_parent(trunk_handle     *spl,    // IN
  * Fetch the latest copy of the root
  *
  * The copy is guaranteed to be the latest at some time during the call
- * duration, but may be out of date after return.
+ * duration, but may be out of date after return. The epoch keeps a trunk_clear
+ * from freeing the root between reading its address and getting it.
  */
 static inline void
 trunk_root_get(trunk_handle *spl, trunk_node *root)
 {
-   platform_batch_rwlock_get(&spl->trunk_root_lock, TRUNK_ROOT_LOCK_IDX);
+   epoch_enter(&spl->epoch);
    trunk_node_get(spl->cc, spl->root_addr, root);
-   platform_batch_rwlock_unget(&spl->trunk_root_lock, TRUNK_ROOT_LOCK_IDX);
+   epoch_exit(&spl->epoch);
 }
 
 /*
@@ -1205,16 +1491,53 @@ trunk_root_full_claim(trunk_handle *spl)
    platform_batch_rwlock_claim_loop(&spl->trunk_root_lock, TRUNK_ROOT_LOCK_IDX);
 }
 
+/*
+ * Tree updates (incorporations, compactions and filter builds) run between
+ * trunk_block_clear and trunk_unblock_clear, so that trunk_clear and
+ * trunk_checkpoint can wait for the ones in flight and then have the whole
+ * tree to themselves.
+ */
+static inline void
+trunk_block_clear(trunk_handle *spl)
+{
+   platform_batch_rwlock_get(&spl->trunk_root_lock, TRUNK_CLEAR_LOCK_IDX);
+}
+
 static inline void
-trunk_root_lock(trunk_handle *spl)
+trunk_unblock_clear(trunk_handle *spl)
 {
-   platform_batch_rwlock_lock(&spl->trunk_root_lock, TRUNK_ROOT_LOCK_IDX);
+   platform_batch_rwlock_unget(&spl->trunk_root_lock, TRUNK_CLEAR_LOCK_IDX);
+}
+
+/*
+ * Waits for the tree updates in flight to finish and holds off new ones until
+ * trunk_unblock_updates, leaving the tree to readers only.
+ */
+static inline void
+trunk_block_updates(trunk_handle *spl)
+{
+   platform_batch_rwlock_get(&spl->trunk_root_lock, TRUNK_CLEAR_LOCK_IDX);
+   platform_batch_rwlock_claim_loop(&spl->trunk_root_lock,
+                                    TRUNK_CLEAR_LOCK_IDX);
+   platform_batch_rwlock_lock(&spl->trunk_root_lock, TRUNK_CLEAR_LOCK_IDX);
 }
 
 static inline void
-trunk_root_unlock(trunk_handle *spl)
+trunk_unblock_updates(trunk_handle *spl)
+{
+   platform_batch_rwlock_full_unlock(&spl->trunk_root_lock,
+                                     TRUNK_CLEAR_LOCK_IDX);
+}
+
+/*
+ * Returns TRUE if req refers to a tree which trunk_clear has since swapped
+ * out. Must be called between trunk_block_clear and trunk_unblock_clear.
+ */
+static inline bool32
+trunk_compact_bundle_req_is_cleared(trunk_handle             *spl,
+                                    trunk_compact_bundle_req *req)
 {
-   platform_batch_rwlock_unlock(&spl->trunk_root_lock, TRUNK_ROOT_LOCK_IDX);
+   return req->clear_generation != spl->clear_generation;
 }
 
 static inline void
@@ -1250,7 +1573,8 @@ trunk_claim_and_copy_root(trunk_handle *spl,      // IN
  *-----------------------------------------------------------------------------
  * Update claimed root
  *
- * Switches in the given new root and releases the trunk root lock.
+ * Switches in the given new root and releases the trunk root lock. Readers
+ * are not waited for: the old root stays valid for those still using it.
  *
  * Must be preceded with a call to trunk_claim_and_copy_root.
  *-----------------------------------------------------------------------------
@@ -1259,9 +1583,7 @@ void
 trunk_update_claimed_root(trunk_handle *spl,    // IN
                           trunk_node   *new_root) // IN
 {
-   trunk_root_lock(spl);
-   spl->root_addr = new_root->addr;
-   trunk_root_unlock(spl);
+   __atomic_store_n(&spl->root_addr, new_root->addr, __ATOMIC_RELEASE);
    trunk_root_full_unclaim(spl);
 }
 
@@ -1525,6 +1847,8 @@ trunk_set_pivot_data_new_root(trunk_handle *spl,
    pdata->num_kv_bytes_whole  = 0;
    pdata->num_tuples_bundle   = 0;
    pdata->num_kv_bytes_bundle = 0;
+   pdata->num_tombstones      = 0;
+   pdata->num_updates         = 0;
    pdata->start_branch        = trunk_start_branch(spl, node);
    pdata->start_bundle        = trunk_end_bundle(spl, node);
    ZERO_STRUCT(pdata->filter);
@@ -1548,6 +1872,8 @@ trunk_init_pivot_data_from_pred(trunk_handle *spl,
    pdata->num_kv_bytes_whole  = 0;
    pdata->num_tuples_bundle   = 0;
    pdata->num_kv_bytes_bundle = 0;
+   pdata->num_tombstones      = 0;
+   pdata->num_updates         = 0;
    copy_key_to_ondisk_key(&pdata->pivot, new_pivot);
    platform_assert(pdata->srq_idx == -1);
 
@@ -1670,6 +1996,51 @@ trunk_find_pivot(trunk_handle *spl,
    }
 }
 
+/*
+ * find_pivot(less_than_or_equal) for a node read without a read lock, whose
+ * contents may be torn: returns FALSE instead of reading beyond the pivots the
+ * node has room for. The pivot found is only to be trusted once the node is
+ * validated.
+ */
+static bool32
+trunk_find_pivot_optimistic(trunk_handle *spl,
+                            trunk_node   *node,
+                            key           target,
+                            uint16       *pivot_no)
+{
+   uint16 num_pivot_keys =
+      *(const volatile uint16 *)&node->hdr->num_pivot_keys;
+   if (num_pivot_keys < 2 || num_pivot_keys > spl->cfg.max_pivot_keys) {
+      return FALSE;
+   }
+
+   // the last pivot with pivot <= target, of the num_pivot_keys - 1 children
+   uint16 lo = 0, hi = num_pivot_keys - 1;
+   while (hi - lo > 1) {
+      uint16            mid   = lo + (hi - lo) / 2;
+      trunk_pivot_data *pdata = trunk_get_pivot_data(spl, node, mid);
+      ondisk_key_length length =
+         *(const volatile ondisk_key_length *)&pdata->pivot.length;
+      key pivot;
+      if (length == ONDISK_KEY_NEGATIVE_INFINITY) {
+         pivot = NEGATIVE_INFINITY_KEY;
+      } else if (length == ONDISK_KEY_POSITIVE_INFINITY) {
+         pivot = POSITIVE_INFINITY_KEY;
+      } else if (length > trunk_max_key_size(spl)) {
+         return FALSE;
+      } else {
+         pivot = key_create(length, pdata->pivot.bytes);
+      }
+      if (trunk_key_compare(spl, pivot, target) <= 0) {
+         lo = mid;
+      } else {
+         hi = mid;
+      }
+   }
+   *pivot_no = lo;
+   return TRUE;
+}
+
 /*
  * branch_live_for_pivot returns TRUE if the branch is live for the pivot and
  * FALSE otherwise.
@@ -1862,6 +2233,8 @@ trunk_pivot_clear_counts(trunk_handle *spl, trunk_node *node, uint16 pivot_no)
    pdata->num_tuples_bundle   = 0;
    pdata->num_kv_bytes_whole  = 0;
    pdata->num_kv_bytes_bundle = 0;
+   pdata->num_tombstones      = 0;
+   pdata->num_updates         = 0;
 }
 
 static inline uint64
@@ -2017,6 +2390,28 @@ trunk_pivot_branch_tuple_counts(trunk_handle *spl,
       spl, node, pivot_no, branch->root_addr, num_tuples, num_kv_bytes);
 }
 
+/*
+ * Branches only count their deletes and updates as a whole, so each pivot gets
+ * a share of them in proportion to its tuples in the output branch.
+ */
+static inline void
+trunk_pivot_share_message_counts(trunk_handle             *spl,
+                                 trunk_compact_bundle_req *req,
+                                 uint16                    pos)
+{
+   uint64 num_tuples = req->output_pivot_tuple_count[pos];
+   uint64 total      = req->output_tuple_count;
+   if (total == 0) {
+      req->output_pivot_tombstone_count[pos] = 0;
+      req->output_pivot_update_count[pos]    = 0;
+      return;
+   }
+   req->output_pivot_tombstone_count[pos] =
+      req->output_tombstone_count * num_tuples / total;
+   req->output_pivot_update_count[pos] =
+      req->output_update_count * num_tuples / total;
+}
+
 debug_only static inline uint64
 trunk_pivot_tuples_in_branch_slow(trunk_handle *spl,
                                   trunk_node   *node,
@@ -2103,6 +2498,8 @@ trunk_pivot_clear(trunk_handle *spl, trunk_node *node, trunk_pivot_data *pdata)
    pdata->num_tuples_bundle   = 0;
    pdata->num_kv_bytes_whole  = 0;
    pdata->num_kv_bytes_bundle = 0;
+   pdata->num_tombstones      = 0;
+   pdata->num_updates         = 0;
    pdata->srq_idx             = -1;
    if (start_branch == node->hdr->start_branch) {
       trunk_reset_start_branch(spl, node);
@@ -2485,9 +2882,13 @@ trunk_leaf_rebundle_all_branches(trunk_handle *spl,
       srq_print(&spl->srq);
       pdata->srq_idx = -1;
    }
-   pdata->generation        = trunk_inc_pivot_generation(spl, node);
-   pdata->num_tuples_bundle = bundle->num_tuples;
-   pdata->num_tuples_whole  = 0;
+   pdata->generation          = trunk_inc_pivot_generation(spl, node);
+   pdata->num_tuples_bundle   = bundle->num_tuples;
+   pdata->num_tuples_whole    = 0;
+   pdata->num_kv_bytes_bundle = bundle->num_kv_bytes;
+   pdata->num_kv_bytes_whole  = 0;
+   pdata->num_tombstones      = 0;
+   pdata->num_updates         = 0;
    return bundle_no;
 }
 
@@ -2826,10 +3227,11 @@ trunk_process_generation_to_pos(trunk_handle             *spl,
 /*
  * trunk_garbage_collect_node_get fetches the node at the
  * given height containing the given key from the snapshot with root given by
- * old_root_addr. It performs hand-over-hand write-locking to drain readers
- * along the path.
+ * old_root_addr. Readers still on the snapshot are not drained: what is
+ * reclaimed from it is freed only once they have left, see
+ * trunk_reclaim_enqueue.
  *
- * Returns the node with a write lock.
+ * Returns the node with a read lock.
  */
 static inline void
 trunk_garbage_collect_node_get(trunk_handle             *spl,
@@ -2846,8 +3248,6 @@ trunk_garbage_collect_node_get(trunk_handle             *spl,
    trunk_node node;
    trunk_node_get(spl->cc, old_root_addr, &node);
    uint16 root_height = trunk_node_height(&node);
-   trunk_node_claim(spl->cc, &node);
-   trunk_node_lock(spl->cc, &node);
    platform_assert(height <= root_height);
 
    for (uint16 h = root_height; h > height; h--) {
@@ -2859,10 +3259,6 @@ trunk_garbage_collect_node_get(trunk_handle             *spl,
       trunk_node        child;
       trunk_node_get(spl->cc, pdata->addr, &child);
       // Here is where we would deallocate the trunk node
-      trunk_node_claim(spl->cc, &child);
-      trunk_node_lock(spl->cc, &child);
-      trunk_node_unlock(spl->cc, &node);
-      trunk_node_unclaim(spl->cc, &node);
       trunk_node_unget(spl->cc, &node);
       node = child;
    }
@@ -2910,14 +3306,11 @@ trunk_garbage_collect_bundle(trunk_handle             *spl,
          if (trunk_bundle_live_for_pivot(spl, &node, bundle_no, pivot_no)) {
             key start_key = trunk_get_pivot(spl, &node, pivot_no);
             key end_key   = trunk_get_pivot(spl, &node, pivot_no + 1);
-            trunk_zap_branch_range(
-               spl, branch, start_key, end_key, PAGE_TYPE_BRANCH);
+            trunk_reclaim_branch_range(spl, branch, start_key, end_key);
          }
       }
    }
 
-   trunk_node_unlock(spl->cc, &node);
-   trunk_node_unclaim(spl->cc, &node);
    trunk_node_unget(spl->cc, &node);
 }
 
@@ -2996,7 +3389,7 @@ trunk_replace_bundle_branches(trunk_handle             *spl,
            filter_no = trunk_add_subbundle_filter_number(spl, filter_no, 1))
       {
          routing_filter *old_filter = trunk_get_sb_filter(spl, node, filter_no);
-         trunk_dec_filter(spl, old_filter);
+         trunk_reclaim_filter(spl, old_filter);
       }
 
       // move any later filters
@@ -3077,6 +3470,7 @@ trunk_replace_bundle_branches(trunk_handle             *spl,
                new_branch_no,
                &req->output_pivot_tuple_count[pos],
                &req->output_pivot_kv_byte_count[pos]);
+            trunk_pivot_share_message_counts(spl, req, pos);
          }
 
          uint64 tuples_reclaimed = req->input_pivot_tuple_count[pos]
@@ -3163,15 +3557,228 @@ trunk_zap_branch_range(trunk_handle *spl,
 }
 
 /*
- * Decrement the ref count for branch and destroy it and its filter if it
- * reaches 0.
+ *-----------------------------------------------------------------------------
+ * Deferred reclamation
+ *
+ *      Compactions drop the previous generation of a bundle (its branch
+ *      ranges and filters) by queueing them here rather than dec_ref'ing them
+ *      in place, which would walk their mini allocator meta pages and discard
+ *      their extents on the compaction's critical path.
+ *
+ *      Once TRUNK_RECLAIM_BATCH_ENTRIES have been queued, a task is enqueued
+ *      at the tail of the normal queue to drain them. The drain dec_refs each
+ *      entry into an extent batch, so the extents freed by the whole drain are
+ *      discarded and freed together, in address order.
+ *
+ *      Every queued range was unlinked when it was queued, but lookups,
+ *      iterators and async lookups that started earlier may still be reading
+ *      it. Each entry is tagged with the epoch it was retired in, and a drain
+ *      only releases the entries no reader can reach anymore, leaving the rest
+ *      for the next one. Deferring a dec_ref only keeps the extents alive
+ *      longer, and ref counts on overlapping ranges commute.
+ *      trunk_prepare_for_shutdown drains whatever is left.
+ *-----------------------------------------------------------------------------
  */
-static inline void
-trunk_dec_ref(trunk_handle *spl, trunk_branch *branch, bool32 is_memtable)
+#define TRUNK_RECLAIM_BATCH_ENTRIES 64
+
+struct trunk_reclaim_entry {
+   trunk_reclaim_entry *next;
+   uint64               epoch;        // see epoch_retire
+   uint64               subtree_addr; // root of a tree dropped by trunk_clear
+   trunk_branch         branch;       // root_addr is 0 for filters
+   key_buffer           start_key;
+   key_buffer           end_key;
+   routing_filter       filter;
+};
+
+static void
+trunk_reclaim_init(trunk_handle *spl)
+{
+   ZERO_CONTENTS(&spl->reclaim);
+   platform_spinlock_init(
+      &spl->reclaim.lock, platform_get_module_id(), spl->heap_id);
+}
+
+static void
+trunk_reclaim_drain(trunk_handle *spl)
+{
+   trunk_reclaim_queue *queue = &spl->reclaim;
+
+   platform_spin_lock(&queue->lock);
+   trunk_reclaim_entry *entry = queue->head;
+   queue->head                = NULL;
+   queue->num_entries         = 0;
+   queue->drain_enqueued      = FALSE;
+   platform_spin_unlock(&queue->lock);
+
+   uint64               bound         = epoch_safe_bound(&spl->epoch, TRUE);
+   trunk_reclaim_entry *deferred      = NULL;
+   trunk_reclaim_entry *deferred_tail = NULL;
+
+   mini_extent_batch branch_batch;
+   mini_extent_batch filter_batch;
+   mini_extent_batch_init(&branch_batch, spl->cc, PAGE_TYPE_BRANCH);
+   mini_extent_batch_init(&filter_batch, spl->cc, PAGE_TYPE_FILTER);
+   while (entry != NULL) {
+      trunk_reclaim_entry *next = entry->next;
+      if (bound <= entry->epoch) {
+         // still reachable, leave it for the next drain
+         if (deferred == NULL) {
+            deferred_tail = entry;
+         }
+         entry->next = deferred;
+         deferred    = entry;
+         entry       = next;
+         continue;
+      }
+      if (entry->subtree_addr != 0) {
+         trunk_clear_subtree(spl, entry->subtree_addr);
+      } else if (entry->branch.root_addr != 0) {
+         btree_dec_ref_range_batched(spl->cc,
+                                     &spl->cfg.btree_cfg,
+                                     entry->branch.root_addr,
+                                     key_buffer_key(&entry->start_key),
+                                     key_buffer_key(&entry->end_key),
+                                     &branch_batch);
+         key_buffer_deinit(&entry->start_key);
+         key_buffer_deinit(&entry->end_key);
+      } else {
+         routing_filter_zap_batched(spl->cc, &entry->filter, &filter_batch);
+      }
+      platform_free(spl->heap_id, entry);
+      entry = next;
+   }
+   mini_extent_batch_flush(&branch_batch);
+   mini_extent_batch_flush(&filter_batch);
+
+   if (deferred != NULL) {
+      // not counted in num_entries, so they don't trigger a drain by themselves
+      platform_spin_lock(&queue->lock);
+      deferred_tail->next = queue->head;
+      queue->head         = deferred;
+      platform_spin_unlock(&queue->lock);
+   }
+}
+
+static void
+trunk_reclaim_task(void *arg, void *scratch)
+{
+   trunk_reclaim_drain((trunk_handle *)arg);
+}
+
+static void
+trunk_reclaim_deinit(trunk_handle *spl)
+{
+   epoch_synchronize(&spl->epoch, TRUE);
+   trunk_reclaim_drain(spl);
+   platform_assert(spl->reclaim.head == NULL);
+   platform_spinlock_destroy(&spl->reclaim.lock);
+}
+
+/*
+ * Tags entry with the current epoch and queues it. With drain_now, the drain
+ * task is enqueued whatever the number of entries queued.
+ */
+static void
+trunk_reclaim_enqueue(trunk_handle        *spl,
+                      trunk_reclaim_entry *entry,
+                      bool32               drain_now)
+{
+   trunk_reclaim_queue *queue = &spl->reclaim;
+
+   entry->epoch = epoch_retire(&spl->epoch);
+
+   platform_spin_lock(&queue->lock);
+   entry->next = queue->head;
+   queue->head = entry;
+   queue->num_entries++;
+   bool32 should_drain =
+      !queue->drain_enqueued
+      && (drain_now || queue->num_entries >= TRUNK_RECLAIM_BATCH_ENTRIES);
+   if (should_drain) {
+      queue->drain_enqueued = TRUE;
+   }
+   platform_spin_unlock(&queue->lock);
+
+   if (should_drain) {
+      platform_status rc = task_enqueue(
+         spl->ts, TASK_TYPE_NORMAL, trunk_reclaim_task, spl, TASK_PRIORITY_LOW);
+      if (!SUCCESS(rc)) {
+         trunk_reclaim_drain(spl);
+      }
+   }
+}
+
+/*
+ * Queue the dec_ref of branch over [start_key, end_key] for reclamation. Falls
+ * back to waiting out the readers and dec_ref'ing it in place if the entry
+ * cannot be allocated.
+ */
+static void
+trunk_reclaim_branch_range(trunk_handle *spl,
+                           trunk_branch *branch,
+                           key           start_key,
+                           key           end_key)
+{
+   platform_assert(branch->root_addr != 0, "root_addr=%lu", branch->root_addr);
+   trunk_reclaim_entry *entry = TYPED_ZALLOC(spl->heap_id, entry);
+   if (entry == NULL) {
+      epoch_synchronize(&spl->epoch, TRUE);
+      trunk_zap_branch_range(spl, branch, start_key, end_key, PAGE_TYPE_BRANCH);
+      return;
+   }
+   entry->branch = *branch;
+   key_buffer_init(&entry->start_key, spl->heap_id);
+   key_buffer_init(&entry->end_key, spl->heap_id);
+   platform_status rc = key_buffer_copy_key(&entry->start_key, start_key);
+   if (SUCCESS(rc)) {
+      rc = key_buffer_copy_key(&entry->end_key, end_key);
+   }
+   if (!SUCCESS(rc)) {
+      key_buffer_deinit(&entry->start_key);
+      key_buffer_deinit(&entry->end_key);
+      platform_free(spl->heap_id, entry);
+      epoch_synchronize(&spl->epoch, TRUE);
+      trunk_zap_branch_range(spl, branch, start_key, end_key, PAGE_TYPE_BRANCH);
+      return;
+   }
+   trunk_reclaim_enqueue(spl, entry, FALSE);
+}
+
+/*
+ * Queue the dec_ref of filter for reclamation.
+ */
+static void
+trunk_reclaim_filter(trunk_handle *spl, routing_filter *filter)
 {
-   page_type type = is_memtable ? PAGE_TYPE_MEMTABLE : PAGE_TYPE_BRANCH;
-   trunk_zap_branch_range(
-      spl, branch, NEGATIVE_INFINITY_KEY, POSITIVE_INFINITY_KEY, type);
+   if (filter->addr == 0) {
+      return;
+   }
+   trunk_reclaim_entry *entry = TYPED_ZALLOC(spl->heap_id, entry);
+   if (entry == NULL) {
+      epoch_synchronize(&spl->epoch, TRUE);
+      trunk_dec_filter(spl, filter);
+      return;
+   }
+   entry->filter = *filter;
+   trunk_reclaim_enqueue(spl, entry, FALSE);
+}
+
+/*
+ * Queue the release of the subtree at addr, which trunk_clear has unlinked,
+ * and have it drained without waiting for a full batch.
+ */
+static void
+trunk_reclaim_subtree(trunk_handle *spl, uint64 addr)
+{
+   trunk_reclaim_entry *entry = TYPED_ZALLOC(spl->heap_id, entry);
+   if (entry == NULL) {
+      epoch_synchronize(&spl->epoch, TRUE);
+      trunk_clear_subtree(spl, addr);
+      return;
+   }
+   entry->subtree_addr = addr;
+   trunk_reclaim_enqueue(spl, entry, TRUE);
 }
 
 /*
@@ -3305,8 +3912,81 @@ trunk_get_compacted_memtable(trunk_handle *spl, uint64 generation)
    return &spl->compacted_memtable[memtable_idx];
 }
 
-static inline void
-trunk_memtable_inc_ref(trunk_handle *spl, uint64 mt_gen)
+/*
+ * Drops a ref on the memtable, and lets a caller of trunk_try_insert that was
+ * refused for the want of a memtable know once it is free.
+ */
+static void
+trunk_memtable_dec_ref_maybe_recycle(trunk_handle *spl, memtable *mt)
+{
+   if (!memtable_dec_ref_maybe_recycle(spl->mt_ctxt, mt)) {
+      return;
+   }
+   trunk_capacity_fn fn = spl->capacity_fn;
+   if (fn != NULL && spl->capacity_wanted
+       && __sync_bool_compare_and_swap(&spl->capacity_wanted, TRUE, FALSE))
+   {
+      fn(spl->capacity_arg);
+   }
+}
+
+/*
+ * Recycles the retired memtables that no lookup can reach anymore. Returns
+ * TRUE if there were any.
+ */
+static bool32
+trunk_memtable_recycle_retired(trunk_handle *spl)
+{
+   bool32 recycled = FALSE;
+   uint64 bound    = 0;
+   for (uint64 mt_no = 0; mt_no < TRUNK_NUM_MEMTABLES; mt_no++) {
+      trunk_compacted_memtable *cmt = &spl->compacted_memtable[mt_no];
+      if (!__atomic_load_n(&cmt->retire_pending, __ATOMIC_ACQUIRE)) {
+         continue;
+      }
+      if (bound == 0) {
+         bound = epoch_safe_bound(&spl->epoch, FALSE);
+      }
+      if (cmt->retire_epoch < bound
+          && __sync_bool_compare_and_swap(&cmt->retire_pending, TRUE, FALSE))
+      {
+         trunk_memtable_dec_ref_maybe_recycle(spl, &spl->mt_ctxt->mt[mt_no]);
+         recycled = TRUE;
+      }
+   }
+   return recycled;
+}
+
+/*
+ * Drops the ref the memtable context holds on an incorporated or discarded
+ * memtable. Lookups that read the memtable generations before it was retired
+ * may still be reading it, so it is only recycled once they have left, by
+ * whichever caller of trunk_memtable_recycle_retired comes along first: the
+ * next retirement, or an insert waiting for a memtable. A try insert waiting
+ * for the capacity callback is not left to chance: the lookups are waited
+ * out, which is short, as they do not hold their epoch across calls.
+ *
+ * Async lookups are not waited for, they are done with the memtables before
+ * they first return to their caller.
+ */
+static void
+trunk_memtable_retire(trunk_handle *spl, uint64 generation)
+{
+   trunk_compacted_memtable *cmt =
+      &spl->compacted_memtable[generation % TRUNK_NUM_MEMTABLES];
+   debug_assert(!cmt->retire_pending);
+   cmt->retire_epoch = epoch_retire(&spl->epoch);
+   __atomic_store_n(&cmt->retire_pending, TRUE, __ATOMIC_RELEASE);
+   trunk_memtable_recycle_retired(spl);
+   // pairs with the try insert setting capacity_wanted
+   if (cmt->retire_pending && spl->capacity_wanted) {
+      epoch_synchronize(&spl->epoch, FALSE);
+      trunk_memtable_recycle_retired(spl);
+   }
+}
+
+static inline void
+trunk_memtable_inc_ref(trunk_handle *spl, uint64 mt_gen)
 {
    memtable *mt = trunk_get_memtable(spl, mt_gen);
    allocator_inc_ref(spl->al, mt->root_addr);
@@ -3317,7 +3997,7 @@ void
 trunk_memtable_dec_ref(trunk_handle *spl, uint64 generation)
 {
    memtable *mt = trunk_get_memtable(spl, generation);
-   memtable_dec_ref_maybe_recycle(spl->mt_ctxt, mt);
+   trunk_memtable_dec_ref_maybe_recycle(spl, mt);
 
    // the branch in the compacted memtable is now in the tree, so don't zap it,
    // we don't try to zero out the cmt because that would introduce a race.
@@ -3367,6 +4047,165 @@ trunk_memtable_iterator_deinit(trunk_handle   *spl,
    }
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * Write throttling, see trunk_write_throttle
+ *-----------------------------------------------------------------------------
+ */
+
+/*
+ * Returns how far compaction is behind, as a percent. The counters are read
+ * without locks, so this is an estimate.
+ *
+ * Delaying inserts would only hold up the foreground threads that run tasks
+ * when there are no background threads for them, so there is no debt unless
+ * both kinds of task have background threads.
+ */
+static uint64
+trunk_compaction_debt_percent(trunk_handle *spl)
+{
+   uint64 num_threads = task_num_background_threads(spl->ts, TASK_TYPE_NORMAL);
+   if (num_threads == 0
+       || task_num_background_threads(spl->ts, TASK_TYPE_MEMTABLE) == 0)
+   {
+      return 0;
+   }
+
+   // full memtables not yet retired, besides the one being filled
+   memtable_context *ctxt        = spl->mt_ctxt;
+   uint64            outstanding = ctxt->generation - ctxt->generation_retired;
+   uint64            backlog     = outstanding > 1 ? outstanding - 1 : 0;
+   uint64            debt =
+      100 * backlog / MAX(spl->cfg.mt_cfg.max_memtables - 1, 1);
+
+   uint64 num_waiting = task_num_waiting(spl->ts, TASK_TYPE_NORMAL);
+   uint64 task_debt =
+      100 * num_waiting / (TRUNK_THROTTLE_TASKS_PER_BG_THREAD * num_threads);
+   debt = MAX(debt, task_debt);
+   return MIN(debt, 100);
+}
+
+/*
+ * Recomputes the compaction debt and the rate inserts are paced to. Called
+ * as each memtable fills and as each is incorporated, with incorporated set.
+ *
+ * The time between incorporations measures absorb_rate: it is the rate of
+ * inserts while they keep up, and the rate of incorporation while memtables
+ * queue up. Intervals when inserts were held back by throttling alone tell
+ * neither, and are not counted.
+ */
+static void
+trunk_throttle_update(trunk_handle *spl, bool32 incorporated)
+{
+   trunk_write_throttle *throttle = &spl->throttle;
+   uint64                debt     = trunk_compaction_debt_percent(spl);
+   throttle->debt_percent         = debt;
+
+   if (incorporated) {
+      memtable_context *ctxt = spl->mt_ctxt;
+      timestamp         now  = platform_get_timestamp();
+      // memtables not yet retired, the one being filled among them
+      uint64 outstanding = ctxt->generation - ctxt->generation_retired;
+      if (throttle->last_incorporation != 0
+          && (throttle->rate == 0 || outstanding > 1))
+      {
+         uint64 memtable_bytes = spl->cfg.mt_cfg.max_extents_per_memtable
+                                 * cache_extent_size(spl->cc)
+                                 / MEMTABLE_SPACE_OVERHEAD_FACTOR;
+         uint64 elapsed_ns = MAX(now - throttle->last_incorporation, 1);
+         uint64 sample     = memtable_bytes * SEC_TO_NSEC(1) / elapsed_ns;
+         throttle->absorb_rate = throttle->absorb_rate == 0
+                                    ? sample
+                                    : (3 * throttle->absorb_rate + sample) / 4;
+      }
+      throttle->last_incorporation = now;
+   }
+
+   uint64 throttle_percent = spl->cfg.write_throttle_percent;
+   uint64 absorb_rate      = throttle->absorb_rate;
+   if (throttle_percent >= 100 || debt < throttle_percent || absorb_rate == 0)
+   {
+      throttle->rate = 0;
+      return;
+   }
+   uint64 rate = absorb_rate * (100 - debt) / (100 - throttle_percent);
+   rate = MAX(rate, absorb_rate / TRUNK_THROTTLE_MIN_RATE_DIVISOR);
+   throttle->rate = MAX(rate, 1);
+}
+
+/*
+ * Paces an insert of the given size to the throttle's rate. Each insert
+ * claims the next slot of time at that rate, and sleeps until its slot comes
+ * round. Must not hold the memtable insert lock.
+ *
+ * Unless block is set, an insert that would have to sleep claims no slot,
+ * and FALSE is returned with the time until its slot in *retry_ns.
+ */
+static inline bool32
+trunk_throttle_insert(trunk_handle *spl,
+                      uint64        bytes,
+                      bool32        block,
+                      uint64       *retry_ns)
+{
+   trunk_write_throttle *throttle = &spl->throttle;
+   uint64                rate     = throttle->rate;
+   if (rate == 0) {
+      return TRUE;
+   }
+
+   uint64 cost_ns = bytes * SEC_TO_NSEC(1) / rate;
+   uint64 now     = platform_get_timestamp();
+   uint64 next;
+   uint64 start;
+   do {
+      next  = throttle->next_insert_ns;
+      start = MAX(next, now);
+      if (!block && start - now >= TRUNK_THROTTLE_MIN_DELAY_NS) {
+         *retry_ns = start - now;
+         return FALSE;
+      }
+   } while (!__sync_bool_compare_and_swap(
+      &throttle->next_insert_ns, next, start + cost_ns));
+
+   uint64 delay_ns = start - now;
+   if (delay_ns < TRUNK_THROTTLE_MIN_DELAY_NS) {
+      return TRUE;
+   }
+   platform_sleep_ns(delay_ns);
+   __sync_fetch_and_add(&throttle->num_delays, 1);
+   __sync_fetch_and_add(&throttle->delay_ns, delay_ns);
+   return TRUE;
+}
+
+/*
+ * How long a trunk_try_insert refused for the want of a memtable should wait
+ * before retrying: until the oldest full memtable is due to be incorporated,
+ * going by the rate incorporation has kept up.
+ */
+static uint64
+trunk_try_insert_retry_ns(trunk_handle *spl)
+{
+   memtable_context     *ctxt     = spl->mt_ctxt;
+   trunk_write_throttle *throttle = &spl->throttle;
+
+   uint64 outstanding = ctxt->generation - ctxt->generation_retired;
+   uint64 absorb_rate = throttle->absorb_rate;
+   if (outstanding < spl->cfg.mt_cfg.max_memtables || absorb_rate == 0) {
+      return TRUNK_TRY_INSERT_MIN_RETRY_NS;
+   }
+
+   uint64 memtable_bytes = spl->cfg.mt_cfg.max_extents_per_memtable
+                           * cache_extent_size(spl->cc)
+                           / MEMTABLE_SPACE_OVERHEAD_FACTOR;
+   uint64 interval_ns = memtable_bytes * SEC_TO_NSEC(1) / absorb_rate;
+   uint64 elapsed_ns =
+      platform_timestamp_elapsed(throttle->last_incorporation);
+   if (interval_ns <= elapsed_ns + TRUNK_TRY_INSERT_MIN_RETRY_NS) {
+      return TRUNK_TRY_INSERT_MIN_RETRY_NS;
+   }
+   return interval_ns - elapsed_ns;
+}
+
 /*
  * Attempts to insert (key, data) into the current memtable.
  *
@@ -3375,19 +4214,61 @@ trunk_memtable_iterator_deinit(trunk_handle   *spl,
  *    locked if the current memtable is full
  *    lock_acquired if the current memtable is full and this thread is
  *       responsible for flushing it.
+ *
+ * Unless block is set, returns STATUS_BUSY, with how long to wait before
+ * retrying in *retry_ns, rather than wait for throttling or a memtable.
  */
 platform_status
-trunk_memtable_insert(trunk_handle *spl, key tuple_key, message msg)
+trunk_memtable_insert(trunk_handle *spl,
+                      key           tuple_key,
+                      message       msg,
+                      bool32        block,
+                      uint64       *retry_ns)
 {
-   uint64 generation;
+   uint64          generation;
+   platform_status rc;
 
-   platform_status rc =
-      memtable_maybe_rotate_and_begin_insert(spl->mt_ctxt, &generation);
-   while (STATUS_IS_EQ(rc, STATUS_BUSY)) {
-      // Memtable isn't ready, do a task if available; may be required to
-      // incorporate memtable that we're waiting on
-      task_perform_one_if_needed(spl->ts, 0);
+   uint64 bytes = key_length(tuple_key) + message_length(msg);
+   if (!trunk_throttle_insert(spl, bytes, block, retry_ns)) {
+      return STATUS_BUSY;
+   }
+
+   if (block) {
       rc = memtable_maybe_rotate_and_begin_insert(spl->mt_ctxt, &generation);
+   } else {
+      rc = memtable_try_rotate_and_begin_insert(spl->mt_ctxt, &generation);
+      if (STATUS_IS_EQ(rc, STATUS_BUSY) && trunk_memtable_recycle_retired(spl))
+      {
+         rc = memtable_try_rotate_and_begin_insert(spl->mt_ctxt, &generation);
+      }
+      if (STATUS_IS_EQ(rc, STATUS_BUSY) && spl->capacity_fn != NULL) {
+         // Ask to be told once a memtable frees up, then check that one did
+         // not just before; pairs with the recycling memtable's transition
+         // and with trunk_memtable_retire.
+         __sync_lock_test_and_set(&spl->capacity_wanted, TRUE);
+         __sync_synchronize();
+         trunk_memtable_recycle_retired(spl);
+         rc = memtable_try_rotate_and_begin_insert(spl->mt_ctxt, &generation);
+      }
+      if (STATUS_IS_EQ(rc, STATUS_BUSY)) {
+         *retry_ns = trunk_try_insert_retry_ns(spl);
+         return rc;
+      }
+   }
+   if (STATUS_IS_EQ(rc, STATUS_BUSY)) {
+      // Every memtable is full, so stall until one is incorporated
+      timestamp stall_start = platform_get_timestamp();
+      do {
+         // Memtable isn't ready, do a task if available; may be required to
+         // incorporate memtable that we're waiting on, or it may only be
+         // waiting for lookups to leave before it is recycled
+         trunk_memtable_recycle_retired(spl);
+         task_perform_one_if_needed(spl->ts, 0);
+         rc = memtable_maybe_rotate_and_begin_insert(spl->mt_ctxt, &generation);
+      } while (STATUS_IS_EQ(rc, STATUS_BUSY));
+      __sync_fetch_and_add(&spl->throttle.num_stalls, 1);
+      __sync_fetch_and_add(&spl->throttle.stall_ns,
+                           platform_timestamp_elapsed(stall_start));
    }
    if (!SUCCESS(rc)) {
       goto out;
@@ -3488,10 +4369,13 @@ trunk_memtable_compact_and_build_filter(trunk_handle  *spl,
       filter_build_start = platform_get_timestamp();
    }
 
-   cmt->req         = TYPED_ZALLOC(spl->heap_id, cmt->req);
-   cmt->req->spl    = spl;
-   cmt->req->fp_arr = req.fingerprint_arr;
-   cmt->req->type   = TRUNK_COMPACTION_TYPE_MEMTABLE;
+   cmt->req                         = TYPED_ZALLOC(spl->heap_id, cmt->req);
+   cmt->req->spl                    = spl;
+   cmt->req->fp_arr                 = req.fingerprint_arr;
+   cmt->req->type                   = TRUNK_COMPACTION_TYPE_MEMTABLE;
+   cmt->req->output_tuple_count     = req.num_tuples;
+   cmt->req->output_tombstone_count = req.num_tombstones;
+   cmt->req->output_update_count    = req.num_updates;
    uint32 *dup_fp_arr =
       TYPED_ARRAY_MALLOC(spl->heap_id, dup_fp_arr, req.num_tuples);
    memmove(dup_fp_arr, cmt->req->fp_arr, req.num_tuples * sizeof(uint32));
@@ -3499,6 +4383,7 @@ trunk_memtable_compact_and_build_filter(trunk_handle  *spl,
 
    platform_status rc = routing_filter_add(spl->cc,
                                            &spl->cfg.filter_cfg,
+                                           &spl->filter_packer,
                                            &empty_filter,
                                            &cmt->filter,
                                            cmt->req->fp_arr,
@@ -3587,6 +4472,7 @@ trunk_install_new_compacted_subbundle(trunk_handle             *spl,
    req->spl                  = spl;
    req->height               = trunk_node_height(node);
    req->max_pivot_generation = trunk_pivot_generation(spl, node);
+   req->clear_generation     = spl->clear_generation;
    key_buffer_init_from_key(
       &req->start_key, spl->heap_id, trunk_min_key(spl, node));
    key_buffer_init_from_key(
@@ -3623,7 +4509,8 @@ trunk_install_new_compacted_subbundle(trunk_handle             *spl,
                                        req->input_pivot_tuple_count,
                                        req->input_pivot_kv_byte_count);
 
-   // record the pivot generations and increment the boundaries
+   // record the pivot generations and message counts and increment the
+   // boundaries
    uint16 num_children = trunk_num_children(spl, node);
    for (uint16 pivot_no = 0; pivot_no < num_children; pivot_no++) {
       if (pivot_no != 0) {
@@ -3632,10 +4519,46 @@ trunk_install_new_compacted_subbundle(trunk_handle             *spl,
       }
       trunk_pivot_data *pdata = trunk_get_pivot_data(spl, node, pivot_no);
       req->pivot_generation[pivot_no] = pdata->generation;
+      trunk_pivot_share_message_counts(spl, req, pivot_no);
    }
    debug_assert(trunk_subbundle_branch_count(spl, node, sb) != 0);
 }
 
+/*
+ * Drops a compacted memtable which trunk_clear has cleared instead of
+ * incorporating it: its branch and filter are released and it is retired
+ * without touching the root.
+ *
+ * Must be called between trunk_block_clear and trunk_unblock_clear.
+ */
+static void
+trunk_memtable_discard_cleared(trunk_handle *spl, uint64 generation)
+{
+   trunk_default_log_if_enabled(
+      spl, "discard cleared memtable gen %lu\n", generation);
+
+   trunk_compacted_memtable *cmt =
+      trunk_get_compacted_memtable(spl, generation);
+   trunk_reclaim_branch_range(
+      spl, &cmt->branch, NEGATIVE_INFINITY_KEY, POSITIVE_INFINITY_KEY);
+   trunk_reclaim_filter(spl, &cmt->filter);
+   platform_free(spl->heap_id, cmt->req->fp_arr);
+   platform_free(spl->heap_id, cmt->req);
+   cmt->req = NULL;
+
+   memtable_block_lookups(spl->mt_ctxt);
+   memtable *mt = trunk_get_memtable(spl, generation);
+   debug_assert(generation == memtable_generation_to_incorporate(spl->mt_ctxt));
+   memtable_transition(
+      mt, MEMTABLE_STATE_INCORPORATION_ASSIGNED, MEMTABLE_STATE_INCORPORATING);
+   memtable_transition(
+      mt, MEMTABLE_STATE_INCORPORATING, MEMTABLE_STATE_INCORPORATED);
+   memtable_increment_to_generation_retired(spl->mt_ctxt, generation);
+   memtable_unblock_lookups(spl->mt_ctxt);
+
+   trunk_memtable_retire(spl, generation);
+}
+
 /*
  * Function to incorporate the memtable to the root.
  * Carries out the following steps :
@@ -3644,14 +4567,14 @@ trunk_install_new_compacted_subbundle(trunk_handle             *spl,
  *  3. If the new root is full, flush until it is no longer full. Also flushes
  *     any full descendents.
  *  4. If necessary, split the new root.
- *  5. Lock lookup lock (blocks lookups, which must obtain a read lock on the
- *     lookup lock).
+ *  5. Block lookups (lookups retry their snapshot of the memtable
+ *     generations and the root rather than wait, see trunk_lookup_snapshot).
  *  6. Transition memtable state and increment generation_retired.
- *  7. Update root to new_root and unlock all locks (root lock, lookup lock,
- *     new root lock).
+ *  7. Update root to new_root, unblock lookups and unlock all locks (root
+ *     lock, new root lock).
  *  8. Enqueue the filter building task.
- *  9. Decrement the now-incorporated memtable ref count and recycle if no
- *     references.
+ *  9. Retire the now-incorporated memtable, to be recycled once no lookup can
+ *     be reading it.
  *
  * This functions has some preconditions prior to being called.
  *  --> Trunk root node should be write locked.
@@ -3662,6 +4585,13 @@ trunk_memtable_incorporate_and_flush(trunk_handle  *spl,
                                      uint64         generation,
                                      const threadid tid)
 {
+   trunk_block_clear(spl);
+   if (memtable_generation_is_cleared(spl->mt_ctxt, generation)) {
+      trunk_memtable_discard_cleared(spl, generation);
+      trunk_unblock_clear(spl);
+      return;
+   }
+
    trunk_node new_root;
    uint64     old_root_addr; // unused
    trunk_claim_and_copy_root(spl, &new_root, &old_root_addr);
@@ -3714,9 +4644,9 @@ trunk_memtable_incorporate_and_flush(trunk_handle  *spl,
    }
 
    /*
-    * Lock the lookup lock, blocking lookups.
-    * Transition memtable state and increment memtable generation (blocks
-    * lookups from accessing the memtable that's being incorporated).
+    * Block lookups, so they see the memtable either before it is retired or
+    * in the new root. Transition memtable state and increment memtable
+    * generation (hides the memtable from lookups started from now on).
     */
    memtable_block_lookups(spl->mt_ctxt);
    memtable *mt = trunk_get_memtable(spl, generation);
@@ -3732,6 +4662,7 @@ trunk_memtable_incorporate_and_flush(trunk_handle  *spl,
    // Switch in the new root and release all locks
    trunk_update_claimed_root_and_unlock(spl, &new_root);
    memtable_unblock_lookups(spl->mt_ctxt);
+   trunk_throttle_update(spl, TRUE);
 
    // Enqueue the filter building task.
    trunk_log_stream_if_enabled(
@@ -3743,14 +4674,18 @@ trunk_memtable_incorporate_and_flush(trunk_handle  *spl,
       req->height,
       req->bundle_no);
    trunk_close_log_stream_if_enabled(spl, &stream);
-   task_enqueue(
-      spl->ts, TASK_TYPE_NORMAL, trunk_bundle_build_filters, req, TRUE);
+   task_enqueue(spl->ts,
+                TASK_TYPE_NORMAL,
+                trunk_bundle_build_filters,
+                req,
+                TASK_PRIORITY_HIGH);
+   trunk_unblock_clear(spl);
 
    /*
-    * Decrement the now-incorporated memtable ref count and recycle if no
-    * references
+    * Retire the now-incorporated memtable, it is recycled once no lookup can
+    * be reading it
     */
-   memtable_dec_ref_maybe_recycle(spl->mt_ctxt, mt);
+   trunk_memtable_retire(spl, generation);
 
    if (spl->cfg.use_stats) {
       const threadid tid = platform_get_tid();
@@ -3816,7 +4751,8 @@ trunk_memtable_flush(trunk_handle *spl, uint64 generation)
                 TASK_TYPE_MEMTABLE,
                 trunk_memtable_flush_internal_virtual,
                 &cmt->mt_args,
-                FALSE);
+                TASK_PRIORITY_NORMAL);
+   trunk_throttle_update(spl, FALSE);
 }
 
 void
@@ -3826,13 +4762,39 @@ trunk_memtable_flush_virtual(void *arg, uint64 generation)
    trunk_memtable_flush(spl, generation);
 }
 
+/*
+ * Reads the memtable generations to look up, [*mt_gen_end + 1, *mt_gen_start],
+ * and the root holding everything older, as of a single point in time, so
+ * that a memtable being incorporated is seen either in the memtables or in the
+ * tree, but not in both.
+ *
+ * The caller must be in a read section of spl->epoch for as long as it uses
+ * them: a memtable is not recycled, nor the tree under root_addr freed, until
+ * the readers that might have seen them have left.
+ */
+static inline void
+trunk_lookup_snapshot(trunk_handle *spl,
+                      uint64       *mt_gen_start,
+                      uint64       *mt_gen_end,
+                      uint64       *root_addr)
+{
+   uint64 seq;
+   do {
+      seq           = memtable_begin_lookup(spl->mt_ctxt);
+      *mt_gen_start = memtable_generation(spl->mt_ctxt);
+      *mt_gen_end   = memtable_generation_lookup_end(spl->mt_ctxt);
+      *root_addr    = spl->root_addr;
+   } while (!memtable_end_lookup(spl->mt_ctxt, seq));
+   platform_assert(*mt_gen_start - *mt_gen_end <= TRUNK_NUM_MEMTABLES);
+}
+
 static inline uint64
 trunk_memtable_root_addr_for_lookup(trunk_handle *spl,
                                     uint64        generation,
                                     bool32       *is_compacted)
 {
    memtable *mt = trunk_get_memtable(spl, generation);
-   platform_assert(memtable_ok_to_lookup(mt));
+   platform_assert(memtable_ok_to_lookup(mt, generation));
 
    if (memtable_ok_to_lookup_compacted(mt)) {
       // lookup in packed tree
@@ -3900,7 +4862,7 @@ trunk_inc_filter_ref(trunk_handle *spl, routing_filter *filter, uint32 lineno)
                 filter->addr,
                 filter->meta_head,
                 filter->num_fingerprints);
-   mini_unkeyed_inc_ref(spl->cc, filter->meta_head);
+   mini_unkeyed_inc_ref(spl->cc, filter->meta_head, PAGE_TYPE_FILTER);
 }
 
 static inline void
@@ -4128,6 +5090,7 @@ trunk_build_filters(trunk_handle             *spl,
       uint16          value      = filter_scratch->value[pos];
       platform_status rc         = routing_filter_add(spl->cc,
                                               filter_cfg,
+                                              &spl->filter_packer,
                                               &old_filter,
                                               &new_filter,
                                               fp_arr,
@@ -4187,6 +5150,9 @@ trunk_replace_routing_filter(trunk_handle             *spl,
       pdata->num_kv_bytes_bundle -= bundle_num_kv_bytes;
       pdata->num_kv_bytes_whole += bundle_num_kv_bytes;
 
+      pdata->num_tombstones += compact_req->output_pivot_tombstone_count[pos];
+      pdata->num_updates += compact_req->output_pivot_update_count[pos];
+
       uint64 num_tuples_to_reclaim = trunk_pivot_tuples_to_reclaim(spl, pdata);
       if (pdata->srq_idx != -1 && spl->cfg.reclaim_threshold != UINT64_MAX) {
          srq_update(&spl->srq, pdata->srq_idx, num_tuples_to_reclaim);
@@ -4218,23 +5184,16 @@ trunk_garbage_collect_filters(trunk_handle             *spl,
          continue;
       }
       debug_assert(pdata->generation < req->max_pivot_generation);
-      trunk_dec_filter(spl, &pdata->filter);
+      trunk_reclaim_filter(spl, &pdata->filter);
    }
-   trunk_node_unlock(spl->cc, &node);
-   trunk_node_unclaim(spl->cc, &node);
    trunk_node_unget(spl->cc, &node);
 }
 
 
-/*
- * Asynchronous task function which builds routing filters for a compacted
- * bundle
- */
-void
-trunk_bundle_build_filters(void *arg, void *scratch)
+static void
+trunk_bundle_build_filters_internal(trunk_compact_bundle_req *compact_req)
 {
-   trunk_compact_bundle_req *compact_req = (trunk_compact_bundle_req *)arg;
-   trunk_handle             *spl         = compact_req->spl;
+   trunk_handle *spl = compact_req->spl;
 
    bool32 should_continue_build_filters = TRUE;
    while (should_continue_build_filters) {
@@ -4268,11 +5227,16 @@ trunk_bundle_build_filters(void *arg, void *scratch)
       }
 
       if (trunk_build_filter_should_reenqueue(compact_req, &node)) {
+         /*
+          * The earlier bundles' filters are built by tasks of higher
+          * priority. A thread takes its own newest task first, so at the
+          * same priority this one would run again ahead of them.
+          */
          task_enqueue(spl->ts,
                       TASK_TYPE_NORMAL,
                       trunk_bundle_build_filters,
                       compact_req,
-                      FALSE);
+                      TASK_PRIORITY_LOW);
          trunk_log_stream_if_enabled(
             spl, &stream, "out of order, reequeuing\n");
          trunk_close_log_stream_if_enabled(spl, &stream);
@@ -4320,6 +5284,8 @@ trunk_bundle_build_filters(void *arg, void *scratch)
             trunk_clear_bundle(spl, &node, compact_req->bundle_no);
          }
 
+         trunk_compact_tombstones(spl, &node);
+
          trunk_node_unlock(spl->cc, &node);
          trunk_node_unclaim(spl->cc, &node);
          debug_assert(trunk_verify_node(spl, &node));
@@ -4409,6 +5375,33 @@ out:
    return;
 }
 
+/*
+ * Asynchronous task function which builds routing filters for a compacted
+ * bundle
+ */
+void
+trunk_bundle_build_filters(void *arg, void *scratch)
+{
+   trunk_compact_bundle_req *compact_req = (trunk_compact_bundle_req *)arg;
+   trunk_handle             *spl         = compact_req->spl;
+
+   trunk_block_clear(spl);
+   if (trunk_compact_bundle_req_is_cleared(spl, compact_req)) {
+      trunk_default_log_if_enabled(
+         spl,
+         "build_filter abort cleared: height %u, bundle %u\n",
+         compact_req->height,
+         compact_req->bundle_no);
+      platform_free(spl->heap_id, compact_req->fp_arr);
+      key_buffer_deinit(&compact_req->start_key);
+      key_buffer_deinit(&compact_req->end_key);
+      platform_free(spl->heap_id, compact_req);
+   } else {
+      trunk_bundle_build_filters_internal(compact_req);
+   }
+   trunk_unblock_clear(spl);
+}
+
 static cache_async_result
 trunk_filter_lookup_async(trunk_handle       *spl,
                           routing_config     *cfg,
@@ -4613,8 +5606,12 @@ trunk_compact_bundle_enqueue(trunk_handle             *spl,
    key start_key = key_buffer_key(&req->start_key);
    key end_key   = key_buffer_key(&req->end_key);
    platform_assert(trunk_key_compare(spl, start_key, end_key) < 0);
-   return task_enqueue(
-      spl->ts, TASK_TYPE_NORMAL, trunk_compact_bundle, req, FALSE);
+   req->clear_generation = spl->clear_generation;
+   return task_enqueue(spl->ts,
+                       TASK_TYPE_NORMAL,
+                       trunk_compact_bundle,
+                       req,
+                       TASK_PRIORITY_NORMAL);
 }
 
 /*
@@ -5097,15 +6094,14 @@ trunk_compact_bundle_cleanup_iterators(trunk_handle           *spl,
  *        a. node if leaf which has split, in which case discard (interaction 6)
  *        b. node is internal and bundle has been flushed
  */
-void
-trunk_compact_bundle(void *arg, void *scratch_buf)
+static void
+trunk_compact_bundle_internal(trunk_compact_bundle_req *req,
+                              trunk_task_scratch       *task_scratch)
 {
-   platform_status           rc;
-   trunk_compact_bundle_req *req          = arg;
-   trunk_task_scratch       *task_scratch = scratch_buf;
-   compact_bundle_scratch   *scratch      = &task_scratch->compact_bundle;
-   trunk_handle             *spl          = req->spl;
-   threadid                  tid;
+   platform_status         rc;
+   compact_bundle_scratch *scratch = &task_scratch->compact_bundle;
+   trunk_handle           *spl     = req->spl;
+   threadid                tid;
 
    /*
     * 1. Acquire node read lock
@@ -5244,7 +6240,9 @@ trunk_compact_bundle(void *arg, void *scratch_buf)
       platform_free(spl->heap_id, req);
       goto out;
    }
-   req->fp_arr = pack_req.fingerprint_arr;
+   // tuples the compaction filter removes need no deletes past the leaves
+   pack_req.discard_deletes = merge_mode == MERGE_FULL;
+   req->fp_arr              = pack_req.fingerprint_arr;
    if (spl->cfg.use_stats) {
       pack_start = platform_get_timestamp();
    }
@@ -5266,10 +6264,13 @@ trunk_compact_bundle(void *arg, void *scratch_buf)
    }
 
    trunk_branch new_branch;
-   new_branch.root_addr     = pack_req.root_addr;
-   uint64 num_tuples        = pack_req.num_tuples;
-   req->fp_arr              = pack_req.fingerprint_arr;
-   pack_req.fingerprint_arr = NULL;
+   new_branch.root_addr        = pack_req.root_addr;
+   uint64 num_tuples           = pack_req.num_tuples;
+   req->fp_arr                 = pack_req.fingerprint_arr;
+   req->output_tuple_count     = pack_req.num_tuples;
+   req->output_tombstone_count = pack_req.num_tombstones;
+   req->output_update_count    = pack_req.num_updates;
+   pack_req.fingerprint_arr    = NULL;
    btree_pack_req_deinit(&pack_req, spl->heap_id);
 
    trunk_log_stream_if_enabled(
@@ -5280,6 +6281,8 @@ trunk_compact_bundle(void *arg, void *scratch_buf)
          spl->stats[tid].compactions_empty[height]++;
       }
       spl->stats[tid].compaction_tuples[height] += num_tuples;
+      spl->stats[tid].compaction_tuples_filtered[height] +=
+         pack_req.num_filtered;
       if (num_tuples > spl->stats[tid].compaction_max_tuples[height]) {
          spl->stats[tid].compaction_max_tuples[height] = num_tuples;
       }
@@ -5334,7 +6337,8 @@ trunk_compact_bundle(void *arg, void *scratch_buf)
          // Here is where we would garbage collect the old path
 
          if (num_tuples != 0) {
-            trunk_dec_ref(spl, &new_branch, FALSE);
+            trunk_reclaim_branch_range(
+               spl, &new_branch, NEGATIVE_INFINITY_KEY, POSITIVE_INFINITY_KEY);
          }
          platform_free(spl->heap_id, req->fp_arr);
          platform_free(spl->heap_id, req);
@@ -5409,7 +6413,8 @@ trunk_compact_bundle(void *arg, void *scratch_buf)
    }
    if (num_replacements == 0) {
       if (num_tuples != 0) {
-         trunk_dec_ref(spl, &new_branch, FALSE);
+         trunk_reclaim_branch_range(
+            spl, &new_branch, NEGATIVE_INFINITY_KEY, POSITIVE_INFINITY_KEY);
       }
       if (spl->cfg.use_stats) {
          spl->stats[tid].compactions_discarded_flushed[height]++;
@@ -5435,14 +6440,39 @@ trunk_compact_bundle(void *arg, void *scratch_buf)
          key_string(trunk_data_config(spl), key_buffer_key(&req->end_key)),
          req->height,
          req->bundle_no);
-      task_enqueue(
-         spl->ts, TASK_TYPE_NORMAL, trunk_bundle_build_filters, req, TRUE);
+      task_enqueue(spl->ts,
+                   TASK_TYPE_NORMAL,
+                   trunk_bundle_build_filters,
+                   req,
+                   TASK_PRIORITY_HIGH);
    }
 out:
    trunk_log_stream_if_enabled(spl, &stream, "\n");
    trunk_close_log_stream_if_enabled(spl, &stream);
 }
 
+void
+trunk_compact_bundle(void *arg, void *scratch_buf)
+{
+   trunk_compact_bundle_req *req = arg;
+   trunk_handle             *spl = req->spl;
+
+   trunk_block_clear(spl);
+   if (trunk_compact_bundle_req_is_cleared(spl, req)) {
+      trunk_default_log_if_enabled(
+         spl,
+         "compact_bundle abort cleared: height %u, bundle %u\n",
+         req->height,
+         req->bundle_no);
+      key_buffer_deinit(&req->start_key);
+      key_buffer_deinit(&req->end_key);
+      platform_free(spl->heap_id, req);
+   } else {
+      trunk_compact_bundle_internal(req, scratch_buf);
+   }
+   trunk_unblock_clear(spl);
+}
+
 /*
  *-----------------------------------------------------------------------------
  * Splitting functions
@@ -5539,9 +6569,26 @@ trunk_split_index(trunk_handle             *spl,
    // add right child to parent
    rc = trunk_add_pivot(spl, parent, &right_node, pivot_no + 1);
    platform_assert(SUCCESS(rc));
+   trunk_pivot_data *left_pdata = trunk_get_pivot_data(spl, parent, pivot_no);
+   uint64            num_tuples_whole = left_pdata->num_tuples_whole;
+   uint64            num_tombstones   = left_pdata->num_tombstones;
+   uint64            num_updates      = left_pdata->num_updates;
    trunk_pivot_recount_num_tuples_and_kv_bytes(spl, parent, pivot_no);
    trunk_pivot_recount_num_tuples_and_kv_bytes(spl, parent, pivot_no + 1);
 
+   // share the deletes and updates out in proportion to the recounted tuples
+   for (uint16 i = pivot_no; i <= pivot_no + 1; i++) {
+      trunk_pivot_data *pdata = trunk_get_pivot_data(spl, parent, i);
+      pdata->num_tombstones   = 0;
+      pdata->num_updates      = 0;
+      if (num_tuples_whole != 0) {
+         pdata->num_tombstones =
+            num_tombstones * pdata->num_tuples_whole / num_tuples_whole;
+         pdata->num_updates =
+            num_updates * pdata->num_tuples_whole / num_tuples_whole;
+      }
+   }
+
    trunk_log_stream_if_enabled(
       spl, &stream, "----------------------------------------\n");
    trunk_log_node_if_enabled(&stream, spl, parent);
@@ -6120,14 +7167,17 @@ trunk_range_iterator_init(trunk_handle         *spl,
 
    ZERO_ARRAY(range_itor->compacted);
 
-   // grab the lookup lock
-   memtable_begin_lookup(spl->mt_ctxt);
+   // everything read until the branches are ref'd is protected by the epoch
+   epoch_enter(&spl->epoch);
+   uint64 trunk_root_addr;
+   trunk_lookup_snapshot(spl,
+                         &range_itor->memtable_start_gen,
+                         &range_itor->memtable_end_gen,
+                         &trunk_root_addr);
 
    // memtables
    ZERO_ARRAY(range_itor->branch);
    // Note this iteration is in descending generation order
-   range_itor->memtable_start_gen = memtable_generation(spl->mt_ctxt);
-   range_itor->memtable_end_gen   = memtable_generation_retired(spl->mt_ctxt);
    range_itor->num_memtable_branches =
       range_itor->memtable_start_gen - range_itor->memtable_end_gen;
    for (uint64 mt_gen = range_itor->memtable_start_gen;
@@ -6158,8 +7208,7 @@ trunk_range_iterator_init(trunk_handle         *spl,
    }
 
    trunk_node node;
-   trunk_node_get(spl->cc, spl->root_addr, &node);
-   memtable_end_lookup(spl->mt_ctxt);
+   trunk_node_get(spl->cc, trunk_root_addr, &node);
 
    // index btrees
    uint16 height = trunk_node_height(&node);
@@ -6233,6 +7282,7 @@ trunk_range_iterator_init(trunk_handle         *spl,
       &range_itor->local_max_key, spl->heap_id, local_max);
 
    trunk_node_unget(spl->cc, &node);
+   epoch_exit(&spl->epoch);
 
    for (uint64 i = 0; i < range_itor->num_branches; i++) {
       uint64          branch_no  = range_itor->num_branches - i - 1;
@@ -6657,6 +7707,81 @@ trunk_maybe_reclaim_space(trunk_handle *spl)
    }
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * Tombstone compaction
+ *
+ *      Heavily deleted or updated ranges pile up delete and update messages,
+ *      which every lookup and scan of the range has to merge past until a
+ *      flush happens to push them down. So whenever filters are built for a
+ *      node, its pivots whose whole branches are dense with such messages are
+ *      flushed (or, in leaves, fully compacted) right away, however much of
+ *      the disk is in use.
+ *-----------------------------------------------------------------------------
+ */
+static inline bool32
+trunk_pivot_needs_tombstone_compaction(trunk_handle     *spl,
+                                       trunk_pivot_data *pdata)
+{
+   uint64 percent      = spl->cfg.tombstone_compaction_percent;
+   uint64 num_messages = pdata->num_tombstones + pdata->num_updates;
+   return percent <= 100 && num_messages >= TRUNK_MIN_TOMBSTONE_COMPACTION
+          && 100 * num_messages >= percent * pdata->num_tuples_whole;
+}
+
+/*
+ * Flushes the pivots of node which are dense with deletes and updates, or
+ * compacts node if it is such a leaf.
+ *
+ * A leaf is only compacted once it has no bundles left, since rebundling its
+ * branches would strand the compactions of those bundles in flight. Index
+ * nodes are only flushed from while they have room for another child, as a
+ * flush may split the child.
+ *
+ * NOTE: node must be write locked, as returned by
+ * trunk_copy_path_by_key_and_height.
+ */
+static void
+trunk_compact_tombstones(trunk_handle *spl, trunk_node *node)
+{
+   uint16 height = trunk_node_height(node);
+   if (trunk_node_is_leaf(node)) {
+      trunk_pivot_data *pdata = trunk_get_pivot_data(spl, node, 0);
+      if (trunk_bundle_count(spl, node) == 0
+          && trunk_pivot_needs_tombstone_compaction(spl, pdata))
+      {
+         trunk_compact_leaf(spl, node);
+         if (spl->cfg.use_stats) {
+            spl->stats[platform_get_tid()].tombstone_compactions[height]++;
+         }
+      }
+      return;
+   }
+
+   // flushes may split children, so the number of children is not fixed
+   for (uint16 pivot_no = 0; pivot_no < trunk_num_children(spl, node);
+        pivot_no++)
+   {
+      trunk_pivot_data *pdata = trunk_get_pivot_data(spl, node, pivot_no);
+      if (!trunk_pivot_needs_tombstone_compaction(spl, pdata)
+          || trunk_needs_split(spl, node))
+      {
+         continue;
+      }
+      trunk_node child;
+      trunk_node_get(spl->cc, pdata->addr, &child);
+      bool32 has_room = trunk_room_to_flush(spl, node, &child, pdata);
+      trunk_node_unget(spl->cc, &child);
+      if (!has_room) {
+         continue;
+      }
+      platform_status rc = trunk_flush(spl, node, pdata, FALSE);
+      if (SUCCESS(rc) && spl->cfg.use_stats) {
+         spl->stats[platform_get_tid()].tombstone_compactions[height]++;
+      }
+   }
+}
+
 /*
  *-----------------------------------------------------------------------------
  * Main Splinter API functions
@@ -6667,8 +7792,12 @@ trunk_maybe_reclaim_space(trunk_handle *spl)
  *-----------------------------------------------------------------------------
  */
 
-platform_status
-trunk_insert(trunk_handle *spl, key tuple_key, message data)
+static platform_status
+trunk_insert_internal(trunk_handle *spl,
+                      key           tuple_key,
+                      message       data,
+                      bool32        block,
+                      uint64       *retry_ns)
 {
    timestamp      ts;
    const threadid tid = platform_get_tid();
@@ -6680,16 +7809,23 @@ trunk_insert(trunk_handle *spl, key tuple_key, message data)
       return STATUS_BAD_PARAM;
    }
 
+   if (spl->read_only) {
+      return STATUS_NO_PERMISSION;
+   }
+
    if (message_class(data) == MESSAGE_TYPE_DELETE) {
       data = DELETE_MESSAGE;
    }
 
-   platform_status rc = trunk_memtable_insert(spl, tuple_key, data);
+   platform_status rc =
+      trunk_memtable_insert(spl, tuple_key, data, block, retry_ns);
    if (!SUCCESS(rc)) {
       goto out;
    }
 
-   task_perform_one_if_needed(spl->ts, spl->cfg.queue_scale_percent);
+   if (block) {
+      task_perform_one_if_needed(spl->ts, spl->cfg.queue_scale_percent);
+   }
 
    if (spl->cfg.use_stats) {
       switch (message_class(data)) {
@@ -6717,6 +7853,28 @@ out:
    return rc;
 }
 
+platform_status
+trunk_insert(trunk_handle *spl, key tuple_key, message data)
+{
+   return trunk_insert_internal(spl, tuple_key, data, TRUE, NULL);
+}
+
+platform_status
+trunk_try_insert(trunk_handle *spl,
+                 key           tuple_key,
+                 message       data,
+                 uint64       *retry_ns)
+{
+   return trunk_insert_internal(spl, tuple_key, data, FALSE, retry_ns);
+}
+
+void
+trunk_set_capacity_callback(trunk_handle *spl, trunk_capacity_fn fn, void *arg)
+{
+   spl->capacity_arg = arg;
+   spl->capacity_fn  = fn;
+}
+
 bool32
 trunk_filter_lookup(trunk_handle      *spl,
                     trunk_node        *node,
@@ -6874,25 +8032,114 @@ trunk_pivot_lookup(trunk_handle      *spl,
       spl, node, &pdata->filter, cfg, pdata->start_branch, target, data);
 }
 
-// If any change is made in here, please make similar change in
-// trunk_lookup_async
-platform_status
-trunk_lookup(trunk_handle *spl, key target, merge_accumulator *result)
+static inline bool32
+trunk_lookup_expired(trunk_handle *spl, merge_accumulator *result)
 {
-   // look in memtables
-
-   // 1. get read lock on lookup lock
-   //     --- 2. for [mt_no = mt->generation..mt->gen_to_incorp]
-   // 2. for gen = mt->generation; mt[gen % ...].gen == gen; gen --;
-   //                also handles switch to READY ^^^^^
+   data_config *data_cfg = spl->cfg.data_cfg;
+   return data_message_expired(data_cfg,
+                               merge_accumulator_to_message(result),
+                               data_expiry_now(data_cfg));
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ * trunk_lookup_node_get --
+ *
+ *      Returns the first node on the path to target from the root at
+ *      root_addr that a lookup has to search, read locked: the first whose
+ *      pivot for target has live branches, or the leaf.
+ *
+ *      The nodes above it are read without read locks, so that lookups write
+ *      no shared cacheline in the upper levels, where all of them pass. A
+ *      node is validated before the child address read from it is followed,
+ *      and again once the child is secured, which stands in for holding the
+ *      parent while getting the child: a flush locks both. Falls back to the
+ *      root, read locked, if a node changes during the descent.
+ *-----------------------------------------------------------------------------
+ */
+static void
+trunk_lookup_node_get(trunk_handle *spl,
+                      uint64        root_addr,
+                      key           target,
+                      trunk_node   *out_node)
+{
+   cache     *cc = spl->cc;
+   trunk_node node;
+   uint64     version;
+
+   node.addr = root_addr;
+   node.page = cache_get_optimistic(cc, node.addr, PAGE_TYPE_TRUNK, &version);
+   if (node.page == NULL) {
+      trunk_node_get(cc, root_addr, out_node);
+      return;
+   }
+   node.hdr = (trunk_hdr *)node.page->data;
+
+   while (TRUE) {
+      uint16 pivot_no;
+      uint16 height = *(const volatile uint16 *)&node.hdr->height;
+      if (height == 0
+          || !trunk_find_pivot_optimistic(spl, &node, target, &pivot_no))
+      {
+         break;
+      }
+      volatile trunk_hdr        *hdr = node.hdr;
+      volatile trunk_pivot_data *pdata =
+         trunk_get_pivot_data(spl, &node, pivot_no);
+      bool32 empty = pdata->start_bundle == hdr->end_bundle
+                     && pdata->start_branch == hdr->end_branch;
+      uint64 child_addr = pdata->addr;
+      if (!empty || !cache_validate_optimistic(cc, node.page, version)) {
+         break;
+      }
+
+      trunk_node child;
+      uint64     child_version;
+      child.addr = child_addr;
+      child.page =
+         cache_get_optimistic(cc, child.addr, PAGE_TYPE_TRUNK, &child_version);
+      if (child.page == NULL) {
+         trunk_node_get(cc, child.addr, out_node);
+         if (!cache_validate_optimistic(cc, node.page, version)) {
+            trunk_node_unget(cc, out_node);
+            trunk_node_get(cc, root_addr, out_node);
+         }
+         return;
+      }
+      child.hdr = (trunk_hdr *)child.page->data;
+      if (!cache_validate_optimistic(cc, node.page, version)) {
+         trunk_node_get(cc, root_addr, out_node);
+         return;
+      }
+      node    = child;
+      version = child_version;
+   }
+
+   // unchanged since it was secured means unchanged since its parent was read
+   trunk_node_get(cc, node.addr, out_node);
+   if (!cache_validate_optimistic(cc, out_node->page, version)) {
+      trunk_node_unget(cc, out_node);
+      trunk_node_get(cc, root_addr, out_node);
+   }
+}
+
+// If any change is made in here, please make similar change in
+// trunk_lookup_async
+platform_status
+trunk_lookup(trunk_handle *spl, key target, merge_accumulator *result)
+{
+   // look in memtables
+
+   // 1. take a snapshot of the memtable generations and the root
+   // 2. for gen = mt->generation; mt[gen % ...].gen == gen; gen --;
+   //                also handles switch to READY ^^^^^
 
    merge_accumulator_set_to_null(result);
 
-   memtable_begin_lookup(spl->mt_ctxt);
+   epoch_enter(&spl->epoch);
    bool32 found_in_memtable = FALSE;
-   uint64 mt_gen_start      = memtable_generation(spl->mt_ctxt);
-   uint64 mt_gen_end        = memtable_generation_retired(spl->mt_ctxt);
-   platform_assert(mt_gen_start - mt_gen_end <= TRUNK_NUM_MEMTABLES);
+   uint64 mt_gen_start, mt_gen_end, root_addr;
+   trunk_lookup_snapshot(spl, &mt_gen_start, &mt_gen_end, &root_addr);
 
    for (uint64 mt_gen = mt_gen_start; mt_gen != mt_gen_end; mt_gen--) {
       platform_status rc;
@@ -6905,10 +8152,7 @@ trunk_lookup(trunk_handle *spl, key target, merge_accumulator *result)
    }
 
    trunk_node node;
-   trunk_root_get(spl, &node);
-
-   // release memtable lookup lock
-   memtable_end_lookup(spl->mt_ctxt);
+   trunk_lookup_node_get(spl, root_addr, target, &node);
 
    // look in index nodes
    uint16 height = trunk_node_height(&node);
@@ -6944,12 +8188,10 @@ trunk_lookup(trunk_handle *spl, key target, merge_accumulator *result)
    }
 found_final_answer_early:
 
-   if (found_in_memtable) {
-      // release memtable lookup lock
-      memtable_end_lookup(spl->mt_ctxt);
-   } else {
+   if (!found_in_memtable) {
       trunk_node_unget(spl->cc, &node);
    }
+   epoch_exit(&spl->epoch);
    if (spl->cfg.use_stats) {
       threadid tid = platform_get_tid();
       if (!merge_accumulator_is_null(result)) {
@@ -6959,9 +8201,13 @@ found_final_answer_early:
       }
    }
 
-   /* Normalize DELETE messages to return a null merge_accumulator */
+   /*
+    * Normalize DELETE messages, and inserts which have expired, to return a
+    * null merge_accumulator
+    */
    if (!merge_accumulator_is_null(result)
-       && merge_accumulator_message_class(result) == MESSAGE_TYPE_DELETE)
+       && (merge_accumulator_message_class(result) == MESSAGE_TYPE_DELETE
+           || trunk_lookup_expired(spl, result)))
    {
       merge_accumulator_set_to_null(result);
    }
@@ -7105,14 +8351,18 @@ trunk_lookup_async(trunk_handle      *spl,    // IN
          case async_state_start:
          {
             merge_accumulator_set_to_null(result);
+            // keeps the tree under ctxt->root_addr alive until the end
+            ctxt->epoch = epoch_enter_async(&spl->epoch);
             trunk_async_set_state(ctxt, async_state_lookup_memtable);
             // fallthrough
          }
          case async_state_lookup_memtable:
          {
-            memtable_begin_lookup(spl->mt_ctxt);
-            uint64 mt_gen_start = memtable_generation(spl->mt_ctxt);
-            uint64 mt_gen_end   = memtable_generation_retired(spl->mt_ctxt);
+            // the memtables are done with before returning to the caller
+            epoch_enter(&spl->epoch);
+            uint64 mt_gen_start, mt_gen_end;
+            trunk_lookup_snapshot(
+               spl, &mt_gen_start, &mt_gen_end, &ctxt->root_addr);
             for (uint64 mt_gen = mt_gen_start; mt_gen != mt_gen_end; mt_gen--) {
                platform_status rc;
                rc = trunk_memtable_lookup(spl, mt_gen, target, result);
@@ -7120,10 +8370,10 @@ trunk_lookup_async(trunk_handle      *spl,    // IN
                if (merge_accumulator_is_definitive(result)) {
                   trunk_async_set_state(ctxt,
                                         async_state_found_final_answer_early);
-                  memtable_end_lookup(spl->mt_ctxt);
                   break;
                }
             }
+            epoch_exit(&spl->epoch);
             if (ctxt->state == async_state_found_final_answer_early) {
                break;
             }
@@ -7133,7 +8383,7 @@ trunk_lookup_async(trunk_handle      *spl,    // IN
          {
             cache_ctxt_init(
                spl->cc, trunk_async_callback, NULL, &ctxt->cache_ctxt);
-            res = trunk_node_get_async(spl->cc, spl->root_addr, ctxt);
+            res = trunk_node_get_async(spl->cc, ctxt->root_addr, ctxt);
             switch (res) {
                case async_locked:
                case async_no_reqs:
@@ -7162,7 +8412,6 @@ trunk_lookup_async(trunk_handle      *spl,    // IN
                   ctxt->trunk_node.page = ctxt->cache_ctxt.page;
                   ctxt->trunk_node.hdr =
                      (trunk_hdr *)(ctxt->cache_ctxt.page->data);
-                  memtable_end_lookup(spl->mt_ctxt);
                   break;
                default:
                   platform_assert(0);
@@ -7515,11 +8764,14 @@ trunk_lookup_async(trunk_handle      *spl,    // IN
                message_type type = merge_accumulator_message_class(result);
                debug_assert(type == MESSAGE_TYPE_DELETE
                             || type == MESSAGE_TYPE_INSERT);
-               if (type == MESSAGE_TYPE_DELETE) {
+               if (type == MESSAGE_TYPE_DELETE
+                   || trunk_lookup_expired(spl, result))
+               {
                   merge_accumulator_set_to_null(result);
                }
             }
 
+            epoch_exit_async(&spl->epoch, ctxt->epoch);
             res  = async_success;
             done = TRUE;
             break;
@@ -7581,6 +8833,34 @@ destroy_range_itor:
  * XXX Fix this api to return platform_status
  *-----------------------------------------------------------------------------
  */
+/*
+ * Makes root, which must be newly allocated, write locked and have a zeroed
+ * header, the root of an empty tree with a single leaf, and releases it.
+ */
+static void
+trunk_init_empty_root(trunk_handle *spl, trunk_node *root)
+{
+   // set up the initial leaf
+   trunk_node leaf;
+   trunk_alloc(spl->cc, &spl->mini, 0, &leaf);
+   memset(leaf.hdr, 0, trunk_page_size(&spl->cfg));
+   trunk_set_initial_pivots(spl, &leaf);
+   trunk_inc_pivot_generation(spl, &leaf);
+
+   // add leaf to root and fix up root
+   root->hdr->height = 1;
+   trunk_add_pivot_new_root(spl, root, &leaf);
+   trunk_inc_pivot_generation(spl, root);
+
+   trunk_node_unlock(spl->cc, &leaf);
+   trunk_node_unclaim(spl->cc, &leaf);
+   trunk_node_unget(spl->cc, &leaf);
+
+   trunk_node_unlock(spl->cc, root);
+   trunk_node_unclaim(spl->cc, root);
+   trunk_node_unget(spl->cc, root);
+}
+
 trunk_handle *
 trunk_create(trunk_config     *cfg,
              allocator        *al,
@@ -7604,6 +8884,8 @@ trunk_create(trunk_config     *cfg,
    platform_batch_rwlock_init(&spl->trunk_root_lock);
 
    srq_init(&spl->srq, platform_get_module_id(), hid);
+   trunk_reclaim_init(spl);
+   epoch_domain_init(&spl->epoch);
 
    // get a free node for the root
    //    we don't use the mini allocator for this, since the root doesn't
@@ -7631,6 +8913,7 @@ trunk_create(trunk_config     *cfg,
              TRUNK_MAX_HEIGHT,
              PAGE_TYPE_TRUNK,
              FALSE);
+   mini_packer_init(&spl->filter_packer, cc, PAGE_TYPE_FILTER, spl->heap_id);
 
    // set up the memtable context
    memtable_config *mt_cfg = &spl->cfg.mt_cfg;
@@ -7645,25 +8928,7 @@ trunk_create(trunk_config     *cfg,
    // ALEX: For now we assume an init means destroying any present super blocks
    trunk_set_super_block(spl, FALSE, FALSE, TRUE);
 
-   // set up the initial leaf
-   trunk_node leaf;
-   trunk_alloc(spl->cc, &spl->mini, 0, &leaf);
-   memset(leaf.hdr, 0, trunk_page_size(&spl->cfg));
-   trunk_set_initial_pivots(spl, &leaf);
-   trunk_inc_pivot_generation(spl, &leaf);
-
-   // add leaf to root and fix up root
-   root.hdr->height = 1;
-   trunk_add_pivot_new_root(spl, &root, &leaf);
-   trunk_inc_pivot_generation(spl, &root);
-
-   trunk_node_unlock(spl->cc, &leaf);
-   trunk_node_unclaim(spl->cc, &leaf);
-   trunk_node_unget(spl->cc, &leaf);
-
-   trunk_node_unlock(spl->cc, &root);
-   trunk_node_unclaim(spl->cc, &root);
-   trunk_node_unget(spl->cc, &root);
+   trunk_init_empty_root(spl, &root);
 
    if (spl->cfg.use_stats) {
       spl->stats = TYPED_ARRAY_ZALLOC(spl->heap_id, spl->stats, MAX_THREADS);
@@ -7694,17 +8959,19 @@ trunk_create(trunk_config     *cfg,
 /*
  * Open (mount) an existing splinter database
  */
-trunk_handle *
-trunk_mount(trunk_config     *cfg,
-            allocator        *al,
-            cache            *cc,
-            task_system      *ts,
-            allocator_root_id id,
-            platform_heap_id  hid)
+static trunk_handle *
+trunk_mount_internal(trunk_config     *cfg,
+                     allocator        *al,
+                     cache            *cc,
+                     task_system      *ts,
+                     allocator_root_id id,
+                     bool32            read_only,
+                     platform_heap_id  hid)
 {
    trunk_handle *spl = TYPED_FLEXIBLE_STRUCT_ZALLOC(
       hid, spl, compacted_memtable, TRUNK_NUM_MEMTABLES);
    memmove(&spl->cfg, cfg, sizeof(*cfg));
+   spl->read_only = read_only;
 
    spl->al = al;
    spl->cc = cc;
@@ -7714,20 +8981,28 @@ trunk_mount(trunk_config     *cfg,
    spl->ts      = ts;
 
    srq_init(&spl->srq, platform_get_module_id(), hid);
+   trunk_reclaim_init(spl);
+   epoch_domain_init(&spl->epoch);
 
    platform_batch_rwlock_init(&spl->trunk_root_lock);
 
    // find the unmounted super block
    spl->root_addr                      = 0;
+   uint64             meta_head        = 0;
    uint64             meta_tail        = 0;
+   uint64             warmup_addr      = 0;
    uint64             latest_timestamp = 0;
+   bool32             checkpointed     = FALSE;
    page_handle       *super_page;
    trunk_super_block *super = trunk_get_super_block_if_valid(spl, &super_page);
    if (super != NULL) {
       if (super->unmounted && super->timestamp > latest_timestamp) {
          spl->root_addr   = super->root_addr;
+         meta_head        = super->meta_head;
          meta_tail        = super->meta_tail;
+         warmup_addr      = super->warmup_addr;
          latest_timestamp = super->timestamp;
+         checkpointed     = super->checkpointed;
       }
       trunk_release_super_block(spl, super_page);
    }
@@ -7743,8 +9018,6 @@ trunk_mount(trunk_config     *cfg,
       platform_free(hid, spl);
       return (trunk_handle *)NULL;
    }
-   uint64 meta_head = spl->root_addr + trunk_page_size(&spl->cfg);
-
    memtable_config *mt_cfg = &spl->cfg.mt_cfg;
    spl->mt_ctxt            = memtable_context_create(
       spl->heap_id, cc, mt_cfg, trunk_memtable_flush_virtual, spl);
@@ -7758,11 +9031,15 @@ trunk_mount(trunk_config     *cfg,
              TRUNK_MAX_HEIGHT,
              PAGE_TYPE_TRUNK,
              FALSE);
-   if (spl->cfg.use_log) {
+   mini_packer_init(&spl->filter_packer, cc, PAGE_TYPE_FILTER, spl->heap_id);
+   if (spl->cfg.use_log && !spl->read_only) {
       spl->log = log_create(cc, spl->cfg.log_cfg, spl->heap_id);
    }
 
-   trunk_set_super_block(spl, FALSE, FALSE, FALSE);
+   // a read-only table is left marked unmounted, as it is not changed
+   if (!spl->read_only) {
+      trunk_set_super_block(spl, FALSE, FALSE, FALSE);
+   }
 
    if (spl->cfg.use_stats) {
       spl->stats = TYPED_ARRAY_ZALLOC(spl->heap_id, spl->stats, MAX_THREADS);
@@ -7786,9 +9063,44 @@ trunk_mount(trunk_config     *cfg,
          platform_assert_status_ok(rc);
       }
    }
+
+   if (!spl->read_only) {
+      // the first writable mount of a checkpoint finishes its compactions
+      if (checkpointed) {
+         trunk_for_each_node(spl, trunk_resume_compactions, NULL);
+      }
+      trunk_cache_warmup_start(spl, warmup_addr);
+   }
    return spl;
 }
 
+trunk_handle *
+trunk_mount(trunk_config     *cfg,
+            allocator        *al,
+            cache            *cc,
+            task_system      *ts,
+            allocator_root_id id,
+            platform_heap_id  hid)
+{
+   return trunk_mount_internal(cfg, al, cc, ts, id, FALSE, hid);
+}
+
+/*
+ * Mounts table id, typically a checkpoint, for lookups and range queries
+ * only: inserts and clears fail with STATUS_NO_PERMISSION, and the table is
+ * left as it was found.
+ */
+trunk_handle *
+trunk_mount_read_only(trunk_config     *cfg,
+                      allocator        *al,
+                      cache            *cc,
+                      task_system      *ts,
+                      allocator_root_id id,
+                      platform_heap_id  hid)
+{
+   return trunk_mount_internal(cfg, al, cc, ts, id, TRUE, hid);
+}
+
 /*
  * This function is only safe to call when all other calls to spl have returned
  * and all tasks have been complete.
@@ -7813,6 +9125,15 @@ trunk_prepare_for_shutdown(trunk_handle *spl)
    platform_status rc = task_perform_until_quiescent(spl->ts);
    platform_assert_status_ok(rc);
 
+   // release the dead branches and filters still waiting to be reclaimed
+   trunk_reclaim_deinit(spl);
+
+   // and the memtables, now that no lookup can be reading them
+   trunk_memtable_recycle_retired(spl);
+   for (uint64 mt_no = 0; mt_no < TRUNK_NUM_MEMTABLES; mt_no++) {
+      platform_assert(!spl->compacted_memtable[mt_no].retire_pending);
+   }
+
    // destroy memtable context (and its memtables)
    memtable_context_destroy(spl->heap_id, spl->mt_ctxt);
 
@@ -7824,6 +9145,9 @@ trunk_prepare_for_shutdown(trunk_handle *spl)
    // release the trunk mini allocator
    mini_release(&spl->mini, NULL_KEY);
 
+   // close the extent small filters are being packed into
+   mini_packer_deinit(&spl->filter_packer);
+
    // flush all dirty pages in the cache
    cache_flush(spl->cc);
 }
@@ -7866,6 +9190,630 @@ trunk_node_destroy(trunk_handle *spl, uint64 addr, void *arg)
    return TRUE;
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ * Clear
+ *
+ * trunk_clear empties the table in place. With inserts and tree updates held
+ * off, it swaps the root for an empty one and hides every memtable from
+ * lookups, then leaves the old tree to the reclamation queue. The caller waits
+ * only for the updates already in flight, however much data there was.
+ *-----------------------------------------------------------------------------
+ */
+
+/*
+ * Releases the branches and filters of the unlinked subtree at addr. Runs
+ * once no lookup or iterator can reach it anymore, see trunk_reclaim_drain.
+ * A node is write locked before its children are released, and stays locked
+ * until they are, waiting out the background walks of older snapshots.
+ */
+static void
+trunk_clear_subtree(trunk_handle *spl, uint64 addr)
+{
+   trunk_node node;
+   trunk_node_get(spl->cc, addr, &node);
+   trunk_node_claim(spl->cc, &node);
+   trunk_node_lock(spl->cc, &node);
+   if (!trunk_node_is_leaf(&node)) {
+      uint16 num_children = trunk_num_children(spl, &node);
+      for (uint16 pivot_no = 0; pivot_no < num_children; pivot_no++) {
+         trunk_pivot_data *pdata = trunk_get_pivot_data(spl, &node, pivot_no);
+         trunk_clear_subtree(spl, pdata->addr);
+      }
+   }
+   trunk_node_unlock(spl->cc, &node);
+   trunk_node_unclaim(spl->cc, &node);
+   trunk_node_unget(spl->cc, &node);
+
+   trunk_node_destroy(spl, addr, NULL);
+}
+
+platform_status
+trunk_clear(trunk_handle *spl)
+{
+   if (spl->read_only) {
+      return STATUS_NO_PERMISSION;
+   }
+
+   // block inserts, retiring the current memtable if it has anything in it
+   bool32          finalized;
+   platform_status rc = memtable_begin_clear(spl->mt_ctxt, &finalized);
+   while (STATUS_IS_EQ(rc, STATUS_BUSY)) {
+      // the next memtable isn't ready, its incorporation may be a task
+      trunk_memtable_recycle_retired(spl);
+      task_perform_one_if_needed(spl->ts, 0);
+      rc = memtable_begin_clear(spl->mt_ctxt, &finalized);
+   }
+   platform_assert_status_ok(rc);
+
+   trunk_block_updates(spl);
+
+   trunk_node new_root;
+   trunk_alloc(spl->cc, &spl->mini, 1, &new_root);
+   memset(new_root.hdr, 0, trunk_page_size(&spl->cfg));
+   uint64 new_root_addr = new_root.addr;
+   trunk_init_empty_root(spl, &new_root);
+
+   // switch in the new root and hide the memtables from lookups
+   memtable_block_lookups(spl->mt_ctxt);
+   trunk_root_full_claim(spl);
+   uint64 old_root_addr = spl->root_addr;
+   __atomic_store_n(&spl->root_addr, new_root_addr, __ATOMIC_RELEASE);
+   memtable_mark_cleared(spl->mt_ctxt);
+   spl->clear_generation++;
+   trunk_root_full_unclaim(spl);
+   memtable_unblock_lookups(spl->mt_ctxt);
+
+   // the space reclamation queue refers to nodes of the old tree
+   srq_deinit(&spl->srq);
+   srq_init(&spl->srq, platform_get_module_id(), spl->heap_id);
+
+   trunk_unblock_updates(spl);
+   memtable_end_clear(spl->mt_ctxt, finalized);
+
+   trunk_default_log_if_enabled(
+      spl, "clear: old root %lu, new root %lu\n", old_root_addr, new_root_addr);
+
+   trunk_reclaim_subtree(spl, old_root_addr);
+   return STATUS_OK;
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ * Compact range
+ *
+ * trunk_compact_range fully compacts a key range. It flushes the memtable,
+ * then walks the range one height at a time from the root down, flushing
+ * every pivot with branches into its child, and finally compacts each leaf
+ * into a single branch. The compactions and filter builds this leads to run
+ * as usual tasks, which the caller helps perform while it waits for them.
+ *
+ * A node which cannot take a flush yet (it or its child is full) or whose
+ * leaf compactions are still in flight is waited on for at most
+ * TRUNK_COMPACT_RANGE_WAIT_NS, and then left as it is.
+ *-----------------------------------------------------------------------------
+ */
+typedef struct trunk_compact_range_req {
+   trunk_handle                   *spl;
+   key_buffer                      start_key;
+   key_buffer                      end_key;
+   trunk_compact_range_progress_fn progress;
+   void                           *arg;
+} trunk_compact_range_req;
+
+typedef enum trunk_compact_range_state {
+   TRUNK_COMPACT_RANGE_DONE,
+   TRUNK_COMPACT_RANGE_READY,
+   TRUNK_COMPACT_RANGE_BUSY,
+} trunk_compact_range_state;
+
+/*
+ * Gets everything inserted so far into the trunk, helping with the
+ * incorporation tasks while it waits.
+ */
+static void
+trunk_flush_memtables(trunk_handle *spl)
+{
+   uint64          generation;
+   platform_status rc = memtable_finalize_current(spl->mt_ctxt, &generation);
+   while (STATUS_IS_EQ(rc, STATUS_BUSY)) {
+      trunk_memtable_recycle_retired(spl);
+      task_perform_one_if_needed(spl->ts, 0);
+      rc = memtable_finalize_current(spl->mt_ctxt, &generation);
+   }
+   platform_assert_status_ok(rc);
+   uint64 wait = 1;
+   while (!memtable_generation_is_retired(spl->mt_ctxt, generation)) {
+      task_perform_one_if_needed(spl->ts, 0);
+      platform_sleep_ns(wait);
+      wait = wait > 2048 ? wait : 2 * wait;
+   }
+}
+
+static inline bool32
+trunk_pivot_in_range(trunk_handle *spl,
+                     trunk_node   *node,
+                     uint16        pivot_no,
+                     key           start_key,
+                     key           end_key)
+{
+   return trunk_key_compare(spl, trunk_get_pivot(spl, node, pivot_no), end_key)
+             < 0
+          && trunk_key_compare(
+                spl, trunk_get_pivot(spl, node, pivot_no + 1), start_key)
+                > 0;
+}
+
+/*
+ * Returns whether node has anything left to compact in [start_key, end_key):
+ * index pivots with branches, or leaf branches to merge. A leaf with bundles
+ * still being compacted is BUSY.
+ */
+static trunk_compact_range_state
+trunk_compact_range_node_state(trunk_handle *spl,
+                               trunk_node   *node,
+                               key           start_key,
+                               key           end_key)
+{
+   if (trunk_node_is_leaf(node)) {
+      if (trunk_bundle_count(spl, node) != 0) {
+         return TRUNK_COMPACT_RANGE_BUSY;
+      }
+      return trunk_branch_count(spl, node) > 1 ? TRUNK_COMPACT_RANGE_READY
+                                               : TRUNK_COMPACT_RANGE_DONE;
+   }
+   uint16 num_children = trunk_num_children(spl, node);
+   for (uint16 pivot_no = 0; pivot_no < num_children; pivot_no++) {
+      trunk_pivot_data *pdata = trunk_get_pivot_data(spl, node, pivot_no);
+      if (trunk_pivot_in_range(spl, node, pivot_no, start_key, end_key)
+          && trunk_pivot_branch_count(spl, node, pdata) != 0)
+      {
+         return TRUNK_COMPACT_RANGE_READY;
+      }
+   }
+   return TRUNK_COMPACT_RANGE_DONE;
+}
+
+/*
+ * Flushes the pivots of node in [start_key, end_key) which have branches, or
+ * compacts node if it is a leaf. Returns BUSY if there is more to wait for:
+ * pivots which could not be flushed yet, or the leaf compaction.
+ *
+ * As for trunk_compact_tombstones, a pivot is only flushed while node has
+ * room for another child and the child has room for the flush.
+ *
+ * NOTE: node must be write locked, as returned by
+ * trunk_copy_path_by_key_and_height.
+ */
+static trunk_compact_range_state
+trunk_compact_range_node(trunk_handle *spl,
+                         trunk_node   *node,
+                         key           start_key,
+                         key           end_key)
+{
+   if (trunk_node_is_leaf(node)) {
+      if (trunk_compact_range_node_state(spl, node, start_key, end_key)
+          == TRUNK_COMPACT_RANGE_READY)
+      {
+         trunk_compact_leaf(spl, node);
+         return TRUNK_COMPACT_RANGE_BUSY;
+      }
+      return trunk_compact_range_node_state(spl, node, start_key, end_key);
+   }
+
+   trunk_compact_range_state state = TRUNK_COMPACT_RANGE_DONE;
+   // flushes may split children, so the number of children is not fixed
+   for (uint16 pivot_no = 0; pivot_no < trunk_num_children(spl, node);
+        pivot_no++)
+   {
+      trunk_pivot_data *pdata = trunk_get_pivot_data(spl, node, pivot_no);
+      if (!trunk_pivot_in_range(spl, node, pivot_no, start_key, end_key)
+          || trunk_pivot_branch_count(spl, node, pdata) == 0)
+      {
+         continue;
+      }
+      if (trunk_needs_split(spl, node)) {
+         state = TRUNK_COMPACT_RANGE_BUSY;
+         continue;
+      }
+      trunk_node child;
+      trunk_node_get(spl->cc, pdata->addr, &child);
+      bool32 has_room = trunk_room_to_flush(spl, node, &child, pdata);
+      trunk_node_unget(spl->cc, &child);
+      if (!has_room) {
+         state = TRUNK_COMPACT_RANGE_BUSY;
+         continue;
+      }
+      platform_status rc = trunk_flush(spl, node, pdata, FALSE);
+      platform_assert_status_ok(rc);
+   }
+   return state;
+}
+
+/*
+ * Compacts the nodes at height covering [start_key, end_key), left to right.
+ * While a node is BUSY, performs a waiting task or else sleeps, and tries it
+ * again.
+ */
+static void
+trunk_compact_range_level(trunk_handle *spl,
+                          key           start_key,
+                          key           end_key,
+                          uint16        height)
+{
+   key_buffer      cursor;
+   platform_status rc =
+      key_buffer_init_from_key(&cursor, spl->heap_id, start_key);
+   platform_assert_status_ok(rc);
+
+   timestamp wait_start = platform_get_timestamp();
+   uint64    wait       = 1;
+   while (trunk_key_compare(spl, key_buffer_key(&cursor), end_key) < 0) {
+      // hold off trunk_clear, which could leave the tree shorter than height
+      trunk_block_clear(spl);
+      trunk_node node;
+      rc = trunk_node_get_by_key_and_height(
+         spl, key_buffer_key(&cursor), height, &node);
+      if (!SUCCESS(rc)) {
+         trunk_unblock_clear(spl);
+         break;
+      }
+      trunk_compact_range_state state =
+         trunk_compact_range_node_state(spl, &node, start_key, end_key);
+      if (state == TRUNK_COMPACT_RANGE_READY) {
+         trunk_node_unget(spl->cc, &node);
+         uint64 old_root_addr; // unused
+         trunk_copy_path_by_key_and_height(
+            spl, key_buffer_key(&cursor), height, &node, &old_root_addr);
+         state = trunk_compact_range_node(spl, &node, start_key, end_key);
+         trunk_node_unlock(spl->cc, &node);
+         trunk_node_unclaim(spl->cc, &node);
+      }
+      bool32 advance = state == TRUNK_COMPACT_RANGE_DONE
+                       || platform_timestamp_elapsed(wait_start)
+                             > TRUNK_COMPACT_RANGE_WAIT_NS;
+      if (advance) {
+         key_buffer_copy_key(&cursor, trunk_max_key(spl, &node));
+      }
+      trunk_node_unget(spl->cc, &node);
+      trunk_unblock_clear(spl);
+
+      if (advance) {
+         wait_start = platform_get_timestamp();
+         wait       = 1;
+      } else if (SUCCESS(task_perform_one(spl->ts))) {
+         wait = 1;
+      } else {
+         platform_sleep_ns(wait);
+         wait = MIN(2 * wait, 1 << 16);
+      }
+   }
+   key_buffer_deinit(&cursor);
+}
+
+static void
+trunk_compact_range_internal(trunk_compact_range_req *req)
+{
+   trunk_handle *spl       = req->spl;
+   key           start_key = key_buffer_key(&req->start_key);
+   key           end_key   = key_buffer_key(&req->end_key);
+
+   trunk_flush_memtables(spl);
+
+   trunk_node root;
+   trunk_root_get(spl, &root);
+   uint16 root_height = trunk_node_height(&root);
+   trunk_node_unget(spl->cc, &root);
+
+   // the memtable, then each height of the trunk
+   uint64 num_levels = root_height + 2;
+   if (req->progress) {
+      req->progress(1, num_levels, req->arg);
+   }
+   for (uint16 h = 0; h <= root_height; h++) {
+      uint16 height = root_height - h;
+      trunk_compact_range_level(spl, start_key, end_key, height);
+      if (req->progress) {
+         req->progress(h + 2, num_levels, req->arg);
+      }
+   }
+   trunk_default_log_if_enabled(
+      spl,
+      "compact_range: range %s-%s, height %u\n",
+      key_string(trunk_data_config(spl), start_key),
+      key_string(trunk_data_config(spl), end_key),
+      root_height);
+}
+
+static platform_status
+trunk_compact_range_req_init(trunk_compact_range_req        *req,
+                             trunk_handle                   *spl,
+                             key                             start_key,
+                             key                             end_key,
+                             trunk_compact_range_progress_fn progress,
+                             void                           *arg)
+{
+   if (spl->read_only) {
+      return STATUS_NO_PERMISSION;
+   }
+   if (trunk_key_compare(spl, start_key, end_key) >= 0) {
+      return STATUS_BAD_PARAM;
+   }
+   req->spl      = spl;
+   req->progress = progress;
+   req->arg      = arg;
+   platform_status rc =
+      key_buffer_init_from_key(&req->start_key, spl->heap_id, start_key);
+   if (!SUCCESS(rc)) {
+      return rc;
+   }
+   rc = key_buffer_init_from_key(&req->end_key, spl->heap_id, end_key);
+   if (!SUCCESS(rc)) {
+      key_buffer_deinit(&req->start_key);
+   }
+   return rc;
+}
+
+static void
+trunk_compact_range_req_deinit(trunk_compact_range_req *req)
+{
+   key_buffer_deinit(&req->start_key);
+   key_buffer_deinit(&req->end_key);
+}
+
+static void
+trunk_compact_range_task(void *arg, void *scratch)
+{
+   trunk_compact_range_req *req = arg;
+   trunk_handle            *spl = req->spl;
+   trunk_compact_range_internal(req);
+   trunk_compact_range_req_deinit(req);
+   platform_free(spl->heap_id, req);
+}
+
+/*
+ * Compacts [start_key, end_key) and returns once it is done. progress, if
+ * not NULL, is called as each level (the memtable, then each height of the
+ * trunk) is done.
+ */
+platform_status
+trunk_compact_range(trunk_handle                   *spl,
+                    key                             start_key,
+                    key                             end_key,
+                    trunk_compact_range_progress_fn progress,
+                    void                           *arg)
+{
+   trunk_compact_range_req req;
+   platform_status         rc = trunk_compact_range_req_init(
+      &req, spl, start_key, end_key, progress, arg);
+   if (!SUCCESS(rc)) {
+      return rc;
+   }
+   trunk_compact_range_internal(&req);
+   trunk_compact_range_req_deinit(&req);
+   return STATUS_OK;
+}
+
+/*
+ * As trunk_compact_range, but runs as a background task. The last call to
+ * progress, with levels_done == num_levels, reports that it is done.
+ */
+platform_status
+trunk_compact_range_async(trunk_handle                   *spl,
+                          key                             start_key,
+                          key                             end_key,
+                          trunk_compact_range_progress_fn progress,
+                          void                           *arg)
+{
+   trunk_compact_range_req *req = TYPED_ZALLOC(spl->heap_id, req);
+   if (req == NULL) {
+      return STATUS_NO_MEMORY;
+   }
+   platform_status rc = trunk_compact_range_req_init(
+      req, spl, start_key, end_key, progress, arg);
+   if (!SUCCESS(rc)) {
+      platform_free(spl->heap_id, req);
+      return rc;
+   }
+   rc = task_enqueue(spl->ts,
+                     TASK_TYPE_NORMAL,
+                     trunk_compact_range_task,
+                     req,
+                     TASK_PRIORITY_LOW);
+   if (!SUCCESS(rc)) {
+      trunk_compact_range_req_deinit(req);
+      platform_free(spl->heap_id, req);
+   }
+   return rc;
+}
+
+/*
+ *-----------------------------------------------------------------------------
+ * Checkpoints
+ *
+ * trunk_checkpoint records the current contents of the table as a new table,
+ * which trunk_mount opens as a writable clone and trunk_mount_read_only as a
+ * read-only view. Flushes update trunk nodes in place, so the nodes are
+ * copied, but the copies take references on the branches and filters they
+ * point to: every page of data is shared until one of the tables compacts it
+ * away.
+ *-----------------------------------------------------------------------------
+ */
+
+/*
+ * Makes copy, which must be newly allocated and write locked, a copy of node,
+ * taking a reference on each of its branch ranges and filters, copies the
+ * children of node likewise into pages from mini and releases copy.
+ */
+static void
+trunk_checkpoint_node(trunk_handle   *spl,
+                      mini_allocator *mini,
+                      trunk_node     *node,
+                      trunk_node     *copy)
+{
+   memmove(copy->hdr, node->hdr, trunk_page_size(&spl->cfg));
+
+   uint16 num_children = trunk_num_children(spl, copy);
+   for (uint16 pivot_no = 0; pivot_no < num_children; pivot_no++) {
+      trunk_pivot_data *pdata = trunk_get_pivot_data(spl, copy, pivot_no);
+      // the space reclamation queue belongs to the source table
+      pdata->srq_idx = -1;
+      if (pdata->filter.addr != 0) {
+         trunk_inc_filter(spl, &pdata->filter);
+      }
+      key start_key = trunk_get_pivot(spl, copy, pivot_no);
+      key end_key   = trunk_get_pivot(spl, copy, pivot_no + 1);
+      for (uint16 branch_no = pdata->start_branch;
+           branch_no != trunk_end_branch(spl, copy);
+           branch_no = trunk_add_branch_number(spl, branch_no, 1))
+      {
+         trunk_branch *branch = trunk_get_branch(spl, copy, branch_no);
+         trunk_inc_branch_range(spl, branch, start_key, end_key);
+      }
+
+      if (!trunk_node_is_leaf(copy)) {
+         trunk_node child;
+         trunk_node child_copy;
+         trunk_node_get(spl->cc, pdata->addr, &child);
+         trunk_alloc(spl->cc, mini, trunk_node_height(&child), &child_copy);
+         trunk_checkpoint_node(spl, mini, &child, &child_copy);
+         trunk_node_unget(spl->cc, &child);
+         pdata->addr = child_copy.addr;
+      }
+   }
+
+   uint16 start_filter = trunk_start_sb_filter(spl, copy);
+   uint16 end_filter   = trunk_end_sb_filter(spl, copy);
+   for (uint16 filter_no = start_filter; filter_no != end_filter;
+        filter_no        = trunk_add_subbundle_filter_number(spl, filter_no, 1))
+   {
+      routing_filter *filter = trunk_get_sb_filter(spl, copy, filter_no);
+      if (filter->addr != 0) {
+         trunk_inc_filter(spl, filter);
+      }
+   }
+
+   trunk_node_unlock(spl->cc, copy);
+   trunk_node_unclaim(spl->cc, copy);
+   trunk_node_unget(spl->cc, copy);
+}
+
+/*
+ * Compactions and filter builds pending when a checkpoint was taken belong to
+ * the source table, so the bundles they were for are still there in the
+ * checkpoint. Enqueues a compaction for each live bundle in the node at addr,
+ * which, as for a flush, goes on to build its filters. The bundle's tuples are
+ * already in the pivot counts, and are counted again for the compaction to
+ * take them out.
+ */
+static bool32
+trunk_resume_compactions(trunk_handle *spl, uint64 addr, void *arg)
+{
+   trunk_node node;
+   trunk_node_get(spl->cc, addr, &node);
+   uint16 end_bundle = trunk_end_bundle(spl, &node);
+   for (uint16 bundle_no = trunk_start_bundle(spl, &node);
+        bundle_no != end_bundle;
+        bundle_no = trunk_add_bundle_number(spl, bundle_no, 1))
+   {
+      trunk_compact_bundle_req *req = TYPED_ZALLOC(spl->heap_id, req);
+      req->spl                      = spl;
+      req->addr                     = node.addr;
+      req->height                   = trunk_node_height(&node);
+      req->bundle_no                = bundle_no;
+      req->type                     = TRUNK_COMPACTION_TYPE_FLUSH;
+      req->max_pivot_generation     = trunk_pivot_generation(spl, &node);
+      key_buffer_init_from_key(
+         &req->start_key, spl->heap_id, trunk_min_key(spl, &node));
+      key_buffer_init_from_key(
+         &req->end_key, spl->heap_id, trunk_max_key(spl, &node));
+      uint16 num_children = trunk_num_children(spl, &node);
+      for (uint16 pivot_no = 0; pivot_no < num_children; pivot_no++) {
+         trunk_pivot_data *pdata = trunk_get_pivot_data(spl, &node, pivot_no);
+         req->pivot_generation[pivot_no] = pdata->generation;
+      }
+      trunk_bundle *bundle = trunk_get_bundle(spl, &node, bundle_no);
+      trunk_tuples_in_bundle(spl,
+                             &node,
+                             bundle,
+                             req->input_pivot_tuple_count,
+                             req->input_pivot_kv_byte_count);
+      platform_status rc = trunk_compact_bundle_enqueue(spl, "resume", req);
+      platform_assert_status_ok(rc);
+   }
+   trunk_node_unget(spl->cc, &node);
+   return TRUE;
+}
+
+platform_status
+trunk_checkpoint(trunk_handle *spl, allocator_root_id checkpoint_id)
+{
+   if (checkpoint_id == INVALID_ALLOCATOR_ROOT_ID || checkpoint_id == spl->id) {
+      return STATUS_BAD_PARAM;
+   }
+   uint64          super_addr;
+   platform_status rc =
+      allocator_get_super_addr(spl->al, checkpoint_id, &super_addr);
+   if (SUCCESS(rc)) {
+      // checkpoint_id is taken
+      return STATUS_BAD_PARAM;
+   }
+   rc = allocator_alloc_super_addr(spl->al, checkpoint_id, &super_addr);
+   if (!SUCCESS(rc)) {
+      return STATUS_LIMIT_EXCEEDED;
+   }
+   uint64 root_addr;
+   rc = allocator_alloc(spl->al, &root_addr, PAGE_TYPE_TRUNK);
+   if (!SUCCESS(rc)) {
+      allocator_remove_super_addr(spl->al, checkpoint_id);
+      return rc;
+   }
+
+   trunk_flush_memtables(spl);
+
+   // set up the checkpoint's root and trunk mini allocator, as trunk_create
+   trunk_node root_copy;
+   root_copy.addr = root_addr;
+   root_copy.page = cache_alloc(spl->cc, root_addr, PAGE_TYPE_TRUNK);
+   root_copy.hdr  = (trunk_hdr *)root_copy.page->data;
+   mini_allocator mini;
+   mini_init(&mini,
+             spl->cc,
+             spl->cfg.data_cfg,
+             root_addr + trunk_page_size(&spl->cfg),
+             0,
+             TRUNK_MAX_HEIGHT,
+             PAGE_TYPE_TRUNK,
+             FALSE);
+
+   trunk_block_updates(spl);
+   trunk_node root;
+   trunk_node_get(spl->cc, spl->root_addr, &root);
+   trunk_checkpoint_node(spl, &mini, &root, &root_copy);
+   trunk_node_unget(spl->cc, &root);
+   trunk_unblock_updates(spl);
+
+   mini_release(&mini, NULL_KEY);
+
+   // the checkpoint is complete once everything it points to is on disk
+   cache_flush(spl->cc);
+   trunk_super_block super = {0};
+   super.root_addr         = root_addr;
+   super.meta_head         = mini.meta_head;
+   super.meta_tail         = mini_meta_tail(&mini);
+   super.checkpointed      = TRUE;
+   super.unmounted         = TRUE;
+   trunk_write_super_block(spl, super_addr, &super);
+
+   trunk_default_log_if_enabled(
+      spl,
+      "checkpoint %lu: root %lu, checkpoint root %lu\n",
+      checkpoint_id,
+      spl->root_addr,
+      root_addr);
+   return STATUS_OK;
+}
+
 /*
  * Destroy a database such that it cannot be re-opened later
  */
@@ -7903,7 +9851,12 @@ trunk_unmount(trunk_handle **spl_in)
    trunk_handle *spl = *spl_in;
    srq_deinit(&spl->srq);
    trunk_prepare_for_shutdown(spl);
-   trunk_set_super_block(spl, FALSE, TRUE, FALSE);
+   if (!spl->read_only) {
+      if (spl->cfg.use_cache_warmup) {
+         trunk_cache_warmup_save(spl);
+      }
+      trunk_set_super_block(spl, FALSE, TRUE, FALSE);
+   }
    if (spl->cfg.use_stats) {
       for (uint64 i = 0; i < MAX_THREADS; i++) {
          platform_histo_destroy(spl->heap_id,
@@ -8397,15 +10350,50 @@ trunk_verify_tree(trunk_handle *spl)
    return success;
 }
 
+/*
+ * Space used by each level of the tree, see trunk_print_space_use()
+ */
+typedef struct trunk_space_use {
+   uint64 bytes_used_on_level[TRUNK_MAX_HEIGHT];
+   uint64 filter_bytes_on_level[TRUNK_MAX_HEIGHT];
+   uint64 filter_bytes_saved;
+} trunk_space_use;
+
+/*
+ * Filters may be shared by several nodes, so each node is charged its share
+ */
+static void
+trunk_filter_space_use(trunk_handle    *spl,
+                       routing_filter  *filter,
+                       uint16           height,
+                       trunk_space_use *space_use)
+{
+   if (filter->addr == 0) {
+      return;
+   }
+   uint64 refs;
+   uint64 bytes_used;
+   uint64 bytes_saved;
+   mini_unkeyed_space_use(spl->cc,
+                          filter->meta_head,
+                          PAGE_TYPE_FILTER,
+                          &refs,
+                          &bytes_used,
+                          &bytes_saved);
+   platform_assert(refs != 0);
+   space_use->filter_bytes_on_level[height] += bytes_used / refs;
+   space_use->filter_bytes_saved += bytes_saved / refs;
+}
+
 /*
  * Returns the amount of space used by each level of the tree
  */
 bool32
 trunk_node_space_use(trunk_handle *spl, uint64 addr, void *arg)
 {
-   uint64    *bytes_used_on_level = (uint64 *)arg;
-   uint64     bytes_used_in_node  = 0;
-   trunk_node node;
+   trunk_space_use *space_use          = (trunk_space_use *)arg;
+   uint64           bytes_used_in_node = 0;
+   trunk_node       node;
    trunk_node_get(spl->cc, addr, &node);
    uint16 num_pivot_keys = trunk_num_pivot_keys(spl, &node);
    uint16 num_children   = trunk_num_children(spl, &node);
@@ -8442,7 +10430,20 @@ trunk_node_space_use(trunk_handle *spl, uint64 addr, void *arg)
    }
 
    uint16 height = trunk_node_height(&node);
-   bytes_used_on_level[height] += bytes_used_in_node;
+   space_use->bytes_used_on_level[height] += bytes_used_in_node;
+
+   for (uint16 pivot_no = 0; pivot_no < num_children; pivot_no++) {
+      trunk_pivot_data *pdata = trunk_get_pivot_data(spl, &node, pivot_no);
+      trunk_filter_space_use(spl, &pdata->filter, height, space_use);
+   }
+   for (uint16 filter_no = trunk_start_sb_filter(spl, &node);
+        filter_no != trunk_end_sb_filter(spl, &node);
+        filter_no = trunk_add_subbundle_filter_number(spl, filter_no, 1))
+   {
+      routing_filter *filter = trunk_get_sb_filter(spl, &node, filter_no);
+      trunk_filter_space_use(spl, filter, height, space_use);
+   }
+
    trunk_node_unget(spl->cc, &node);
    return TRUE;
 }
@@ -8450,19 +10451,27 @@ trunk_node_space_use(trunk_handle *spl, uint64 addr, void *arg)
 void
 trunk_print_space_use(platform_log_handle *log_handle, trunk_handle *spl)
 {
-   uint64 bytes_used_by_level[TRUNK_MAX_HEIGHT] = {0};
-   trunk_for_each_node(spl, trunk_node_space_use, bytes_used_by_level);
+   trunk_space_use space_use = {0};
+   trunk_for_each_node(spl, trunk_node_space_use, &space_use);
 
    platform_log(log_handle,
                 "Space used by level: trunk_tree_height=%d\n",
                 trunk_tree_height(spl));
    for (uint16 i = 0; i <= trunk_tree_height(spl); i++) {
+      uint64 bytes_used        = space_use.bytes_used_on_level[i];
+      uint64 filter_bytes_used = space_use.filter_bytes_on_level[i];
       platform_log(log_handle,
-                   "%u: %lu bytes (%s)\n",
+                   "%u: %lu bytes (%s), filters: %lu bytes (%s)\n",
                    i,
-                   bytes_used_by_level[i],
-                   size_str(bytes_used_by_level[i]));
+                   bytes_used,
+                   size_str(bytes_used),
+                   filter_bytes_used,
+                   size_str(filter_bytes_used));
    }
+   platform_log(log_handle,
+                "Saved by packing small filters: %lu bytes (%s)\n",
+                space_use.filter_bytes_saved,
+                size_str(space_use.filter_bytes_saved));
    platform_log(log_handle, "\n");
 }
 
@@ -8718,7 +10727,7 @@ trunk_print_memtable(platform_log_handle *log_handle, trunk_handle *spl)
    platform_log(log_handle, "-------------------\n{\n");
 
    uint64 mt_gen_start = memtable_generation(spl->mt_ctxt);
-   uint64 mt_gen_end   = memtable_generation_retired(spl->mt_ctxt);
+   uint64 mt_gen_end   = memtable_generation_lookup_end(spl->mt_ctxt);
    for (uint64 mt_gen = mt_gen_start; mt_gen != mt_gen_end; mt_gen--) {
       memtable *mt = trunk_get_memtable(spl, mt_gen);
       platform_log(log_handle,
@@ -8762,7 +10771,8 @@ trunk_print_super_block(platform_log_handle *log_handle, trunk_handle *spl)
 
    platform_log(log_handle, "Superblock root_addr=%lu {\n", super->root_addr);
    platform_log(log_handle,
-                "meta_tail=%lu log_addr=%lu log_meta_addr=%lu\n",
+                "meta_head=%lu meta_tail=%lu log_addr=%lu log_meta_addr=%lu\n",
+                super->meta_head,
                 super->meta_tail,
                 super->meta_tail,
                 super->log_meta_addr);
@@ -8841,6 +10851,7 @@ trunk_print_insertion_stats(platform_log_handle *log_handle, trunk_handle *spl)
          global->compactions_discarded_leaf_split[h] += spl->stats[thr_i].compactions_discarded_leaf_split[h];
          global->compactions_empty[h]                += spl->stats[thr_i].compactions_empty[h];
          global->compaction_tuples[h]                += spl->stats[thr_i].compaction_tuples[h];
+         global->compaction_tuples_filtered[h]       += spl->stats[thr_i].compaction_tuples_filtered[h];
          if (spl->stats[thr_i].compaction_max_tuples[h] > global->compaction_max_tuples[h]) {
             global->compaction_max_tuples[h] = spl->stats[thr_i].compaction_max_tuples[h];
          }
@@ -8875,6 +10886,7 @@ trunk_print_insertion_stats(platform_log_handle *log_handle, trunk_handle *spl)
          global->space_rec_time_ns[h]                += spl->stats[thr_i].space_rec_time_ns[h];
          global->space_rec_tuples_reclaimed[h]       += spl->stats[thr_i].space_rec_tuples_reclaimed[h];
          global->tuples_reclaimed[h]                 += spl->stats[thr_i].tuples_reclaimed[h];
+         global->tombstone_compactions[h]            += spl->stats[thr_i].tombstone_compactions[h];
       }
       global->insertions                  += spl->stats[thr_i].insertions;
       global->updates                     += spl->stats[thr_i].updates;
@@ -8933,6 +10945,12 @@ trunk_print_insertion_stats(platform_log_handle *log_handle, trunk_handle *spl)
    platform_log(log_handle, "| completed deletes: %10lu\n", global->discarded_deletes);
    platform_log(log_handle, "------------------------------------------------------------------------------------\n");
    platform_log(log_handle, "| root stalls:       %10lu\n", global->memtable_flush_root_full);
+   platform_log(log_handle, "| memtable stalls:   %10lu\n", spl->throttle.num_stalls);
+   platform_log(log_handle, "| stall time (ns):   %10lu\n", spl->throttle.stall_ns);
+   platform_log(log_handle, "| throttle delays:   %10lu\n", spl->throttle.num_delays);
+   platform_log(log_handle, "| delay time (ns):   %10lu\n", spl->throttle.delay_ns);
+   platform_log(log_handle, "| throttle rate B/s: %10lu\n", spl->throttle.rate);
+   platform_log(log_handle, "| compaction debt %%: %10lu\n", spl->throttle.debt_percent);
    platform_log(log_handle, "------------------------------------------------------------------------------------\n");
    platform_log(log_handle, "\n");
 
@@ -9086,6 +11104,30 @@ trunk_print_insertion_stats(platform_log_handle *log_handle, trunk_handle *spl)
             global->tuples_reclaimed[rev_h], avg_tuples_per_sr);
    }
    platform_log(log_handle, "------------------------------------------------------------------------------------\n");
+   platform_log(log_handle, "\n");
+
+   platform_log(log_handle, "Tombstone Compaction Statistics\n");
+   platform_log(log_handle, "-------------------------\n");
+   platform_log(log_handle, "| height | compactions |\n");
+   platform_log(log_handle, "|--------|-------------|\n");
+   for (h = 1; h <= height; h++) {
+      rev_h = height - h;
+      platform_log(log_handle, "| %6u | %11lu |\n",
+            rev_h, global->tombstone_compactions[rev_h]);
+   }
+   platform_log(log_handle, "-------------------------\n");
+   platform_log(log_handle, "\n");
+
+   platform_log(log_handle, "Compaction Filter Statistics\n");
+   platform_log(log_handle, "---------------------------\n");
+   platform_log(log_handle, "| height | tuples removed |\n");
+   platform_log(log_handle, "|--------|----------------|\n");
+   for (h = 1; h <= height; h++) {
+      rev_h = height - h;
+      platform_log(log_handle, "| %6u | %14lu |\n",
+            rev_h, global->compaction_tuples_filtered[rev_h]);
+   }
+   platform_log(log_handle, "---------------------------\n");
    task_print_stats(spl->ts);
    platform_log(log_handle, "\n");
    platform_log(log_handle, "------------------------------------------------------------------------------------\n");
@@ -9197,7 +11239,7 @@ trunk_print_lookup(trunk_handle        *spl,
    platform_stream_handle stream;
    platform_open_log_stream(&stream);
    uint64 mt_gen_start = memtable_generation(spl->mt_ctxt);
-   uint64 mt_gen_end   = memtable_generation_retired(spl->mt_ctxt);
+   uint64 mt_gen_end   = memtable_generation_lookup_end(spl->mt_ctxt);
    for (uint64 mt_gen = mt_gen_start; mt_gen != mt_gen_end; mt_gen--) {
       bool32 memtable_is_compacted;
       uint64 root_addr = trunk_memtable_root_addr_for_lookup(
@@ -9376,6 +11418,11 @@ trunk_reset_stats(trunk_handle *spl)
          platform_assert_status_ok(rc);
       }
    }
+
+   spl->throttle.num_delays = 0;
+   spl->throttle.delay_ns   = 0;
+   spl->throttle.num_stalls = 0;
+   spl->throttle.stall_ns   = 0;
 }
 
 void
@@ -9559,6 +11606,10 @@ trunk_config_init(trunk_config        *trunk_cfg,
    trunk_cfg->verbose_logging_enabled = verbose_logging;
    trunk_cfg->log_handle              = log_handle;
 
+   trunk_cfg->tombstone_compaction_percent =
+      TRUNK_DEFAULT_TOMBSTONE_COMPACTION_PERCENT;
+   trunk_cfg->write_throttle_percent = TRUNK_DEFAULT_WRITE_THROTTLE_PERCENT;
+
    // Inline what we would get from trunk_pivot_size(trunk_handle *).
    trunk_pivot_size = data_cfg->max_key_size + sizeof(trunk_pivot_data);
 
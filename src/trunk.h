@@ -19,6 +19,7 @@
 #include "allocator.h"
 #include "log.h"
 #include "srq.h"
+#include "epoch.h"
 
 /*
  * Max height of the Trunk Tree; Limited for convenience to allow for static
@@ -62,8 +63,12 @@ typedef struct trunk_config {
    uint64 target_leaf_kv_bytes; // make leaves this big when splitting
    uint64 reclaim_threshold;    // start reclaming space when
                                 // free space < threshold
+   uint64 tombstone_compaction_percent; // compact pivots whose whole branches
+                                        // are this % deletes and updates
    uint64 queue_scale_percent;  // Governs when inserters perform bg tasks.  See
                                 // task.h
+   uint64 write_throttle_percent; // pace inserts once compaction debt is this
+                                  // %, see trunk_write_throttle
    bool32          use_stats;   // stats
    memtable_config mt_cfg;
    btree_config    btree_cfg;
@@ -71,6 +76,7 @@ typedef struct trunk_config {
    data_config    *data_cfg;
    bool32          use_log;
    log_config     *log_cfg;
+   bool32          use_cache_warmup; // save/restore hot cache extents
 
    // verbose logging
    bool32               verbose_logging_enabled;
@@ -112,6 +118,7 @@ typedef struct trunk_stats {
    uint64 compactions_discarded_leaf_split[TRUNK_MAX_HEIGHT];
    uint64 compactions_empty[TRUNK_MAX_HEIGHT];
    uint64 compaction_tuples[TRUNK_MAX_HEIGHT];
+   uint64 compaction_tuples_filtered[TRUNK_MAX_HEIGHT];
    uint64 compaction_max_tuples[TRUNK_MAX_HEIGHT];
    uint64 compaction_time_ns[TRUNK_MAX_HEIGHT];
    uint64 compaction_time_max_ns[TRUNK_MAX_HEIGHT];
@@ -154,6 +161,8 @@ typedef struct trunk_stats {
    uint64 space_rec_time_ns[TRUNK_MAX_HEIGHT];
    uint64 space_rec_tuples_reclaimed[TRUNK_MAX_HEIGHT];
    uint64 tuples_reclaimed[TRUNK_MAX_HEIGHT];
+
+   uint64 tombstone_compactions[TRUNK_MAX_HEIGHT];
 } PLATFORM_CACHELINE_ALIGNED trunk_stats;
 
 // splinter refers to btrees as branches
@@ -175,8 +184,55 @@ typedef struct trunk_compacted_memtable {
    timestamp                 wait_start;
    trunk_memtable_args       mt_args;
    trunk_compact_bundle_req *req;
+   // see trunk_memtable_retire
+   uint64          retire_epoch;
+   volatile bool32 retire_pending;
 } trunk_compacted_memtable;
 
+/*
+ * Queue of dead branch ranges and filters whose refs are dropped in batches by
+ * a background task, off the compaction path. See trunk_reclaim_*.
+ */
+typedef struct trunk_reclaim_entry trunk_reclaim_entry;
+
+typedef struct trunk_reclaim_queue {
+   platform_spinlock    lock;
+   trunk_reclaim_entry *head;
+   uint64               num_entries;
+   bool32               drain_enqueued;
+} trunk_reclaim_queue;
+
+/*
+ * Once compaction falls behind, inserts are paced to the rate at which it
+ * keeps up, rather than left to run into full memtables and stall.
+ *
+ * Compaction debt is the larger of the share of memtables that are full and
+ * waiting to be incorporated (besides the one being filled) and the normal
+ * tasks waiting, relative to TRUNK_THROTTLE_TASKS_PER_BG_THREAD per
+ * background thread. At write_throttle_percent debt, inserts are paced to
+ * absorb_rate, and slowed linearly to 1/TRUNK_THROTTLE_MIN_RATE_DIVISOR of it
+ * as the debt reaches 100%.
+ */
+typedef struct trunk_write_throttle {
+   // memtable bytes/s that incorporation keeps up with
+   volatile uint64 absorb_rate;
+   timestamp       last_incorporation;
+   volatile uint64 debt_percent;
+   // bytes/s inserts are paced to, 0 if they are not
+   volatile uint64 rate;
+   // when the bytes inserted so far are paid for, at rate
+   volatile uint64 next_insert_ns;
+
+   // stats, kept whether or not use_stats is set
+   volatile uint64 num_delays;
+   volatile uint64 delay_ns;
+   volatile uint64 num_stalls;
+   volatile uint64 stall_ns;
+} PLATFORM_CACHELINE_ALIGNED trunk_write_throttle;
+
+// Called once a memtable frees up after trunk_try_insert found none
+typedef void (*trunk_capacity_fn)(void *arg);
+
 struct trunk_handle {
    volatile uint64       root_addr;
    uint64                super_block_idx;
@@ -192,6 +248,7 @@ struct trunk_handle {
    cache         *cc;
    log_handle    *log;
    mini_allocator mini;
+   mini_packer    filter_packer; // packs small filters into shared extents
 
    // memtables
    allocator_root_id id;
@@ -200,6 +257,9 @@ struct trunk_handle {
    // task system
    task_system *ts; // ALEX: currently not durable
 
+   // head of the cache warm-up list recorded in the super block at unmount
+   uint64 warmup_addr;
+
    // stats
    trunk_stats *stats;
 
@@ -218,6 +278,26 @@ struct trunk_handle {
    // space rec queue
    srq srq;
 
+   // incremented by each trunk_clear, see trunk_compact_bundle_req
+   uint64 clear_generation;
+
+   // mounted by trunk_mount_read_only
+   bool32 read_only;
+
+   // dead branches and filters waiting to be released
+   trunk_reclaim_queue reclaim;
+
+   trunk_write_throttle throttle;
+
+   // see trunk_set_capacity_callback
+   trunk_capacity_fn capacity_fn;
+   void             *capacity_arg;
+   volatile bool32   capacity_wanted;
+
+   // keeps memtables, branches and filters alive for lookups, see
+   // trunk_lookup_snapshot
+   epoch_domain epoch;
+
    trunk_compacted_memtable compacted_memtable[/*cfg.mt_cfg.max_memtables*/];
 };
 
@@ -295,6 +375,8 @@ typedef struct trunk_async_ctxt {
    trunk_async_state state;      // state machine's current state
    trunk_node        trunk_node; // Current trunk node
    uint16            height;     // height of trunk_node
+   uint64            root_addr;  // root to go with the memtables looked up
+   uint64            epoch;      // from epoch_enter_async
 
    uint16 sb_no;     // subbundle number (newest)
    uint16 end_sb_no; // subbundle number (oldest,
@@ -333,6 +415,26 @@ typedef struct trunk_async_ctxt {
 platform_status
 trunk_insert(trunk_handle *spl, key tuple_key, message data);
 
+/*
+ * Like trunk_insert, but never blocks or performs background tasks. Returns
+ * STATUS_BUSY, with an estimate of how long to wait before retrying in
+ * *retry_ns, if the insert would have to wait for a memtable to free up or
+ * be delayed by write throttling.
+ */
+platform_status
+trunk_try_insert(trunk_handle *spl,
+                 key           tuple_key,
+                 message       data,
+                 uint64       *retry_ns);
+
+/*
+ * Has fn(arg) called once a memtable frees up after a trunk_try_insert was
+ * refused for the want of one. It is called from whichever thread frees the
+ * memtable, so it must be quick and must not call back into the trunk.
+ */
+void
+trunk_set_capacity_callback(trunk_handle *spl, trunk_capacity_fn fn, void *arg);
+
 platform_status
 trunk_lookup(trunk_handle *spl, key target, merge_accumulator *result);
 
@@ -366,6 +468,29 @@ trunk_range(trunk_handle  *spl,
             tuple_function func,
             void          *arg);
 
+platform_status
+trunk_clear(trunk_handle *spl);
+
+typedef void (*trunk_compact_range_progress_fn)(uint64 levels_done,
+                                                uint64 num_levels,
+                                                void  *arg);
+platform_status
+trunk_compact_range(trunk_handle                   *spl,
+                    key                             start_key,
+                    key                             end_key,
+                    trunk_compact_range_progress_fn progress,
+                    void                           *arg);
+
+platform_status
+trunk_compact_range_async(trunk_handle                   *spl,
+                          key                             start_key,
+                          key                             end_key,
+                          trunk_compact_range_progress_fn progress,
+                          void                           *arg);
+
+platform_status
+trunk_checkpoint(trunk_handle *spl, allocator_root_id checkpoint_id);
+
 trunk_handle *
 trunk_create(trunk_config     *cfg,
              allocator        *al,
@@ -382,6 +507,13 @@ trunk_mount(trunk_config     *cfg,
             task_system      *ts,
             allocator_root_id id,
             platform_heap_id  hid);
+trunk_handle *
+trunk_mount_read_only(trunk_config     *cfg,
+                      allocator        *al,
+                      cache            *cc,
+                      task_system      *ts,
+                      allocator_root_id id,
+                      platform_heap_id  hid);
 void
 trunk_unmount(trunk_handle **spl);
 
@@ -134,6 +134,7 @@ config_usage()
    platform_error_log("\t--cache-debug-log\n");
    platform_error_log("\t--queue-scale-percent (%d)\n",
                       TEST_CONFIG_DEFAULT_QUEUE_SCALE_PERCENT);
+   platform_error_log("\t--write-throttle-percent\n");
    platform_error_log("\t--memtable-capacity-gib\n");
    platform_error_log("\t--memtable-capacity-mib (%d)\n",
                       TEST_CONFIG_DEFAULT_MEMTABLE_CAPACITY_MB);
@@ -147,6 +148,10 @@ config_usage()
                       TEST_CONFIG_DEFAULT_NUM_NORMAL_BG_THREADS);
    platform_error_log("\t--num-memtable-bg-threads (%d)\n",
                       TEST_CONFIG_DEFAULT_NUM_MEMTABLE_BG_THREADS);
+   platform_error_log("\t--max-normal-bg-threads (0: fixed pool)\n");
+   platform_error_log("\t--max-memtable-bg-threads (0: fixed pool)\n");
+   platform_error_log("\t--normal-bg-cpus (any; e.g. 0-3,8 or node:1)\n");
+   platform_error_log("\t--memtable-bg-cpus (any; e.g. 0-3,8 or node:1)\n");
 
    platform_error_log("\t--stats\n");
    platform_error_log("\t--no-stats\n");
@@ -283,6 +288,8 @@ config_parse(master_config *cfg, const uint8 num_config, int argc, char *argv[])
          config_set_gib("cache-capacity", cfg, cache_capacity) {}
          config_set_string("cache-debug-log", cfg, cache_logfile) {}
          config_set_uint64("queue-scale-percent", cfg, queue_scale_percent) {}
+         config_set_uint64(
+            "write-throttle-percent", cfg, write_throttle_percent) {}
          config_set_mib("memtable-capacity", cfg, memtable_capacity) {}
          config_set_gib("memtable-capacity", cfg, memtable_capacity) {}
          config_set_uint64("rough-count-height", cfg, btree_rough_count_height)
@@ -302,6 +309,12 @@ config_parse(master_config *cfg, const uint8 num_config, int argc, char *argv[])
          config_set_uint64("num-normal-bg-threads", cfg, num_normal_bg_threads);
          config_set_uint64(
             "num-memtable-bg-threads", cfg, num_memtable_bg_threads);
+         config_set_uint64(
+            "max-normal-bg-threads", cfg, max_normal_bg_threads);
+         config_set_uint64(
+            "max-memtable-bg-threads", cfg, max_memtable_bg_threads);
+         config_set_list("normal-bg-cpus", cfg, normal_bg_cpus) {}
+         config_set_list("memtable-bg-cpus", cfg, memtable_bg_cpus) {}
 
          config_has_option("stats")
          {
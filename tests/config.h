@@ -77,6 +77,10 @@ typedef struct master_config {
    // task system
    uint64 num_normal_bg_threads;   // Both bg_threads fields have to be non-zero
    uint64 num_memtable_bg_threads; // for background threads to be enabled
+   uint64 max_normal_bg_threads;   // Pools may grow to these; 0 means fixed
+   uint64 max_memtable_bg_threads;
+   char   normal_bg_cpus[MAX_STRING_LENGTH]; // "" means any CPU
+   char   memtable_bg_cpus[MAX_STRING_LENGTH];
 
    // splinter
    uint64 memtable_capacity;
@@ -85,6 +89,7 @@ typedef struct master_config {
    uint64 use_stats;
    uint64 reclaim_threshold;
    uint64 queue_scale_percent;
+   uint64 write_throttle_percent; // 0 means trunk's default
    bool   verbose_logging_enabled;
    bool   verbose_progress;
 
@@ -189,6 +194,25 @@ config_parse_use_shmem(int argc, char *argv[]);
       }                                                                        \
    }
 
+/*
+ * As config_set_string, but the argument is one value, commas and all (like
+ * a list of CPUs), for every config.
+ */
+#define config_set_list(name, var, field)                                      \
+   config_has_option(name) if (i + 1 == argc)                                  \
+   {                                                                           \
+      platform_error_log("config: failed to parse %s\n", name);                \
+      return STATUS_BAD_PARAM;                                                 \
+   }                                                                           \
+   i++;                                                                        \
+   for (uint8 _idx = 0; _idx < num_config; _idx++) {                           \
+      int _rc = snprintf(var[_idx].field, MAX_STRING_LENGTH, "%s", argv[i]);   \
+      if (_rc >= MAX_STRING_LENGTH) {                                          \
+         platform_error_log("config: %s too long\n", name);                    \
+         return STATUS_BAD_PARAM;                                              \
+      }                                                                        \
+   }
+
 #define _config_set_numerical(name, var, field, type)                          \
    config_has_option(name) if (i + 1 == argc)                                  \
    {                                                                           \
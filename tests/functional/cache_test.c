@@ -169,6 +169,36 @@ test_cache_basic(cache *cc, clockcache_config *cfg, platform_heap_id hid)
       goto exit;
    }
 
+   /*
+    * Get all entries for read in batches with cache_get_many, verify
+    * addresses and ref counts, and release.
+    */
+   for (uint32 j = 0; j < pages_allocated && SUCCESS(rc);) {
+      uint32 batch_size = MIN(cfg->page_capacity / 2, pages_allocated - j);
+      cache_get_many(cc, &addr_arr[j], batch_size, PAGE_TYPE_MISC, page_arr);
+      for (uint32 i = 0; i < batch_size; i++) {
+         if (page_arr[i]->disk_addr != addr_arr[j + i]) {
+            platform_error_log("Expected page at %lu, but found %lu\n",
+                               addr_arr[j + i],
+                               page_arr[i]->disk_addr);
+            rc = STATUS_TEST_FAILED;
+         }
+         uint32 refcount = cache_get_read_ref(cc, page_arr[i]);
+         if (refcount != 1) {
+            platform_error_log("Expected one reference, but found %u\n",
+                               refcount);
+            rc = STATUS_TEST_FAILED;
+         }
+      }
+      for (uint32 i = 0; i < batch_size; i++) {
+         cache_unget(cc, page_arr[i]);
+      }
+      j += batch_size;
+   }
+   if (!SUCCESS(rc)) {
+      goto exit;
+   }
+
    /*
     * Get all entries for read, upgrade to write, verify ref counts,
     * and release. Verify that there are no dirty entries afterwards.
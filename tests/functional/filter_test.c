@@ -69,8 +69,14 @@ test_filter_basic(cache           *cc,
 
    routing_filter filter[MAX_FILTERS] = {{0}};
    for (uint64 i = 0; i < num_values; i++) {
-      rc = routing_filter_add(
-         cc, cfg, &filter[i], &filter[i + 1], fp_arr[i], num_fingerprints, i);
+      rc = routing_filter_add(cc,
+                              cfg,
+                              NULL,
+                              &filter[i],
+                              &filter[i + 1],
+                              fp_arr[i],
+                              num_fingerprints,
+                              i);
       // platform_default_log("FILTER %lu\n", i);
       // routing_filter_print(cc, cfg, &filter);
       uint32 estimated_input_keys =
@@ -185,6 +191,7 @@ test_filter_perf(cache           *cc,
             k * num_fingerprints * num_values + i * num_fingerprints;
          platform_status rc = routing_filter_add(cc,
                                                  cfg,
+                                                 NULL,
                                                  &filter[k],
                                                  &new_filter,
                                                  &fp_arr[fp_start],
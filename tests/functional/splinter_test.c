@@ -2749,7 +2749,7 @@ splinter_test(int argc, char *argv[])
       MAX(num_lookup_threads, MAX(num_insert_threads, num_pthreads));
 
    for (task_type type = 0; type != NUM_TASK_TYPES; type++) {
-      total_threads += task_cfg.num_background_threads[type];
+      total_threads += task_cfg.max_background_threads[type];
    }
    // Check if IO subsystem has enough reqs for max async IOs inflight
    if (io_cfg.async_queue_size < total_threads * max_async_inflight) {
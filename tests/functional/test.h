@@ -248,6 +248,16 @@ test_config_init(trunk_config           *splinter_cfg,  // OUT
                                                 num_bg_threads,
                                                 trunk_get_scratch_size());
    platform_assert_status_ok(rc);
+   task_cfg->max_background_threads[TASK_TYPE_NORMAL] =
+      MAX(master_cfg->num_normal_bg_threads, master_cfg->max_normal_bg_threads);
+   task_cfg->max_background_threads[TASK_TYPE_MEMTABLE] = MAX(
+      master_cfg->num_memtable_bg_threads, master_cfg->max_memtable_bg_threads);
+   rc = platform_cpu_set_parse(master_cfg->normal_bg_cpus,
+                               &task_cfg->background_cpus[TASK_TYPE_NORMAL]);
+   platform_assert_status_ok(rc);
+   rc = platform_cpu_set_parse(master_cfg->memtable_bg_cpus,
+                               &task_cfg->background_cpus[TASK_TYPE_MEMTABLE]);
+   platform_assert_status_ok(rc);
 
    rc = trunk_config_init(splinter_cfg,
                           &cache_cfg->super,
@@ -268,6 +278,9 @@ test_config_init(trunk_config           *splinter_cfg,  // OUT
    if (!SUCCESS(rc)) {
       return rc;
    }
+   if (master_cfg->write_throttle_percent) {
+      splinter_cfg->write_throttle_percent = master_cfg->write_throttle_percent;
+   }
 
    gen->type             = MESSAGE_TYPE_INSERT;
    gen->min_payload_size = GENERATOR_MIN_PAYLOAD_SIZE;
@@ -307,6 +307,176 @@ CTEST2(btree_stress, test_random_inserts_concurrent)
    platform_free(hid, threads);
 }
 
+/*
+ * -------------------------------------------------------------------------
+ * Packing a tree counts the deletes and updates that go into it.
+ */
+CTEST2(btree_stress, test_pack_counts_deletes_and_updates)
+{
+   int           nkvs = 100000;
+   cache        *cc   = (cache *)&data->cc;
+   btree_config *cfg  = &data->dbtree_cfg;
+
+   mini_allocator mini;
+   uint64         root_addr = btree_create(cc, cfg, &mini, PAGE_TYPE_MEMTABLE);
+
+   uint64 bt_page_size = btree_page_size(cfg);
+   uint8 *keybuf       = TYPED_MANUAL_MALLOC(data->hid, keybuf, bt_page_size);
+   uint8 *msgbuf       = TYPED_MANUAL_MALLOC(data->hid, msgbuf, bt_page_size);
+
+   // a quarter of the tuples are deletes and another quarter updates
+   for (uint64 i = 0; i < nkvs; i++) {
+      message msg = gen_msg(cfg, i, msgbuf, bt_page_size);
+      if (i % 4 == 0) {
+         msg = DELETE_MESSAGE;
+      } else if (i % 4 == 1) {
+         msg = message_create(MESSAGE_TYPE_UPDATE, message_slice(msg));
+      }
+      uint64 generation;
+      bool32 was_unique;
+      platform_status rc = btree_insert(cc,
+                                        cfg,
+                                        data->hid,
+                                        &data->test_scratch,
+                                        root_addr,
+                                        &mini,
+                                        gen_key(cfg, i, keybuf, bt_page_size),
+                                        msg,
+                                        &generation,
+                                        &was_unique);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+
+   btree_iterator dbiter;
+   btree_iterator_init(cc,
+                       cfg,
+                       &dbiter,
+                       root_addr,
+                       PAGE_TYPE_MEMTABLE,
+                       NEGATIVE_INFINITY_KEY,
+                       POSITIVE_INFINITY_KEY,
+                       NEGATIVE_INFINITY_KEY,
+                       greater_than_or_equal,
+                       FALSE,
+                       0);
+
+   btree_pack_req  req;
+   platform_status rc = btree_pack_req_init(
+      &req, cc, cfg, &dbiter.super, nkvs, NULL, 0, data->hid);
+   ASSERT_TRUE(SUCCESS(rc));
+   rc = btree_pack(&req);
+   ASSERT_TRUE(SUCCESS(rc));
+
+   ASSERT_EQUAL(nkvs, req.num_tuples);
+   ASSERT_EQUAL(nkvs / 4, req.num_tombstones);
+   ASSERT_EQUAL(nkvs / 4, req.num_updates);
+
+   btree_pack_req_deinit(&req, data->hid);
+   btree_iterator_deinit(&dbiter);
+   platform_free(data->hid, keybuf);
+   platform_free(data->hid, msgbuf);
+}
+
+/*
+ * A compaction filter which removes every third key.
+ */
+static int
+drop_every_third_key(const data_config *cfg,
+                     slice              key_slice,
+                     merge_accumulator *msg)
+{
+   if (ungen_key(key_create_from_slice(key_slice)) % 3 == 0) {
+      merge_accumulator_set_class(msg, MESSAGE_TYPE_DELETE);
+   }
+   return 0;
+}
+
+/*
+ * -------------------------------------------------------------------------
+ * Packing a tree applies the compaction filter and drops expired inserts,
+ * leaving deletes in their place unless deletes can be discarded.
+ */
+CTEST2(btree_stress, test_pack_filters_and_expires_tuples)
+{
+   int           nkvs = 30000;
+   cache        *cc   = (cache *)&data->cc;
+   btree_config *cfg  = &data->dbtree_cfg;
+
+   mini_allocator mini;
+   uint64         root_addr = btree_create(cc, cfg, &mini, PAGE_TYPE_MEMTABLE);
+
+   uint64 bt_page_size = btree_page_size(cfg);
+   uint8 *keybuf       = TYPED_MANUAL_MALLOC(data->hid, keybuf, bt_page_size);
+
+   // of the keys the filter keeps, every other one has expired
+   for (uint64 i = 0; i < nkvs; i++) {
+      struct {
+         message_expiry_header hdr;
+         uint64                i;
+      } value              = {.i = i};
+      value.hdr.expires_at = i % 3 == 1 ? 1 : 0;
+      message msg          = message_create(MESSAGE_TYPE_INSERT,
+                                   slice_create(sizeof(value), &value));
+      uint64  generation;
+      bool32  was_unique;
+      platform_status rc = btree_insert(cc,
+                                        cfg,
+                                        data->hid,
+                                        &data->test_scratch,
+                                        root_addr,
+                                        &mini,
+                                        gen_key(cfg, i, keybuf, bt_page_size),
+                                        msg,
+                                        &generation,
+                                        &was_unique);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+
+   data_config *data_cfg        = cfg->data_cfg;
+   data_config  filter_cfg      = *data_cfg;
+   filter_cfg.compaction_filter = drop_every_third_key;
+   filter_cfg.message_expiry    = TRUE;
+   cfg->data_cfg                = &filter_cfg;
+
+   for (int discard_deletes = 0; discard_deletes < 2; discard_deletes++) {
+      btree_iterator dbiter;
+      btree_iterator_init(cc,
+                          cfg,
+                          &dbiter,
+                          root_addr,
+                          PAGE_TYPE_MEMTABLE,
+                          NEGATIVE_INFINITY_KEY,
+                          POSITIVE_INFINITY_KEY,
+                          NEGATIVE_INFINITY_KEY,
+                          greater_than_or_equal,
+                          FALSE,
+                          0);
+
+      btree_pack_req  req;
+      platform_status rc = btree_pack_req_init(
+         &req, cc, cfg, &dbiter.super, nkvs, NULL, 0, data->hid);
+      ASSERT_TRUE(SUCCESS(rc));
+      req.discard_deletes = discard_deletes;
+      rc                  = btree_pack(&req);
+      ASSERT_TRUE(SUCCESS(rc));
+
+      ASSERT_EQUAL(2 * nkvs / 3, req.num_filtered);
+      if (discard_deletes) {
+         ASSERT_EQUAL(nkvs / 3, req.num_tuples);
+         ASSERT_EQUAL(0, req.num_tombstones);
+      } else {
+         ASSERT_EQUAL(nkvs, req.num_tuples);
+         ASSERT_EQUAL(2 * nkvs / 3, req.num_tombstones);
+      }
+
+      btree_pack_req_deinit(&req, data->hid);
+      btree_iterator_deinit(&dbiter);
+   }
+
+   cfg->data_cfg = data_cfg;
+   platform_free(data->hid, keybuf);
+}
+
 /*
  * ********************************************************************************
  * Define minions and helper functions used by this test suite.
@@ -0,0 +1,181 @@
+// Copyright 2023 VMware, Inc.
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * -----------------------------------------------------------------------------
+ * clockcache_test.c --
+ *
+ *  Exercises optimistic page reads in clockcache.c: which writes and
+ *  evictions fail them, and when they are not attempted at all.
+ * -----------------------------------------------------------------------------
+ */
+#include "ctest.h" // This is required for all test-case files.
+#include "platform.h"
+#include "config.h"
+#include "io.h"
+#include "rc_allocator.h"
+#include "clockcache.h"
+#include "unit_tests.h"
+#include <fcntl.h>
+
+#define TEST_EXTENT_CAPACITY (100)
+#define TEST_CACHE_CAPACITY  (64 * MiB)
+
+/*
+ * Global data declaration macro:
+ */
+CTEST_DATA(clockcache)
+{
+   io_config          io_cfg;
+   allocator_config   allocator_cfg;
+   clockcache_config  cache_cfg;
+   platform_heap_id   hid;
+   platform_io_handle io;
+   rc_allocator       al;
+   clockcache         cc;
+   uint64             extent_addr;
+};
+
+CTEST_SETUP(clockcache)
+{
+   set_log_streams_for_tests(MSG_LEVEL_ERRORS);
+   // the cache needs a thread id, and there is no task system to assign one
+   platform_set_tid(0);
+
+   bool use_shmem = config_parse_use_shmem(Ctest_argc, (char **)Ctest_argv);
+   platform_status rc = platform_heap_create(
+      platform_get_module_id(), 256 * MiB, use_shmem, &data->hid);
+   platform_assert_status_ok(rc);
+
+   io_config_init(&data->io_cfg,
+                  LAIO_DEFAULT_PAGE_SIZE,
+                  LAIO_DEFAULT_EXTENT_SIZE,
+                  O_RDWR | O_CREAT,
+                  0755,
+                  256,
+                  "clockcache_test.db");
+   allocator_config_init(&data->allocator_cfg,
+                         &data->io_cfg,
+                         TEST_EXTENT_CAPACITY * LAIO_DEFAULT_EXTENT_SIZE);
+   clockcache_config_init(
+      &data->cache_cfg, &data->io_cfg, TEST_CACHE_CAPACITY, "", FALSE);
+
+   if (!SUCCESS(io_handle_init(&data->io, &data->io_cfg, data->hid))
+       || !SUCCESS(rc_allocator_init(&data->al,
+                                     &data->allocator_cfg,
+                                     (io_handle *)&data->io,
+                                     data->hid,
+                                     platform_get_module_id()))
+       || !SUCCESS(clockcache_init(&data->cc,
+                                   &data->cache_cfg,
+                                   (io_handle *)&data->io,
+                                   (allocator *)&data->al,
+                                   "test",
+                                   data->hid,
+                                   platform_get_module_id())))
+   {
+      ASSERT_TRUE(FALSE, "Failed to init io or rc_allocator or clockcache\n");
+   }
+
+   rc = allocator_alloc(
+      (allocator *)&data->al, &data->extent_addr, PAGE_TYPE_MISC);
+   platform_assert_status_ok(rc);
+}
+
+CTEST_TEARDOWN(clockcache)
+{
+   cache     *cc = (cache *)&data->cc;
+   allocator *al = (allocator *)&data->al;
+   allocator_dec_ref(al, data->extent_addr, PAGE_TYPE_MISC);
+   cache_extent_discard(cc, data->extent_addr, PAGE_TYPE_MISC);
+   allocator_dec_ref(al, data->extent_addr, PAGE_TYPE_MISC);
+
+   clockcache_deinit(&data->cc);
+   rc_allocator_deinit(&data->al);
+   io_handle_deinit(&data->io);
+   platform_heap_destroy(&data->hid);
+   platform_set_tid(INVALID_TID);
+}
+
+/*
+ * Allocates the page at addr, fills it with value and releases it.
+ */
+static void
+write_page(cache *cc, uint64 addr, char value)
+{
+   page_handle *page = cache_alloc(cc, addr, PAGE_TYPE_MISC);
+   memset(page->data, value, cache_page_size(cc));
+   cache_unlock(cc, page);
+   cache_unclaim(cc, page);
+   cache_unget(cc, page);
+}
+
+/*
+ * A read validates unless the page was written in between, even if the
+ * write is over by the time of the validation.
+ */
+CTEST2(clockcache, test_optimistic_read_fails_on_write)
+{
+   cache *cc   = (cache *)&data->cc;
+   uint64 addr = data->extent_addr;
+   write_page(cc, addr, 1);
+
+   uint64       version;
+   page_handle *read =
+      cache_get_optimistic(cc, addr, PAGE_TYPE_MISC, &version);
+   ASSERT_TRUE(read != NULL);
+   ASSERT_EQUAL(1, read->data[0]);
+   ASSERT_TRUE(cache_validate_optimistic(cc, read, version));
+
+   // read locks do not get in the way
+   page_handle *page = cache_get(cc, addr, TRUE, PAGE_TYPE_MISC);
+   ASSERT_TRUE(page == read);
+   ASSERT_TRUE(cache_validate_optimistic(cc, read, version));
+
+   ASSERT_TRUE(cache_try_claim(cc, page));
+   cache_lock(cc, page);
+   ASSERT_FALSE(cache_validate_optimistic(cc, read, version));
+   uint64 locked_version;
+   ASSERT_TRUE(
+      cache_get_optimistic(cc, addr, PAGE_TYPE_MISC, &locked_version) == NULL);
+   page->data[0] = 2;
+   cache_unlock(cc, page);
+   cache_unclaim(cc, page);
+   cache_unget(cc, page);
+   ASSERT_FALSE(cache_validate_optimistic(cc, read, version));
+
+   read = cache_get_optimistic(cc, addr, PAGE_TYPE_MISC, &version);
+   ASSERT_TRUE(read != NULL);
+   ASSERT_EQUAL(2, read->data[0]);
+   ASSERT_TRUE(cache_validate_optimistic(cc, read, version));
+}
+
+/*
+ * A read fails once the page is evicted, and is not attempted on pages that
+ * are not cached, which optimistic reads never load.
+ */
+CTEST2(clockcache, test_optimistic_read_fails_on_eviction)
+{
+   cache *cc   = (cache *)&data->cc;
+   uint64 addr = data->extent_addr;
+   write_page(cc, addr, 1);
+
+   uint64       version;
+   page_handle *read =
+      cache_get_optimistic(cc, addr, PAGE_TYPE_MISC, &version);
+   ASSERT_TRUE(read != NULL);
+
+   cache_flush(cc);
+   cache_evict(cc, FALSE);
+   ASSERT_FALSE(cache_validate_optimistic(cc, read, version));
+   ASSERT_TRUE(cache_get_optimistic(cc, addr, PAGE_TYPE_MISC, &version)
+               == NULL);
+
+   page_handle *page = cache_get(cc, addr, TRUE, PAGE_TYPE_MISC);
+   ASSERT_EQUAL(1, page->data[0]);
+   cache_unget(cc, page);
+   read = cache_get_optimistic(cc, addr, PAGE_TYPE_MISC, &version);
+   ASSERT_TRUE(read != NULL);
+   ASSERT_EQUAL(1, read->data[0]);
+   ASSERT_TRUE(cache_validate_optimistic(cc, read, version));
+}
@@ -0,0 +1,109 @@
+// Copyright 2023 VMware, Inc.
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * -----------------------------------------------------------------------------
+ * epoch_test.c --
+ *
+ *  Check which retired tags epoch_is_safe lets through, for plain and async
+ *  read sections.
+ * -----------------------------------------------------------------------------
+ */
+#include "platform.h"
+#include "epoch.h"
+#include "ctest.h" // This is required for all test-case files.
+
+/*
+ * Global data declaration macro:
+ */
+CTEST_DATA(epoch)
+{
+   epoch_domain *domain;
+};
+
+CTEST_SETUP(epoch)
+{
+   // read sections are announced in the slot of the thread id
+   platform_set_tid(0);
+   data->domain = TYPED_ZALLOC(platform_get_heap_id(), data->domain);
+   ASSERT_TRUE(data->domain != NULL);
+   epoch_domain_init(data->domain);
+}
+
+CTEST_TEARDOWN(epoch)
+{
+   platform_free(platform_get_heap_id(), data->domain);
+   platform_set_tid(INVALID_TID);
+}
+
+/*
+ * A tag stays unsafe until the readers in when it was retired leave, however
+ * deeply they nested.
+ */
+CTEST2(epoch, test_retired_waits_for_readers)
+{
+   uint64 tag = epoch_retire(data->domain);
+   ASSERT_TRUE(epoch_is_safe(data->domain, tag, TRUE));
+
+   epoch_enter(data->domain);
+   epoch_enter(data->domain);
+   tag = epoch_retire(data->domain);
+   ASSERT_FALSE(epoch_is_safe(data->domain, tag, FALSE));
+
+   epoch_exit(data->domain);
+   ASSERT_FALSE(epoch_is_safe(data->domain, tag, FALSE));
+
+   epoch_exit(data->domain);
+   ASSERT_TRUE(epoch_is_safe(data->domain, tag, FALSE));
+}
+
+/*
+ * Readers that enter once the epoch has moved past a tag do not hold it back.
+ */
+CTEST2(epoch, test_later_readers_do_not_hold_back)
+{
+   uint64 tag = epoch_retire(data->domain);
+   epoch_safe_bound(data->domain, TRUE);
+
+   epoch_enter(data->domain);
+   ASSERT_TRUE(epoch_is_safe(data->domain, tag, FALSE));
+   uint64 token = epoch_enter_async(data->domain);
+   ASSERT_TRUE(epoch_is_safe(data->domain, tag, TRUE));
+   epoch_exit_async(data->domain, token);
+   epoch_exit(data->domain);
+}
+
+/*
+ * Async read sections hold back only the reclamations that include them.
+ */
+CTEST2(epoch, test_async_readers)
+{
+   uint64 token = epoch_enter_async(data->domain);
+   uint64 tag   = epoch_retire(data->domain);
+   ASSERT_TRUE(epoch_is_safe(data->domain, tag, FALSE));
+   ASSERT_FALSE(epoch_is_safe(data->domain, tag, TRUE));
+
+   epoch_exit_async(data->domain, token);
+   ASSERT_TRUE(epoch_is_safe(data->domain, tag, TRUE));
+}
+
+/*
+ * A thread that always has an async lookup in flight still lets tags become
+ * safe once the lookups started before them are done.
+ */
+CTEST2(epoch, test_overlapping_async_readers_make_progress)
+{
+   uint64 token = epoch_enter_async(data->domain);
+   for (uint64 i = 0; i < 100; i++) {
+      uint64 tag = epoch_retire(data->domain);
+      ASSERT_FALSE(epoch_is_safe(data->domain, tag, TRUE));
+
+      uint64 next_token = epoch_enter_async(data->domain);
+      ASSERT_FALSE(epoch_is_safe(data->domain, tag, TRUE));
+
+      epoch_exit_async(data->domain, token);
+      ASSERT_TRUE(epoch_is_safe(data->domain, tag, TRUE));
+      token = next_token;
+   }
+   epoch_exit_async(data->domain, token);
+}
@@ -0,0 +1,140 @@
+// Copyright 2023 VMware, Inc.
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * -----------------------------------------------------------------------------
+ * laio_test.c --
+ *
+ *  Exercises IO scheduling in laio.c: the limit on background IO, and its
+ *  adaptive scaling by foreground read latency.
+ * -----------------------------------------------------------------------------
+ */
+#include "ctest.h" // This is required for all test-case files.
+#include "platform.h"
+#include "config.h"
+#include "io.h"
+#include "unit_tests.h"
+#include <fcntl.h>
+
+#define TEST_BG_RATE   (MiB)
+#define TEST_NUM_PAGES (2 * TEST_BG_RATE / LAIO_DEFAULT_PAGE_SIZE)
+
+/*
+ * Global data declaration macro:
+ */
+CTEST_DATA(laio)
+{
+   io_config          io_cfg;
+   platform_heap_id   hid;
+   platform_io_handle io;
+   char               page[LAIO_DEFAULT_PAGE_SIZE];
+};
+
+CTEST_SETUP(laio)
+{
+   set_log_streams_for_tests(MSG_LEVEL_ERRORS);
+   // IO classes are kept per thread id
+   platform_set_tid(0);
+
+   bool use_shmem = config_parse_use_shmem(Ctest_argc, (char **)Ctest_argv);
+   platform_status rc = platform_heap_create(
+      platform_get_module_id(), 256 * MiB, use_shmem, &data->hid);
+   platform_assert_status_ok(rc);
+
+   io_config_init(&data->io_cfg,
+                  LAIO_DEFAULT_PAGE_SIZE,
+                  LAIO_DEFAULT_EXTENT_SIZE,
+                  O_RDWR | O_CREAT,
+                  0755,
+                  256,
+                  "laio_test.db");
+   data->io_cfg.bg_max_bytes_per_sec = TEST_BG_RATE;
+}
+
+CTEST_TEARDOWN(laio)
+{
+   platform_heap_destroy(&data->hid);
+   platform_set_tid(INVALID_TID);
+}
+
+/*
+ * Background writes are held to the configured rate, once the bucket's
+ * initial second's worth is spent. Foreground writes are not held back.
+ */
+CTEST2(laio, test_bg_writes_are_rate_limited)
+{
+   platform_status rc = io_handle_init(&data->io, &data->io_cfg, data->hid);
+   ASSERT_TRUE(SUCCESS(rc));
+   io_handle *ioh = (io_handle *)&data->io;
+
+   for (uint64 i = 0; i < TEST_NUM_PAGES; i++) {
+      rc = io_write(
+         ioh, data->page, sizeof(data->page), i * sizeof(data->page));
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+   ASSERT_EQUAL(0, data->io.bg_bytes);
+   ASSERT_EQUAL(0, data->io.bg_throttled_ns);
+
+   ASSERT_EQUAL(IO_CLASS_FOREGROUND, io_set_class(ioh, IO_CLASS_BACKGROUND));
+   timestamp start = platform_get_timestamp();
+   for (uint64 i = 0; i < TEST_NUM_PAGES; i++) {
+      rc = io_write(
+         ioh, data->page, sizeof(data->page), i * sizeof(data->page));
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+   uint64 elapsed_ns = platform_timestamp_elapsed(start);
+   ASSERT_EQUAL(IO_CLASS_BACKGROUND, io_set_class(ioh, IO_CLASS_FOREGROUND));
+
+   ASSERT_EQUAL(TEST_NUM_PAGES * sizeof(data->page), data->io.bg_bytes);
+   // 2 seconds' worth of writes, less the bucket's initial second
+   ASSERT_TRUE(elapsed_ns >= SEC_TO_NSEC(1) * 9 / 10,
+               "elapsed_ns=%lu",
+               elapsed_ns);
+   ASSERT_TRUE(data->io.bg_throttled_ns > 0);
+
+   io_handle_deinit(&data->io);
+}
+
+/*
+ * Foreground reads slower than the latency target scale the background rate
+ * down, as far as its floor.
+ */
+CTEST2(laio, test_adaptive_bg_rate)
+{
+   data->io_cfg.fg_read_latency_target_ns = 1;
+   platform_status rc = io_handle_init(&data->io, &data->io_cfg, data->hid);
+   ASSERT_TRUE(SUCCESS(rc));
+   io_handle *ioh = (io_handle *)&data->io;
+
+   rc = io_write(ioh, data->page, sizeof(data->page), 0);
+   ASSERT_TRUE(SUCCESS(rc));
+   ASSERT_EQUAL(TEST_BG_RATE, laio_bg_rate(&data->io));
+
+   rc = io_read(ioh, data->page, sizeof(data->page), 0);
+   ASSERT_TRUE(SUCCESS(rc));
+   ASSERT_EQUAL(1, data->io.fg_reads);
+   ASSERT_EQUAL(TEST_BG_RATE / LAIO_BG_MIN_RATE_DIVISOR,
+                laio_bg_rate(&data->io));
+
+   // Background reads are not timed
+   io_set_class(ioh, IO_CLASS_BACKGROUND);
+   rc = io_read(ioh, data->page, sizeof(data->page), 0);
+   ASSERT_TRUE(SUCCESS(rc));
+   io_set_class(ioh, IO_CLASS_FOREGROUND);
+   ASSERT_EQUAL(1, data->io.fg_reads);
+
+   io_handle_deinit(&data->io);
+}
+
+/*
+ * The adaptive mode scales the background limit, so it needs one.
+ */
+CTEST2(laio, test_latency_target_requires_bg_limit)
+{
+   data->io_cfg.fg_read_latency_target_ns = USEC_TO_NSEC(100);
+   data->io_cfg.bg_max_bytes_per_sec      = 0;
+   ASSERT_FALSE(SUCCESS(laio_config_valid(&data->io_cfg)));
+
+   data->io_cfg.fg_read_latency_target_ns = 0;
+   ASSERT_TRUE(SUCCESS(laio_config_valid(&data->io_cfg)));
+}
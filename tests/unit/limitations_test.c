@@ -257,6 +257,13 @@ CTEST2(limitations, test_splinterdb_create_invalid_task_system_config)
 
    int rc = splinterdb_create(&cfg, &kvsb);
    ASSERT_NOT_EQUAL(0, rc);
+
+   // Nor confine them to CPUs that can't be parsed
+   cfg.num_normal_bg_threads   = 1;
+   cfg.num_memtable_bg_threads = 1;
+   cfg.normal_bg_cpus          = "0-";
+   rc                          = splinterdb_create(&cfg, &kvsb);
+   ASSERT_NOT_EQUAL(0, rc);
 }
 
 /*
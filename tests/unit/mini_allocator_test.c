@@ -0,0 +1,254 @@
+// Copyright 2023 VMware, Inc.
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * -----------------------------------------------------------------------------
+ * mini_allocator_test.c --
+ *
+ *  Exercises packed mini allocators in mini_allocator.c: small objects
+ *  sharing extents through a mini_packer, their ref counts and the release
+ *  of shared extents once every page in them is freed.
+ * -----------------------------------------------------------------------------
+ */
+#include "ctest.h" // This is required for all test-case files.
+#include "platform.h"
+#include "config.h"
+#include "io.h"
+#include "rc_allocator.h"
+#include "clockcache.h"
+#include "mini_allocator.h"
+#include "unit_tests.h"
+#include <fcntl.h>
+
+#define TEST_EXTENT_CAPACITY  (1000)
+#define TEST_CACHE_CAPACITY   (64 * MiB)
+#define TEST_NUM_OBJECTS      (16)
+#define TEST_PAGES_PER_OBJECT (4)
+
+/*
+ * Global data declaration macro:
+ */
+CTEST_DATA(mini_allocator)
+{
+   io_config          io_cfg;
+   allocator_config   allocator_cfg;
+   clockcache_config  cache_cfg;
+   platform_heap_id   hid;
+   platform_io_handle io;
+   rc_allocator       al;
+   clockcache         cc;
+   mini_packer        packer;
+};
+
+CTEST_SETUP(mini_allocator)
+{
+   set_log_streams_for_tests(MSG_LEVEL_ERRORS);
+   // the cache needs a thread id, and there is no task system to assign one
+   platform_set_tid(0);
+
+   bool use_shmem = config_parse_use_shmem(Ctest_argc, (char **)Ctest_argv);
+   platform_status rc = platform_heap_create(
+      platform_get_module_id(), 256 * MiB, use_shmem, &data->hid);
+   platform_assert_status_ok(rc);
+
+   io_config_init(&data->io_cfg,
+                  LAIO_DEFAULT_PAGE_SIZE,
+                  LAIO_DEFAULT_EXTENT_SIZE,
+                  O_RDWR | O_CREAT,
+                  0755,
+                  256,
+                  "mini_allocator_test.db");
+   allocator_config_init(&data->allocator_cfg,
+                         &data->io_cfg,
+                         TEST_EXTENT_CAPACITY * LAIO_DEFAULT_EXTENT_SIZE);
+   clockcache_config_init(
+      &data->cache_cfg, &data->io_cfg, TEST_CACHE_CAPACITY, "", FALSE);
+
+   if (!SUCCESS(io_handle_init(&data->io, &data->io_cfg, data->hid))
+       || !SUCCESS(rc_allocator_init(&data->al,
+                                     &data->allocator_cfg,
+                                     (io_handle *)&data->io,
+                                     data->hid,
+                                     platform_get_module_id()))
+       || !SUCCESS(clockcache_init(&data->cc,
+                                   &data->cache_cfg,
+                                   (io_handle *)&data->io,
+                                   (allocator *)&data->al,
+                                   "test",
+                                   data->hid,
+                                   platform_get_module_id())))
+   {
+      ASSERT_TRUE(FALSE, "Failed to init io or rc_allocator or clockcache\n");
+   }
+
+   mini_packer_init(
+      &data->packer, (cache *)&data->cc, PAGE_TYPE_FILTER, data->hid);
+}
+
+CTEST_TEARDOWN(mini_allocator)
+{
+   clockcache_deinit(&data->cc);
+   rc_allocator_deinit(&data->al);
+   io_handle_deinit(&data->io);
+   platform_heap_destroy(&data->hid);
+   platform_set_tid(INVALID_TID);
+}
+
+/*
+ * Builds a packed mini allocator with a run of num_pages - 1 pages after its
+ * meta_head, and returns its meta_head.
+ */
+static uint64
+build_packed_object(mini_packer *packer, uint64 num_pages, uint64 *run_addr)
+{
+   mini_allocator mini;
+   uint64         meta_head = mini_init_packed(&mini, packer);
+   *run_addr                = mini_alloc_pages(&mini, num_pages - 1);
+   mini_release(&mini, NULL_KEY);
+   return meta_head;
+}
+
+/*
+ * Small objects share extents, and the extents are freed once every object
+ * in them is gone and the packer has moved on.
+ */
+CTEST2(mini_allocator, test_packed_objects_share_extents)
+{
+   cache     *cc               = (cache *)&data->cc;
+   allocator *al               = (allocator *)&data->al;
+   uint64     pages_per_extent = cache_pages_per_extent(cc);
+   uint64     in_use           = allocator_in_use(al);
+
+   uint64 meta_head[TEST_NUM_OBJECTS];
+   uint64 run_addr[TEST_NUM_OBJECTS];
+   for (uint64 i = 0; i < TEST_NUM_OBJECTS; i++) {
+      meta_head[i] = build_packed_object(
+         &data->packer, TEST_PAGES_PER_OBJECT, &run_addr[i]);
+      // runs never straddle extents
+      uint64 last_addr =
+         run_addr[i] + (TEST_PAGES_PER_OBJECT - 2) * cache_page_size(cc);
+      ASSERT_TRUE(allocator_config_pages_share_extent(
+         allocator_get_config(al), run_addr[i], last_addr));
+   }
+
+   uint64 num_extents =
+      (TEST_NUM_OBJECTS * TEST_PAGES_PER_OBJECT + pages_per_extent - 1)
+      / pages_per_extent;
+   ASSERT_EQUAL(in_use + num_extents, allocator_in_use(al));
+
+   // An extra ref keeps an object's pages, and so its extent, alive
+   ASSERT_EQUAL(2, mini_unkeyed_inc_ref(cc, meta_head[0], PAGE_TYPE_FILTER));
+   for (uint64 i = 0; i < TEST_NUM_OBJECTS; i++) {
+      uint8 refs = i == 0 ? 1 : 0;
+      ASSERT_EQUAL(refs,
+                   mini_unkeyed_dec_ref(
+                      cc, meta_head[i], PAGE_TYPE_FILTER, FALSE));
+   }
+   ASSERT_EQUAL(in_use + 2, allocator_in_use(al));
+
+   ASSERT_EQUAL(
+      0, mini_unkeyed_dec_ref(cc, meta_head[0], PAGE_TYPE_FILTER, FALSE));
+   ASSERT_EQUAL(in_use + 1, allocator_in_use(al));
+
+   // The packer still holds its open extent until it is closed
+   mini_packer_deinit(&data->packer);
+   ASSERT_EQUAL(in_use, allocator_in_use(al));
+}
+
+/*
+ * An object with more pages than fit in one meta_page spills into more
+ * packed meta_pages, which are freed along with it.
+ */
+CTEST2(mini_allocator, test_packed_object_spills_meta_pages)
+{
+   cache     *cc               = (cache *)&data->cc;
+   allocator *al               = (allocator *)&data->al;
+   uint64     pages_per_extent = cache_pages_per_extent(cc);
+   uint64     in_use           = allocator_in_use(al);
+
+   mini_allocator mini;
+   uint64         meta_head = mini_init_packed(&mini, &data->packer);
+   for (uint64 i = 0; i < 2 * cache_page_size(cc) / sizeof(uint64); i++) {
+      mini_alloc(&mini, 0, NULL_KEY, NULL);
+   }
+   mini_release(&mini, NULL_KEY);
+   ASSERT_NOT_EQUAL(meta_head, mini_meta_tail(&mini));
+
+   uint64 refs;
+   uint64 bytes_used;
+   uint64 bytes_saved;
+   mini_unkeyed_space_use(
+      cc, meta_head, PAGE_TYPE_FILTER, &refs, &bytes_used, &bytes_saved);
+   ASSERT_EQUAL(1, refs);
+   uint64 num_pages = bytes_used / cache_page_size(cc);
+   ASSERT_TRUE(num_pages > 2 * cache_page_size(cc) / sizeof(uint64));
+   ASSERT_TRUE(allocator_in_use(al) - in_use
+               >= (num_pages + pages_per_extent - 1) / pages_per_extent);
+
+   ASSERT_EQUAL(0,
+                mini_unkeyed_dec_ref(cc, meta_head, PAGE_TYPE_FILTER, FALSE));
+   mini_packer_deinit(&data->packer);
+   ASSERT_EQUAL(in_use, allocator_in_use(al));
+}
+
+/*
+ * Space accounting charges packed objects by the page, and reports how much
+ * less they take than extents of their own would.
+ */
+CTEST2(mini_allocator, test_packed_space_use)
+{
+   cache *cc          = (cache *)&data->cc;
+   uint64 page_size   = cache_page_size(cc);
+   uint64 extent_size = cache_extent_size(cc);
+
+   uint64 run_addr;
+   uint64 meta_head =
+      build_packed_object(&data->packer, TEST_PAGES_PER_OBJECT, &run_addr);
+
+   uint64 refs;
+   uint64 bytes_used;
+   uint64 bytes_saved;
+   mini_unkeyed_space_use(
+      cc, meta_head, PAGE_TYPE_FILTER, &refs, &bytes_used, &bytes_saved);
+   ASSERT_EQUAL(1, refs);
+   ASSERT_EQUAL(TEST_PAGES_PER_OBJECT * page_size, bytes_used);
+   // a meta extent and a data extent
+   ASSERT_EQUAL(2 * extent_size - bytes_used, bytes_saved);
+
+   ASSERT_EQUAL(0,
+                mini_unkeyed_dec_ref(cc, meta_head, PAGE_TYPE_FILTER, FALSE));
+   mini_packer_deinit(&data->packer);
+}
+
+/*
+ * Batched dec_refs leave the extents they free allocated until the batch is
+ * flushed.
+ */
+CTEST2(mini_allocator, test_batched_dec_ref_defers_free)
+{
+   cache     *cc     = (cache *)&data->cc;
+   allocator *al     = (allocator *)&data->al;
+   uint64     in_use = allocator_in_use(al);
+
+   uint64 meta_head[TEST_NUM_OBJECTS];
+   uint64 run_addr[TEST_NUM_OBJECTS];
+   for (uint64 i = 0; i < TEST_NUM_OBJECTS; i++) {
+      meta_head[i] = build_packed_object(
+         &data->packer, TEST_PAGES_PER_OBJECT, &run_addr[i]);
+   }
+   mini_packer_deinit(&data->packer);
+   uint64 num_extents = allocator_in_use(al) - in_use;
+   ASSERT_TRUE(num_extents > 0);
+
+   mini_extent_batch batch;
+   mini_extent_batch_init(&batch, cc, PAGE_TYPE_FILTER);
+   for (uint64 i = 0; i < TEST_NUM_OBJECTS; i++) {
+      ASSERT_EQUAL(0, mini_unkeyed_dec_ref_batched(cc, meta_head[i], &batch));
+   }
+   ASSERT_EQUAL(num_extents, batch.num_extents);
+   ASSERT_EQUAL(in_use + num_extents, allocator_in_use(al));
+
+   mini_extent_batch_flush(&batch);
+   ASSERT_EQUAL(0, batch.num_extents);
+   ASSERT_EQUAL(in_use, allocator_in_use(al));
+}
@@ -169,3 +169,72 @@ CTEST2(platform_api, test_platform_condvar_init_destroy)
 
    platform_condvar_destroy(&cv);
 }
+
+/*
+ * Threads whose ids share a stripe of a platform_batch_rwlock count their
+ * read locks in the same counter, and a claim waits for all of them.
+ */
+CTEST2(platform_api, test_platform_batch_rwlock_shared_stripe)
+{
+   platform_batch_rwlock *lock = TYPED_MALLOC(data->hid, lock);
+   ASSERT_TRUE(lock != NULL);
+   platform_batch_rwlock_init(lock);
+   threadid saved_tid = platform_get_tid();
+
+   threadid tids[] = {1, 1 + PLATFORM_BATCH_RWLOCK_STRIPES, MAX_THREADS - 1};
+   uint64   stripe = tids[2] % PLATFORM_BATCH_RWLOCK_STRIPES;
+   ASSERT_NOT_EQUAL(1, stripe);
+   for (uint64 i = 0; i < ARRAY_SIZE(tids); i++) {
+      platform_set_tid(tids[i]);
+      platform_batch_rwlock_get(lock, 0);
+   }
+   ASSERT_EQUAL(2, lock->read_counter[1][0]);
+
+   // The last reader claims and locks once the others have ungotten
+   platform_set_tid(tids[0]);
+   platform_batch_rwlock_unget(lock, 0);
+   platform_set_tid(tids[1]);
+   platform_batch_rwlock_unget(lock, 0);
+   platform_set_tid(tids[2]);
+   ASSERT_TRUE(platform_batch_rwlock_try_claim(lock, 0));
+   platform_batch_rwlock_lock(lock, 0);
+   for (uint64 i = 0; i < PLATFORM_BATCH_RWLOCK_STRIPES; i++) {
+      ASSERT_EQUAL(0, lock->read_counter[i][0]);
+   }
+   platform_batch_rwlock_full_unlock(lock, 0);
+   ASSERT_EQUAL(0, lock->read_counter[stripe][0]);
+   ASSERT_FALSE(lock->write_lock[0].claim);
+
+   platform_set_tid(saved_tid);
+   platform_free(data->hid, lock);
+}
+
+/*
+ * Lists of CPUs parse into the CPUs and ranges they name, and malformed
+ * lists are rejected.
+ */
+CTEST2(platform_api, test_platform_cpu_set_parse)
+{
+   platform_cpu_set set;
+   ASSERT_TRUE(SUCCESS(platform_cpu_set_parse(NULL, &set)));
+   ASSERT_EQUAL(0, platform_cpu_set_count(&set));
+   ASSERT_TRUE(SUCCESS(platform_cpu_set_parse("", &set)));
+   ASSERT_EQUAL(0, platform_cpu_set_count(&set));
+
+   ASSERT_TRUE(SUCCESS(platform_cpu_set_parse("0-2,5,7-8", &set)));
+   ASSERT_EQUAL(6, platform_cpu_set_count(&set));
+   uint64 exp_cpus[] = {0, 1, 2, 5, 7, 8};
+   for (uint64 i = 0; i < ARRAY_SIZE(exp_cpus); i++) {
+      ASSERT_TRUE(platform_cpu_set_contains(&set, exp_cpus[i]));
+   }
+   ASSERT_FALSE(platform_cpu_set_contains(&set, 3));
+
+   const char *bad_lists[] = {"x", "1-", "3-1", "1,,2", "1;2", "100000"};
+   for (uint64 i = 0; i < ARRAY_SIZE(bad_lists); i++) {
+      ASSERT_FALSE(SUCCESS(platform_cpu_set_parse(bad_lists[i], &set)),
+                   "cpus='%s'",
+                   bad_lists[i]);
+   }
+   ASSERT_FALSE(SUCCESS(platform_cpu_set_parse("node:", &set)));
+   ASSERT_FALSE(SUCCESS(platform_cpu_set_parse("node:100000", &set)));
+}
@@ -0,0 +1,346 @@
+// Copyright 2023 VMware, Inc.
+// SPDX-License-Identifier: Apache-2.0
+
+/*
+ * -----------------------------------------------------------------------------
+ * rc_allocator_test.c --
+ *
+ *  Exercises extent allocation in rc_allocator.c: the per-thread
+ *  reservations, the free bitmap, and stealing reserved extents from
+ *  other threads when the disk fills up.
+ * -----------------------------------------------------------------------------
+ */
+#include "ctest.h" // This is required for all test-case files.
+#include "platform.h"
+#include "config.h"
+#include "io.h"
+#include "rc_allocator.h"
+#include "unit_tests.h"
+#include <fcntl.h>
+
+// Spans several words of the free bitmap summary, and is not a multiple of 64.
+#define TEST_EXTENT_CAPACITY (10000)
+#define TEST_NUM_THREADS     (8)
+#define TEST_NUM_DISCARDS    (8)
+
+typedef struct alloc_thread_params {
+   rc_allocator *al;
+   threadid      tid;
+   uint64       *addrs;
+   uint64        num_allocated;
+} alloc_thread_params;
+
+/*
+ * Global data declaration macro:
+ */
+CTEST_DATA(rc_allocator)
+{
+   platform_heap_id   hid;
+   platform_module_id mid;
+   io_config          io_cfg;
+   allocator_config   al_cfg;
+   rc_allocator      *al;
+   uint64             num_free; // # of extents free after init
+};
+
+CTEST_SETUP(rc_allocator)
+{
+   set_log_streams_for_tests(MSG_LEVEL_ERRORS);
+
+   bool use_shmem = config_parse_use_shmem(Ctest_argc, (char **)Ctest_argv);
+   data->mid      = platform_get_module_id();
+   platform_status rc =
+      platform_heap_create(data->mid, 256 * MiB, use_shmem, &data->hid);
+   platform_assert_status_ok(rc);
+
+   io_config_init(&data->io_cfg,
+                  LAIO_DEFAULT_PAGE_SIZE,
+                  LAIO_DEFAULT_EXTENT_SIZE,
+                  0,
+                  0,
+                  256,
+                  "rc_allocator_test.db");
+   allocator_config_init(&data->al_cfg,
+                         &data->io_cfg,
+                         TEST_EXTENT_CAPACITY * LAIO_DEFAULT_EXTENT_SIZE);
+
+   data->al = TYPED_ZALLOC(data->hid, data->al);
+   ASSERT_TRUE(data->al != NULL);
+   // The allocator does no IO until it is mounted or unmounted.
+   rc = rc_allocator_init(data->al, &data->al_cfg, NULL, data->hid, data->mid);
+   ASSERT_TRUE(SUCCESS(rc));
+   data->num_free =
+      TEST_EXTENT_CAPACITY - allocator_in_use((allocator *)data->al);
+}
+
+CTEST_TEARDOWN(rc_allocator)
+{
+   rc_allocator_deinit(data->al);
+   platform_free(data->hid, data->al);
+   platform_heap_destroy(&data->hid);
+}
+
+static void
+alloc_until_full(rc_allocator *al, uint64 *addrs, uint64 *num_allocated)
+{
+   uint64 addr;
+   while (SUCCESS(allocator_alloc((allocator *)al, &addr, PAGE_TYPE_MISC))) {
+      addrs[(*num_allocated)++] = addr;
+   }
+}
+
+static void
+alloc_thread(void *arg)
+{
+   alloc_thread_params *params = (alloc_thread_params *)arg;
+   platform_set_tid(params->tid);
+   alloc_until_full(params->al, params->addrs, &params->num_allocated);
+   platform_set_tid(INVALID_TID);
+}
+
+/*
+ * Checks that the addrs are distinct, extent-aligned, in range, and
+ * allocated.
+ */
+static void
+check_allocated(rc_allocator *al, uint64 *addrs, uint64 num_addrs)
+{
+   uint64 extent_size = al->cfg->io_cfg->extent_size;
+
+   uint8 *seen = TYPED_ARRAY_ZALLOC(al->heap_id, seen, TEST_EXTENT_CAPACITY);
+   for (uint64 i = 0; i < num_addrs; i++) {
+      ASSERT_EQUAL(0, addrs[i] % extent_size);
+      uint64 extent_no = addrs[i] / extent_size;
+      ASSERT_TRUE(extent_no < TEST_EXTENT_CAPACITY);
+      ASSERT_EQUAL(0, seen[extent_no], "extent %lu allocated twice", extent_no);
+      seen[extent_no] = 1;
+      ASSERT_EQUAL(2, allocator_get_refcount((allocator *)al, addrs[i]));
+   }
+   platform_free(al->heap_id, seen);
+}
+
+/*
+ * Allocating until out of space hands out every free extent exactly once,
+ * and freed extents can all be allocated again.
+ */
+CTEST2(rc_allocator, test_alloc_all_extents)
+{
+   allocator *al    = (allocator *)data->al;
+   uint64    *addrs = TYPED_ARRAY_ZALLOC(data->hid, addrs, TEST_EXTENT_CAPACITY);
+   uint64     num_allocated = 0;
+
+   alloc_until_full(data->al, addrs, &num_allocated);
+   ASSERT_EQUAL(data->num_free, num_allocated);
+   ASSERT_EQUAL(TEST_EXTENT_CAPACITY, allocator_in_use(al));
+   check_allocated(data->al, addrs, num_allocated);
+
+   // Free every other extent, then all of them
+   for (uint64 i = 0; i < num_allocated; i += 2) {
+      allocator_dec_ref(al, addrs[i], PAGE_TYPE_MISC);
+      allocator_dec_ref(al, addrs[i], PAGE_TYPE_MISC);
+   }
+   uint64 *realloc_addrs =
+      TYPED_ARRAY_ZALLOC(data->hid, realloc_addrs, TEST_EXTENT_CAPACITY);
+   uint64 num_reallocated = 0;
+   alloc_until_full(data->al, realloc_addrs, &num_reallocated);
+   ASSERT_EQUAL((num_allocated + 1) / 2, num_reallocated);
+
+   for (uint64 i = 1; i < num_allocated; i += 2) {
+      allocator_dec_ref(al, addrs[i], PAGE_TYPE_MISC);
+      allocator_dec_ref(al, addrs[i], PAGE_TYPE_MISC);
+   }
+   for (uint64 i = 0; i < num_reallocated; i++) {
+      allocator_dec_ref(al, realloc_addrs[i], PAGE_TYPE_MISC);
+      allocator_dec_ref(al, realloc_addrs[i], PAGE_TYPE_MISC);
+   }
+   platform_free(data->hid, realloc_addrs);
+   ASSERT_EQUAL(TEST_EXTENT_CAPACITY - data->num_free, allocator_in_use(al));
+
+   num_allocated = 0;
+   alloc_until_full(data->al, addrs, &num_allocated);
+   ASSERT_EQUAL(data->num_free, num_allocated);
+   check_allocated(data->al, addrs, num_allocated);
+
+   rc_allocator_stats stats;
+   rc_allocator_get_stats(data->al, &stats);
+   ASSERT_EQUAL(TEST_EXTENT_CAPACITY, stats.max_allocated);
+   ASSERT_EQUAL(stats.extent_deallocs[PAGE_TYPE_MISC] + num_allocated,
+                stats.extent_allocs[PAGE_TYPE_MISC]);
+
+   platform_free(data->hid, addrs);
+}
+
+/*
+ * Concurrent allocators, each with its own reservation, together hand out
+ * every free extent exactly once. Threads that run out first steal from
+ * the reservations of the others.
+ */
+CTEST2(rc_allocator, test_concurrent_alloc)
+{
+   alloc_thread_params params[TEST_NUM_THREADS];
+   platform_thread     threads[TEST_NUM_THREADS];
+   ZERO_ARRAY(params);
+
+   for (uint64 i = 0; i < TEST_NUM_THREADS; i++) {
+      params[i].al  = data->al;
+      params[i].tid = i;
+      params[i].addrs =
+         TYPED_ARRAY_ZALLOC(data->hid, params[i].addrs, TEST_EXTENT_CAPACITY);
+      platform_status rc = platform_thread_create(
+         &threads[i], FALSE, alloc_thread, &params[i], data->hid);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+
+   uint64 *addrs = TYPED_ARRAY_ZALLOC(data->hid, addrs, TEST_EXTENT_CAPACITY);
+   uint64  num_allocated = 0;
+   for (uint64 i = 0; i < TEST_NUM_THREADS; i++) {
+      platform_thread_join(threads[i]);
+      memmove(&addrs[num_allocated],
+              params[i].addrs,
+              params[i].num_allocated * sizeof(*addrs));
+      num_allocated += params[i].num_allocated;
+      platform_free(data->hid, params[i].addrs);
+   }
+
+   ASSERT_EQUAL(data->num_free, num_allocated);
+   check_allocated(data->al, addrs, num_allocated);
+   platform_free(data->hid, addrs);
+}
+
+static platform_io_handle *
+create_io_handle(io_config *io_cfg, platform_heap_id hid)
+{
+   io_cfg->flags          = O_RDWR | O_CREAT;
+   io_cfg->perms          = 0755;
+   platform_io_handle *io = TYPED_ZALLOC(hid, io);
+   platform_status     rc = io_handle_init(io, io_cfg, hid);
+   ASSERT_TRUE(SUCCESS(rc));
+   return io;
+}
+
+static void
+destroy_io_handle(platform_io_handle *io, platform_heap_id hid)
+{
+   io_handle_deinit(io);
+   platform_free(hid, io);
+}
+
+/*
+ * Freed extents are discarded on the device, and are only reallocated
+ * after that.
+ */
+CTEST2(rc_allocator, test_discard_freed_extents)
+{
+   uint64 page_size = data->io_cfg.page_size;
+   uint64 addrs[TEST_NUM_DISCARDS];
+
+   platform_io_handle *io = create_io_handle(&data->io_cfg, data->hid);
+   platform_status     rc;
+
+   allocator_config al_cfg = data->al_cfg;
+   al_cfg.use_discard      = TRUE;
+   rc_allocator *al        = TYPED_ZALLOC(data->hid, al);
+   rc = rc_allocator_init(al, &al_cfg, (io_handle *)io, data->hid, data->mid);
+   ASSERT_TRUE(SUCCESS(rc));
+   uint64 in_use = allocator_in_use((allocator *)al);
+
+   char *page = TYPED_ARRAY_MALLOC(data->hid, page, page_size);
+   memset(page, 0xab, page_size);
+   for (uint64 i = 0; i < TEST_NUM_DISCARDS; i++) {
+      rc = allocator_alloc((allocator *)al, &addrs[i], PAGE_TYPE_MISC);
+      ASSERT_TRUE(SUCCESS(rc));
+      rc = io_write((io_handle *)io, page, page_size, addrs[i]);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+
+   for (uint64 i = 0; i < TEST_NUM_DISCARDS; i++) {
+      allocator_dec_ref((allocator *)al, addrs[i], PAGE_TYPE_MISC);
+      allocator_dec_ref((allocator *)al, addrs[i], PAGE_TYPE_MISC);
+   }
+   ASSERT_EQUAL(in_use, allocator_in_use((allocator *)al));
+
+   for (uint64 wait_ms = 0; al->discard_pending > 0 && wait_ms < 10000;
+        wait_ms++) {
+      platform_sleep_ns(MILLION);
+   }
+   ASSERT_EQUAL(0, al->discard_pending);
+
+   if (!al->discard.unsupported) {
+      ASSERT_EQUAL(TEST_NUM_DISCARDS, al->discard.extents_discarded);
+      ASSERT_TRUE(al->discard.discards_issued >= 1);
+      for (uint64 i = 0; i < TEST_NUM_DISCARDS; i++) {
+         rc = io_read((io_handle *)io, page, page_size, addrs[i]);
+         ASSERT_TRUE(SUCCESS(rc));
+         for (uint64 j = 0; j < page_size; j++) {
+            ASSERT_EQUAL(0, page[j]);
+         }
+      }
+   }
+
+   rc_allocator_deinit(al);
+   platform_free(data->hid, al);
+   platform_free(data->hid, page);
+   destroy_io_handle(io, data->hid);
+}
+
+static void
+count_grow_callback(void *arg, uint64 capacity)
+{
+   uint64 *num_grows = (uint64 *)arg;
+   (*num_grows)++;
+}
+
+/*
+ * The allocator grows up to its max capacity, explicitly or by
+ * grow_increment when it runs out of space, and the new capacity is
+ * persisted.
+ */
+CTEST2(rc_allocator, test_grow)
+{
+   uint64 extent_size   = data->io_cfg.extent_size;
+   uint64 init_extents  = TEST_EXTENT_CAPACITY / 10;
+   uint64 grown_extents = init_extents + 100;
+   uint64 num_grows     = 0;
+
+   platform_io_handle *io = create_io_handle(&data->io_cfg, data->hid);
+
+   allocator_config al_cfg;
+   allocator_config_init(&al_cfg, &data->io_cfg, init_extents * extent_size);
+   allocator_config_set_max_capacity(&al_cfg, data->al_cfg.capacity);
+   al_cfg.grow_increment = 1000 * extent_size;
+   rc_allocator *al      = TYPED_ZALLOC(data->hid, al);
+   platform_status rc =
+      rc_allocator_init(al, &al_cfg, (io_handle *)io, data->hid, data->mid);
+   ASSERT_TRUE(SUCCESS(rc));
+   rc_allocator_set_grow_callback(al, count_grow_callback, &num_grows);
+
+   rc = rc_allocator_grow(al, grown_extents * extent_size + 1);
+   ASSERT_TRUE(STATUS_IS_EQ(rc, STATUS_BAD_PARAM));
+   rc = rc_allocator_grow(al, (TEST_EXTENT_CAPACITY + 1) * extent_size);
+   ASSERT_TRUE(STATUS_IS_EQ(rc, STATUS_BAD_PARAM));
+   rc = rc_allocator_grow(al, (init_extents - 1) * extent_size);
+   ASSERT_TRUE(STATUS_IS_EQ(rc, STATUS_BAD_PARAM));
+   ASSERT_EQUAL(0, num_grows);
+
+   rc = rc_allocator_grow(al, grown_extents * extent_size);
+   ASSERT_TRUE(SUCCESS(rc));
+   ASSERT_EQUAL(1, num_grows);
+   ASSERT_EQUAL(grown_extents, al_cfg.extent_capacity);
+   ASSERT_EQUAL(grown_extents * extent_size, al->meta_page->capacity);
+
+   // Grows 1000 extents at a time up to the max capacity
+   uint64 *addrs = TYPED_ARRAY_ZALLOC(data->hid, addrs, TEST_EXTENT_CAPACITY);
+   uint64  num_allocated = 0;
+   alloc_until_full(al, addrs, &num_allocated);
+   ASSERT_EQUAL(TEST_EXTENT_CAPACITY, al_cfg.extent_capacity);
+   ASSERT_EQUAL(TEST_EXTENT_CAPACITY, allocator_in_use((allocator *)al));
+   ASSERT_EQUAL(1 + (TEST_EXTENT_CAPACITY - grown_extents + 999) / 1000,
+                num_grows);
+   ASSERT_EQUAL(data->al_cfg.capacity, al->meta_page->capacity);
+   check_allocated(al, addrs, num_allocated);
+
+   platform_free(data->hid, addrs);
+   rc_allocator_deinit(al);
+   platform_free(data->hid, al);
+   destroy_io_handle(io, data->hid);
+}
@@ -63,6 +63,9 @@ test_lookup_by_range(void         *datap,
 // Verify consistency of data after so-many inserts
 #define TEST_VERIFY_GRANULARITY 100000
 
+// Bytes/s inserts are paced to by test_inserts_are_paced_by_throttle
+#define TEST_THROTTLE_RATE (MiB)
+
 /* Macro to show progress message as workload is running */
 #define SHOW_PCT_PROGRESS(op_num, num_ops, msg)                                \
    do {                                                                        \
@@ -267,6 +270,52 @@ CTEST2(splinter, test_inserts)
    trunk_destroy(spl);
 }
 
+/*
+ * Once throttled, inserts are paced to the throttle's rate. Few enough are
+ * inserted that the memtable does not fill, which would recompute the rate.
+ */
+CTEST2(splinter, test_inserts_are_paced_by_throttle)
+{
+   allocator *alp = (allocator *)&data->al;
+
+   trunk_handle *spl = trunk_create(data->splinter_cfg,
+                                    alp,
+                                    (cache *)data->clock_cache,
+                                    data->tasks,
+                                    test_generate_allocator_root_id(),
+                                    data->hid);
+   ASSERT_TRUE(spl != NULL);
+   ASSERT_EQUAL(0, spl->throttle.rate);
+
+   DECLARE_AUTO_KEY_BUFFER(keybuf, spl->heap_id);
+   const size_t      key_size = trunk_max_key_size(spl);
+   merge_accumulator msg;
+   merge_accumulator_init(&msg, spl->heap_id);
+
+   spl->throttle.rate = TEST_THROTTLE_RATE;
+   uint64    bytes    = 0;
+   timestamp start    = platform_get_timestamp();
+   for (uint64 insert_num = 0; bytes < TEST_THROTTLE_RATE / 4; insert_num++) {
+      test_key(&keybuf, TEST_RANDOM, insert_num, 0, 0, key_size, 0);
+      generate_test_message(&data->gen, insert_num, &msg);
+      key             tuple_key = key_buffer_key(&keybuf);
+      message         value     = merge_accumulator_to_message(&msg);
+      platform_status rc        = trunk_insert(spl, tuple_key, value);
+      ASSERT_TRUE(SUCCESS(rc));
+      bytes += key_length(tuple_key) + message_length(value);
+   }
+   uint64 elapsed_ns = platform_timestamp_elapsed(start);
+
+   // A quarter second's worth, less what is not slept at the end
+   ASSERT_TRUE(elapsed_ns >= SEC_TO_NSEC(1) / 5, "elapsed_ns=%lu", elapsed_ns);
+   ASSERT_TRUE(spl->throttle.num_delays > 0);
+   ASSERT_TRUE(spl->throttle.delay_ns > 0);
+   ASSERT_EQUAL(0, spl->throttle.num_stalls);
+
+   merge_accumulator_deinit(&msg);
+   trunk_destroy(spl);
+}
+
 static void
 trunk_shadow_init(trunk_shadow    *shadow,
                   data_config     *data_cfg,
@@ -63,6 +63,9 @@ insert_some_keys(const int num_inserts, splinterdb *kvsb);
 static int
 insert_keys(splinterdb *kvsb, const int minkey, int numkeys, const int incr);
 
+static int
+lookup_keys(splinterdb *kvsb, const int minkey, int numkeys);
+
 static int
 check_current_tuple(splinterdb_iterator *it, const int expected_i);
 
@@ -753,6 +756,679 @@ CTEST2(splinterdb_quick, test_repeated_insert_close_reopen)
    }
 }
 
+/*
+ * Test that close and re-open with cache warm-up enabled records the hot
+ * extents, prefetches them after the re-open, and that the data is intact.
+ * Re-open twice, so that the warm-up list is shown to be consumed (and its
+ * space freed) by the first re-open.
+ */
+CTEST2(splinterdb_quick, test_close_and_reopen_with_cache_warmup)
+{
+   splinterdb_close(&data->kvsb);
+
+   data->cfg.cache_warmup            = TRUE;
+   data->cfg.num_normal_bg_threads   = 1;
+   data->cfg.num_memtable_bg_threads = 1;
+
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   const int num_inserts = 20000;
+   rc                    = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+
+   splinterdb_lookup_result result;
+   for (int reopen = 0; reopen < 2; reopen++) {
+      splinterdb_close(&data->kvsb);
+      rc = splinterdb_open(&data->cfg, &data->kvsb);
+      ASSERT_EQUAL(0, rc);
+
+      splinterdb_lookup_result_init(data->kvsb, &result, 0, NULL);
+      for (int i = 0; i < num_inserts; i++) {
+         char key[TEST_INSERT_KEY_LENGTH] = {0};
+         char val[TEST_INSERT_VAL_LENGTH] = {0};
+         snprintf(key, sizeof(key), key_fmt, i);
+         snprintf(val, sizeof(val), val_fmt, i);
+
+         rc = splinterdb_lookup(
+            data->kvsb, slice_create(sizeof(key), key), &result);
+         ASSERT_EQUAL(0, rc);
+         ASSERT_TRUE(splinterdb_lookup_found(&result));
+
+         slice value;
+         rc = splinterdb_lookup_result_value(&result, &value);
+         ASSERT_EQUAL(0, rc);
+         ASSERT_EQUAL(sizeof(val), slice_length(value));
+         ASSERT_STREQN(val, slice_data(value), slice_length(value));
+      }
+      splinterdb_lookup_result_deinit(&result);
+   }
+}
+
+/*
+ * Exercise the background cache cleaner, with a low dirty-page watermark so
+ * that it cleans eagerly, and a rate limit. Data must survive a reopen.
+ */
+CTEST2(splinterdb_quick, test_insert_with_cache_cleaner)
+{
+   splinterdb_close(&data->kvsb);
+
+   data->cfg.cache_size                      = 4 * Mega;
+   data->cfg.memtable_capacity               = Mega;
+   data->cfg.cache_use_cleaner               = TRUE;
+   data->cfg.cache_cleaner_dirty_watermark   = 64;
+   data->cfg.cache_cleaner_max_pages_per_sec = 100000;
+
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   const int num_inserts = 60000;
+   rc                    = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+
+   splinterdb_close(&data->kvsb);
+   rc = splinterdb_open(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   splinterdb_lookup_result result;
+   splinterdb_lookup_result_init(data->kvsb, &result, 0, NULL);
+   for (int i = 0; i < num_inserts; i++) {
+      char key[TEST_INSERT_KEY_LENGTH] = {0};
+      char val[TEST_INSERT_VAL_LENGTH] = {0};
+      snprintf(key, sizeof(key), key_fmt, i);
+      snprintf(val, sizeof(val), val_fmt, i);
+
+      rc = splinterdb_lookup(
+         data->kvsb, slice_create(sizeof(key), key), &result);
+      ASSERT_EQUAL(0, rc);
+      ASSERT_TRUE(splinterdb_lookup_found(&result));
+
+      slice value;
+      rc = splinterdb_lookup_result_value(&result, &value);
+      ASSERT_EQUAL(0, rc);
+      ASSERT_EQUAL(sizeof(val), slice_length(value));
+      ASSERT_STREQN(val, slice_data(value), slice_length(value));
+   }
+   splinterdb_lookup_result_deinit(&result);
+}
+
+/*
+ * Shrink and grow the cache of a running instance, checking that the data
+ * stays readable and that invalid sizes are rejected.
+ */
+CTEST2(splinterdb_quick, test_set_cache_size)
+{
+   splinterdb_close(&data->kvsb);
+
+   uint64 cache_size        = data->cfg.cache_size;
+   data->cfg.cache_max_size = 2 * cache_size;
+
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_EQUAL(cache_size, splinterdb_get_cache_size(data->kvsb));
+
+   ASSERT_EQUAL(EINVAL, splinterdb_set_cache_size(data->kvsb, 3 * cache_size));
+   ASSERT_EQUAL(EINVAL, splinterdb_set_cache_size(data->kvsb, cache_size + 1));
+   ASSERT_EQUAL(EINVAL, splinterdb_set_cache_size(data->kvsb, 0));
+
+   const int num_inserts = 20000;
+   rc                    = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+
+   uint64 sizes[] = {cache_size / 8, 2 * cache_size, cache_size / 4};
+   for (int s = 0; s < ARRAY_SIZE(sizes); s++) {
+      rc = splinterdb_set_cache_size(data->kvsb, sizes[s]);
+      ASSERT_EQUAL(0, rc);
+      ASSERT_EQUAL(sizes[s], splinterdb_get_cache_size(data->kvsb));
+
+      rc = lookup_keys(data->kvsb, 0, num_inserts);
+      ASSERT_EQUAL(0, rc);
+   }
+
+   // keep inserting into the shrunk cache
+   rc = insert_keys(data->kvsb, num_inserts, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+}
+
+/*
+ * Test growing the disk explicitly, that the new size persists across a
+ * close and re-open, and that re-opening with a larger disk_size grows it.
+ */
+CTEST2(splinterdb_quick, test_grow_disk)
+{
+   splinterdb_close(&data->kvsb);
+
+   uint64 disk_size        = data->cfg.disk_size;
+   data->cfg.max_disk_size = 4 * disk_size;
+
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_EQUAL(disk_size, splinterdb_get_disk_size(data->kvsb));
+
+   ASSERT_EQUAL(EINVAL, splinterdb_grow(data->kvsb, 5 * disk_size));
+   ASSERT_EQUAL(EINVAL, splinterdb_grow(data->kvsb, disk_size + 1));
+   ASSERT_EQUAL(EINVAL, splinterdb_grow(data->kvsb, disk_size / 2));
+
+   const int num_inserts = 20000;
+   rc                    = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+
+   rc = splinterdb_grow(data->kvsb, 2 * disk_size);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_EQUAL(2 * disk_size, splinterdb_get_disk_size(data->kvsb));
+
+   rc = insert_keys(data->kvsb, num_inserts, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+
+   splinterdb_close(&data->kvsb);
+   rc = splinterdb_open(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_EQUAL(2 * disk_size, splinterdb_get_disk_size(data->kvsb));
+   rc = lookup_keys(data->kvsb, 0, 2 * num_inserts);
+   ASSERT_EQUAL(0, rc);
+
+   splinterdb_close(&data->kvsb);
+   data->cfg.disk_size = 3 * disk_size;
+   rc                  = splinterdb_open(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_EQUAL(3 * disk_size, splinterdb_get_disk_size(data->kvsb));
+   rc = lookup_keys(data->kvsb, 0, 2 * num_inserts);
+   ASSERT_EQUAL(0, rc);
+}
+
+/*
+ * Test that a disk which is too small for the data grows automatically.
+ */
+CTEST2(splinterdb_quick, test_auto_grow_disk)
+{
+   splinterdb_close(&data->kvsb);
+
+   uint64 disk_size              = 4 * Mega;
+   data->cfg.disk_size           = disk_size;
+   data->cfg.max_disk_size       = 256 * disk_size;
+   data->cfg.disk_grow_increment = disk_size;
+   data->cfg.memtable_capacity   = Mega;
+
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   const int num_inserts = 60000;
+   rc                    = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_TRUE(splinterdb_get_disk_size(data->kvsb) > disk_size);
+   ASSERT_EQUAL(0, splinterdb_get_disk_size(data->kvsb) % disk_size);
+
+   rc = lookup_keys(data->kvsb, 0, num_inserts);
+   ASSERT_EQUAL(0, rc);
+}
+
+/*
+ * Test that splinterdb_clear() empties the database, both the memtables and
+ * the trunk, and that it can be refilled and reopened afterwards.
+ */
+CTEST2(splinterdb_quick, test_clear)
+{
+   splinterdb_close(&data->kvsb);
+   data->cfg.memtable_capacity = Mega;
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   const int num_inserts = 20000;
+   rc                    = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+
+   rc = splinterdb_clear(data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   splinterdb_lookup_result result;
+   splinterdb_lookup_result_init(data->kvsb, &result, 0, NULL);
+   for (int i = 0; i < num_inserts; i += 97) {
+      char key[TEST_INSERT_KEY_LENGTH] = {0};
+      snprintf(key, sizeof(key), key_fmt, i);
+      rc = splinterdb_lookup(
+         data->kvsb, slice_create(sizeof(key), key), &result);
+      ASSERT_EQUAL(0, rc);
+      ASSERT_FALSE(splinterdb_lookup_found(&result));
+   }
+   splinterdb_lookup_result_deinit(&result);
+
+   splinterdb_iterator *it = NULL;
+   rc = splinterdb_iterator_init(data->kvsb, &it, NULL_SLICE);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_FALSE(splinterdb_iterator_valid(it));
+   splinterdb_iterator_deinit(it);
+
+   // a clear of an empty database is fine too
+   rc = splinterdb_clear(data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   rc = insert_keys(data->kvsb, num_inserts, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+   rc = lookup_keys(data->kvsb, num_inserts, num_inserts);
+   ASSERT_EQUAL(0, rc);
+
+   splinterdb_close(&data->kvsb);
+   rc = splinterdb_open(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+   rc = lookup_keys(data->kvsb, num_inserts, num_inserts);
+   ASSERT_EQUAL(0, rc);
+
+   int i = 0;
+   rc    = splinterdb_iterator_init(data->kvsb, &it, NULL_SLICE);
+   ASSERT_EQUAL(0, rc);
+   for (; splinterdb_iterator_valid(it); splinterdb_iterator_next(it)) {
+      i++;
+   }
+   ASSERT_EQUAL(num_inserts, i);
+   splinterdb_iterator_deinit(it);
+}
+
+/*
+ * Checkpoints keep the contents a database had when they were taken, open
+ * read-only or as writable clones which never change the database, and
+ * survive a close and reopen.
+ */
+CTEST2(splinterdb_quick, test_checkpoint)
+{
+   splinterdb_close(&data->kvsb);
+   data->cfg.memtable_capacity = Mega;
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   const int    num_inserts   = 20000;
+   const uint64 checkpoint_id = 2;
+   splinterdb  *ckpt          = NULL;
+   rc                         = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+
+   ASSERT_EQUAL(EINVAL, splinterdb_checkpoint(data->kvsb, 0));
+   ASSERT_EQUAL(EINVAL, splinterdb_checkpoint(data->kvsb, 1));
+   ASSERT_EQUAL(ENOENT,
+                splinterdb_open_checkpoint(
+                   data->kvsb, checkpoint_id, TRUE, &ckpt));
+
+   rc = splinterdb_checkpoint(data->kvsb, checkpoint_id);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_EQUAL(EINVAL, splinterdb_checkpoint(data->kvsb, checkpoint_id));
+
+   // change the database after the checkpoint
+   rc = insert_keys(data->kvsb, num_inserts, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+   char key[TEST_INSERT_KEY_LENGTH] = {0};
+   snprintf(key, sizeof(key), key_fmt, 0);
+   rc = splinterdb_delete(data->kvsb, slice_create(sizeof(key), key));
+   ASSERT_EQUAL(0, rc);
+
+   // a read-only checkpoint sees what was there when it was taken
+   rc = splinterdb_open_checkpoint(data->kvsb, checkpoint_id, TRUE, &ckpt);
+   ASSERT_EQUAL(0, rc);
+   rc = lookup_keys(ckpt, 0, num_inserts);
+   ASSERT_EQUAL(0, rc);
+   splinterdb_lookup_result result;
+   splinterdb_lookup_result_init(ckpt, &result, 0, NULL);
+   snprintf(key, sizeof(key), key_fmt, num_inserts);
+   rc = splinterdb_lookup(ckpt, slice_create(sizeof(key), key), &result);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_FALSE(splinterdb_lookup_found(&result));
+   splinterdb_lookup_result_deinit(&result);
+   rc = splinterdb_insert(ckpt,
+                          slice_create(sizeof(key), key),
+                          slice_create(sizeof(key), key));
+   ASSERT_EQUAL(EPERM, rc);
+   splinterdb_close(&ckpt);
+
+   // a writable clone changes the checkpoint but not the database
+   rc = splinterdb_open_checkpoint(data->kvsb, checkpoint_id, FALSE, &ckpt);
+   ASSERT_EQUAL(0, rc);
+   rc = insert_keys(ckpt, 2 * num_inserts, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+   rc = lookup_keys(ckpt, 2 * num_inserts, num_inserts);
+   ASSERT_EQUAL(0, rc);
+   splinterdb_lookup_result_init(data->kvsb, &result, 0, NULL);
+   snprintf(key, sizeof(key), key_fmt, 2 * num_inserts);
+   rc = splinterdb_lookup(data->kvsb, slice_create(sizeof(key), key), &result);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_FALSE(splinterdb_lookup_found(&result));
+   snprintf(key, sizeof(key), key_fmt, 0);
+   rc = splinterdb_lookup(data->kvsb, slice_create(sizeof(key), key), &result);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_FALSE(splinterdb_lookup_found(&result));
+   splinterdb_lookup_result_deinit(&result);
+   splinterdb_close(&ckpt);
+
+   // the checkpoint, with the clone's changes, survives a reopen
+   splinterdb_close(&data->kvsb);
+   rc = splinterdb_open(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+   rc = splinterdb_open_checkpoint(data->kvsb, checkpoint_id, TRUE, &ckpt);
+   ASSERT_EQUAL(0, rc);
+   rc = lookup_keys(ckpt, 0, num_inserts);
+   ASSERT_EQUAL(0, rc);
+   rc = lookup_keys(ckpt, 2 * num_inserts, num_inserts);
+   ASSERT_EQUAL(0, rc);
+   splinterdb_close(&ckpt);
+   rc = lookup_keys(data->kvsb, 1, 2 * num_inserts - 1);
+   ASSERT_EQUAL(0, rc);
+
+   rc = splinterdb_delete_checkpoint(data->kvsb, checkpoint_id);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_EQUAL(ENOENT,
+                splinterdb_open_checkpoint(
+                   data->kvsb, checkpoint_id, TRUE, &ckpt));
+   rc = lookup_keys(data->kvsb, 1, 2 * num_inserts - 1);
+   ASSERT_EQUAL(0, rc);
+
+   // the id can be used again
+   rc = splinterdb_checkpoint(data->kvsb, checkpoint_id);
+   ASSERT_EQUAL(0, rc);
+   rc = splinterdb_delete_checkpoint(data->kvsb, checkpoint_id);
+   ASSERT_EQUAL(0, rc);
+}
+
+/*
+ * After most of a database is deleted, lookups and scans see only what is
+ * left, both while the deletes are being compacted away and after a reopen.
+ */
+CTEST2(splinterdb_quick, test_mass_delete)
+{
+   splinterdb_close(&data->kvsb);
+   data->cfg.memtable_capacity = Mega;
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   const int num_inserts = 30000;
+   const int del_start   = 3000;
+   const int del_end     = 27000;
+   rc                    = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+   for (int i = del_start; i < del_end; i++) {
+      char key[TEST_INSERT_KEY_LENGTH] = {0};
+      snprintf(key, sizeof(key), key_fmt, i);
+      rc = splinterdb_delete(data->kvsb, slice_create(sizeof(key), key));
+      ASSERT_EQUAL(0, rc);
+   }
+   // more inserts push the deletes down the tree
+   rc = insert_keys(data->kvsb, num_inserts, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+
+   for (int pass = 0; pass < 2; pass++) {
+      rc = lookup_keys(data->kvsb, 0, del_start);
+      ASSERT_EQUAL(0, rc);
+      rc = lookup_keys(data->kvsb, del_end, 2 * num_inserts - del_end);
+      ASSERT_EQUAL(0, rc);
+
+      splinterdb_lookup_result result;
+      splinterdb_lookup_result_init(data->kvsb, &result, 0, NULL);
+      for (int i = del_start; i < del_end; i += 97) {
+         char key[TEST_INSERT_KEY_LENGTH] = {0};
+         snprintf(key, sizeof(key), key_fmt, i);
+         rc = splinterdb_lookup(
+            data->kvsb, slice_create(sizeof(key), key), &result);
+         ASSERT_EQUAL(0, rc);
+         ASSERT_FALSE(splinterdb_lookup_found(&result));
+      }
+      splinterdb_lookup_result_deinit(&result);
+
+      int                  num_found = 0;
+      splinterdb_iterator *it        = NULL;
+      rc = splinterdb_iterator_init(data->kvsb, &it, NULL_SLICE);
+      ASSERT_EQUAL(0, rc);
+      for (; splinterdb_iterator_valid(it); splinterdb_iterator_next(it)) {
+         num_found++;
+      }
+      splinterdb_iterator_deinit(it);
+      ASSERT_EQUAL(2 * num_inserts - (del_end - del_start), num_found);
+
+      splinterdb_close(&data->kvsb);
+      rc = splinterdb_open(&data->cfg, &data->kvsb);
+      ASSERT_EQUAL(0, rc);
+   }
+}
+
+/*
+ * Records the progress reported by splinterdb_compact_range.
+ */
+typedef struct compact_range_progress {
+   uint64 calls;
+   uint64 levels_done;
+   uint64 num_levels;
+} compact_range_progress;
+
+static void
+record_compact_range_progress(uint64 levels_done,
+                              uint64 num_levels,
+                              void  *arg)
+{
+   compact_range_progress *progress = arg;
+   progress->num_levels             = num_levels;
+   progress->calls++;
+   // written last, as the async test polls it
+   __atomic_store_n(&progress->levels_done, levels_done, __ATOMIC_RELEASE);
+}
+
+/*
+ * Compacting a range with deleted and overwritten keys leaves lookups and
+ * iterators seeing the same data as before, and reports each level done.
+ */
+CTEST2(splinterdb_quick, test_compact_range)
+{
+   splinterdb_close(&data->kvsb);
+   data->cfg.memtable_capacity     = Mega;
+   data->cfg.num_normal_bg_threads = 1;
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   const int num_inserts = 30000;
+   const int del_start   = 5000;
+   const int del_end     = 15000;
+   rc                    = insert_keys(data->kvsb, 0, num_inserts, 1);
+   ASSERT_EQUAL(0, rc);
+   for (int i = del_start; i < del_end; i++) {
+      char key[TEST_INSERT_KEY_LENGTH] = {0};
+      snprintf(key, sizeof(key), key_fmt, i);
+      rc = splinterdb_delete(data->kvsb, slice_create(sizeof(key), key));
+      ASSERT_EQUAL(0, rc);
+   }
+   // overwrite the rest with the same values
+   rc = insert_keys(data->kvsb, del_end, num_inserts - del_end, 1);
+   ASSERT_EQUAL(0, rc);
+
+   char start[TEST_INSERT_KEY_LENGTH] = {0};
+   char end[TEST_INSERT_KEY_LENGTH]   = {0};
+   snprintf(start, sizeof(start), key_fmt, 0);
+   snprintf(end, sizeof(end), key_fmt, 2 * del_end);
+   rc = splinterdb_compact_range(data->kvsb,
+                                 slice_create(sizeof(end), end),
+                                 slice_create(sizeof(start), start),
+                                 NULL,
+                                 NULL);
+   ASSERT_EQUAL(EINVAL, rc);
+
+   compact_range_progress progress = {0};
+   rc = splinterdb_compact_range(data->kvsb,
+                                 slice_create(sizeof(start), start),
+                                 slice_create(sizeof(end), end),
+                                 record_compact_range_progress,
+                                 &progress);
+   ASSERT_EQUAL(0, rc);
+   ASSERT_TRUE(progress.num_levels >= 2);
+   ASSERT_EQUAL(progress.num_levels, progress.calls);
+   ASSERT_EQUAL(progress.num_levels, progress.levels_done);
+
+   // and the rest of the keys, in the background
+   compact_range_progress async_progress = {0};
+   rc = splinterdb_compact_range_async(data->kvsb,
+                                       slice_create(sizeof(end), end),
+                                       NULL_SLICE,
+                                       record_compact_range_progress,
+                                       &async_progress);
+   ASSERT_EQUAL(0, rc);
+   uint64 levels_done;
+   while ((levels_done = __atomic_load_n(&async_progress.levels_done,
+                                         __ATOMIC_ACQUIRE))
+             == 0
+          || levels_done < async_progress.num_levels)
+   {
+      platform_sleep_ns(USEC_TO_NSEC(1000));
+   }
+
+   for (int pass = 0; pass < 2; pass++) {
+      rc = lookup_keys(data->kvsb, 0, del_start);
+      ASSERT_EQUAL(0, rc);
+      rc = lookup_keys(data->kvsb, del_end, num_inserts - del_end);
+      ASSERT_EQUAL(0, rc);
+
+      splinterdb_lookup_result result;
+      splinterdb_lookup_result_init(data->kvsb, &result, 0, NULL);
+      for (int i = del_start; i < del_end; i += 97) {
+         char key[TEST_INSERT_KEY_LENGTH] = {0};
+         snprintf(key, sizeof(key), key_fmt, i);
+         rc = splinterdb_lookup(
+            data->kvsb, slice_create(sizeof(key), key), &result);
+         ASSERT_EQUAL(0, rc);
+         ASSERT_FALSE(splinterdb_lookup_found(&result));
+      }
+      splinterdb_lookup_result_deinit(&result);
+
+      int                  num_found = 0;
+      splinterdb_iterator *it        = NULL;
+      rc = splinterdb_iterator_init(data->kvsb, &it, NULL_SLICE);
+      ASSERT_EQUAL(0, rc);
+      for (; splinterdb_iterator_valid(it); splinterdb_iterator_next(it)) {
+         num_found++;
+      }
+      splinterdb_iterator_deinit(it);
+      ASSERT_EQUAL(num_inserts - (del_end - del_start), num_found);
+
+      splinterdb_close(&data->kvsb);
+      rc = splinterdb_open(&data->cfg, &data->kvsb);
+      ASSERT_EQUAL(0, rc);
+   }
+}
+
+/*
+ * With message expiry on, inserts whose expiry time has passed are neither
+ * found by lookups nor returned by iterators, whether they are still in the
+ * memtable or have been compacted into the tree.
+ */
+CTEST2(splinterdb_quick, test_message_expiry)
+{
+   splinterdb_close(&data->kvsb);
+   data->default_data_cfg.super.message_expiry = TRUE;
+   data->cfg.memtable_capacity                 = Mega;
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   // every other key has expired, the rest expire in an hour or never
+   const int num_inserts = 20000;
+   uint64    now         = platform_get_real_time() / SEC_TO_NSEC(1);
+   for (int i = 0; i < num_inserts; i++) {
+      char key[TEST_INSERT_KEY_LENGTH] = {0};
+      snprintf(key, sizeof(key), key_fmt, i);
+      struct {
+         message_expiry_header hdr;
+         char                  val[TEST_INSERT_VAL_LENGTH];
+      } value = {0};
+      value.hdr.expires_at = i % 2 ? now - 1 : (i % 4 ? now + 3600 : 0);
+      snprintf(value.val, sizeof(value.val), val_fmt, i);
+      rc = splinterdb_insert(data->kvsb,
+                             slice_create(sizeof(key), key),
+                             slice_create(sizeof(value), &value));
+      ASSERT_EQUAL(0, rc);
+   }
+
+   for (int pass = 0; pass < 2; pass++) {
+      splinterdb_lookup_result result;
+      splinterdb_lookup_result_init(data->kvsb, &result, 0, NULL);
+      for (int i = 0; i < num_inserts; i += 7) {
+         char key[TEST_INSERT_KEY_LENGTH] = {0};
+         snprintf(key, sizeof(key), key_fmt, i);
+         rc = splinterdb_lookup(
+            data->kvsb, slice_create(sizeof(key), key), &result);
+         ASSERT_EQUAL(0, rc);
+         ASSERT_EQUAL(i % 2 == 0, splinterdb_lookup_found(&result));
+      }
+      splinterdb_lookup_result_deinit(&result);
+
+      int                  num_found = 0;
+      splinterdb_iterator *it        = NULL;
+      rc = splinterdb_iterator_init(data->kvsb, &it, NULL_SLICE);
+      ASSERT_EQUAL(0, rc);
+      for (; splinterdb_iterator_valid(it); splinterdb_iterator_next(it)) {
+         num_found++;
+      }
+      splinterdb_iterator_deinit(it);
+      ASSERT_EQUAL(num_inserts / 2, num_found);
+
+      splinterdb_close(&data->kvsb);
+      rc = splinterdb_open(&data->cfg, &data->kvsb);
+      ASSERT_EQUAL(0, rc);
+   }
+}
+
+static void
+count_capacity_calls(void *arg)
+{
+   __atomic_add_fetch((uint64 *)arg, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Try inserts never incorporate memtables themselves, so with no background
+ * threads to do it they run out of memtables and are refused. A blocking
+ * insert then incorporates one, which calls the capacity callback.
+ */
+CTEST2(splinterdb_quick, test_try_insert)
+{
+   splinterdb_close(&data->kvsb);
+   data->cfg.memtable_capacity = Mega;
+   int rc = splinterdb_create(&data->cfg, &data->kvsb);
+   ASSERT_EQUAL(0, rc);
+
+   uint64 num_calls = 0;
+   splinterdb_set_capacity_callback(
+      data->kvsb, count_capacity_calls, &num_calls);
+
+   // Far more than fit in the memtables
+   const uint64 max_inserts = 100 * Mega / sizeof(uint64);
+   uint64       retry_ns    = 0;
+   uint64       i;
+   for (i = 0; i < max_inserts; i++) {
+      slice key_and_value = slice_create(sizeof(i), &i);
+      rc                  = splinterdb_try_insert(
+         data->kvsb, key_and_value, key_and_value, &retry_ns);
+      if (rc != 0) {
+         break;
+      }
+   }
+   ASSERT_EQUAL(EAGAIN, rc);
+   ASSERT_TRUE(retry_ns > 0);
+   ASSERT_EQUAL(0, __atomic_load_n(&num_calls, __ATOMIC_ACQUIRE));
+
+   rc = splinterdb_insert(
+      data->kvsb, slice_create(sizeof(i), &i), slice_create(sizeof(i), &i));
+   ASSERT_EQUAL(0, rc);
+   ASSERT_EQUAL(1, __atomic_load_n(&num_calls, __ATOMIC_ACQUIRE));
+
+   i++;
+   rc = splinterdb_try_insert(data->kvsb,
+                              slice_create(sizeof(i), &i),
+                              slice_create(sizeof(i), &i),
+                              &retry_ns);
+   ASSERT_EQUAL(0, rc);
+
+   splinterdb_lookup_result result;
+   splinterdb_lookup_result_init(data->kvsb, &result, 0, NULL);
+   for (uint64 j = 0; j <= i; j += i / 16) {
+      rc = splinterdb_lookup(data->kvsb, slice_create(sizeof(j), &j), &result);
+      ASSERT_EQUAL(0, rc);
+      ASSERT_TRUE(splinterdb_lookup_found(&result));
+   }
+   splinterdb_lookup_result_deinit(&result);
+
+   // num_calls goes out of scope before the teardown's close
+   splinterdb_set_capacity_callback(data->kvsb, NULL, NULL);
+}
+
 // Check that the value-oriented functions work sensibly with a custom
 // data_config
 CTEST2(splinterdb_quick, test_custom_data_config)
@@ -1035,6 +1711,40 @@ insert_keys(splinterdb *kvsb, const int minkey, int numkeys, const int incr)
    return rc;
 }
 
+/*
+ * Helper function to look up the keys inserted by insert_keys(minkey,
+ * numkeys, 1), and check their values.
+ *
+ * Returns: Return code: rc == 0 => success; anything else => failure
+ */
+static int
+lookup_keys(splinterdb *kvsb, const int minkey, int numkeys)
+{
+   int                      rc = 0;
+   splinterdb_lookup_result result;
+   splinterdb_lookup_result_init(kvsb, &result, 0, NULL);
+
+   for (int kctr = minkey; numkeys; kctr++, numkeys--) {
+      char key[TEST_INSERT_KEY_LENGTH] = {0};
+      char val[TEST_INSERT_VAL_LENGTH] = {0};
+      snprintf(key, sizeof(key), key_fmt, kctr);
+      snprintf(val, sizeof(val), val_fmt, kctr);
+
+      rc = splinterdb_lookup(kvsb, slice_create(sizeof(key), key), &result);
+      ASSERT_EQUAL(0, rc);
+      ASSERT_TRUE(splinterdb_lookup_found(&result));
+
+      slice value;
+      rc = splinterdb_lookup_result_value(&result, &value);
+      ASSERT_EQUAL(0, rc);
+      ASSERT_EQUAL(sizeof(val), slice_length(value));
+      ASSERT_STREQN(val, slice_data(value), slice_length(value));
+   }
+
+   splinterdb_lookup_result_deinit(&result);
+   return rc;
+}
+
 /*
  * Work horse routine to check if the current tuple pointed to by the
  * iterator is the expected one, as indicated by its index,
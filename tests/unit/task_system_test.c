@@ -51,6 +51,31 @@ typedef struct {
    int          line; // Thread created on / around this line #
 } thread_config_lockstep;
 
+// Counts the test tasks run, some of which enqueue more tasks
+typedef struct {
+   task_system    *tasks;
+   uint64          fan_out; // tasks enqueued by each fan_out_task
+   volatile uint64 num_run;
+} task_counter;
+
+// Records the CPUs test tasks ran on
+typedef struct {
+   volatile uint64 num_run;
+   volatile uint64 num_off_cpu; // tasks that ran off the expected CPU
+   uint64          exp_cpu;
+} cpu_record;
+
+// Records the order in which test tasks ran
+typedef struct {
+   uint64 num_run;
+   uint64 ids[4];
+} task_order;
+
+typedef struct {
+   task_order *order;
+   uint64      id;
+} ordered_task;
+
 #define TEST_MAX_KEY_SIZE 13
 
 // Function prototypes
@@ -74,6 +99,24 @@ exec_one_of_n_threads(void *arg);
 static void
 exec_user_thread_loop_for_stop(void *arg);
 
+static void
+count_task(void *arg, void *scratch);
+
+static void
+fan_out_task(void *arg, void *scratch);
+
+static void
+record_order_task(void *arg, void *scratch);
+
+static void
+sleep_task(void *arg, void *scratch);
+
+static void
+record_cpu_task(void *arg, void *scratch);
+
+static uint64
+total_tasks_stolen(task_system *tasks, task_type type);
+
 /*
  * Global data declaration macro:
  */
@@ -105,7 +148,8 @@ CTEST_SETUP(task_system)
    platform_status rc = STATUS_OK;
    bool use_shmem     = config_parse_use_shmem(Ctest_argc, (char **)Ctest_argv);
 
-   uint64 heap_capacity = (256 * MiB); // small heap is sufficient.
+   // small heap is sufficient, plus scratch space for up to MAX_THREADS
+   uint64 heap_capacity = (256 * MiB) + MAX_THREADS * trunk_get_scratch_size();
    // Create a heap for io and task system to use.
    rc = platform_heap_create(
       platform_get_module_id(), heap_capacity, use_shmem, &data->hid);
@@ -141,7 +185,7 @@ CTEST_SETUP(task_system)
 
    // Main thread should now be marked as being active in the bitmask.
    // Active threads have their bit turned -OFF- in this bitmask.
-   uint64 task_bitmask              = task_active_tasks_mask(data->tasks);
+   uint64 task_bitmask              = task_active_tasks_mask(data->tasks, 0);
    uint64 all_threads_inactive_mask = (~0L);
    uint64 this_thread_active_mask   = (~0x1L);
    uint64 exp_bitmask = (all_threads_inactive_mask & this_thread_active_mask);
@@ -210,7 +254,7 @@ CTEST2(task_system, test_one_thread_using_lower_apis)
 
    // Main thread is at index 0
    thread_cfg.exp_thread_idx         = 1;
-   thread_cfg.active_threads_bitmask = task_active_tasks_mask(data->tasks);
+   thread_cfg.active_threads_bitmask = task_active_tasks_mask(data->tasks, 0);
 
    platform_status rc = STATUS_OK;
 
@@ -265,7 +309,7 @@ CTEST2(task_system, test_one_thread_using_extern_apis)
 
    // Main thread is at index 0
    thread_cfg.exp_thread_idx         = 1;
-   thread_cfg.active_threads_bitmask = task_active_tasks_mask(data->tasks);
+   thread_cfg.active_threads_bitmask = task_active_tasks_mask(data->tasks, 0);
 
    platform_status rc = STATUS_OK;
 
@@ -376,7 +420,7 @@ CTEST2(task_system, test_task_system_creation_with_bg_threads)
    active_threads_mask = ~active_threads_mask;
 
    uint64 exp_bitmask  = (all_threads_inactive_mask & active_threads_mask);
-   uint64 task_bitmask = task_active_tasks_mask(data->tasks);
+   uint64 task_bitmask = task_active_tasks_mask(data->tasks, 0);
 
    ASSERT_EQUAL(exp_bitmask,
                 task_bitmask,
@@ -459,6 +503,252 @@ CTEST2(task_system, test_use_all_but_one_threads_for_bg_threads)
    set_log_streams_for_tests(MSG_LEVEL_INFO);
 }
 
+/*
+ * ------------------------------------------------------------------------
+ * Tasks enqueued by the main thread, more than fit on its deque, and tasks
+ * those enqueue in turn from the background threads, all run exactly once.
+ * The background threads get the main thread's tasks by stealing them.
+ * ------------------------------------------------------------------------
+ */
+CTEST2(task_system, test_tasks_are_stolen_by_bg_threads)
+{
+   task_system_destroy(data->hid, &data->tasks);
+   platform_status rc = create_task_system_with_bg_threads(data, 0, 4);
+   ASSERT_TRUE(SUCCESS(rc));
+
+   const uint64 num_tasks = 4 * TASK_DEQUE_CAPACITY;
+   task_counter counter   = {.tasks = data->tasks, .fan_out = 3};
+   for (uint64 i = 0; i < num_tasks; i++) {
+      task_fn func = i % 2 ? fan_out_task : count_task;
+      rc = task_enqueue(
+         data->tasks, TASK_TYPE_NORMAL, func, &counter, TASK_PRIORITY_NORMAL);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+
+   uint64 exp_num_run = num_tasks + num_tasks / 2 * counter.fan_out;
+   while (counter.num_run != exp_num_run) {
+      platform_sleep_ns(USEC_TO_NSEC(1000));
+   }
+   rc = task_perform_until_quiescent(data->tasks);
+   ASSERT_TRUE(SUCCESS(rc));
+   ASSERT_EQUAL(exp_num_run, counter.num_run);
+   ASSERT_TRUE(total_tasks_stolen(data->tasks, TASK_TYPE_NORMAL) > 0);
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * Without background threads, tasks run only when a thread asks to perform
+ * one. Higher priority tasks run first, and among those of one priority, the
+ * thread's own tasks run newest first.
+ * ------------------------------------------------------------------------
+ */
+CTEST2(task_system, test_perform_one_order)
+{
+   ordered_task  tasks[4];
+   task_order    order         = {0};
+   task_priority priorities[4] = {TASK_PRIORITY_LOW,
+                                  TASK_PRIORITY_HIGH,
+                                  TASK_PRIORITY_NORMAL,
+                                  TASK_PRIORITY_HIGH};
+   for (uint64 i = 0; i < ARRAY_SIZE(tasks); i++) {
+      tasks[i]           = (ordered_task){.order = &order, .id = i};
+      platform_status rc = task_enqueue(data->tasks,
+                                        TASK_TYPE_NORMAL,
+                                        record_order_task,
+                                        &tasks[i],
+                                        priorities[i]);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+   ASSERT_FALSE(task_system_is_quiescent(data->tasks));
+
+   for (uint64 i = 0; i < ARRAY_SIZE(tasks); i++) {
+      ASSERT_TRUE(SUCCESS(task_perform_one(data->tasks)));
+   }
+   ASSERT_TRUE(STATUS_IS_EQ(STATUS_TIMEDOUT, task_perform_one(data->tasks)));
+   ASSERT_TRUE(task_system_is_quiescent(data->tasks));
+
+   uint64 exp_ids[] = {3, 1, 2, 0};
+   ASSERT_EQUAL(ARRAY_SIZE(exp_ids), order.num_run);
+   for (uint64 i = 0; i < ARRAY_SIZE(exp_ids); i++) {
+      ASSERT_EQUAL(exp_ids[i], order.ids[i], "i=%lu", i);
+   }
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * A backlog of higher priority tasks does not starve a low priority one: it
+ * runs as the thread's TASK_STARVATION_INTERVAL'th task.
+ * ------------------------------------------------------------------------
+ */
+CTEST2(task_system, test_low_priority_is_not_starved)
+{
+   const uint64 num_high = 2 * TASK_STARVATION_INTERVAL;
+   ordered_task low      = {.id = 1};
+   task_counter counter  = {.tasks = data->tasks};
+   for (uint64 i = 0; i < num_high; i++) {
+      platform_status rc = task_enqueue(data->tasks,
+                                        TASK_TYPE_NORMAL,
+                                        count_task,
+                                        &counter,
+                                        TASK_PRIORITY_HIGH);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+   task_order order   = {0};
+   low.order          = &order;
+   platform_status rc = task_enqueue(data->tasks,
+                                     TASK_TYPE_NORMAL,
+                                     record_order_task,
+                                     &low,
+                                     TASK_PRIORITY_LOW);
+   ASSERT_TRUE(SUCCESS(rc));
+
+   for (uint64 i = 0; i < TASK_STARVATION_INTERVAL; i++) {
+      ASSERT_EQUAL(0, order.num_run, "i=%lu", i);
+      ASSERT_TRUE(SUCCESS(task_perform_one(data->tasks)));
+   }
+   ASSERT_EQUAL(1, order.num_run);
+   ASSERT_EQUAL(TASK_STARVATION_INTERVAL - 1, counter.num_run);
+
+   task_perform_all(data->tasks);
+   ASSERT_EQUAL(num_high, counter.num_run);
+   ASSERT_TRUE(task_system_is_quiescent(data->tasks));
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * A pool that may grow adds threads while its tasks wait too long, up to its
+ * maximum, and retires them down to its minimum once it is idle again.
+ * ------------------------------------------------------------------------
+ */
+CTEST2(task_system, test_adaptive_bg_threads_grow_and_shrink)
+{
+   task_system_destroy(data->hid, &data->tasks);
+
+   uint64 num_bg_threads[NUM_TASK_TYPES] = {0};
+   num_bg_threads[TASK_TYPE_NORMAL]      = 1;
+   platform_status rc = task_system_config_init(&data->task_cfg,
+                                                TRUE, // use stats
+                                                num_bg_threads,
+                                                trunk_get_scratch_size());
+   ASSERT_TRUE(SUCCESS(rc));
+   data->task_cfg.max_background_threads[TASK_TYPE_NORMAL] = 4;
+   rc = task_system_create(data->hid, data->ioh, &data->tasks, &data->task_cfg);
+   ASSERT_TRUE(SUCCESS(rc));
+
+   task_bg_thread_group *bg = &data->tasks->group[TASK_TYPE_NORMAL].bg;
+   ASSERT_EQUAL(1, bg->num_threads);
+
+   // Each task takes over the queue wait target, so a backlog falls behind
+   const uint64 num_tasks = 200;
+   task_counter counter   = {.tasks = data->tasks};
+   for (uint64 i = 0; i < num_tasks; i++) {
+      rc = task_enqueue(data->tasks,
+                        TASK_TYPE_NORMAL,
+                        sleep_task,
+                        &counter,
+                        TASK_PRIORITY_NORMAL);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+   while (counter.num_run != num_tasks) {
+      platform_sleep_ns(USEC_TO_NSEC(1000));
+   }
+   ASSERT_TRUE(bg->num_threads_added > 0);
+   ASSERT_TRUE(bg->num_threads_added <= 3);
+
+   // Idle, it shrinks back, one thread per TASK_BG_SHRINK_SAMPLES samples
+   uint64 max_wait_ns = 2 * (bg->num_threads_added + 1) * TASK_BG_SHRINK_SAMPLES
+                        * TASK_BG_SAMPLE_INTERVAL_NS;
+   timestamp start = platform_get_timestamp();
+   while (bg->num_threads != 1
+          && platform_timestamp_elapsed(start) < max_wait_ns)
+   {
+      platform_sleep_ns(TASK_BG_SAMPLE_INTERVAL_NS);
+   }
+   ASSERT_EQUAL(1, bg->num_threads);
+   ASSERT_EQUAL(bg->num_threads_added, bg->num_threads_retired);
+   ASSERT_TRUE(task_system_is_quiescent(data->tasks));
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * The maximum size of a pool may not be below its configured size, nor add
+ * up to more threads than the task system can have.
+ * ------------------------------------------------------------------------
+ */
+CTEST2(task_system, test_adaptive_bg_threads_limits)
+{
+   task_system_destroy(data->hid, &data->tasks);
+
+   uint64 num_bg_threads[NUM_TASK_TYPES] = {0};
+   num_bg_threads[TASK_TYPE_NORMAL]      = 2;
+   platform_status rc = task_system_config_init(&data->task_cfg,
+                                                TRUE, // use stats
+                                                num_bg_threads,
+                                                trunk_get_scratch_size());
+   ASSERT_TRUE(SUCCESS(rc));
+
+   data->task_cfg.max_background_threads[TASK_TYPE_NORMAL] = 1;
+   rc = task_system_create(data->hid, data->ioh, &data->tasks, &data->task_cfg);
+   ASSERT_FALSE(SUCCESS(rc));
+
+   data->task_cfg.max_background_threads[TASK_TYPE_NORMAL]   = MAX_THREADS / 2;
+   data->task_cfg.max_background_threads[TASK_TYPE_MEMTABLE] = MAX_THREADS / 2;
+   rc = task_system_create(data->hid, data->ioh, &data->tasks, &data->task_cfg);
+   ASSERT_FALSE(SUCCESS(rc));
+
+   // Leave a task system for teardown to destroy
+   rc = create_task_system_without_bg_threads(data);
+   ASSERT_TRUE(SUCCESS(rc));
+}
+
+/*
+ * ------------------------------------------------------------------------
+ * Background threads of a group confined to a set of CPUs run its tasks
+ * there, with zeroed scratch space.
+ * ------------------------------------------------------------------------
+ */
+CTEST2(task_system, test_bg_threads_run_on_their_cpus)
+{
+   task_system_destroy(data->hid, &data->tasks);
+
+   // Pick a CPU this process may run on
+   cpu_set_t allowed;
+   ASSERT_EQUAL(0, sched_getaffinity(0, sizeof(allowed), &allowed));
+   uint64 cpu = 0;
+   while (!CPU_ISSET(cpu, &allowed)) {
+      cpu++;
+   }
+   char cpus[32];
+   snprintf(cpus, sizeof(cpus), "%lu", cpu);
+
+   uint64 num_bg_threads[NUM_TASK_TYPES] = {0};
+   num_bg_threads[TASK_TYPE_NORMAL]      = 2;
+   platform_status rc = task_system_config_init(&data->task_cfg,
+                                                TRUE, // use stats
+                                                num_bg_threads,
+                                                trunk_get_scratch_size());
+   ASSERT_TRUE(SUCCESS(rc));
+   rc = platform_cpu_set_parse(
+      cpus, &data->task_cfg.background_cpus[TASK_TYPE_NORMAL]);
+   ASSERT_TRUE(SUCCESS(rc));
+   rc = task_system_create(data->hid, data->ioh, &data->tasks, &data->task_cfg);
+   ASSERT_TRUE(SUCCESS(rc));
+
+   cpu_record record = {.exp_cpu = cpu};
+   for (uint64 i = 0; i < 64; i++) {
+      rc = task_enqueue(data->tasks,
+                        TASK_TYPE_NORMAL,
+                        record_cpu_task,
+                        &record,
+                        TASK_PRIORITY_NORMAL);
+      ASSERT_TRUE(SUCCESS(rc));
+   }
+   while (record.num_run != 64) {
+      platform_sleep_ns(USEC_TO_NSEC(1000));
+   }
+   ASSERT_EQUAL(0, record.num_off_cpu);
+}
+
 /* Wrapper function to create Splinter Task system w/o background threads. */
 static platform_status
 create_task_system_without_bg_threads(void *datap)
@@ -534,7 +824,7 @@ exec_one_thread_use_lower_apis(void *arg)
    thread_config *thread_cfg = (thread_config *)arg;
 
    uint64 task_bitmask_before_register =
-      task_active_tasks_mask(thread_cfg->tasks);
+      task_active_tasks_mask(thread_cfg->tasks, 0);
 
    // Verify that the state of active-threads bitmask (managed by Splinter) has
    // not changed just by creating this pthread. It should be the same as what
@@ -551,7 +841,7 @@ exec_one_thread_use_lower_apis(void *arg)
    task_register_this_thread(thread_cfg->tasks, trunk_get_scratch_size());
 
    uint64 task_bitmask_after_register =
-      task_active_tasks_mask(thread_cfg->tasks);
+      task_active_tasks_mask(thread_cfg->tasks, 0);
 
    // _Now, the active tasks bitmask should have changed.
    ASSERT_NOT_EQUAL(task_bitmask_before_register, task_bitmask_after_register);
@@ -592,7 +882,7 @@ exec_one_thread_use_lower_apis(void *arg)
    task_deregister_this_thread(thread_cfg->tasks);
 
    uint64 task_bitmask_after_deregister =
-      task_active_tasks_mask(thread_cfg->tasks);
+      task_active_tasks_mask(thread_cfg->tasks, 0);
 
    // De-registering this task removes it from the active tasks mask
    ASSERT_EQUAL(task_bitmask_before_register, task_bitmask_after_deregister);
@@ -631,7 +921,7 @@ exec_one_thread_use_extern_apis(void *arg)
    uint64 bitmask_before_thread_create = thread_cfg->active_threads_bitmask;
 
    uint64 bitmask_after_thread_create =
-      task_active_tasks_mask(thread_cfg->tasks);
+      task_active_tasks_mask(thread_cfg->tasks, 0);
 
    // The task_thread_create() -> task_invoke_with_hooks() also registers this
    // thread with Splinter. First, confirm that the bitmask has changed from
@@ -745,3 +1035,64 @@ exec_user_thread_loop_for_stop(void *arg)
                   this_threads_idx,
                   thread_cfg->line);
 }
+
+static void
+count_task(void *arg, void *scratch)
+{
+   task_counter *counter = (task_counter *)arg;
+   __sync_fetch_and_add(&counter->num_run, 1);
+}
+
+/* Enqueues fan_out more count_tasks from whichever thread runs it. */
+static void
+fan_out_task(void *arg, void *scratch)
+{
+   task_counter *counter = (task_counter *)arg;
+   for (uint64 i = 0; i < counter->fan_out; i++) {
+      platform_status rc = task_enqueue(counter->tasks,
+                                        TASK_TYPE_NORMAL,
+                                        count_task,
+                                        counter,
+                                        TASK_PRIORITY_NORMAL);
+      platform_assert_status_ok(rc);
+   }
+   count_task(arg, scratch);
+}
+
+static void
+record_order_task(void *arg, void *scratch)
+{
+   ordered_task *ot                     = (ordered_task *)arg;
+   ot->order->ids[ot->order->num_run++] = ot->id;
+}
+
+/* Counts itself run after taking a few times the queue wait target. */
+static void
+sleep_task(void *arg, void *scratch)
+{
+   platform_sleep_ns(2 * TASK_BG_QUEUE_WAIT_TARGET_NS);
+   count_task(arg, scratch);
+}
+
+/* Counts itself run, and whether it was on the expected CPU. */
+static void
+record_cpu_task(void *arg, void *scratch)
+{
+   cpu_record *record = (cpu_record *)arg;
+   if (sched_getcpu() != record->exp_cpu) {
+      __sync_fetch_and_add(&record->num_off_cpu, 1);
+   }
+   // Scratch space is zeroed before the thread runs any task
+   platform_assert(((char *)scratch)[trunk_get_scratch_size() - 1] == 0);
+   __sync_fetch_and_add(&record->num_run, 1);
+}
+
+static uint64
+total_tasks_stolen(task_system *tasks, task_type type)
+{
+   uint64 num_stolen = 0;
+   for (threadid tid = 0; tid < MAX_THREADS; tid++) {
+      num_stolen += tasks->group[type].stats[tid].total_tasks_stolen;
+   }
+   return num_stolen;
+}